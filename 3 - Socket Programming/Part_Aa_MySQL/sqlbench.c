@@ -0,0 +1,578 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <mysql/mysql.h>
+#include <sqlite3.h>
+#include "sqlproto.h"
+
+#define BUFSIZE 1024
+#define MAX_CONNECTIONS 1024
+#define DEFAULT_CONNECTIONS 8
+#define DEFAULT_SECONDS 10
+#define DEFAULT_TABLE_ROWS 10000
+#define PREPARE_BATCH_ROWS 500
+
+/* Where the queries go: through the gateway, or straight to a backend for comparison */
+enum { TARGET_GATEWAY, TARGET_MYSQL, TARGET_SQLITE };
+
+/* One benchmark connection and what it measured */
+typedef struct {
+	int index;
+	pthread_t thread;
+	int sock;                     // gateway
+	MYSQL *mysql;                 // direct mysql
+	sqlite3 *sqlite;              // direct sqlite
+	uint32_t nextId;
+	uint64_t random;              // xorshift state of the generated mix
+	unsigned long nextLine;       // position in the replayed query file
+	unsigned long long nextInsert;
+	unsigned long queries, errors;
+	unsigned long long bytesSent, bytesReceived;
+	float *latencies;             // us, one per query
+	size_t noLatencies, latencyCap;
+} Connection;
+
+/* Settings shared by all connections */
+struct bench {
+	int target;
+	char **args;                  // positional arguments of the target
+	int noConnections;
+	double seconds;               // run length, unless maxQueries is set
+	unsigned long maxQueries;     // per connection, 0 runs for seconds
+	double rate;                  // queries per second over all connections, 0 as fast as possible
+	char **lines;                 // replayed queries, NULL for the generated mix
+	size_t *lineLens;
+	unsigned long noLines;
+	unsigned long tableRows;      // rows of the generated mix's table
+	unsigned long long insertBase; // ids of this run's inserts start here
+	double start;                 // monotonic seconds the measured run starts at
+	pthread_barrier_t ready;
+} bench;
+
+int Connect(Connection *conn);
+void Disconnect(Connection *conn);
+int RunQuery(Connection *conn, const char *query, size_t len);
+int GatewayQuery(Connection *conn, const char *query, size_t len);
+int MysqlQuery(Connection *conn, const char *query, size_t len);
+int SqliteQuery(Connection *conn, const char *query, size_t len);
+void* ConnectionMain(void *arg);
+const char* NextQuery(Connection *conn, char *buffer, size_t bufferLen, size_t *len);
+uint64_t NextRandom(Connection *conn);
+void PrepareTable(Connection *conn, unsigned long rows);
+void LoadQueryFile(const char *path);
+void RecordLatency(Connection *conn, double seconds);
+void Report(Connection *conns, int noConns, double elapsed);
+int CompareFloats(const void *a, const void *b);
+double Now();
+int SendAll(int sock, const char *data, size_t len);
+int RecvAll(int sock, char *buffer, size_t len);
+
+int main(int argc, char **argv) {
+
+	const char *queryFile = NULL;
+	int prepare = 0;
+	int opt, i;
+
+	bench.noConnections = DEFAULT_CONNECTIONS;
+	bench.seconds = DEFAULT_SECONDS;
+	bench.tableRows = DEFAULT_TABLE_ROWS;
+	while ((opt = getopt(argc, argv, "c:t:n:r:f:s:P")) != -1) {
+		switch (opt) {
+		case 'c': bench.noConnections = atoi(optarg); break;
+		case 't': bench.seconds = atof(optarg); break;
+		case 'n': bench.maxQueries = strtoul(optarg, NULL, 10); break;
+		case 'r': bench.rate = atof(optarg); break;
+		case 'f': queryFile = optarg; break;
+		case 's': bench.tableRows = strtoul(optarg, NULL, 10); break;
+		case 'P': prepare = 1; break;
+		default:
+			argc = 0; // print usage below
+		}
+	}
+	// Shift the options away, positional arguments keep their indices
+	argc -= optind - 1;
+	argv += optind - 1;
+
+	if (argc >= 2 && strcmp(argv[1], "gateway") == 0 && argc == 4) {
+		bench.target = TARGET_GATEWAY;
+	} else if (argc >= 2 && strcmp(argv[1], "mysql") == 0 && argc == 7) {
+		bench.target = TARGET_MYSQL;
+	} else if (argc >= 2 && strcmp(argv[1], "sqlite") == 0 && argc == 3) {
+		bench.target = TARGET_SQLITE;
+	} else {
+		argc = 0;
+	}
+	if (argc == 0 || bench.noConnections < 1 || bench.noConnections > MAX_CONNECTIONS
+	    || bench.seconds <= 0 || bench.tableRows < 1) {
+		fprintf(stderr, "[-c connections] [-t seconds] [-n queries per connection] [-r total queries/s] [-f query file] [-s table rows] [-P] <target>\n");
+		fprintf(stderr, "  gateway <server address> <server port>\n");
+		fprintf(stderr, "  mysql <username> <password> <host> <database> <port>\n");
+		fprintf(stderr, "  sqlite <database file>\n");
+		exit(-1);
+	}
+	bench.args = argv + 2;
+	// Runs on the same table insert disjoint ids
+	bench.insertBase = bench.tableRows + 1 + (unsigned long long)(time(NULL) % 1000000) * 10000000000ULL;
+
+	if (queryFile != NULL) {
+		LoadQueryFile(queryFile);
+	}
+
+	Connection *conns = calloc(bench.noConnections, sizeof(Connection));
+	if (conns == NULL) {
+		perror("calloc() failed");
+		exit(-1);
+	}
+	if (bench.target == TARGET_MYSQL && mysql_library_init(0, NULL, NULL) != 0) {
+		fprintf(stderr, "mysql_library_init() failed\n");
+		exit(-1);
+	}
+	for (i = 0; i < bench.noConnections; i++) {
+		conns[i].index = i;
+		conns[i].nextId = 1;
+		conns[i].random = 0x9E3779B97F4A7C15ULL * (i + 1);
+		conns[i].nextLine = bench.noLines ? (bench.noLines * i) / bench.noConnections : 0;
+		if (!Connect(&conns[i])) {
+			exit(-1);
+		}
+	}
+
+	// The generated mix runs on a table of its own, created and filled by -P
+	if (prepare && bench.lines == NULL) {
+		PrepareTable(&conns[0], bench.tableRows);
+	}
+
+	pthread_barrier_init(&bench.ready, NULL, bench.noConnections + 1);
+	for (i = 0; i < bench.noConnections; i++) {
+		if (pthread_create(&conns[i].thread, NULL, ConnectionMain, &conns[i]) != 0) {
+			perror("pthread_create() failed");
+			exit(-1);
+		}
+	}
+	bench.start = Now();
+	pthread_barrier_wait(&bench.ready);
+	for (i = 0; i < bench.noConnections; i++) {
+		pthread_join(conns[i].thread, NULL);
+	}
+	double elapsed = Now() - bench.start;
+
+	Report(conns, bench.noConnections, elapsed);
+	for (i = 0; i < bench.noConnections; i++) {
+		Disconnect(&conns[i]);
+		free(conns[i].latencies);
+	}
+	free(conns);
+	exit(0);
+}
+
+/* Runs the queries of one connection. At a target rate each query has its due time and
+ * its latency counts from then, so a stalled server is charged for the queries it delayed. */
+void* ConnectionMain(void *arg) {
+	Connection *conn = arg;
+	char buffer[BUFSIZE];
+	double interval = bench.rate > 0 ? bench.noConnections / bench.rate : 0;
+	unsigned long sent;
+
+	pthread_barrier_wait(&bench.ready);
+	// Spread the connections over the interval rather than sending in bursts
+	double due = bench.start + interval * conn->index / bench.noConnections;
+
+	for (sent = 0; bench.maxQueries ? sent < bench.maxQueries : Now() - bench.start < bench.seconds; sent++) {
+		size_t len;
+		const char *query = NextQuery(conn, buffer, sizeof(buffer), &len);
+		double begin = Now();
+		if (interval > 0) {
+			if (due > begin) {
+				struct timespec pause;
+				pause.tv_sec = (time_t)(due - begin);
+				pause.tv_nsec = (long)((due - begin - pause.tv_sec) * 1e9);
+				nanosleep(&pause, NULL);
+			}
+			begin = due;
+			due += interval;
+		}
+		if (!RunQuery(conn, query, len)) {
+			conn->errors++;
+		}
+		conn->queries++;
+		RecordLatency(conn, Now() - begin);
+	}
+	return NULL;
+}
+
+/* The next query of the replayed file, as it was read, or of the generated OLTP mix,
+ * written into buffer: 70% point selects, 10% range selects, 15% updates, 5% inserts */
+const char* NextQuery(Connection *conn, char *buffer, size_t bufferLen, size_t *len) {
+	if (bench.lines != NULL) {
+		unsigned long line = conn->nextLine++ % bench.noLines;
+		*len = bench.lineLens[line];
+		return bench.lines[line];
+	}
+
+	unsigned long id = 1 + NextRandom(conn) % bench.tableRows;
+	unsigned int pick = NextRandom(conn) % 100;
+	if (pick < 70) {
+		*len = snprintf(buffer, bufferLen, "SELECT c FROM sbtest WHERE id = %lu", id);
+	} else if (pick < 80) {
+		*len = snprintf(buffer, bufferLen, "SELECT id, k, c FROM sbtest WHERE id BETWEEN %lu AND %lu", id, id + 9);
+	} else if (pick < 95) {
+		*len = snprintf(buffer, bufferLen, "UPDATE sbtest SET k = k + 1 WHERE id = %lu", id);
+	} else {
+		// Above the prepared rows, in a range of ids per run and connection
+		unsigned long long newId = bench.insertBase + (unsigned long long)conn->index * 100000000ULL
+		                         + conn->nextInsert++;
+		*len = snprintf(buffer, bufferLen, "INSERT INTO sbtest (id, k, c) VALUES (%llu, %lu, 'bench-%llu')",
+		                newId, id, newId);
+	}
+	return buffer;
+}
+
+/* xorshift64* */
+uint64_t NextRandom(Connection *conn) {
+	conn->random ^= conn->random >> 12;
+	conn->random ^= conn->random << 25;
+	conn->random ^= conn->random >> 27;
+	return conn->random * 0x2545F4914F6CDD1DULL;
+}
+
+/* Creates the table of the generated mix and fills it in multi-row INSERTs */
+void PrepareTable(Connection *conn, unsigned long rows) {
+	char *query = malloc(PREPARE_BATCH_ROWS * 64 + BUFSIZE);
+	unsigned long id;
+	size_t len = 0;
+
+	if (query == NULL) {
+		perror("malloc() failed");
+		exit(-1);
+	}
+	if (!RunQuery(conn, "DROP TABLE IF EXISTS sbtest", 27)
+	    || !RunQuery(conn, "CREATE TABLE sbtest (id BIGINT NOT NULL PRIMARY KEY, k INTEGER NOT NULL, c VARCHAR(64) NOT NULL)", 96)) {
+		fprintf(stderr, "Creating table sbtest failed\n");
+		exit(-1);
+	}
+	for (id = 1; id <= rows; id++) {
+		if (len == 0) {
+			len = sprintf(query, "INSERT INTO sbtest (id, k, c) VALUES ");
+		} else {
+			query[len++] = ',';
+		}
+		len += sprintf(query + len, "(%lu, %lu, 'row-%lu')", id, (unsigned long)(NextRandom(conn) % rows), id);
+		if (id % PREPARE_BATCH_ROWS == 0 || id == rows) {
+			if (!RunQuery(conn, query, len)) {
+				fprintf(stderr, "Filling table sbtest failed\n");
+				exit(-1);
+			}
+			len = 0;
+		}
+	}
+	printf("Prepared table sbtest with %lu rows\n", rows);
+	free(query);
+	conn->bytesSent = conn->bytesReceived = 0;
+}
+
+/* Reads the queries to replay, one per line of any length; empty lines and -- comments are skipped */
+void LoadQueryFile(const char *path) {
+	FILE *file = fopen(path, "r");
+	char *line = NULL;
+	size_t lineCap = 0;
+	ssize_t read;
+	unsigned long cap = 0;
+
+	if (file == NULL) {
+		perror("fopen() failed");
+		exit(-1);
+	}
+	while ((read = getline(&line, &lineCap, file)) != -1) {
+		size_t len = read;
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+			line[--len] = '\0';
+		}
+		if (len == 0 || strncmp(line, "--", 2) == 0) {
+			continue;
+		}
+		if (bench.noLines == cap) {
+			cap = cap ? cap * 2 : 256;
+			bench.lines = realloc(bench.lines, cap * sizeof(char *));
+			bench.lineLens = realloc(bench.lineLens, cap * sizeof(size_t));
+			if (bench.lines == NULL || bench.lineLens == NULL) {
+				perror("realloc() failed");
+				exit(-1);
+			}
+		}
+		bench.lineLens[bench.noLines] = len;
+		bench.lines[bench.noLines] = strdup(line);
+		if (bench.lines[bench.noLines++] == NULL) {
+			perror("strdup() failed");
+			exit(-1);
+		}
+	}
+	free(line);
+	fclose(file);
+	if (bench.noLines == 0) {
+		fprintf(stderr, "%s holds no queries\n", path);
+		exit(-1);
+	}
+}
+
+int Connect(Connection *conn) {
+	if (bench.target == TARGET_GATEWAY) {
+		struct sockaddr_in servAddr;
+		memset(&servAddr, 0, sizeof(servAddr));
+		servAddr.sin_family = AF_INET;
+		servAddr.sin_port = htons(atoi(bench.args[1]));
+		if (inet_pton(AF_INET, bench.args[0], &servAddr.sin_addr.s_addr) <= 0) {
+			perror("inet_pton() failed");
+			return 0;
+		}
+		conn->sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (conn->sock < 0) {
+			perror("socket() failed");
+			return 0;
+		}
+		if (connect(conn->sock, (struct sockaddr *) &servAddr, sizeof(servAddr)) < 0) {
+			perror("connect() failed");
+			return 0;
+		}
+		// Queries are small and sent one at a time, don't let Nagle hold them back
+		int on = 1;
+		setsockopt(conn->sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	} else if (bench.target == TARGET_MYSQL) {
+		conn->mysql = mysql_init(NULL);
+		if (!mysql_real_connect(conn->mysql, bench.args[2], bench.args[0], bench.args[1], bench.args[3],
+		                        atoi(bench.args[4]), NULL, 0)) {
+			fprintf(stderr, "Error: %s[%d]\n", mysql_error(conn->mysql), mysql_errno(conn->mysql));
+			return 0;
+		}
+	} else {
+		if (sqlite3_open_v2(bench.args[0], &conn->sqlite, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, NULL) != SQLITE_OK) {
+			fprintf(stderr, "Error: %s\n", sqlite3_errmsg(conn->sqlite));
+			return 0;
+		}
+		// The same settings as the gateway's sqlite backend
+		sqlite3_busy_timeout(conn->sqlite, 5000);
+		sqlite3_exec(conn->sqlite, "PRAGMA journal_mode=WAL", NULL, NULL, NULL);
+	}
+	return 1;
+}
+
+void Disconnect(Connection *conn) {
+	if (bench.target == TARGET_GATEWAY) {
+		close(conn->sock);
+	} else if (bench.target == TARGET_MYSQL) {
+		mysql_close(conn->mysql);
+	} else {
+		sqlite3_close(conn->sqlite);
+	}
+}
+
+/* Runs a query and reads its whole result, 0 on error */
+int RunQuery(Connection *conn, const char *query, size_t len) {
+	if (bench.target == TARGET_GATEWAY) {
+		return GatewayQuery(conn, query, len);
+	} else if (bench.target == TARGET_MYSQL) {
+		return MysqlQuery(conn, query, len);
+	}
+	return SqliteQuery(conn, query, len);
+}
+
+/* Sends a query frame and reads the response frames up to FRAME_END */
+int GatewayQuery(Connection *conn, const char *query, size_t len) {
+	unsigned char header[FRAME_HEADER_LEN];
+	char buffer[CHUNKSIZE];
+	uint32_t id = conn->nextId++;
+	int success = 1;
+
+	PutFrameHeader(header, FRAME_QUERY, id, len);
+	if (!SendAll(conn->sock, (char *)header, FRAME_HEADER_LEN) || !SendAll(conn->sock, query, len)) {
+		exit(-1);
+	}
+	conn->bytesSent += FRAME_HEADER_LEN + len;
+
+	for (;;) {
+		if (!RecvAll(conn->sock, (char *)header, FRAME_HEADER_LEN)) {
+			exit(-1);
+		}
+		uint32_t frameLen = GetUint32(header + 5);
+		conn->bytesReceived += FRAME_HEADER_LEN + frameLen;
+		if (GetUint32(header + 1) != id) {
+			fprintf(stderr, "Response to unknown request %u\n", GetUint32(header + 1));
+			exit(-1);
+		}
+		if (header[0] == FRAME_ERROR) {
+			success = 0;
+		}
+		while (frameLen > 0) {
+			size_t chunkLen = frameLen < sizeof(buffer) ? frameLen : sizeof(buffer);
+			if (!RecvAll(conn->sock, buffer, chunkLen)) {
+				exit(-1);
+			}
+			frameLen -= chunkLen;
+		}
+		if (header[0] == FRAME_END) {
+			return success;
+		}
+	}
+}
+
+/* Runs a query on mysql, fetching the rows one at a time as the gateway does */
+int MysqlQuery(Connection *conn, const char *query, size_t len) {
+	conn->bytesSent += len;
+	if (mysql_real_query(conn->mysql, query, len) != 0) {
+		return 0;
+	}
+	MYSQL_RES *result = mysql_use_result(conn->mysql);
+	if (result == NULL) {
+		return mysql_field_count(conn->mysql) == 0;
+	}
+	unsigned int noColumns = mysql_num_fields(result);
+	MYSQL_ROW row;
+	while ((row = mysql_fetch_row(result)) != NULL) {
+		unsigned long *lengths = mysql_fetch_lengths(result);
+		unsigned int i;
+		for (i = 0; i < noColumns; i++) {
+			conn->bytesReceived += lengths[i];
+		}
+	}
+	int success = mysql_errno(conn->mysql) == 0;
+	mysql_free_result(result);
+	return success;
+}
+
+/* Runs a query on the sqlite database, stepping through its rows */
+int SqliteQuery(Connection *conn, const char *query, size_t len) {
+	sqlite3_stmt *stmt;
+	int rc, i;
+
+	conn->bytesSent += len;
+	if (sqlite3_prepare_v2(conn->sqlite, query, len, &stmt, NULL) != SQLITE_OK) {
+		return 0;
+	}
+	if (stmt == NULL) {
+		return 1;
+	}
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		for (i = 0; i < sqlite3_column_count(stmt); i++) {
+			sqlite3_column_text(stmt, i);
+			conn->bytesReceived += sqlite3_column_bytes(stmt, i);
+		}
+	}
+	sqlite3_finalize(stmt);
+	return rc == SQLITE_DONE;
+}
+
+void RecordLatency(Connection *conn, double seconds) {
+	if (conn->noLatencies == conn->latencyCap) {
+		conn->latencyCap = conn->latencyCap ? conn->latencyCap * 2 : 4096;
+		conn->latencies = realloc(conn->latencies, conn->latencyCap * sizeof(float));
+		if (conn->latencies == NULL) {
+			perror("realloc() failed");
+			exit(-1);
+		}
+	}
+	conn->latencies[conn->noLatencies++] = seconds * 1e6;
+}
+
+/* Prints throughput, errors, traffic and the latency distribution over all connections */
+void Report(Connection *conns, int noConns, double elapsed) {
+	static const double percentiles[] = { 50, 90, 99, 99.9 };
+	unsigned long queries = 0, errors = 0;
+	unsigned long long sent = 0, received = 0;
+	size_t noLatencies = 0;
+	int i;
+
+	for (i = 0; i < noConns; i++) {
+		queries += conns[i].queries;
+		errors += conns[i].errors;
+		sent += conns[i].bytesSent;
+		received += conns[i].bytesReceived;
+		noLatencies += conns[i].noLatencies;
+	}
+	float *all = malloc((noLatencies ? noLatencies : 1) * sizeof(float));
+	if (all == NULL) {
+		perror("malloc() failed");
+		exit(-1);
+	}
+	noLatencies = 0;
+	for (i = 0; i < noConns; i++) {
+		memcpy(all + noLatencies, conns[i].latencies, conns[i].noLatencies * sizeof(float));
+		noLatencies += conns[i].noLatencies;
+	}
+	qsort(all, noLatencies, sizeof(float), CompareFloats);
+
+	const char *targets[] = { "gateway", "mysql", "sqlite" };
+	printf("Target: %s, %d connections, %s, %s\n", targets[bench.target], noConns,
+	       bench.lines ? "replayed queries" : "OLTP mix", bench.rate > 0 ? "fixed rate" : "maximum rate");
+	printf("Queries: %lu in %.2f s\tQPS: %.1f", queries, elapsed, queries / elapsed);
+	if (bench.rate > 0) {
+		printf(" (target %.1f)", bench.rate);
+	}
+	printf("\nErrors: %lu (%.2f%%)\n", errors, queries ? 100.0 * errors / queries : 0.0);
+	printf("Bytes sent: %llu\tBytes received: %llu%s\n", sent, received,
+	       bench.target == TARGET_GATEWAY ? "" : " (values only)");
+	if (noLatencies > 0) {
+		double sum = 0;
+		size_t j;
+		for (j = 0; j < noLatencies; j++) {
+			sum += all[j];
+		}
+		printf("Latency ms: avg %.3f", sum / noLatencies / 1e3);
+		for (j = 0; j < sizeof(percentiles) / sizeof(percentiles[0]); j++) {
+			size_t rank = (size_t)(percentiles[j] / 100 * noLatencies);
+			printf("  p%g %.3f", percentiles[j], all[rank < noLatencies ? rank : noLatencies - 1] / 1e3);
+		}
+		printf("  max %.3f\n", all[noLatencies - 1] / 1e3);
+	}
+	free(all);
+}
+
+int CompareFloats(const void *a, const void *b) {
+	float x = *(const float *)a, y = *(const float *)b;
+	return (x > y) - (x < y);
+}
+
+/* Monotonic seconds */
+double Now() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Sends the whole buffer, 0 on failure */
+int SendAll(int sock, const char *data, size_t len) {
+	while (len > 0) {
+		ssize_t sentLen = send(sock, data, len, MSG_NOSIGNAL);
+		if (sentLen < 0) {
+			perror("send() failed");
+			return 0;
+		}
+		data += sentLen;
+		len -= sentLen;
+	}
+	return 1;
+}
+
+/* Reads exactly len bytes, 0 on failure */
+int RecvAll(int sock, char *buffer, size_t len) {
+	while (len > 0) {
+		ssize_t recvLen = recv(sock, buffer, len, 0);
+		if (recvLen < 0) {
+			perror("recv() failed");
+			return 0;
+		} else if (recvLen == 0) {
+			fputs("recv() connection closed prematurely\n", stderr);
+			return 0;
+		}
+		buffer += recvLen;
+		len -= recvLen;
+	}
+	return 1;
+}
@@ -1,20 +1,175 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include "sqlproto.h"
 
 #define BUFSIZE 1024
+#define MAX_DEPTH 256
+
+enum { DECODE_BITMAP, DECODE_VARINT, DECODE_LENGTH, DECODE_DOUBLE, DECODE_BYTES };
+enum { FORMAT_TEXT, FORMAT_TSV, FORMAT_CSV, FORMAT_JSON };
+
+/* How each output format writes the values of a row */
+typedef struct {
+	const char *name;
+	const char *separator;        // between the values of a row
+	const char *null;
+	const char *quote;            // around text values
+} Format;
+
+const Format formats[] = {
+	{ "text", "\t|", "NULL", "" },
+	{ "tsv",  "\t",  "\\N",  "" },
+	{ "csv",  ",",   "",     "\"" },
+	{ "json", ",",   "null", "\"" },
+};
+
+/* Incremental decoder of binary rows, which may span frames */
+typedef struct {
+	unsigned int noColumns;
+	unsigned char types[MAX_COLUMNS];
+	int state;
+	unsigned int column;          // column being decoded
+	unsigned char bitmap[MAX_COLUMNS / 8];
+	unsigned int bitmapLen;
+	unsigned int got;             // bytes of the bitmap or double received so far
+	unsigned char bytes[8];
+	uint64_t varint;
+	int shift;
+	uint64_t remaining;           // bytes left of a text value
+	unsigned long long noRows;
+	FILE *out;
+	const Format *format;
+} RowDecoder;
+
+/* A query sent to the server whose response hasn't ended yet */
+typedef struct {
+	int inUse;
+	uint32_t id;
+	char query[BUFSIZE];
+	RowDecoder dec;
+	unsigned char *columns;       // column header, it may span frames
+	size_t columnsLen;
+	int isResultSet;
+	int failed;
+	unsigned long long count;     // rows in the result set or rows affected
+	FILE *out;                    // where the response is rendered
+	char *outBuf;                 // response kept until it ends, when pipelining
+	size_t outLen;
+	FILE *messages;               // status and error texts, kept apart from
+	char *messagesBuf;            // the results in the machine-readable formats
+	size_t messagesLen;
+	FILE *errors;
+	char *errorsBuf;
+	size_t errorsLen;
+} Request;
+
+int outputFormat = FORMAT_TEXT;
+FILE *output;                     // results, stdout unless -o is given
+int echoQueries = 0;              // print each query above its result, in batch mode
+
+/* Ctrl-C cancels the queries in flight, or quits when there are none */
+volatile sig_atomic_t waiting = 0;
+volatile sig_atomic_t interrupted = 0;
+
+/* Totals of a batch run */
+struct {
+	unsigned long long statements;
+	unsigned long long errors;
+	unsigned long long resultSets;
+	unsigned long long rowsReturned;
+	unsigned long long rowsAffected;
+} totals;
+
+int RecvAll(int sockfd, char *buffer, size_t len);
+void SendAll(int sockfd, const char *data, size_t len);
+void SendQuery(int sockfd, uint32_t id, const char *query, size_t len);
+void SendCancels(int sockfd, Request *requests, int depth);
+void OnInterrupt(int sig);
+char *ReadStatement(FILE *in, size_t *len);
+int ParseLoadCommand(const char *args, char *table, char *path, char *format, int *skipLines);
+void SendLoad(int sockfd, Request *requests, int depth, int slot, FILE *file,
+              char format, int skipLines, const char *table, int *outstanding);
+int ReceiveFrame(int sockfd, Request *requests, int depth);
+void StartRequest(Request *req, uint32_t id, const char *query, int pipelined);
+void FinishRequest(Request *req, int pipelined);
+
+/* Binary result decoding and rendering */
+int ParseColumns(RowDecoder *dec, FILE *out, const unsigned char *header, size_t len);
+void DecodeRows(RowDecoder *dec, const unsigned char *data, size_t len);
+void StartValue(RowDecoder *dec);
+void PrintDouble(FILE *out, double value);
+void PrintText(FILE *out, const unsigned char *text, size_t len);
+void PrintTrimmed(FILE *out, const char *text, size_t len);
 
 int main(int argc, char **argv) {
 
-	if (argc != 3) {
-		perror("<Server Address> <Server Port>");
+	// -p sets how many queries may be in flight at once, their results are
+	// printed as each completes. -f runs a script, "-" for stdin, as
+	// statements ended by ';', -o and -F set where and how results go.
+	int depth = 1;
+	int keepGoing = 0;
+	const char *scriptPath = NULL;
+	const char *outputPath = NULL;
+	int opt, i;
+	while ((opt = getopt(argc, argv, "p:f:o:F:k")) != -1) {
+		switch (opt) {
+		case 'p': depth = atoi(optarg); break;
+		case 'f': scriptPath = optarg; break;
+		case 'o': outputPath = optarg; break;
+		case 'k': keepGoing = 1; break;
+		case 'F':
+			outputFormat = -1;
+			for (i = 0; i < (int)(sizeof(formats) / sizeof(formats[0])); i++) {
+				if (strcmp(optarg, formats[i].name) == 0) {
+					outputFormat = i;
+				}
+			}
+			break;
+		default:
+			argc = 0; // print usage below
+		}
+	}
+	// Shift the options away, positional arguments keep their indices
+	argc -= optind - 1;
+	argv += optind - 1;
+
+	if (argc != 3 || depth < 1 || depth > MAX_DEPTH || outputFormat < 0) {
+		perror("[-p pipeline depth] [-f script|-] [-o file] [-F text|tsv|csv|json] [-k] <Server Address> <Server Port>");
 		exit(-1);
 	}
+
+	int batch = scriptPath != NULL;
+	FILE *input = stdin;
+	if (batch && strcmp(scriptPath, "-") != 0) {
+		input = fopen(scriptPath, "r");
+		if (input == NULL) {
+			perror("fopen() failed");
+			exit(-1);
+		}
+	}
+	output = stdout;
+	if (outputPath != NULL) {
+		output = fopen(outputPath, "w");
+		if (output == NULL) {
+			perror("fopen() failed");
+			exit(-1);
+		}
+	}
+	// Client side errors, kept off the results in batch mode
+	FILE *notes = batch ? stderr : stdout;
+	echoQueries = batch && outputFormat == FORMAT_TEXT;
 	
 	char *servIP = argv[1];
 	
@@ -48,46 +203,825 @@ int main(int argc, char **argv) {
 		exit(-1);
 	}
 	
+	// No SA_RESTART: a blocked poll() returns so that the cancels go out
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = OnInterrupt;
+	sigaction(SIGINT, &action, NULL);
+
+	Request *requests = calloc(depth, sizeof(Request));
+	if (requests == NULL) {
+		perror("calloc() failed");
+		exit(-1);
+	}
+	uint32_t nextId = 1;
+	int outstanding = 0;
+	int inputDone = 0;
+	char *query = NULL;
+	size_t querySize = 0;
+	struct timespec started, stopped;
+	clock_gettime(CLOCK_MONOTONIC, &started);
+
 	// Loopaction
-    while(1) {
-        printf("MYSQL: ");
-        char query[BUFSIZE];
-        memset(query, 0, BUFSIZE);
-        fgets(query, BUFSIZE, stdin);
-
-        if (strncmp(query, "exit", 4) == 0) {
-            break;
-        }
+    while (!inputDone || outstanding > 0) {
+        // Keep up to depth queries in flight, stop sending after an error
+        // in batch mode unless -k
+        while (!inputDone && outstanding < depth) {
+            if (batch && totals.errors > 0 && !keepGoing) {
+                inputDone = 1;
+                break;
+            }
+            size_t queryLen;
+            if (batch) {
+                free(query);
+                query = ReadStatement(input, &queryLen);
+                if (query == NULL) {
+                    inputDone = 1;
+                    break;
+                }
+            } else {
+                if (depth == 1) {
+                    printf("MYSQL: ");
+                }
+                ssize_t lineLen = getline(&query, &querySize, stdin);
+                if (lineLen < 0 || strncmp(query, "exit", 4) == 0) {
+                    inputDone = 1;
+                    break;
+                }
+                queryLen = lineLen;
+                if (queryLen > 0 && query[queryLen-1] == '\n') {
+                    query[--queryLen] = '\0';
+                }
+            }
+            if (queryLen > MAX_QUERY_LEN) {
+                fprintf(notes, "Statement %u longer than %d bytes, not sent\n\n", nextId, MAX_QUERY_LEN);
+                totals.errors++;
+                continue;
+            }
 
-        size_t queryLen = strlen(query);
-        query[queryLen-1] = '\0';
-
-        // Send string to server
-        ssize_t sentLen = send(sockfd, query, queryLen, 0);
-        if (sentLen < 0) {
-            perror("send() failed");
-            exit(-1);
-        } else if (sentLen != queryLen) {
-            perror("send(): sent unexpected number of bytes");
-            exit(-1);
+            // \load <table> <file> [csv|tsv] [header] streams a file into a table
+            FILE *loadFile = NULL;
+            char table[BUFSIZE], path[BUFSIZE], format;
+            int skipLines;
+            if (strncmp(query, "\\load", 5) == 0 && (query[5] == ' ' || query[5] == '\0')) {
+                if (!ParseLoadCommand(query + 5, table, path, &format, &skipLines)) {
+                    fputs("Usage: \\load <table> <file> [csv|tsv] [header]\n\n", notes);
+                    totals.errors += batch;
+                    continue;
+                }
+                loadFile = fopen(path, "rb");
+                if (loadFile == NULL) {
+                    fprintf(notes, "Cannot open %s: %s\n\n", path, strerror(errno));
+                    totals.errors += batch;
+                    continue;
+                }
+            }
+
+            int slot = 0;
+            while (requests[slot].inUse) {
+                slot++;
+            }
+            StartRequest(&requests[slot], nextId++, query, depth > 1);
+            outstanding++;
+
+            // Send query to server
+            if (loadFile != NULL) {
+                waiting = 1;
+                SendLoad(sockfd, requests, depth, slot, loadFile, format, skipLines, table, &outstanding);
+                waiting = 0;
+                fclose(loadFile);
+            } else {
+                SendQuery(sockfd, requests[slot].id, query, queryLen);
+            }
         }
 
-        // Receive result from server
-        char buffer[BUFSIZE];
-        memset(buffer, 0, BUFSIZE);
-        ssize_t recvLen = recv(sockfd, buffer, BUFSIZE - 1, 0);
-        if (recvLen < 0) {
-            perror("recv() failed");
-            exit(-1);
-        } else if (recvLen == 0) {
-            perror("recv() connection closed prematurely");
-            exit(-1);
+        // Receive results from server
+        if (outstanding > 0) {
+            waiting = 1;
+            int done = ReceiveFrame(sockfd, requests, depth);
+            waiting = 0;
+            if (done >= 0) {
+                FinishRequest(&requests[done], depth > 1);
+                outstanding--;
+            }
         }
+	}
 
-        buffer[recvLen] = '\n';
-        fputs(buffer, stdout);	
+	clock_gettime(CLOCK_MONOTONIC, &stopped);
+	if (batch) {
+		double secs = (stopped.tv_sec - started.tv_sec) + (stopped.tv_nsec - started.tv_nsec) / 1e9;
+		fprintf(stderr, "%llu statements, %llu errors, %llu rows returned, %llu rows affected in %.3f s (%.1f statements/s)\n",
+		        totals.statements, totals.errors, totals.rowsReturned, totals.rowsAffected,
+		        secs, secs > 0 ? totals.statements / secs : 0.0);
+		fclose(input);
+	}
+	if (fclose(output) != 0) {
+		perror("fclose() failed");
+		exit(-1);
 	}
 
+	free(query);
+	free(requests);
 	close(sockfd);
-	exit(0);
+	exit(batch && totals.errors > 0 ? 1 : 0);
+}
+
+/* Reads exactly len bytes */
+int RecvAll(int sockfd, char *buffer, size_t len) {
+	size_t totalRecvLen = 0;
+	while (totalRecvLen < len) {
+		ssize_t recvLen = recv(sockfd, buffer + totalRecvLen, len - totalRecvLen, 0);
+		if (recvLen < 0 && errno == EINTR) {
+			continue;
+		} else if (recvLen < 0) {
+			perror("recv() failed");
+			exit(-1);
+		} else if (recvLen == 0) {
+			perror("recv() connection closed prematurely");
+			exit(-1);
+		}
+		totalRecvLen += recvLen;
+	}
+	return totalRecvLen;
+}
+
+/* Sends the whole buffer */
+void SendAll(int sockfd, const char *data, size_t len) {
+	while (len > 0) {
+		ssize_t sentLen = send(sockfd, data, len, 0);
+		if (sentLen < 0 && errno == EINTR) {
+			continue;
+		} else if (sentLen < 0) {
+			perror("send() failed");
+			exit(-1);
+		}
+		data += sentLen;
+		len -= sentLen;
+	}
+}
+
+/* Sends a query frame under the given request id */
+void SendQuery(int sockfd, uint32_t id, const char *query, size_t len) {
+	unsigned char header[FRAME_HEADER_LEN];
+	PutFrameHeader(header, FRAME_QUERY, id, len);
+	SendAll(sockfd, (char *)header, FRAME_HEADER_LEN);
+	SendAll(sockfd, query, len);
+}
+
+/* Reads the next statement of a script: the text up to a ';' outside quotes
+ * and comments, over as many lines as it takes. A line starting with '\' is a
+ * client command of its own. Comments are dropped, '#' and "-- " ones being
+ * MySQL only, except MySQL's executable and hint comments, which open with a
+ * '!' or a '+' after the slash and star. Sets len to the statement's length,
+ * which may exceed what is kept of it beyond MAX_QUERY_LEN; returns NULL at
+ * end of input. */
+char *ReadStatement(FILE *in, size_t *len) {
+	char *stmt = NULL;
+	size_t size = 0, n = 0;
+	size_t content = 0;           // characters outside comments and blanks
+	size_t commentAt = 0;         // where the comment being read starts
+	int quote = 0, escaped = 0;
+	int comment = 0;              // '-' to end of line, '*' to "*/"
+	int keep = 0;                 // the comment is sent along
+	int ended;
+	int c, prev = 0, prev2 = 0;   // the two characters before c
+
+	while ((c = getc(in)) != EOF) {
+		if (n == 0 && (c == ' ' || c == '\t' || c == '\r' || c == '\n')) {
+			continue;
+		}
+		if (quote == 0 && comment == 0) {
+			if (c == ';') {
+				if (content > 0) {
+					break;
+				}
+				n = 0;
+				prev = prev2 = 0;
+				continue;
+			}
+			// A client command takes the rest of the line
+			if (c == '\\' && content == 0) {
+				n = 0;
+				do {
+					if (n + 1 >= size) {
+						size = size ? size * 2 : BUFSIZE;
+						if ((stmt = realloc(stmt, size)) == NULL) {
+							perror("realloc() failed");
+							exit(-1);
+						}
+					}
+					stmt[n++] = c;
+				} while ((c = getc(in)) != EOF && c != '\n');
+				while (n > 0 && (stmt[n - 1] == '\r' || stmt[n - 1] == ' ')) {
+					n--;
+				}
+				content = n;
+				break;
+			}
+		}
+
+		if (n + 1 >= size && n <= MAX_QUERY_LEN) {
+			size = size ? size * 2 : BUFSIZE;
+			if ((stmt = realloc(stmt, size)) == NULL) {
+				perror("realloc() failed");
+				exit(-1);
+			}
+		}
+		if (n + 1 < size) {
+			stmt[n] = c;
+		}
+		n++;
+
+		ended = 0;
+		if (quote != 0) {
+			if (escaped) {
+				escaped = 0;
+			} else if (c == '\\') {
+				escaped = 1;
+			} else if (c == quote) {
+				quote = 0;
+			}
+			content++;
+		} else if (comment == '*') {
+			if (n - 1 == commentAt + 2 && (c == '!' || c == '+')) {
+				keep = 1;
+				content++;
+			} else if (c == '/' && n - 1 > commentAt + 2 && prev == '*') {
+				comment = 0;
+				ended = !keep;
+			}
+		} else if (comment == '-') {
+			if (c == '\n') {
+				comment = 0;
+				ended = 1;
+			}
+		} else if (c == '\'' || c == '"' || c == '`') {
+			quote = c;
+			content++;
+		} else if (c == '#') {
+			comment = '-';
+			commentAt = n - 1;
+		} else if ((c == ' ' || c == '\t' || c == '\r' || c == '\n') && prev == '-' && prev2 == '-') {
+			comment = c == '\n' ? 0 : '-';
+			ended = c == '\n';
+			commentAt = n - 3;
+			content -= 2;
+		} else if (c == '*' && prev == '/') {
+			comment = '*';
+			commentAt = n - 2;
+			keep = 0;
+			content--;
+		} else if (c != ' ' && c != '\t' && c != '\r' && c != '\n') {
+			content++;
+		}
+
+		// A dropped comment leaves a blank keeping the tokens around it apart
+		if (ended) {
+			n = commentAt;
+			c = c == '\n' ? '\n' : ' ';
+			if (n > 0 && n + 1 < size) {
+				stmt[n++] = c;
+			}
+			prev = n > 0 ? c : 0;
+			prev2 = 0;
+			continue;
+		}
+		prev2 = prev;
+		prev = c;
+	}
+	if (comment == '-' || (comment == '*' && !keep)) {
+		n = commentAt;
+	}
+
+	if (content == 0) {
+		free(stmt);
+		return NULL;
+	}
+	// Trailing blanks are dropped
+	while (n > 0 && n < size && (stmt[n - 1] == ' ' || stmt[n - 1] == '\t' || stmt[n - 1] == '\r' || stmt[n - 1] == '\n')) {
+		n--;
+	}
+	stmt[n < size ? n : size - 1] = '\0';
+	*len = n;
+	return stmt;
+}
+
+/* Asks the server to stop every query in flight, their responses end with an error */
+void SendCancels(int sockfd, Request *requests, int depth) {
+	unsigned char header[FRAME_HEADER_LEN];
+	int slot, noCancels = 0;
+	for (slot = 0; slot < depth; slot++) {
+		if (requests[slot].inUse) {
+			PutFrameHeader(header, FRAME_CANCEL, requests[slot].id, 0);
+			SendAll(sockfd, (char *)header, FRAME_HEADER_LEN);
+			noCancels++;
+		}
+	}
+	fprintf(stderr, "Cancelling %d quer%s\n", noCancels, noCancels == 1 ? "y" : "ies");
+}
+
+void OnInterrupt(int sig) {
+	if (!waiting) {
+		_exit(130);
+	}
+	interrupted = 1;
+}
+
+/* Reads "<table> <file> [csv|tsv] [header]", the format defaults to the file's extension */
+int ParseLoadCommand(const char *args, char *table, char *path, char *format, int *skipLines) {
+	char words[2][BUFSIZE];
+	int i;
+	int noWords = sscanf(args, "%1023s %1023s %1023s %1023s", table, path, words[0], words[1]);
+	if (noWords < 2) {
+		return 0;
+	}
+	const char *ext = strrchr(path, '.');
+	*format = (ext != NULL && strcasecmp(ext, ".tsv") == 0) ? LOAD_TSV : LOAD_CSV;
+	*skipLines = 0;
+	for (i = 0; i < noWords - 2; i++) {
+		if (strcmp(words[i], "csv") == 0) {
+			*format = LOAD_CSV;
+		} else if (strcmp(words[i], "tsv") == 0) {
+			*format = LOAD_TSV;
+		} else if (strcmp(words[i], "header") == 0) {
+			*skipLines = 1;
+		} else {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Streams a file to the server as the bulk load of the request in slot. The
+ * responses arriving meanwhile are rendered as they come, the server may be
+ * waiting to send them before it reads more data. */
+void SendLoad(int sockfd, Request *requests, int depth, int slot, FILE *file,
+              char format, int skipLines, const char *table, int *outstanding) {
+	uint32_t id = requests[slot].id;
+	size_t tableLen = strlen(table);
+	unsigned char *frame = malloc(FRAME_HEADER_LEN + LOAD_CHUNKSIZE);
+	if (frame == NULL) {
+		perror("malloc() failed");
+		exit(-1);
+	}
+
+	PutFrameHeader(frame, FRAME_LOAD, id, 2 + tableLen);
+	frame[FRAME_HEADER_LEN] = format;
+	frame[FRAME_HEADER_LEN + 1] = skipLines;
+	memcpy(frame + FRAME_HEADER_LEN + 2, table, tableLen);
+	size_t frameLen = FRAME_HEADER_LEN + 2 + tableLen;
+	size_t sent = 0;
+	int eof = 0, cancelled = 0;
+
+	while (sent < frameLen) {
+		struct pollfd pfd = { sockfd, POLLIN | POLLOUT, 0 };
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno != EINTR) {
+				perror("poll() failed");
+				exit(-1);
+			}
+			pfd.revents = 0;
+		}
+		if (pfd.revents & POLLIN) {
+			int done = ReceiveFrame(sockfd, requests, depth);
+			if (done >= 0) {
+				FinishRequest(&requests[done], depth > 1);
+				(*outstanding)--;
+			}
+		}
+		if (pfd.revents & (POLLOUT | POLLERR | POLLHUP)) {
+			ssize_t sentLen = send(sockfd, frame + sent, frameLen - sent, MSG_DONTWAIT);
+			if (sentLen < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+				perror("send() failed");
+				exit(-1);
+			}
+			sent += sentLen > 0 ? sentLen : 0;
+		}
+
+		// Next chunk. Once the server has answered, the load failed: only the
+		// empty frame ending the data is still sent. So it is after a Ctrl-C,
+		// once the cancels are out between two frames.
+		if (sent == frameLen && !eof) {
+			size_t len = 0;
+			if (interrupted) {
+				interrupted = 0;
+				cancelled = 1;
+				SendCancels(sockfd, requests, depth);
+			}
+			if (requests[slot].inUse && !cancelled) {
+				len = fread(frame + FRAME_HEADER_LEN, 1, LOAD_CHUNKSIZE, file);
+			}
+			PutFrameHeader(frame, FRAME_DATA, id, len);
+			frameLen = FRAME_HEADER_LEN + len;
+			sent = 0;
+			eof = len == 0;
+		}
+	}
+	free(frame);
+}
+
+void StartRequest(Request *req, uint32_t id, const char *query, int pipelined) {
+	memset(req, 0, sizeof(Request));
+	req->inUse = 1;
+	req->id = id;
+	strncpy(req->query, query, BUFSIZE - 1);
+	req->out = output;
+	if (pipelined) {
+		req->out = open_memstream(&req->outBuf, &req->outLen);
+		if (req->out == NULL) {
+			perror("open_memstream() failed");
+			exit(-1);
+		}
+	} else if (echoQueries) {
+		fprintf(req->out, "-- #%u: %s\n", req->id, req->query);
+	}
+	if (outputFormat != FORMAT_TEXT) {
+		req->messages = open_memstream(&req->messagesBuf, &req->messagesLen);
+		req->errors = open_memstream(&req->errorsBuf, &req->errorsLen);
+		if (req->messages == NULL || req->errors == NULL) {
+			perror("open_memstream() failed");
+			exit(-1);
+		}
+	}
+	if (outputFormat == FORMAT_JSON) {
+		fprintf(req->out, "{\"statement\":%u,\"query\":\"", id);
+		PrintText(req->out, (const unsigned char *)query, strlen(query));
+		fputs("\"", req->out);
+	}
+}
+
+/* Completes the rendering of a response, prints a pipelined one under the
+ * query it answers, and adds it to the totals */
+void FinishRequest(Request *req, int pipelined) {
+	if (outputFormat != FORMAT_TEXT) {
+		fclose(req->messages);
+		fclose(req->errors);
+		if (outputFormat == FORMAT_JSON) {
+			fprintf(req->out, ",\"%s\":%llu", req->isResultSet ? "row_count" : "affected_rows", req->count);
+			if (req->messagesLen > 0) {
+				fputs(",\"message\":\"", req->out);
+				PrintTrimmed(req->out, req->messagesBuf, req->messagesLen);
+				fputs("\"", req->out);
+			}
+			if (req->errorsLen > 0) {
+				fputs(",\"error\":\"", req->out);
+				PrintTrimmed(req->out, req->errorsBuf, req->errorsLen);
+				fputs("\"", req->out);
+			}
+			fputs("}\n", req->out);
+		}
+		// The result sets of tsv and csv are told apart by an empty line
+		else if (pipelined && req->isResultSet && totals.resultSets > 0) {
+			fputs("\n", output);
+		}
+		if (outputFormat != FORMAT_JSON && req->errorsLen > 0) {
+			fprintf(stderr, "Statement %u failed: ", req->id);
+			PrintTrimmed(stderr, req->errorsBuf, req->errorsLen);
+			fprintf(stderr, "\n%s\n", req->query);
+		}
+		free(req->messagesBuf);
+		free(req->errorsBuf);
+	}
+	if (pipelined) {
+		fclose(req->out);
+		if (outputFormat == FORMAT_TEXT) {
+			fprintf(output, "-- #%u: %s\n", req->id, req->query);
+		}
+		fwrite(req->outBuf, 1, req->outLen, output);
+		free(req->outBuf);
+	}
+
+	totals.statements++;
+	totals.errors += req->failed;
+	if (req->isResultSet) {
+		totals.resultSets++;
+		totals.rowsReturned += req->count;
+	} else if (!req->failed) {
+		totals.rowsAffected += req->count;
+	}
+	free(req->columns);
+	req->inUse = 0;
+}
+
+/* Renders one frame into the response of its request.
+ * Returns the slot of the request when the frame ended its response, -1 otherwise. */
+int ReceiveFrame(int sockfd, Request *requests, int depth) {
+	unsigned char header[FRAME_HEADER_LEN];
+	struct pollfd pfd = { sockfd, POLLIN, 0 };
+	while (poll(&pfd, 1, -1) < 0) {
+		if (errno != EINTR) {
+			perror("poll() failed");
+			exit(-1);
+		}
+		if (interrupted) {
+			interrupted = 0;
+			SendCancels(sockfd, requests, depth);
+		}
+	}
+	RecvAll(sockfd, (char *)header, FRAME_HEADER_LEN);
+	uint32_t id = GetUint32(header + 1);
+	uint32_t frameLen = GetUint32(header + 5);
+
+	int slot = 0;
+	while (slot < depth && !(requests[slot].inUse && requests[slot].id == id)) {
+		slot++;
+	}
+	if (slot == depth) {
+		fprintf(stderr, "Response to unknown request %u\n", id);
+		exit(-1);
+	}
+	Request *req = &requests[slot];
+
+	if (header[0] == FRAME_COLUMNS) {
+		req->columns = realloc(req->columns, req->columnsLen + frameLen);
+		if (req->columns == NULL) {
+			perror("realloc() failed");
+			exit(-1);
+		}
+		RecvAll(sockfd, (char *)req->columns + req->columnsLen, frameLen);
+		req->columnsLen += frameLen;
+		return -1;
+	}
+
+	// The column header is complete once something else follows it
+	if (req->columns != NULL) {
+		if ((outputFormat == FORMAT_TSV || outputFormat == FORMAT_CSV) && depth == 1 && totals.resultSets > 0) {
+			fputs("\n", req->out);
+		}
+		if (ParseColumns(&req->dec, req->out, req->columns, req->columnsLen) < 0) {
+			fputs("Malformed column header\n", stderr);
+			exit(-1);
+		}
+		free(req->columns);
+		req->columns = NULL;
+		req->isResultSet = 1;
+	}
+
+	if (header[0] == FRAME_END) {
+		unsigned char count[8];
+		RecvAll(sockfd, (char *)count, sizeof(count));
+		req->count = GetUint64(count);
+		if (outputFormat == FORMAT_TEXT) {
+			if (req->isResultSet && req->count == 0) {
+				fputs("Empty set\n", req->out);
+			} else if (req->isResultSet) {
+				fprintf(req->out, "%llu row(s) in set\n", req->count);
+			}
+			fputs("\n", req->out);
+		} else if (outputFormat == FORMAT_JSON && req->isResultSet) {
+			fputs("]", req->out);
+		}
+		return slot;
+	}
+
+	// Status and error texts go with the results in text format only
+	FILE *textOut = req->out;
+	if (header[0] == FRAME_ERROR) {
+		req->failed = 1;
+	}
+	if (outputFormat != FORMAT_TEXT) {
+		textOut = header[0] == FRAME_ERROR ? req->errors : req->messages;
+	}
+
+	// Payloads are handled piecewise, whatever their size
+	while (frameLen > 0) {
+		char buffer[BUFSIZE];
+		size_t chunkLen = frameLen < BUFSIZE ? frameLen : BUFSIZE;
+		RecvAll(sockfd, buffer, chunkLen);
+		if (header[0] == FRAME_ROWS) {
+			DecodeRows(&req->dec, (unsigned char *)buffer, chunkLen);
+		} else {
+			fwrite(buffer, 1, chunkLen, textOut);
+		}
+		frameLen -= chunkLen;
+	}
+	return -1;
+}
+
+/* Reads the column names and types, prints the names as a header line, or
+ * the column list opening the rows in json */
+int ParseColumns(RowDecoder *dec, FILE *out, const unsigned char *header, size_t len) {
+	static const char *typeNames[] = { "", "int", "uint", "double", "text", "blob" };
+	const unsigned char *end = header + len;
+	unsigned int i;
+
+	if (len < 2) {
+		return -1;
+	}
+	memset(dec, 0, sizeof(RowDecoder));
+	dec->out = out;
+	dec->format = &formats[outputFormat];
+	dec->noColumns = (header[0] << 8) | header[1];
+	dec->bitmapLen = (dec->noColumns + 7) / 8;
+	dec->state = DECODE_BITMAP;
+	if (dec->noColumns == 0 || dec->noColumns > MAX_COLUMNS) {
+		return -1;
+	}
+	header += 2;
+
+	for (i = 0; i < dec->noColumns; i++) {
+		uint64_t nameLen = 0;
+		int shift = 0;
+		if (header >= end) {
+			return -1;
+		}
+		dec->types[i] = *header++;
+		if (dec->types[i] < COLTYPE_INT || dec->types[i] > COLTYPE_BLOB) {
+			return -1;
+		}
+		do {
+			if (header >= end) {
+				return -1;
+			}
+			nameLen |= (uint64_t)(*header & 0x7f) << shift;
+			shift += 7;
+		} while (*header++ & 0x80);
+		if (nameLen > (uint64_t)(end - header)) {
+			return -1;
+		}
+		fputs(i > 0 ? dec->format->separator : (outputFormat == FORMAT_JSON ? ",\"columns\":[" : ""), out);
+		if (outputFormat == FORMAT_JSON) {
+			fputs("{\"name\":\"", out);
+			PrintText(out, header, nameLen);
+			fprintf(out, "\",\"type\":\"%s\"}", typeNames[dec->types[i]]);
+		} else {
+			fputs(dec->format->quote, out);
+			PrintText(out, header, nameLen);
+			fputs(dec->format->quote, out);
+		}
+		header += nameLen;
+	}
+	fputs(outputFormat == FORMAT_JSON ? "],\"rows\":[" : "\n", out);
+	return 0;
+}
+
+/* Decodes and prints rows, picking up where the previous chunk stopped */
+void DecodeRows(RowDecoder *dec, const unsigned char *data, size_t len) {
+	while (len > 0) {
+		size_t n;
+		switch (dec->state) {
+		case DECODE_BITMAP:
+			n = dec->bitmapLen - dec->got < len ? dec->bitmapLen - dec->got : len;
+			memcpy(dec->bitmap + dec->got, data, n);
+			dec->got += n;
+			data += n;
+			len -= n;
+			if (dec->got == dec->bitmapLen) {
+				if (outputFormat == FORMAT_JSON) {
+					fputs(dec->noRows > 0 ? ",[" : "[", dec->out);
+				}
+				dec->column = 0;
+				StartValue(dec);
+			}
+			break;
+
+		case DECODE_VARINT:
+		case DECODE_LENGTH:
+			dec->varint |= (uint64_t)(*data & 0x7f) << dec->shift;
+			dec->shift += 7;
+			len--;
+			if (*data++ & 0x80) {
+				break;
+			}
+			if (dec->state == DECODE_LENGTH) {
+				dec->remaining = dec->varint;
+				dec->state = DECODE_BYTES;
+				if (dec->remaining > 0) {
+					break;
+				}
+				fputs(dec->format->quote, dec->out);
+			} else if (dec->types[dec->column] == COLTYPE_INT) {
+				fprintf(dec->out, "%lld", (long long)ZigZagDecode(dec->varint));
+			} else {
+				fprintf(dec->out, "%llu", (unsigned long long)dec->varint);
+			}
+			dec->column++;
+			StartValue(dec);
+			break;
+
+		case DECODE_DOUBLE:
+			n = 8 - dec->got < len ? 8 - dec->got : len;
+			memcpy(dec->bytes + dec->got, data, n);
+			dec->got += n;
+			data += n;
+			len -= n;
+			if (dec->got == 8) {
+				uint64_t bits = GetUint64(dec->bytes);
+				double value;
+				memcpy(&value, &bits, sizeof(value));
+				PrintDouble(dec->out, value);
+				dec->column++;
+				StartValue(dec);
+			}
+			break;
+
+		case DECODE_BYTES:
+			n = dec->remaining < len ? dec->remaining : len;
+			PrintText(dec->out, data, n);
+			dec->remaining -= n;
+			data += n;
+			len -= n;
+			if (dec->remaining == 0) {
+				fputs(dec->format->quote, dec->out);
+				dec->column++;
+				StartValue(dec);
+			}
+			break;
+		}
+	}
+}
+
+/* Moves to the next non-NULL value of the row, or to the next row */
+void StartValue(RowDecoder *dec) {
+	// NULL columns carry no bytes
+	while (dec->column < dec->noColumns && (dec->bitmap[dec->column / 8] & (1 << (dec->column % 8)))) {
+		fputs(dec->column > 0 ? dec->format->separator : "", dec->out);
+		fputs(dec->format->null, dec->out);
+		dec->column++;
+	}
+	if (dec->column == dec->noColumns) {
+		fputs(outputFormat == FORMAT_JSON ? "]" : "\n", dec->out);
+		dec->noRows++;
+		dec->state = DECODE_BITMAP;
+		dec->got = 0;
+		return;
+	}
+
+	fputs(dec->column > 0 ? dec->format->separator : "", dec->out);
+	dec->varint = 0;
+	dec->shift = 0;
+	dec->got = 0;
+	switch (dec->types[dec->column]) {
+	case COLTYPE_INT:
+	case COLTYPE_UINT:
+		dec->state = DECODE_VARINT;
+		break;
+	case COLTYPE_DOUBLE:
+		dec->state = DECODE_DOUBLE;
+		break;
+	default:
+		fputs(dec->format->quote, dec->out);
+		dec->state = DECODE_LENGTH;
+	}
+}
+
+/* Shortest text that reads back as the same double */
+void PrintDouble(FILE *out, double value) {
+	char text[32];
+	if (outputFormat == FORMAT_JSON && !isfinite(value)) {
+		fputs("null", out);
+		return;
+	}
+	snprintf(text, sizeof(text), "%.15g", value);
+	if (strtod(text, NULL) != value) {
+		snprintf(text, sizeof(text), "%.17g", value);
+	}
+	fputs(text, out);
+}
+
+/* Writes text escaped as the output format needs: tsv escapes tabs, newlines
+ * and backslashes, csv doubles quotes, json escapes quotes, backslashes and
+ * control characters. Text format writes it as is. */
+void PrintText(FILE *out, const unsigned char *text, size_t len) {
+	size_t start = 0, i;
+	for (i = 0; i < len; i++) {
+		unsigned char c = text[i];
+		const char *escape = NULL;
+		char code[8];
+
+		if (outputFormat == FORMAT_TSV) {
+			escape = c == '\t' ? "\\t" : c == '\n' ? "\\n" : c == '\r' ? "\\r" : c == '\\' ? "\\\\" : NULL;
+		} else if (outputFormat == FORMAT_CSV) {
+			escape = c == '"' ? "\"\"" : NULL;
+		} else if (outputFormat == FORMAT_JSON) {
+			escape = c == '"' ? "\\\"" : c == '\\' ? "\\\\" : c == '\t' ? "\\t" : c == '\n' ? "\\n" : c == '\r' ? "\\r" : NULL;
+			if (escape == NULL && c < 0x20) {
+				snprintf(code, sizeof(code), "\\u%04x", c);
+				escape = code;
+			}
+		}
+		if (escape != NULL) {
+			fwrite(text + start, 1, i - start, out);
+			fputs(escape, out);
+			start = i + 1;
+		}
+	}
+	fwrite(text + start, 1, len - start, out);
+}
+
+/* Writes a status or error text without its surrounding blank lines,
+ * escaped in json */
+void PrintTrimmed(FILE *out, const char *text, size_t len) {
+	while (len > 0 && (*text == '\n' || *text == ' ')) {
+		text++;
+		len--;
+	}
+	while (len > 0 && (text[len - 1] == '\n' || text[len - 1] == ' ')) {
+		len--;
+	}
+	if (outputFormat == FORMAT_JSON) {
+		PrintText(out, (const unsigned char *)text, len);
+	} else {
+		fwrite(text, 1, len, out);
+	}
 }
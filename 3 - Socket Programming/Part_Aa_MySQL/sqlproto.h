@@ -0,0 +1,132 @@
+/* Wire format shared by sqlserver and sqlclient.
+ *
+ * Both directions carry frames, each a 9 byte header followed by its payload:
+ *     1 byte  frame type
+ *     4 bytes request id, network byte order
+ *     4 bytes payload length, network byte order
+ * The client sends each query in a FRAME_QUERY under an id of its choice and
+ * may have many in flight. Every frame of the response carries the same id;
+ * responses to different queries may interleave and complete in any order.
+ *
+ * A response is a sequence of frames. The server flushes a frame whenever its
+ * chunk buffer fills, so a result of any size streams through constant memory.
+ * FRAME_END closes every response.
+ *
+ * A result set starts with FRAME_COLUMNS:
+ *     2 bytes column count, network byte order
+ *     per column: 1 byte COLTYPE_*, varint name length, name
+ * followed by FRAME_ROWS, whose payloads form one byte stream of rows (a row
+ * may span frames):
+ *     NULL bitmap, (column count + 7) / 8 bytes, bit i set when column i is NULL
+ *     per non-NULL column, by type:
+ *         COLTYPE_INT    zigzag varint
+ *         COLTYPE_UINT   varint
+ *         COLTYPE_DOUBLE 8 bytes IEEE 754, network byte order
+ *         COLTYPE_TEXT, COLTYPE_BLOB   varint length, bytes
+ * Varints are little endian base 128, 7 bits per byte, high bit set on all but
+ * the last byte.
+ *
+ * A bulk load starts with FRAME_LOAD:
+ *     1 byte  LOAD_CSV or LOAD_TSV
+ *     1 byte  leading lines to skip, e.g. a header
+ *     table name
+ * followed by FRAME_DATA frames under the same id carrying the file as is,
+ * chunked anywhere, and an empty FRAME_DATA at end of file. The response is a
+ * FRAME_MESSAGE per progress report, then the usual FRAME_END.
+ *
+ * FRAME_CANCEL, with no payload, asks the server to stop the query of its id.
+ * A query still queued never runs, a running one is killed on the backend; its
+ * response ends with a FRAME_ERROR saying so. The cancel frame gets no response
+ * of its own and is ignored when the query has already finished.
+ */
+#ifndef SQLPROTO_H
+#define SQLPROTO_H
+
+#include <stdint.h>
+
+#define FRAME_HEADER_LEN 9
+#define CHUNKSIZE 16384 // Maximum payload of a response frame
+#define MAX_QUERY_LEN (1024 * 1024) // Maximum payload of a query frame
+#define MAX_COLUMNS 4096
+#define MAX_VARINT_LEN 10
+
+#define FRAME_QUERY   'Q' // Query text, client to server
+#define FRAME_LOAD    'L' // Start of a bulk load, client to server
+#define FRAME_DATA    'D' // Bulk load data, client to server, empty at end of file
+#define FRAME_CANCEL  'X' // Cancels the query of the frame's id, client to server
+
+#define FRAME_COLUMNS 'C' // Column header of a result set
+#define FRAME_ROWS    'R' // Binary rows
+#define FRAME_MESSAGE 'M' // Status text, e.g. "Result Successful."
+#define FRAME_ERROR   'E' // Error text
+#define FRAME_END     'Z' // End of result: 8 bytes, rows in the result set or rows affected
+
+#define LOAD_CSV 'c' // comma separated, fields optionally "quoted", "" for a quote
+#define LOAD_TSV 't' // tab separated, no quoting
+#define LOAD_CHUNKSIZE 65536
+
+#define COLTYPE_INT    1
+#define COLTYPE_UINT   2
+#define COLTYPE_DOUBLE 3
+#define COLTYPE_TEXT   4 // Strings, decimals, dates and times
+#define COLTYPE_BLOB   5
+
+/* Frame header */
+static inline void PutFrameHeader(unsigned char *out, char type, uint32_t id, uint32_t len)
+{
+    int i;
+    out[0] = (unsigned char)type;
+    for (i = 0; i < 4; i++) {
+        out[1 + i] = (unsigned char)(id >> (24 - 8 * i));
+        out[5 + i] = (unsigned char)(len >> (24 - 8 * i));
+    }
+}
+
+static inline uint32_t GetUint32(const unsigned char *in)
+{
+    return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | in[3];
+}
+
+/* Writes value as a varint, returns its length */
+static inline int PutVarint(unsigned char *out, uint64_t value)
+{
+    int len = 0;
+    while (value >= 0x80) {
+        out[len++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[len++] = (unsigned char)value;
+    return len;
+}
+
+/* Maps signed to unsigned so that small magnitudes give short varints */
+static inline uint64_t ZigZagEncode(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t ZigZagDecode(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/* 64 bit values in network byte order */
+static inline void PutUint64(unsigned char *out, uint64_t value)
+{
+    int i;
+    for (i = 7; i >= 0; i--) {
+        out[i] = (unsigned char)value;
+        value >>= 8;
+    }
+}
+
+static inline uint64_t GetUint64(const unsigned char *in)
+{
+    uint64_t value = 0;
+    int i;
+    for (i = 0; i < 8; i++)
+        value = (value << 8) | in[i];
+    return value;
+}
+
+#endif
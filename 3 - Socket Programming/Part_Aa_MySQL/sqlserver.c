@@ -1,13 +1,26 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <errno.h>
 #include <stdbool.h>
+#include <stdarg.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <mysql/mysql.h>
+#include <mysql/mysqld_error.h>
+#include <mysql/errmsg.h>
+#include <sqlite3.h>
+#include "sqlproto.h"
 
 #define BUFSIZE 1024
 #define NAMEBUFSIZE 128
@@ -15,6 +28,46 @@
 #define FALSE 0
 #define DEBUG 0
 
+#define CACHE_DEFAULT_BYTES (16 * 1024 * 1024)
+#define CACHE_DEFAULT_TTL 60  // seconds, 0 means entries never expire
+#define CACHE_MAX_RESULT (1024 * 1024) // larger results are streamed but not cached
+#define CACHE_BUCKETS 4096
+#define TABLE_BUCKETS 256
+#define MAX_DEP_TABLES 16
+#define MAX_PAREN_DEPTH 32
+
+#define STMT_CACHE_DEFAULT 128 // prepared statements kept per mysql connection
+#define STMT_BUCKETS 256
+#define MAX_PARAMS 64
+#define STMT_COLUMN_BUFSIZE 256 // longer values are fetched in pieces of this size
+#define BINARY_CHARSET 63 // charsetnr of binary strings
+
+#define WORKERS_DEFAULT 4 // backend connections, each served by a worker thread
+#define MAX_REPLICAS 16
+#define SQLITE_LOCK_WAIT_MS 5000 // ms to wait for another connection's write lock
+
+#define BATCH_DEFAULT_ROWS 1000 // rows coalesced into one INSERT at most
+#define BATCH_MAX_BYTES (256 * 1024) // statement size at which a batch is sent early
+#define BATCH_BUCKETS 64
+
+#define LOAD_BATCH_ROWS 1000 // rows per INSERT of a bulk load
+#define LOAD_MAX_BUFFERED (4 * 1024 * 1024) // load data queued per client before reading pauses
+#define LOAD_PROGRESS_ROWS 100000 // rows between progress reports
+
+#define STATS_BUCKETS 1024
+#define STATS_MAX_DIGESTS 4096 // further digests are counted together
+#define STATS_HIST_BUCKETS 32 // bucket i counts latencies of 2^i to 2^(i+1) us
+#define STATS_TOP_DEFAULT 10
+#define SLOWLOG_MAX_QUEUED 1024 // slow queries waiting for the log writer, more are dropped
+#define SLOWLOG_MAX_QUERY 8192 // longer query texts are logged truncated
+
+#define MAX_SHARDS 16
+#define MAX_SHARDED_TABLES 64
+#define GATHER_MAX_HELD (1024 * 1024) // rows a shard holds back while another streams, then it waits
+
+#define TIMEOUT_DEFAULT_MS 0 // deadline of every query, 0 means none
+#define MAX_INFLIGHT_DEFAULT 0 // queries a client may have queued or running, 0 means no limit
+
 static const int MAXPENDING = 16; // Maximum outstanding connection requests
 struct mysql_params {
     char user[NAMEBUFSIZE];
@@ -24,28 +77,633 @@ struct mysql_params {
     unsigned int port;
 } mysql_init_params;
 
+/* SQL tokens, pointing into the query text */
+typedef enum { TOKEN_END, TOKEN_WORD, TOKEN_NUMBER, TOKEN_STRING, TOKEN_PUNCT } TokenType;
+typedef struct {
+    TokenType type;
+    const char *start;
+    size_t len;
+} Token;
+
+typedef enum { QUERY_OTHER, QUERY_READ, QUERY_WRITE, QUERY_DDL } QueryKind;
+
+/* Every table seen by the gateway carries a version, bumped by each write to it.
+ * A cached result is valid only while the versions it was stored with are current. */
+typedef struct TableNode {
+    char name[NAMEBUFSIZE];
+    unsigned long version;
+    struct TableNode *next;
+} TableVersion;
+
+/* Versions of the tables a read depends on, taken before it runs */
+typedef struct {
+    unsigned long epoch;
+    int noTables;       // -1 when the tables can't be determined
+    TableVersion *tables[MAX_DEP_TABLES];
+    unsigned long versions[MAX_DEP_TABLES];
+} CacheDeps;
+
+typedef struct CacheEntryNode {
+    char *key;          // normalized query text
+    char *result;       // the result frames, with request id 0
+    size_t resultLen;
+    unsigned long long rowCount;
+    size_t size;        // bytes charged against the cache budget
+    unsigned int hash;
+    time_t expires;
+    CacheDeps deps;
+    int refs;           // workers sending the result, the entry is freed after the last
+    bool removed;       // unlinked from the cache, waiting for refs to drop
+    struct CacheEntryNode *hashNext;
+    struct CacheEntryNode *lruPrev, *lruNext;
+} CacheEntry;
+
+struct query_cache {
+    pthread_mutex_t lock;           // guards everything below, shared by all workers
+    CacheEntry *buckets[CACHE_BUCKETS];
+    CacheEntry *lruHead, *lruTail;  // most / least recently used
+    TableVersion *tables[TABLE_BUCKETS];
+    unsigned long epoch;            // bumped to invalidate everything at once
+    size_t usedBytes;
+    size_t maxBytes;                // 0 disables the cache
+    unsigned int ttl;
+    unsigned int noEntries;
+    unsigned long hits, misses, stores, evictions, expirations, invalidations;
+} queryCache;
+
+/* A statement prepared on the mysql-server for one query shape */
+typedef struct PreparedStmtNode {
+    char *shape;                // normalized query with its literals replaced by '?'
+    unsigned int hash;
+    MYSQL_STMT *stmt;           // NULL when the shape can't be prepared
+    unsigned int noColumns;
+    MYSQL_RES *metadata;        // column names and types
+    unsigned char *types;       // COLTYPE_* of each column
+    MYSQL_BIND *results;        // one STMT_COLUMN_BUFSIZE buffer per column
+    char *buffers;
+    unsigned long *lengths;
+    bool *isNull;
+    struct PreparedStmtNode *hashNext;
+    struct PreparedStmtNode *lruPrev, *lruNext;
+} PreparedStmt;
+
+/* A connection to the backend, with its own prepared statement cache when that is mysql */
+typedef struct {
+    MYSQL *conn;
+    sqlite3 *sqlite;
+    PreparedStmt *stmts[STMT_BUCKETS];
+    PreparedStmt *lruHead, *lruTail;
+    unsigned int noStmts;
+    unsigned int maxStmts;      // 0 sends every query as text
+    unsigned long prepares, executions, fallbacks;
+    unsigned long threadId;     // mysql connection id, what KILL QUERY names
+    unsigned long schemaVersion; // the pool's when the cached statements were prepared
+} DBConnection;
+
+/* A literal lifted out of a query, bound to its placeholder */
+typedef struct {
+    enum enum_field_types type;
+    long long intValue;
+    double doubleValue;
+    char *str;
+    unsigned long len;
+} QueryParam;
+
+/* Response being streamed to a client, in frames of up to CHUNKSIZE bytes */
+typedef struct {
+    struct ClientNode *client;  // NULL when nobody waits for the response
+    uint32_t id;                // request id the frames are sent under
+    bool failed;        // client went away, remaining output is discarded
+    char type;          // type of the frame being filled
+    size_t len;         // payload bytes in the frame
+    unsigned long long rowCount; // rows of the result set, or rows affected
+    unsigned long long bytesSent;
+    bool error;         // an error was reported
+    volatile const int *cancelled; // the job's CancelReason, output stops once it is set
+    struct GatherNode *gather;  // for a part of a scattered query, where its frames go
+    int part;
+    bool replica;       // served by a read replica, which may lag behind the primary
+    char payload[CHUNKSIZE];
+    bool capturing;     // keep a copy of the sent frames for the result cache
+    char *capture;
+    size_t captureLen, captureCap;
+} ResultStream;
+
+/* One shard's share of a scattered query */
+typedef struct {
+    int shard;
+    char *header;               // its column header
+    size_t headerLen, headerCap;
+    char *rows;                 // rows held back while another part has the turn
+    size_t rowsLen, rowsCap;
+    bool checked;               // its header was compared with the one sent
+    bool skipped;               // its columns differ from those sent, its rows are dropped
+} GatherPart;
+
+/* Merges the responses of a query scattered over several shards into one: a single
+ * column header, the rows of one part after the other, their counts added up. The part
+ * with the turn streams its rows to the client as they come, the others hold theirs
+ * back until it ends, and wait once they hold GATHER_MAX_HELD. Messages and errors
+ * are sent at the end, each distinct error once. */
+typedef struct GatherNode {
+    pthread_mutex_t lock;       // also keeps the parts' writes to out apart
+    pthread_cond_t turn;        // the part with the turn has ended
+    ResultStream out;           // the merged response
+    char *query;
+    long long receivedAt, startedAt;
+    GatherPart *parts;
+    int noParts, noDone;
+    int owner;                  // part with the turn, -1 if none
+    const GatherPart *sentHeader; // part whose column header was sent
+    int messagePart;            // part whose status message is kept, -1 before any
+    char *message, *errors;
+    size_t messageLen, messageCap, errorsLen, errorsCap;
+    unsigned long long rowCount;
+} Gather;
+
+/* A storage engine the gateway forwards queries to. Each worker owns one connection
+ * to it; execute runs a query and streams its result, returning FALSE on error.
+ * cancel interrupts the query running on a connection from another thread, through
+ * a connection of its own to the same server when killerConnection is set. */
+typedef struct {
+    const char *name;
+    int noArgs;                 // positional arguments, the server port included
+    const char *usage;
+    bool (*connect)(DBConnection *db, char **argv);
+    bool (*execute)(DBConnection *db, char *query, ssize_t query_len, ResultStream *stream);
+    void (*close)(DBConnection *db);
+    bool (*cancel)(DBConnection *db, DBConnection *killer);
+    bool killerConnection;
+    void (*threadInit)();       // optional, run by each worker before its first query
+    void (*threadEnd)();
+    bool backslashEscapes;      // string literals treat backslash as an escape character
+    int hostArg, portArg;       // arguments a replica replaces, -1 if there is none
+} Backend;
+
+/* Bulk load data received from the client, waiting for the worker */
+typedef struct DataChunkNode {
+    size_t len;
+    struct DataChunkNode *next;
+    char data[];
+} DataChunk;
+
+/* A bulk load in progress, fed by the I/O thread and consumed by a worker */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;       // signalled when data arrives or the load ends
+    DataChunk *head, *tail;
+    size_t queued;              // bytes waiting for the worker
+    bool eof;                   // the last chunk has arrived
+    bool cancelled;             // the client went away before its last chunk
+    bool aborted;               // the worker gave up, further data is discarded
+    bool paused;                // the I/O thread stopped reading the client until the worker catches up
+    int refs;                   // the I/O thread's until end of file, and the worker's
+    char table[NAMEBUFSIZE];
+    char format;                // LOAD_CSV or LOAD_TSV
+    unsigned int skipLines;
+} BulkLoad;
+
+/* Turns load data into multi-row INSERTs, record by record across chunks */
+typedef struct {
+    char delimiter;
+    bool csv;
+    bool backslashEscapes;
+    unsigned int skipLines;
+    char *text;                 // INSERT being built
+    size_t textLen, textCap, prefixLen;
+    char *field;                // field being read
+    size_t fieldLen, fieldCap;
+    bool inQuotes, quoteSeen, fieldQuoted;
+    unsigned int noFields;      // fields of the record so far
+    unsigned long record;       // record being read, skipped ones included, from 1
+    unsigned long batchRows, rows;
+    char error[BUFSIZE];
+} LoadParser;
+
+/* A connected client. The I/O thread reads its queries, workers stream the responses. */
+typedef struct ClientNode {
+    int sock;
+    pthread_mutex_t lock;       // keeps frames of concurrent responses whole, guards refs
+    int refs;                   // one for the I/O thread, one per query in flight
+    int pinned;                 // worker running the client's transaction, -1 if none
+    bool sessionPin;            // pinned by LOCK TABLES or autocommit=0, not just a transaction
+    BulkLoad *load;             // bulk load receiving data, at most one at a time
+    uint32_t loadId;
+    bool paused;                // not read until the worker drains the load's data
+    long long primaryUntil;     // monotonic ms until which its reads stay on the primary
+    long timeoutMs;             // deadline of its queries, 0 for none
+    struct JobNode *held;       // with shards, what opened a transaction that has no shard yet
+    unsigned char *inbuf;       // received bytes that don't form a whole frame yet
+    size_t inLen, inCap;
+} Client;
+
+/* A query waiting for a worker */
+typedef struct JobNode {
+    Client *client;             // NULL for the gateway's own statements
+    uint32_t id;
+    char *query;
+    size_t queryLen;
+    bool pinned;                // part of a transaction, runs on the client's connection
+    struct JobNode *waiters;    // for a coalesced INSERT, the jobs of its rows
+    BulkLoad *load;             // for a bulk load, its data
+    long long receivedAt;       // monotonic us
+    int target;                 // server it runs on
+    bool write;                 // renews the client's read-your-writes window when done
+    long long deadline;         // monotonic us, 0 for none
+    volatile int cancelled;     // CancelReason, set by the watchdog or a cancel frame
+    int kill;                   // KillState, while it runs
+    Gather *gather;             // for a part of a scattered query, the gather merging it
+    int part;
+    struct JobNode *next;
+} Job;
+
+/* Why a query was stopped */
+typedef enum { CANCEL_NONE, CANCEL_DEADLINE, CANCEL_CLIENT } CancelReason;
+typedef enum { KILL_NONE, KILL_SENDING, KILL_SENT } KillState;
+
+typedef struct {
+    Job *head, *tail;
+} JobQueue;
+
+/* A server the workers connect to: the primary, target 0, or a read replica */
+typedef struct {
+    char name[NAMEBUFSIZE];     // host or database file
+    char port[NAMEBUFSIZE];
+    char **argv;                // backend arguments connecting to it
+    JobQueue queue;             // queries any of its workers may run
+    pthread_cond_t wakeup;
+    unsigned int outstanding;   // queued and running, reads go where this is lowest
+    unsigned long served;
+} Target;
+
+/* Worker threads, each running queries on its own backend connection. Every target
+ * has workersPerTarget of them, the primary's first. */
+struct worker_pool {
+    pthread_mutex_t lock;
+    Target *targets;
+    int noTargets;
+    int nextReplica;            // where the search for the least loaded replica starts
+    unsigned int readYourWritesMs; // reads stay on the primary this long after a write, 0 never
+    JobQueue *pinned;           // per worker, the queries of the transactions it runs
+    DBConnection *dbs;
+    Job **current;              // per worker, the job it runs, NULL when idle
+    pthread_t *threads;
+    int noWorkers, workersPerTarget;
+    int nextPin;                // round robin over the primary's workers for new transactions
+    int notify[2];              // pipe waking the I/O thread when a paused client can be read again
+    unsigned int maxInFlight;   // queries a client may have queued or running, 0 no limit
+    unsigned long schemaVersion; // bumped by each DDL that succeeds, voids every prepared statement
+    bool running;
+} workerPool;
+
+/* Stops the queries past their deadline or cancelled by their client while they run.
+ * Shares the pool's lock; a worker whose query is being killed waits for the kill to
+ * land before it starts another. */
+struct watchdog {
+    pthread_t thread;
+    pthread_cond_t wakeup;      // a deadline was set or a cancel requested, on CLOCK_MONOTONIC
+    pthread_cond_t killed;      // a kill went through
+    DBConnection *killers;      // per target, when the backend kills through a connection of its own
+    bool *connected;
+    long defaultTimeoutMs;      // deadline of a new client's queries
+    unsigned long timeouts, cancels, kills;
+} watchdog;
+
+/* A table spread over the shards by the hash of its key column */
+typedef struct {
+    char name[NAMEBUFSIZE];     // lower-cased
+    char column[NAMEBUFSIZE];
+} ShardedTable;
+
+typedef uint32_t ShardSet;      // bit s for shard s
+
+/* Hash sharding, from the shard map given with -S. Every shard is a target: shard 0 is
+ * the server of the positional arguments and holds the tables the map doesn't list. */
+struct shard_map {
+    char *shards[MAX_SHARDS - 1]; // shards 1 and up, host[:port] or database file as -r takes them
+    int noShards;               // shard 0 included, 0 when sharding is off
+    ShardedTable tables[MAX_SHARDED_TABLES];
+    int noTables;
+    unsigned long singleShard, scattered; // routed queries, counted by the I/O thread
+} shardMap;
+
+/* Single-row INSERTs into the same table and columns, waiting to be sent as one statement */
+typedef struct InsertBatchNode {
+    char *text;                 // "INSERT INTO t (a, b) VALUES (...),(...)" so far
+    size_t textLen, textCap, prefixLen;
+    unsigned int hash;          // of the prefix, up to and including VALUES
+    unsigned int noRows;
+    long long deadline;         // monotonic ms at which the batch is sent
+    Job *head, *tail;           // the rows' jobs, acked once the batch commits
+    struct InsertBatchNode *next;
+} InsertBatch;
+
+/* Group commit of INSERTs, driven by the I/O thread */
+struct insert_batcher {
+    InsertBatch *buckets[BATCH_BUCKETS];
+    unsigned int noPending;
+    unsigned int windowMs;      // how long a batch collects rows, 0 disables batching
+    unsigned int maxRows;
+    pthread_mutex_t lock;       // guards the counters, workers update them too
+    unsigned long batches, rows, fallbacks;
+} insertBatcher;
+
+/* Latency histogram and counters of the queries sharing a digest */
+typedef struct QueryStatNode {
+    char *digest;
+    unsigned int hash;
+    unsigned long calls, errors;
+    long long totalUs, waitUs, maxUs;
+    unsigned long long rows, bytes;
+    unsigned long histogram[STATS_HIST_BUCKETS];
+    struct QueryStatNode *next;
+} QueryStat;
+
+struct query_stats {
+    pthread_mutex_t lock;
+    QueryStat *buckets[STATS_BUCKETS];
+    unsigned int noStats;
+    QueryStat other;            // the digests beyond STATS_MAX_DIGESTS
+} queryStats;
+
+/* A query that took longer than the slow log threshold */
+typedef struct SlowQueryNode {
+    time_t when;
+    long long us;
+    unsigned long long rows, bytes;
+    bool error, truncated;
+    struct SlowQueryNode *next;
+    char query[];
+} SlowQuery;
+
+/* Slow query log, written by its own thread so that workers never wait on the file */
+struct slow_log {
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    pthread_t thread;
+    bool running;
+    long long thresholdUs;      // negative when the log is off
+    FILE *file;
+    SlowQuery *head, *tail;
+    unsigned int queued;
+    unsigned long dropped;
+} slowLog;
+
+/* How a statement ties the client to one backend connection */
+typedef enum { PIN_NONE, PIN_TRANSACTION, PIN_SESSION, UNPIN_TRANSACTION, UNPIN_SESSION } PinEffect;
+
 
 /* Socket related functions */
-ssize_t HandleMessage(MYSQL* conn, int clntSock);
+ssize_t HandleMessage(Client *client);
 int AcceptTCPConnection(int servSock);
+bool SendFrame(Client *client, char type, uint32_t id, const char *payload, size_t len);
+Client* NewClient(int sock);
+void SendReply(Client *client, uint32_t id, char type, const char *text);
+void CloseClient(Client *client);
+void ReleaseClient(Client *client);
+
+/* Worker pool functions */
+bool StartWorkers(int noWorkers, unsigned int maxStmts, char **argv, char **replicas, int noReplicas);
+void StopWorkers();
+void* WorkerMain(void *arg);
+void DispatchQuery(Client *client, uint32_t id, const char *query, size_t len);
+PinEffect SessionPinEffect(const char *query);
+Job* NewJob(Client *client, uint32_t id, const char *query, size_t len);
+void EnqueueJob(Job *job, int worker);
+void EnqueueRead(Job *job);
+void EnqueueTarget(Job *job, int target);
+void PushJob(Job *job, JobQueue *queue, int target);
+Job* NextJob(int worker);
+void FinishJob(int target, Client *client, bool write);
+bool AdmitQuery(Client *client, uint32_t id);
+void NoteWrite(Client *client);
+
+/* Deadline and cancellation functions */
+void StartWatchdog();
+void StopWatchdog();
+void* WatchdogMain(void *arg);
+void StopWatching(int worker);
+void CancelQuery(Client *client, uint32_t id);
+long long QueryDeadline(Client *client, const char *query);
+long HintTimeout(const char *query);
+void SetSessionTimeout(Client *client, uint32_t id, const char *args);
+
+/* Sharding functions */
+void LoadShardMap(const char *path);
+const ShardedTable* FindShardedTable(const char *name);
+void DispatchSharded(Client *client, Job *job, PinEffect effect);
+void RejectJob(Job *job, const char *error);
+ShardSet PlanShards(const char *query, char **texts, char *error, size_t errorLen);
+ShardSet InsertShards(const char *query, char **texts, char *error, size_t errorLen);
+ShardSet WhereShards(const char *query, const ShardedTable **sharded, int noSharded, const char *alias, char *error, size_t errorLen);
+const char* MergeClause(const char *query);
+bool IsCteName(const char *query, const char *name);
+bool IsShardKey(const Token *tok, const ShardedTable **sharded, int noSharded, const char *alias);
+const char* KeyLiteral(const char *p, Token *tok, int *shard);
+int KeyShard(const Token *literal, bool negative);
+bool TestRouting();
+void ScatterJob(Job *job, ShardSet shards, char **texts);
+void GatherFrame(ResultStream *stream);
+void GatherTurn(Gather *gather, int part, bool wait, volatile const int *cancelled);
+void GatherError(Gather *gather, const char *text, size_t len);
+void GatherEnd(ResultStream *stream, long long start);
+
+/* Insert batching functions */
+bool BatchInsert(Job *job);
+bool SplitSingleRowInsert(const char *query, size_t *prefixEnd, size_t *valuesStart, size_t *valuesEnd);
+void FlushInsertBatch(InsertBatch *batch);
+void FlushInsertBatches(bool all);
+struct timeval* BatchTimeout(struct timeval *timeout);
+void RunInsertBatch(DBConnection *db, Job *batch);
+
+/* Bulk load functions */
+void DispatchLoad(Client *client, uint32_t id, const unsigned char *payload, size_t len);
+void FeedLoad(Client *client, uint32_t id, const char *data, size_t len);
+bool ResumeClient(Client *client);
+void ReleaseLoad(BulkLoad *load);
+void RunBulkLoad(DBConnection *db, BulkLoad *load, bool inTransaction, ResultStream *stream);
+bool ParseLoadData(DBConnection *db, LoadParser *parser, const char *data, size_t len, ResultStream *stream);
+void AppendLoadChar(LoadParser *parser, char c);
+void EndLoadField(LoadParser *parser);
+bool EndLoadRecord(DBConnection *db, LoadParser *parser, ResultStream *stream);
+bool FlushLoadBatch(DBConnection *db, LoadParser *parser, ResultStream *stream);
+bool RunQuietly(DBConnection *db, const char *query, size_t len, char *error, size_t errorLen);
+void AppendText(char **buffer, size_t *len, size_t *cap, const char *text, size_t textLen);
+
+/* Query statistics functions */
+void StatsInit(long slowMs, const char *slowLogPath);
+void StatsShutdown();
+void StatsRecord(const char *query, long long waitUs, long long us, const ResultStream *stream);
+void SlowLogWrite(const char *query, long long us, const ResultStream *stream);
+void* SlowLogMain(void *arg);
+void StatsTop(ResultStream *stream, int n);
+long long HistogramPercentile(const QueryStat *stat, double p);
+void StatsReset();
+size_t DigestQuery(const char *query, char *out, size_t outLen);
+
+/* Result streaming functions */
+void StreamInit(ResultStream *stream, Client *client, uint32_t id);
+void StreamWrite(ResultStream *stream, char type, const char *data, size_t len);
+void StreamPrintf(ResultStream *stream, char type, const char *format, ...);
+void StreamColumns(ResultStream *stream, MYSQL_FIELD *fields, unsigned int noColumns, unsigned char *types);
+void StreamColumn(ResultStream *stream, unsigned char type, const char *name);
+void StreamVarint(ResultStream *stream, uint64_t value);
+void StreamDouble(ResultStream *stream, double value);
+void StreamTextValue(ResultStream *stream, unsigned char type, const char *value, unsigned long len);
+unsigned char ColumnType(const MYSQL_FIELD *field);
+void StreamSend(ResultStream *stream, const char *frames, size_t len);
+void StreamFlush(ResultStream *stream);
+void StreamEnd(ResultStream *stream);
 
 /* Mysql related functions */
-bool InitializeMYSQL(MYSQL** conn, char ** argv);
-void OperateOnMYSQL(MYSQL* conn, char *query, ssize_t query_len, char *result);
+bool InitializeMYSQL(DBConnection* db, char ** argv);
+bool OperateOnMYSQL(DBConnection* db, char *query, ssize_t query_len, ResultStream *stream);
+void CloseMYSQL(DBConnection* db);
+bool CancelMYSQL(DBConnection* db, DBConnection* killer);
+void MYSQLThreadInit();
+void MYSQLThreadEnd();
+
+/* Embedded SQLite functions */
+bool InitializeSQLite(DBConnection* db, char ** argv);
+bool OperateOnSQLite(DBConnection* db, char *query, ssize_t query_len, ResultStream *stream);
+void CloseSQLite(DBConnection* db);
+bool CancelSQLite(DBConnection* db, DBConnection* killer);
+unsigned char SQLiteColumnType(sqlite3_stmt *stmt, int column, bool hasRow);
+void StreamSQLiteValue(ResultStream *stream, sqlite3_stmt *stmt, int column, unsigned char type);
+
+/* Generic backend functions */
+void ExecuteQuery(DBConnection* db, char *query, ssize_t query_len, bool inTransaction, ResultStream *stream);
+void HandleAdminCommand(DBConnection* db, char *command, ResultStream *stream);
+
+/* Prepared statement functions */
+bool ExecutePrepared(DBConnection* db, char *query, ResultStream *stream, bool *success);
+bool StreamStmtRows(PreparedStmt *ps, ResultStream *stream);
+int FingerprintQuery(const char *query, char *shape, size_t shapeLen, QueryParam *params, int maxParams, char *scratch);
+long UnescapeString(const char *literal, size_t len, char *out);
+PreparedStmt* GetPreparedStmt(DBConnection* db, const char *shape);
+void StmtCacheRemove(DBConnection* db, PreparedStmt *ps);
+void StmtCacheClose(DBConnection* db);
+
+/* Query parsing functions */
+const char* NextToken(const char *p, Token *tok);
+bool TokenIs(const Token *tok, const char *word);
+size_t NormalizeQuery(const char *query, char *out, size_t outLen);
+QueryKind ClassifyQuery(const char *query);
+bool IsCacheableRead(const char *query);
+bool IsReplicaRead(const char *query);
+int ExtractTables(const char *query, char tables[][NAMEBUFSIZE], char aliases[][NAMEBUFSIZE], int maxTables);
+
+/* Query result cache functions */
+void CacheInit(size_t maxBytes, unsigned int ttl);
+CacheEntry* CacheLookup(const char *key);
+void CacheRelease(CacheEntry *entry);
+void CacheSnapshot(const char *query, CacheDeps *deps);
+bool CacheDepsStale(const CacheDeps *deps);
+void CacheStore(const char *key, const CacheDeps *deps, const char *result, size_t resultLen, unsigned long long rowCount);
+void CacheInvalidate(const char *query, QueryKind kind);
+void CacheRemove(CacheEntry *entry);
+void CacheFree(CacheEntry *entry);
+void CacheStats(char *out, size_t outLen);
+TableVersion* GetTableVersion(const char *name);
+unsigned int HashString(const char *str);
+time_t MonotonicSeconds();
+long long MonotonicMillis();
+long long MonotonicMicros();
+
+/* Backends selectable with -b, the first is the default */
+static const Backend backends[] = {
+    { "mysql", 7, "<mysqlserver-username> <mysqlserver user-password> <host> <database> <mysqlserver port>",
+      InitializeMYSQL, OperateOnMYSQL, CloseMYSQL, CancelMYSQL, TRUE, MYSQLThreadInit, MYSQLThreadEnd, TRUE, 4, 6 },
+    { "sqlite", 3, "<database file>",
+      InitializeSQLite, OperateOnSQLite, CloseSQLite, CancelSQLite, FALSE, NULL, NULL, FALSE, 2, -1 },
+};
+const Backend *backend = &backends[0];
 
 int main(int argc, char ** argv) {
 
-	if (argc != 7) {
-		perror("<server port> <mysqlserver-username> <mysqlserver user-password> <host> <database> <mysqlserver port>");
+	size_t cacheBytes = CACHE_DEFAULT_BYTES;
+	unsigned int cacheTTL = CACHE_DEFAULT_TTL;
+	unsigned int maxStmts = STMT_CACHE_DEFAULT;
+	int noWorkers = WORKERS_DEFAULT;
+	long slowMs = -1;
+	const char *slowLogPath = NULL;
+	const char *shardMapPath = NULL;
+	char *replicas[MAX_REPLICAS];
+	int noReplicas = 0;
+	bool routingTest = FALSE;
+	int opt, i;
+	insertBatcher.maxRows = BATCH_DEFAULT_ROWS;
+	pthread_mutex_init(&insertBatcher.lock, NULL);
+	watchdog.defaultTimeoutMs = TIMEOUT_DEFAULT_MS;
+	workerPool.maxInFlight = MAX_INFLIGHT_DEFAULT;
+	while ((opt = getopt(argc, argv, "c:t:p:n:b:g:m:s:l:r:w:T:q:S:R")) != -1) {
+		switch (opt) {
+		case 'R': routingTest = TRUE; break;
+		case 'S': shardMapPath = optarg; break;
+		case 'T': watchdog.defaultTimeoutMs = atol(optarg); break;
+		case 'q': workerPool.maxInFlight = atoi(optarg); break;
+		case 'r':
+			if (noReplicas == MAX_REPLICAS)
+				argc = 0; // print usage below
+			else
+				replicas[noReplicas++] = optarg;
+			break;
+		case 'w': workerPool.readYourWritesMs = atoi(optarg); break;
+		case 's': slowMs = atol(optarg); break;
+		case 'l': slowLogPath = optarg; break;
+		case 'g': insertBatcher.windowMs = atoi(optarg); break;
+		case 'm': insertBatcher.maxRows = atoi(optarg); break;
+		case 'b':
+			for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+				if (strcmp(optarg, backends[i].name) == 0)
+					break;
+			if (i == sizeof(backends) / sizeof(backends[0]))
+				argc = 0; // print usage below
+			else
+				backend = &backends[i];
+			break;
+		case 'c': cacheBytes = strtoul(optarg, NULL, 10); break;
+		case 't': cacheTTL = atoi(optarg); break;
+		case 'p': maxStmts = atoi(optarg); break;
+		case 'n': noWorkers = atoi(optarg); break;
+		default:
+			argc = 0; // print usage below
+		}
+	}
+	// Shift the options away, positional arguments keep their indices
+	argc -= optind - 1;
+	argv += optind - 1;
+
+	// Check the shard routing on a map of its own, instead of serving
+	if (argc > 0 && routingTest)
+		exit(TestRouting() ? 0 : 1);
+
+	if (argc != backend->noArgs || noWorkers < 1 || insertBatcher.maxRows < 1 || watchdog.defaultTimeoutMs < 0
+	    || (shardMapPath && noReplicas > 0)) {
+		fprintf(stderr, "[-c cache bytes] [-t cache ttl secs] [-p prepared statements] [-n backend connections] [-b backend] [-g insert batch window ms] [-m insert batch rows] [-s slow query ms] [-l slow log file] [-r replica]... [-w read-your-writes ms] [-T query timeout ms] [-q queries in flight per client] [-S shard map] [-R] <server port> <backend arguments>\n");
+		for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+			fprintf(stderr, "  -b %-6s : %s\n", backends[i].name, backends[i].usage);
+		fprintf(stderr, "  -r : a replica, host[:port] for mysql, the database file for sqlite\n");
+		fprintf(stderr, "  -S : shard map file, not combined with -r\n");
+		fprintf(stderr, "  -R : check the routing of sample statements over three shards, then exit\n");
 		exit(-1);
 	}
+	if (shardMapPath)
+		LoadShardMap(shardMapPath);
 
 	in_port_t servPort = atoi(argv[1]); // Local port
 
-    MYSQL* conn;
-    // Initialize MySql Server
-    if( InitializeMYSQL(&conn, argv) == 0 ) {
-        perror("MySql server initialization failed");
+	// Every connection to ":memory:" would open a database of its own
+	if (backend->connect == InitializeSQLite && strcmp(argv[2], ":memory:") == 0)
+		noWorkers = 1;
+
+	CacheInit(cacheBytes, cacheTTL);
+	StatsInit(slowMs, slowLogPath);
+    // Initialize the backend connections and the workers running queries on them
+    // Shards take the place of replicas as the other targets
+    if( StartWorkers(noWorkers, maxStmts, argv, shardMapPath ? shardMap.shards : replicas,
+                     shardMapPath ? shardMap.noShards - 1 : noReplicas) == 0 ) {
+        fprintf(stderr, "%s backend initialization failed\n", backend->name);
 		exit(-1);
 	}
 
@@ -80,26 +738,34 @@ int main(int argc, char ** argv) {
 	FD_ZERO(&orgSockSet);
 	FD_SET(STDIN_FILENO, &orgSockSet); // STDIN
 	FD_SET(servSock, &orgSockSet);
+	FD_SET(workerPool.notify[0], &orgSockSet); // Workers waking paused clients
 	int maxDescriptor;
 	if (STDIN_FILENO > servSock) {	
 		maxDescriptor = STDIN_FILENO;
 	} else {
 		maxDescriptor = servSock;
 	}
-	// Setting select timeout as Zero makes select non-blocking
-	struct timeval timeOut;
-	timeOut.tv_sec = 0; // 0 sec
-	timeOut.tv_usec = 0; // 0 microsec
+	if (maxDescriptor < workerPool.notify[0]) {
+		maxDescriptor = workerPool.notify[0];
+	}
+	Client *clients[FD_SETSIZE]; // Connected clients by socket
+	memset(clients, 0, sizeof(clients));
 
 	// Server Loop
+	// The queries run on the workers, so select() can block until a socket is ready
+	// or the oldest batch of INSERTs is due
 	int loopRunning = 1;
 	while (loopRunning) {
 		// The following process has to be done every time
 		// because select() overwrite fd_set.
 		fd_set currSockSet;
 		memcpy(&currSockSet, &orgSockSet, sizeof(fd_set));
+		struct timeval timeOut;
 
-		select(maxDescriptor + 1, &currSockSet, NULL, NULL, &timeOut);
+		if (select(maxDescriptor + 1, &currSockSet, NULL, NULL, BatchTimeout(&timeOut)) <= 0) {
+			FD_ZERO(&currSockSet);
+		}
+		FlushInsertBatches(FALSE);
 
 		int currSock;
 		for (currSock = 0; currSock < maxDescriptor + 1; currSock++) {
@@ -110,6 +776,12 @@ int main(int argc, char ** argv) {
 				if (currSock  == servSock) {
 					int newClntSock;
 					newClntSock = AcceptTCPConnection(servSock);
+					if (newClntSock >= FD_SETSIZE) {
+						puts("Too many clients, connection refused");
+						close(newClntSock);
+						continue;
+					}
+					clients[newClntSock] = NewClient(newClntSock);
 					FD_SET(newClntSock, &orgSockSet);
 					if (maxDescriptor < newClntSock) {
 						maxDescriptor = newClntSock;
@@ -122,23 +794,58 @@ int main(int argc, char ** argv) {
 					loopRunning = 0;
 				}
 
-				// Echo the message
+				// A worker caught up with a bulk load, read its client again
+				else if (currSock == workerPool.notify[0]) {
+					char drain[64];
+					while (read(currSock, drain, sizeof(drain)) > 0)
+						;
+					int clntSock;
+					for (clntSock = 0; clntSock < maxDescriptor + 1; clntSock++) {
+						if (clients[clntSock] && clients[clntSock]->paused && ResumeClient(clients[clntSock])) {
+							FD_SET(clntSock, &orgSockSet);
+						}
+					}
+				}
+
+				// Queue the client's queries
 				else {
-					ssize_t recvLen = HandleMessage(conn, currSock);
+					ssize_t recvLen = HandleMessage(clients[currSock]);
 					if (recvLen == 0) {
 						FD_CLR(currSock, &orgSockSet);
+						CloseClient(clients[currSock]);
+						clients[currSock] = NULL;
+					} else if (clients[currSock]->paused) {
+						// Its bulk load is ahead of the worker
+						FD_CLR(currSock, &orgSockSet);
 					}
 				}
 			}
 		}
 	}
 
+	// Let the workers finish the queued queries, unfinished loads are cancelled
+	int clntSock;
+	for (clntSock = 0; clntSock < maxDescriptor + 1; clntSock++) {
+		if (clients[clntSock]) {
+			CloseClient(clients[clntSock]);
+		}
+	}
+	FlushInsertBatches(TRUE);
+	StopWorkers();
+	StatsShutdown();
+
+	char stats[BUFSIZE];
+	CacheStats(stats, sizeof(stats));
+	fputs(stats, stdout);
+	if (insertBatcher.windowMs > 0)
+		printf("Insert batches: %lu\tRows: %lu\tRow fallbacks: %lu\n",
+		       insertBatcher.batches, insertBatcher.rows, insertBatcher.fallbacks);
+	fflush(stdout);
 
 	int closingSock;
 	for (closingSock = 0; closingSock < maxDescriptor + 1; closingSock++)
 		close(closingSock);
 
-    mysql_close(conn);
 	printf("End of Program\n");
 }
 
@@ -164,100 +871,4416 @@ int AcceptTCPConnection(int servSock) {
 	return(clntSock);
 }
 
-/* Receives query and Sends response */
-ssize_t HandleMessage(MYSQL *conn, int clntSock) {
-	// Receive data
-	char buffer[BUFSIZE], result[BUFSIZE];
-	memset(buffer, 0, BUFSIZE);
-  	memset(result, 0, BUFSIZE);
+/* Receives query and load frames and queues each complete one for the workers,
+ * cancel frames take effect at once. Returns 0 when the client has gone or broken
+ * the protocol. */
+ssize_t HandleMessage(Client *client) {
+    // Make room for the next read, a frame may arrive in pieces
+    if( client->inCap - client->inLen < BUFSIZE )
+    {
+        size_t cap = client->inCap ? client->inCap * 2 : 4 * BUFSIZE;
+        unsigned char *inbuf = (unsigned char*)realloc(client->inbuf, cap);
+        if( inbuf == NULL )
+        {
+            perror("realloc() failed");
+            exit(-1);
+        }
+        client->inbuf = inbuf;
+        client->inCap = cap;
+    }
+
+    ssize_t recvLen = recv(client->sock, client->inbuf + client->inLen, client->inCap - client->inLen, 0);
+    if( recvLen < 0 )
+    {
+        perror("recv() failed");
+        return 0;
+    }
+    client->inLen += recvLen;
 
-    ssize_t recvLen = recv(clntSock, buffer, BUFSIZE, 0);
-	if (recvLen < 0) {
-		perror("recv() failed");
-		exit(-1);
-	}
-	buffer[recvLen] = '\0';
-    
-    if( recvLen > 0 )
-    {
-        if(DEBUG) printf("String received : |%s|\n", buffer);
-
-        // Do operation on MySQL server
-        OperateOnMYSQL(conn, buffer, recvLen, result);
-
-		// Send the mysql result back to client
-		ssize_t sentLen = send(clntSock, result, strlen(result), 0);
-		if (sentLen < 0) {
-			perror("send() failed");
-			exit(-1);
-		} else if (sentLen != strlen(result)) {
-			perror("send() sent unexpected number of bytes");
-			exit(-1);
-		}
+    size_t offset = 0;
+    while( client->inLen - offset >= FRAME_HEADER_LEN )
+    {
+        unsigned char *header = client->inbuf + offset;
+        uint32_t id = GetUint32(header + 1);
+        uint32_t len = GetUint32(header + 5);
+
+        if( (header[0] != FRAME_QUERY && header[0] != FRAME_LOAD && header[0] != FRAME_DATA && header[0] != FRAME_CANCEL)
+            || len > MAX_QUERY_LEN )
+        {
+            static const char error[] = "\nError: malformed or oversized query frame, closing connection\n";
+            unsigned char count[8] = { 0 };
+            SendFrame(client, FRAME_ERROR, id, error, sizeof(error) - 1);
+            SendFrame(client, FRAME_END, id, (char*)count, sizeof(count));
+            return 0;
+        }
+        if( client->inLen - offset - FRAME_HEADER_LEN < len )
+            break;
+
+        if( header[0] == FRAME_QUERY )
+        {
+            if(DEBUG) printf("Query %u received : |%.*s|\n", id, (int)len, (char*)header + FRAME_HEADER_LEN);
+            DispatchQuery(client, id, (char*)header + FRAME_HEADER_LEN, len);
+        }
+        else if( header[0] == FRAME_LOAD )
+            DispatchLoad(client, id, header + FRAME_HEADER_LEN, len);
+        else if( header[0] == FRAME_CANCEL )
+            CancelQuery(client, id);
+        else
+            FeedLoad(client, id, (char*)header + FRAME_HEADER_LEN, len);
+        offset += FRAME_HEADER_LEN + len;
     }
+    memmove(client->inbuf, client->inbuf + offset, client->inLen - offset);
+    client->inLen -= offset;
 
 	return(recvLen);
 }
 
-/* Connects to the mysql-server in the localhost */
-bool InitializeMYSQL(MYSQL** conn, char ** argv)
+/* Sends one frame, FALSE if the client is gone.
+ * The client's lock keeps the frames of concurrent responses from interleaving mid-frame. */
+bool SendFrame(Client *client, char type, uint32_t id, const char *payload, size_t len)
 {
-    char *user = (char*)argv[2];
-    char *password = (char*)argv[3];
-    char *host = (char*)argv[4];
-    char *dbname = (char*)argv[5];
-    unsigned int port = atoi((char*)argv[6]);
-    *conn = mysql_init(NULL); // Initialize the mysql structue
+    unsigned char header[FRAME_HEADER_LEN];
+    struct iovec iov[2];
+    struct msghdr msg;
+    bool success = TRUE;
 
-    if(!mysql_real_connect(*conn, host, user, password, dbname, port, NULL, 0))
+    PutFrameHeader(header, type, id, len);
+    iov[0].iov_base = header;
+    iov[0].iov_len = FRAME_HEADER_LEN;
+    iov[1].iov_base = (void*)payload;
+    iov[1].iov_len = len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    pthread_mutex_lock(&client->lock);
+    while( msg.msg_iovlen > 0 )
     {
-        printf("\nError: %s[%d]\n", mysql_error(*conn), mysql_errno(*conn));
-        return FALSE;
+        ssize_t sentLen = sendmsg(client->sock, &msg, MSG_NOSIGNAL);
+        if( sentLen < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+            perror("sendmsg() failed");
+            success = FALSE;
+            break;
+        }
+        // After a short write, resume part way through the iovecs
+        while( msg.msg_iovlen > 0 && (size_t)sentLen >= msg.msg_iov->iov_len )
+        {
+            sentLen -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if( msg.msg_iovlen > 0 )
+        {
+            msg.msg_iov->iov_base = (char*)msg.msg_iov->iov_base + sentLen;
+            msg.msg_iov->iov_len -= sentLen;
+        }
+    }
+    pthread_mutex_unlock(&client->lock);
+    return success;
+}
+
+Client* NewClient(int sock)
+{
+    Client *client = (Client*)calloc(1, sizeof(Client));
+    if( client == NULL )
+    {
+        perror("calloc() failed");
+        exit(-1);
+    }
+    client->sock = sock;
+    client->refs = 1;
+    client->pinned = -1;
+    client->timeoutMs = watchdog.defaultTimeoutMs;
+    pthread_mutex_init(&client->lock, NULL);
+    // A response is several small frames; with Nagle the last one waits for the
+    // client's delayed ACK, adding ~40 ms to every short query
+    int on = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return client;
+}
+
+/* Answers a request from the I/O thread with a single text frame */
+void SendReply(Client *client, uint32_t id, char type, const char *text)
+{
+    unsigned char count[8] = { 0 };
+    SendFrame(client, type, id, text, strlen(text));
+    SendFrame(client, FRAME_END, id, (char*)count, sizeof(count));
+}
+
+/* The client stopped sending. A bulk load it left unfinished is cancelled and a
+ * transaction it left open is rolled back on its connection; the socket stays
+ * open until the responses in flight are sent. */
+void CloseClient(Client *client)
+{
+    static const char *cleanup[] = { "ROLLBACK", "UNLOCK TABLES", "SET autocommit=1", NULL };
+    int i;
+
+    if( client->load != NULL )
+    {
+        pthread_mutex_lock(&client->load->lock);
+        client->load->eof = client->load->cancelled = TRUE;
+        pthread_cond_signal(&client->load->ready);
+        pthread_mutex_unlock(&client->load->lock);
+        ReleaseLoad(client->load);
+        client->load = NULL;
+    }
+    while( client->held != NULL )
+    {
+        Job *held = client->held;
+        client->held = held->next;
+        free(held->query);
+        free(held);
+    }
+    if( client->pinned >= 0 )
+        for( i = 0; cleanup[i] != NULL; i++ )
+            EnqueueJob(NewJob(NULL, 0, cleanup[i], strlen(cleanup[i])), client->pinned);
+    free(client->inbuf);
+    client->inbuf = NULL;
+    client->inLen = client->inCap = 0;
+    ReleaseClient(client);
+}
+
+/* Drops a reference, the last one closes the socket */
+void ReleaseClient(Client *client)
+{
+    pthread_mutex_lock(&client->lock);
+    bool last = --client->refs == 0;
+    pthread_mutex_unlock(&client->lock);
+    if( last )
+    {
+        close(client->sock);
+        pthread_mutex_destroy(&client->lock);
+        free(client);
+    }
+}
+
+/* Connects noWorkers backend connections to the primary and to each replica, and starts
+ * a worker on each. A replica takes the place of the primary's host (and port) or file.
+ * With sharding the replicas are the shards after the first. */
+bool StartWorkers(int noWorkers, unsigned int maxStmts, char **argv, char **replicas, int noReplicas)
+{
+    char *targetArgv[backend->noArgs];
+    int i, t;
+
+    pthread_mutex_init(&workerPool.lock, NULL);
+    workerPool.noTargets = 1 + noReplicas;
+    workerPool.workersPerTarget = noWorkers;
+    workerPool.noWorkers = noWorkers * workerPool.noTargets;
+    workerPool.running = TRUE;
+    if( pipe(workerPool.notify) < 0 )
+    {
+        perror("pipe() failed");
+        exit(-1);
+    }
+    fcntl(workerPool.notify[0], F_SETFL, O_NONBLOCK);
+    fcntl(workerPool.notify[1], F_SETFL, O_NONBLOCK);
+    workerPool.targets = (Target*)calloc(workerPool.noTargets, sizeof(Target));
+    workerPool.dbs = (DBConnection*)calloc(workerPool.noWorkers, sizeof(DBConnection));
+    workerPool.pinned = (JobQueue*)calloc(workerPool.noWorkers, sizeof(JobQueue));
+    workerPool.threads = (pthread_t*)calloc(workerPool.noWorkers, sizeof(pthread_t));
+    workerPool.current = (Job**)calloc(workerPool.noWorkers, sizeof(Job*));
+    if( workerPool.targets == NULL || workerPool.dbs == NULL || workerPool.pinned == NULL || workerPool.threads == NULL
+        || workerPool.current == NULL )
+    {
+        perror("calloc() failed");
+        exit(-1);
     }
 
+    for( t = 0; t < workerPool.noTargets; t++ )
+    {
+        Target *target = &workerPool.targets[t];
+        pthread_cond_init(&target->wakeup, NULL);
+        memcpy(targetArgv, argv, sizeof(targetArgv));
+        snprintf(target->name, sizeof(target->name), "%s", t == 0 ? argv[backend->hostArg] : replicas[t - 1]);
+        if( backend->portArg >= 0 )
+        {
+            // host:port, the port defaults to the primary's
+            char *colon = strrchr(target->name, ':');
+            snprintf(target->port, sizeof(target->port), "%s", t > 0 && colon ? colon + 1 : argv[backend->portArg]);
+            if( t > 0 && colon )
+                *colon = '\0';
+            targetArgv[backend->portArg] = target->port;
+        }
+        targetArgv[backend->hostArg] = target->name;
+        // Kept for the watchdog's connection
+        target->argv = (char**)malloc(sizeof(targetArgv));
+        if( target->argv == NULL )
+        {
+            perror("malloc() failed");
+            exit(-1);
+        }
+        memcpy(target->argv, targetArgv, sizeof(targetArgv));
+
+        for( i = t * noWorkers; i < (t + 1) * noWorkers; i++ )
+        {
+            workerPool.dbs[i].maxStmts = maxStmts;
+            if( backend->connect(&workerPool.dbs[i], targetArgv) == 0 )
+            {
+                fprintf(stderr, "Cannot connect to %s\n", target->name);
+                return FALSE;
+            }
+        }
+    }
+    for( i = 0; i < workerPool.noWorkers; i++ )
+        if( pthread_create(&workerPool.threads[i], NULL, WorkerMain, (void*)(intptr_t)i) != 0 )
+        {
+            perror("pthread_create() failed");
+            exit(-1);
+        }
+    StartWatchdog();
     return TRUE;
 }
 
-/* Performs query on mysql and returs query-result */
-void OperateOnMYSQL(MYSQL* conn, char *query, ssize_t query_len, char *result)
+/* Waits for the workers to drain the queues, then closes their connections */
+void StopWorkers()
 {
-    MYSQL_RES *res;
-    MYSQL_ROW row;
+    int i;
 
-    mysql_query(conn, query);
+    pthread_mutex_lock(&workerPool.lock);
+    workerPool.running = FALSE;
+    for( i = 0; i < workerPool.noTargets; i++ )
+        pthread_cond_broadcast(&workerPool.targets[i].wakeup);
+    pthread_mutex_unlock(&workerPool.lock);
 
-    res = mysql_store_result(conn);
-    if( res == NULL)
+    for( i = 0; i < workerPool.noWorkers; i++ )
+        pthread_join(workerPool.threads[i], NULL);
+    StopWatchdog();
+    for( i = 0; i < workerPool.noWorkers; i++ )
+        backend->close(&workerPool.dbs[i]);
+}
+
+/* Runs queries on the worker's backend connection, streaming each result under its request id */
+void* WorkerMain(void *arg)
+{
+    int worker = (int)(intptr_t)arg;
+    DBConnection *db = &workerPool.dbs[worker];
+    Job *job;
+
+    if( backend->threadInit )
+        backend->threadInit();
+    while( (job = NextJob(worker)) != NULL )
     {
-        if( mysql_errno(conn)!=0 )
-            sprintf(result, "\nError: %s[%d]\n", mysql_error(conn), mysql_errno(conn));
+        // Gateway commands are answered locally, everything else goes
+        // through the cache to the MySQL server
+        int target = job->target;
+        if( job->waiters )
+        {
+            RunInsertBatch(db, job);
+            FinishJob(target, NULL, FALSE);
+            continue;
+        }
+
+        ResultStream stream;
+        long long start = MonotonicMicros();
+        StreamInit(&stream, job->client, job->id);
+        stream.cancelled = &job->cancelled;
+        stream.gather = job->gather;
+        stream.part = job->part;
+        stream.replica = target > 0 && shardMap.noShards == 0;
+        if( job->deadline && job->deadline <= start )
+            job->cancelled = CANCEL_DEADLINE;
+        if( job->cancelled && !job->load )
+            ; // past its deadline or cancelled while queued, it doesn't run
+        else if( job->load )
+            RunBulkLoad(db, job->load, job->pinned, &stream);
+        else if( job->query[0] == '\\' )
+            HandleAdminCommand(db, job->query, &stream);
+        else
+            ExecuteQuery(db, job->query, job->queryLen, job->pinned, &stream);
+        StopWatching(worker);
+
+        // The backend's own error for the interrupted query gives way to the reason,
+        // along with the output left unsent
+        if( job->cancelled )
+        {
+            stream.cancelled = NULL;
+            stream.len = 0;
+            if( job->cancelled == CANCEL_DEADLINE )
+                StreamPrintf(&stream, FRAME_ERROR, "\nError: query cancelled, its %lld ms deadline passed\n",
+                             (job->deadline - job->receivedAt) / 1000);
+            else
+                StreamPrintf(&stream, FRAME_ERROR, "\nError: query cancelled by the client\n");
+        }
+        // Timed until the last frame is handed to the socket, a scattered query by its gather
+        if( job->gather )
+            GatherEnd(&stream, start);
         else
-            sprintf(result, "\nResult Successful.\n");
+            StreamEnd(&stream);
+        if( !job->gather && !job->load && job->query[0] != '\\' && job->client )
+            StatsRecord(job->query, start - job->receivedAt, MonotonicMicros() - start, &stream);
+
+        FinishJob(target, job->client, job->write);
+        if( job->client && !job->gather )
+            ReleaseClient(job->client);
+        free(job->query);
+        free(job);
+    }
+    if( backend->threadEnd )
+        backend->threadEnd();
+    return NULL;
+}
+
+/* Queues a query. A client's transaction stays on the primary connection it started on.
+ * Plain reads go to the replica with the fewest queries outstanding, other queries to
+ * whichever primary worker is free first. */
+void DispatchQuery(Client *client, uint32_t id, const char *query, size_t len)
+{
+    // The session's deadline applies to the queries sent after it, so it is set here
+    if( len >= 8 && strncmp(query, "\\timeout", 8) == 0 )
+    {
+        char args[NAMEBUFSIZE];
+        size_t argsLen = len - 8 < sizeof(args) - 1 ? len - 8 : sizeof(args) - 1;
+        memcpy(args, query + 8, argsLen);
+        args[argsLen] = '\0';
+        SetSessionTimeout(client, id, args);
+        return;
+    }
+    if( !AdmitQuery(client, id) )
+        return;
+
+    Job *job = NewJob(client, id, query, len);
+    PinEffect effect = SessionPinEffect(job->query);
+    int worker = client->pinned;
+
+    if( job->query[0] != '\\' )
+        job->deadline = QueryDeadline(client, job->query);
+    if( shardMap.noShards > 0 && job->query[0] != '\\' )
+    {
+        DispatchSharded(client, job, effect);
+        return;
+    }
+
+    if( worker < 0 && effect == PIN_NONE && workerPool.noTargets > 1 && IsReplicaRead(job->query) )
+    {
+        // After a write the client reads from the primary for a while, replicas may lag
+        pthread_mutex_lock(&client->lock);
+        bool recentWrite = client->primaryUntil > MonotonicMillis();
+        pthread_mutex_unlock(&client->lock);
+        if( !recentWrite )
+        {
+            EnqueueRead(job);
+            return;
+        }
     }
     else
     {
-        if(mysql_num_rows(res) == 0 )
-            strcat(result, "Empty set");
-        else
+        QueryKind kind = ClassifyQuery(job->query);
+        if( kind == QUERY_WRITE || kind == QUERY_DDL || effect == UNPIN_TRANSACTION || effect == UNPIN_SESSION )
         {
-            unsigned int noColumns = mysql_num_fields(res);
-            char buf[128];
-            int i;
-            while( row = mysql_fetch_row(res) )
-            {
-                for(i = 0; i < noColumns - 1; i++ )
-                {
-                    memset(buf, 0x00, sizeof(buf));
-                    sprintf(buf, "%s\t|", row[i]);
-                    strcat(result, buf);
-                }
-                memset(buf, 0x00, sizeof(buf));
-                sprintf(buf, "%s\n", row[noColumns-1]);
-                strcat(result, buf);
-            }
+            job->write = TRUE;
+            NoteWrite(client);
         }
     }
-    mysql_free_result(res);
+
+    if( (effect == PIN_TRANSACTION || effect == PIN_SESSION) && client->pinned < 0 )
+        worker = client->pinned = workerPool.nextPin++ % workerPool.workersPerTarget;
+    if( effect == PIN_SESSION )
+        client->sessionPin = TRUE;
+    else if( effect == UNPIN_SESSION || (effect == UNPIN_TRANSACTION && !client->sessionPin) )
+    {
+        client->pinned = -1;
+        client->sessionPin = FALSE;
+    }
+
+    // Outside transactions, single-row INSERTs may wait to be committed together
+    if( worker < 0 && insertBatcher.windowMs > 0 && BatchInsert(job) )
+        return;
+    EnqueueJob(job, worker);
+}
+
+/* How a statement ties the session to its backend connection */
+PinEffect SessionPinEffect(const char *query)
+{
+    Token first, second, tok;
+    const char *p = NextToken(query, &first);
+    p = NextToken(p, &second);
+
+    if( TokenIs(&first, "BEGIN") || (TokenIs(&first, "START") && TokenIs(&second, "TRANSACTION")) )
+        return PIN_TRANSACTION;
+    if( TokenIs(&first, "COMMIT") || (TokenIs(&first, "ROLLBACK") && !TokenIs(&second, "TO")) )
+        return UNPIN_TRANSACTION;
+    if( TokenIs(&first, "LOCK") )
+        return PIN_SESSION;
+    if( TokenIs(&first, "UNLOCK") )
+        return UNPIN_SESSION;
+    if( !TokenIs(&first, "SET") )
+        return PIN_NONE;
+
+    // SET [SESSION] autocommit = 0, also spelt @@autocommit or @@session.autocommit
+    for( tok = second; tok.type != TOKEN_END; p = NextToken(p, &tok) )
+        if( tok.type == TOKEN_WORD && tok.len >= 10
+            && strncasecmp(tok.start + tok.len - 10, "autocommit", 10) == 0 )
+        {
+            p = NextToken(p, &tok); // '='
+            NextToken(p, &tok);
+            if( TokenIs(&tok, "OFF") || (tok.type == TOKEN_NUMBER && strtol(tok.start, NULL, 10) == 0) )
+                return PIN_SESSION;
+            return UNPIN_SESSION;
+        }
+    return PIN_NONE;
+}
+
+/* Copies a query into a job, holding a reference on its client */
+Job* NewJob(Client *client, uint32_t id, const char *query, size_t len)
+{
+    Job *job = (Job*)calloc(1, sizeof(Job));
+    char *text = (char*)malloc(len + 1);
+    if( job == NULL || text == NULL )
+    {
+        perror("malloc() failed");
+        exit(-1);
+    }
+    memcpy(text, query, len);
+    text[len] = '\0';
+    job->client = client;
+    job->id = id;
+    job->query = text;
+    job->queryLen = strlen(text);
+    job->receivedAt = MonotonicMicros();
+    if( client )
+    {
+        pthread_mutex_lock(&client->lock);
+        client->refs++;
+        pthread_mutex_unlock(&client->lock);
+    }
+    return job;
+}
+
+/* Queues a job for one worker, or for any primary worker when worker is -1 */
+void EnqueueJob(Job *job, int worker)
+{
+    pthread_mutex_lock(&workerPool.lock);
+    int target = worker < 0 ? 0 : worker / workerPool.workersPerTarget;
+    PushJob(job, worker < 0 ? &workerPool.targets[0].queue : &workerPool.pinned[worker], target);
+    job->pinned = worker >= 0;
+    // Any idle worker of the target can take a shared job, a pinned one needs its own worker
+    if( worker < 0 )
+        pthread_cond_signal(&workerPool.targets[target].wakeup);
+    else
+        pthread_cond_broadcast(&workerPool.targets[target].wakeup);
+    pthread_mutex_unlock(&workerPool.lock);
+}
+
+/* Queues a read on the replica with the fewest queries queued or running. Ties go
+ * round robin, so that idle replicas share a light load. */
+void EnqueueRead(Job *job)
+{
+    int noReplicas = workerPool.noTargets - 1, best = -1, i;
+
+    pthread_mutex_lock(&workerPool.lock);
+    for( i = 0; i < noReplicas; i++ )
+    {
+        int t = 1 + (workerPool.nextReplica + i) % noReplicas;
+        if( best < 0 || workerPool.targets[t].outstanding < workerPool.targets[best].outstanding )
+            best = t;
+    }
+    workerPool.nextReplica = (workerPool.nextReplica + 1) % noReplicas;
+    PushJob(job, &workerPool.targets[best].queue, best);
+    pthread_cond_signal(&workerPool.targets[best].wakeup);
+    pthread_mutex_unlock(&workerPool.lock);
+}
+
+/* Queues a job for any worker of a target */
+void EnqueueTarget(Job *job, int target)
+{
+    pthread_mutex_lock(&workerPool.lock);
+    PushJob(job, &workerPool.targets[target].queue, target);
+    pthread_cond_signal(&workerPool.targets[target].wakeup);
+    pthread_mutex_unlock(&workerPool.lock);
+}
+
+/* Appends a job to a queue of target. Called with the lock held. */
+void PushJob(Job *job, JobQueue *queue, int target)
+{
+    job->target = target;
+    workerPool.targets[target].outstanding++;
+    if( queue->tail )
+        queue->tail->next = job;
+    else
+        queue->head = job;
+    queue->tail = job;
+}
+
+/* Waits for the next job of a worker, its pinned queue first, then its target's, and
+ * puts it under the watchdog. Returns NULL once the pool is stopped and the queues
+ * are empty. */
+Job* NextJob(int worker)
+{
+    Target *target = &workerPool.targets[worker / workerPool.workersPerTarget];
+    Job *job = NULL;
+
+    pthread_mutex_lock(&workerPool.lock);
+    while( TRUE )
+    {
+        JobQueue *queue = workerPool.pinned[worker].head ? &workerPool.pinned[worker]
+                        : target->queue.head ? &target->queue : NULL;
+        if( queue != NULL )
+        {
+            job = queue->head;
+            queue->head = job->next;
+            if( queue->head == NULL )
+                queue->tail = NULL;
+            // A coalesced INSERT answers for many clients, none of them can stop it
+            if( job->waiters == NULL )
+                workerPool.current[worker] = job;
+            if( job->deadline || job->cancelled )
+                pthread_cond_signal(&watchdog.wakeup);
+            break;
+        }
+        if( !workerPool.running )
+            break;
+        pthread_cond_wait(&target->wakeup, &workerPool.lock);
+    }
+    pthread_mutex_unlock(&workerPool.lock);
+    return job;
+}
+
+/* Admission control: a client may have maxInFlight queries queued or running, so that
+ * one client can't take every worker. One over is refused with an error. */
+bool AdmitQuery(Client *client, uint32_t id)
+{
+    char text[BUFSIZE];
+
+    if( workerPool.maxInFlight == 0 )
+        return TRUE;
+    // Each query in flight holds a reference on its client
+    pthread_mutex_lock(&client->lock);
+    unsigned int inFlight = client->refs - 1;
+    pthread_mutex_unlock(&client->lock);
+    if( inFlight < workerPool.maxInFlight )
+        return TRUE;
+    snprintf(text, sizeof(text), "\nError: too many queries in flight, at most %u per connection\n", workerPool.maxInFlight);
+    SendReply(client, id, FRAME_ERROR, text);
+    return FALSE;
+}
+
+/* Accounts a finished job to its target. A write restarts its client's read-your-writes
+ * window, which counts from the commit rather than from the dispatch. */
+void FinishJob(int target, Client *client, bool write)
+{
+    pthread_mutex_lock(&workerPool.lock);
+    workerPool.targets[target].outstanding--;
+    workerPool.targets[target].served++;
+    pthread_mutex_unlock(&workerPool.lock);
+    if( write && client )
+        NoteWrite(client);
+}
+
+/* Keeps the client's reads on the primary for the read-your-writes window */
+void NoteWrite(Client *client)
+{
+    if( workerPool.readYourWritesMs == 0 || workerPool.noTargets == 1 )
+        return;
+    pthread_mutex_lock(&client->lock);
+    client->primaryUntil = MonotonicMillis() + workerPool.readYourWritesMs;
+    pthread_mutex_unlock(&client->lock);
+}
+
+/* Starts the watchdog thread, its wakeups timed on the monotonic clock */
+void StartWatchdog()
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&watchdog.wakeup, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&watchdog.killed, NULL);
+    watchdog.killers = (DBConnection*)calloc(workerPool.noTargets, sizeof(DBConnection));
+    watchdog.connected = (bool*)calloc(workerPool.noTargets, sizeof(bool));
+    if( watchdog.killers == NULL || watchdog.connected == NULL )
+    {
+        perror("calloc() failed");
+        exit(-1);
+    }
+    if( pthread_create(&watchdog.thread, NULL, WatchdogMain, NULL) != 0 )
+    {
+        perror("pthread_create() failed");
+        exit(-1);
+    }
+}
+
+/* Stops the watchdog once the workers are done, closing its connections */
+void StopWatchdog()
+{
+    int t;
+
+    pthread_mutex_lock(&workerPool.lock);
+    pthread_cond_signal(&watchdog.wakeup);
+    pthread_mutex_unlock(&workerPool.lock);
+    pthread_join(watchdog.thread, NULL);
+    for( t = 0; t < workerPool.noTargets; t++ )
+        if( watchdog.connected[t] )
+            backend->close(&watchdog.killers[t]);
 }
 
+/* Marks the running queries whose deadline has passed, and kills the marked ones on
+ * the backend, one at a time and without the pool's lock. Sleeps until the nearest
+ * deadline or until a worker starts a query that has one, or a client cancels one. */
+void* WatchdogMain(void *arg)
+{
+    if( backend->threadInit )
+        backend->threadInit();
+    pthread_mutex_lock(&workerPool.lock);
+    while( workerPool.running )
+    {
+        long long now = MonotonicMicros(), next = 0;
+        int worker = -1, i;
+
+        for( i = 0; i < workerPool.noWorkers && worker < 0; i++ )
+        {
+            Job *job = workerPool.current[i];
+            if( job == NULL || job->kill != KILL_NONE )
+                continue;
+            if( job->deadline && job->deadline <= now && !job->cancelled )
+                job->cancelled = CANCEL_DEADLINE;
+            if( job->cancelled )
+                worker = i;
+            else if( job->deadline && (next == 0 || job->deadline < next) )
+                next = job->deadline;
+        }
+
+        if( worker >= 0 )
+        {
+            Job *job = workerPool.current[worker];
+            int t = worker / workerPool.workersPerTarget;
+            job->kill = KILL_SENDING;
+            pthread_mutex_unlock(&workerPool.lock);
 
+            // A kill connection that failed is opened again for the next kill
+            if( backend->killerConnection && !watchdog.connected[t] )
+            {
+                watchdog.connected[t] = backend->connect(&watchdog.killers[t], workerPool.targets[t].argv);
+                if( !watchdog.connected[t] )
+                    fprintf(stderr, "Cannot connect to %s to cancel a query\n", workerPool.targets[t].name);
+            }
+            bool killed = FALSE;
+            if( watchdog.connected[t] || !backend->killerConnection )
+                killed = backend->cancel(&workerPool.dbs[worker], &watchdog.killers[t]);
+            if( !killed && watchdog.connected[t] )
+            {
+                backend->close(&watchdog.killers[t]);
+                memset(&watchdog.killers[t], 0, sizeof(DBConnection));
+                watchdog.connected[t] = FALSE;
+            }
+
+            pthread_mutex_lock(&workerPool.lock);
+            job->kill = KILL_SENT;
+            watchdog.kills += killed;
+            pthread_cond_broadcast(&watchdog.killed);
+            continue;
+        }
+
+        if( next == 0 )
+            pthread_cond_wait(&watchdog.wakeup, &workerPool.lock);
+        else
+        {
+            struct timespec until;
+            clock_gettime(CLOCK_MONOTONIC, &until);
+            next -= now;
+            until.tv_sec += next / 1000000;
+            until.tv_nsec += (next % 1000000) * 1000;
+            if( until.tv_nsec >= 1000000000 )
+            {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&watchdog.wakeup, &workerPool.lock, &until);
+        }
+    }
+    pthread_mutex_unlock(&workerPool.lock);
+    if( backend->threadEnd )
+        backend->threadEnd();
+    return NULL;
+}
+
+/* The worker's query has returned: takes it from under the watchdog. A kill being
+ * sent is waited for, it must not hit the worker's next query. */
+void StopWatching(int worker)
+{
+    pthread_mutex_lock(&workerPool.lock);
+    Job *job = workerPool.current[worker];
+    while( job != NULL && job->kill == KILL_SENDING )
+        pthread_cond_wait(&watchdog.killed, &workerPool.lock);
+    workerPool.current[worker] = NULL;
+    if( job != NULL && job->cancelled == CANCEL_DEADLINE )
+        watchdog.timeouts++;
+    else if( job != NULL && job->cancelled == CANCEL_CLIENT )
+        watchdog.cancels++;
+    pthread_mutex_unlock(&workerPool.lock);
+}
+
+/* A cancel frame: the client's query of that id is marked, a queued one is answered
+ * without running when a worker takes it, a running one is killed by the watchdog.
+ * Rows waiting in an INSERT batch and queries already done aren't affected. */
+void CancelQuery(Client *client, uint32_t id)
+{
+    int i, t;
+    Job *job;
+
+    pthread_mutex_lock(&workerPool.lock);
+    for( i = 0; i < workerPool.noWorkers; i++ )
+    {
+        job = workerPool.current[i];
+        if( job != NULL && job->client == client && job->id == id && !job->cancelled )
+        {
+            job->cancelled = CANCEL_CLIENT;
+            pthread_cond_signal(&watchdog.wakeup);
+        }
+        for( job = workerPool.pinned[i].head; job != NULL; job = job->next )
+            if( job->client == client && job->id == id && !job->cancelled )
+                job->cancelled = CANCEL_CLIENT;
+    }
+    for( t = 0; t < workerPool.noTargets; t++ )
+        for( job = workerPool.targets[t].queue.head; job != NULL; job = job->next )
+            if( job->client == client && job->id == id && !job->cancelled )
+                job->cancelled = CANCEL_CLIENT;
+    pthread_mutex_unlock(&workerPool.lock);
+}
+
+/* When a query must be done by, counted from its arrival: the MAX_EXECUTION_TIME
+ * hint of the query if it has one, else the client's session deadline. 0 for none. */
+long long QueryDeadline(Client *client, const char *query)
+{
+    long ms = HintTimeout(query);
+    if( ms < 0 )
+        ms = client->timeoutMs;
+    return ms > 0 ? MonotonicMicros() + ms * 1000LL : 0;
+}
+
+/* The N of MAX_EXECUTION_TIME(N) in the optimizer hint comment after the first
+ * keyword, the way MySQL spells a per-query timeout; -1 when there is none */
+long HintTimeout(const char *query)
+{
+    static const char name[] = "MAX_EXECUTION_TIME(";
+    const char *p = query, *end;
+
+    // The hint follows the statement's first keyword, e.g. SELECT /*+ ... */
+    while( isspace((unsigned char)*p) )
+        p++;
+    while( isalpha((unsigned char)*p) )
+        p++;
+    while( isspace((unsigned char)*p) )
+        p++;
+    if( strncmp(p, "/*+", 3) != 0 || (end = strstr(p, "*/")) == NULL )
+        return -1;
+    for( p += 3; p + sizeof(name) - 1 < end; p++ )
+        if( strncasecmp(p, name, sizeof(name) - 1) == 0 )
+            return strtol(p + sizeof(name) - 1, NULL, 10);
+    return -1;
+}
+
+/* "\timeout [ms]": sets the deadline of the session's queries, 0 for none, or
+ * shows it along with the watchdog's counters */
+void SetSessionTimeout(Client *client, uint32_t id, const char *args)
+{
+    char text[BUFSIZE];
+    char *end;
+
+    long ms = strtol(args, &end, 10);
+    if( end != args && ms >= 0 )
+        client->timeoutMs = ms;
+    else if( *args != '\0' && *args != ' ' )
+    {
+        SendReply(client, id, FRAME_ERROR, "\nError: usage \\timeout [ms]\n");
+        return;
+    }
+
+    pthread_mutex_lock(&workerPool.lock);
+    snprintf(text, sizeof(text), "\nQuery deadline: %ld ms%s\nTimed out: %lu\tCancelled: %lu\tKilled on the backend: %lu\n",
+             client->timeoutMs, client->timeoutMs == 0 ? " (none)" : "",
+             watchdog.timeouts, watchdog.cancels, watchdog.kills);
+    pthread_mutex_unlock(&workerPool.lock);
+    SendReply(client, id, FRAME_MESSAGE, text);
+}
+
+/* Reads the shard map: "shard <server>" adds a shard after shard 0, host[:port] for
+ * mysql or the database file for sqlite; "table <name> <key column>" spreads a table
+ * over all the shards by its key. '#' starts a comment. */
+void LoadShardMap(const char *path)
+{
+    char line[BUFSIZE], word[3][NAMEBUFSIZE];
+    int lineNo = 0, i;
+    FILE *file = fopen(path, "r");
+
+    if( file == NULL )
+    {
+        perror("fopen() failed");
+        exit(-1);
+    }
+    shardMap.noShards = 1;
+    while( fgets(line, sizeof(line), file) != NULL )
+    {
+        lineNo++;
+        char *comment = strchr(line, '#');
+        if( comment != NULL )
+            *comment = '\0';
+        int noWords = sscanf(line, "%127s %127s %127s", word[0], word[1], word[2]);
+        if( noWords <= 0 )
+            continue;
+        if( strcmp(word[0], "shard") == 0 && noWords == 2 && shardMap.noShards < MAX_SHARDS )
+        {
+            shardMap.shards[shardMap.noShards - 1] = strdup(word[1]);
+            shardMap.noShards++;
+        }
+        else if( strcmp(word[0], "table") == 0 && noWords == 3 && shardMap.noTables < MAX_SHARDED_TABLES )
+        {
+            ShardedTable *table = &shardMap.tables[shardMap.noTables++];
+            for( i = 0; word[1][i] != '\0'; i++ )
+                table->name[i] = tolower((unsigned char)word[1][i]);
+            table->name[i] = '\0';
+            strcpy(table->column, word[2]);
+        }
+        else
+        {
+            fprintf(stderr, "%s:%d: expected \"shard <server>\" or \"table <name> <key column>\", at most %d shards and %d tables\n",
+                    path, lineNo, MAX_SHARDS, MAX_SHARDED_TABLES);
+            exit(-1);
+        }
+    }
+    fclose(file);
+}
+
+/* The map's entry for a table, NULL when it lives on shard 0 only */
+const ShardedTable* FindShardedTable(const char *name)
+{
+    int i;
+    for( i = 0; i < shardMap.noTables; i++ )
+        if( strcasecmp(shardMap.tables[i].name, name) == 0 )
+            return &shardMap.tables[i];
+    return NULL;
+}
+
+/* Queues a query on the shards it concerns: the one its key selects, or several at once.
+ * A transaction, or a session locked with LOCK TABLES or autocommit=0, belongs to no shard
+ * until its first statement that names a table; the statements that opened it are held
+ * back until then and sent ahead of it. From then on it stays on that shard. */
+void DispatchSharded(Client *client, Job *job, PinEffect effect)
+{
+    char *texts[MAX_SHARDS] = { NULL };
+    char error[BUFSIZE] = "";
+    int worker = client->pinned;
+
+    if( worker < 0 && (effect == PIN_TRANSACTION || effect == PIN_SESSION) )
+    {
+        // Held without its client, the client was already answered
+        Job **tail = &client->held;
+        while( *tail != NULL )
+            tail = &(*tail)->next;
+        *tail = job;
+        job->deadline = 0;
+        ReleaseClient(job->client);
+        job->client = NULL;
+        client->sessionPin |= effect == PIN_SESSION;
+        SendReply(client, job->id, FRAME_MESSAGE, "\nResult Successful.\n");
+        return;
+    }
+    if( worker < 0 && client->held != NULL && (effect == UNPIN_TRANSACTION || effect == UNPIN_SESSION) )
+    {
+        // Ended before it reached a shard, there is nothing to commit or unlock
+        if( effect == UNPIN_SESSION || !client->sessionPin )
+        {
+            while( client->held != NULL )
+            {
+                Job *held = client->held;
+                client->held = held->next;
+                free(held->query);
+                free(held);
+            }
+            client->sessionPin = FALSE;
+        }
+        SendReply(client, job->id, FRAME_MESSAGE, "\nResult Successful.\n");
+        RejectJob(job, NULL);
+        return;
+    }
+
+    ShardSet shards = PlanShards(job->query, texts, error, sizeof(error));
+    int noShards = 0, shard = 0, s;
+    for( s = 0; s < shardMap.noShards; s++ )
+        if( shards & ((ShardSet)1 << s) )
+        {
+            noShards++;
+            shard = s;
+        }
+    if( error[0] != '\0' )
+    {
+        RejectJob(job, error);
+        return;
+    }
+
+    if( worker >= 0 )
+    {
+        // Inside a transaction: statements without tables follow it wherever it is
+        int pinnedShard = worker / workerPool.workersPerTarget;
+        if( shards != 0 && shards != ((ShardSet)1 << pinnedShard) )
+        {
+            for( s = 0; s < shardMap.noShards; s++ )
+                free(texts[s]);
+            snprintf(error, sizeof(error), "this transaction runs on shard %d, the statement needs %s", pinnedShard,
+                     noShards > 1 ? "several shards" : "another shard");
+            RejectJob(job, error);
+            return;
+        }
+        if( effect == PIN_SESSION )
+            client->sessionPin = TRUE;
+        else if( effect == UNPIN_SESSION || (effect == UNPIN_TRANSACTION && !client->sessionPin) )
+        {
+            client->pinned = -1;
+            client->sessionPin = FALSE;
+        }
+        shardMap.singleShard++;
+        EnqueueJob(job, worker);
+        return;
+    }
+
+    if( client->held != NULL && noShards == 1 )
+    {
+        // The held transaction starts on this shard
+        worker = client->pinned = shard * workerPool.workersPerTarget + workerPool.nextPin++ % workerPool.workersPerTarget;
+        while( client->held != NULL )
+        {
+            Job *held = client->held;
+            client->held = held->next;
+            held->next = NULL;
+            EnqueueJob(held, worker);
+        }
+        shardMap.singleShard++;
+        EnqueueJob(job, worker);
+        return;
+    }
+    if( client->held != NULL && noShards > 1 )
+    {
+        for( s = 0; s < shardMap.noShards; s++ )
+            free(texts[s]);
+        RejectJob(job, "a transaction runs on a single shard, the statement needs several");
+        return;
+    }
+
+    if( noShards > 1 )
+    {
+        shardMap.scattered++;
+        ScatterJob(job, shards, texts);
+        return;
+    }
+    shardMap.singleShard++;
+    // Insert batching covers the tables of shard 0
+    if( shard == 0 && insertBatcher.windowMs > 0 && BatchInsert(job) )
+        return;
+    EnqueueTarget(job, shard);
+}
+
+/* Answers a query that won't run with an error, or nothing when error is NULL, and drops it */
+void RejectJob(Job *job, const char *error)
+{
+    char text[BUFSIZE];
+
+    if( error != NULL )
+    {
+        snprintf(text, sizeof(text), "\nError: %s\n", error);
+        SendReply(job->client, job->id, FRAME_ERROR, text);
+    }
+    ReleaseClient(job->client);
+    free(job->query);
+    free(job);
+}
+
+/* The shards a statement runs on, 0 when it names no table and any shard can answer it.
+ * Statements on tables the map doesn't list go to shard 0. A multi-row INSERT whose rows
+ * belong to several shards is split, texts[s] receiving the statement for shard s.
+ * Sets error when the statement can't be routed. */
+ShardSet PlanShards(const char *query, char **texts, char *error, size_t errorLen)
+{
+    char tables[MAX_DEP_TABLES][NAMEBUFSIZE];
+    const ShardedTable *sharded[MAX_DEP_TABLES];
+    int noTables = ExtractTables(query, tables, NULL, MAX_DEP_TABLES), noSharded = 0, i;
+    Token first;
+
+    if( noTables < 0 )
+    {
+        snprintf(error, errorLen, "the statement names too many tables to be routed to its shards");
+        return 0;
+    }
+    for( i = 0; i < noTables; i++ )
+        if( (sharded[noSharded] = FindShardedTable(tables[i])) != NULL )
+            noSharded++;
+    if( noTables == 0 )
+        return 0;
+    if( noSharded == 0 )
+        return 1;
+    // The other shards don't have the tables of shard 0, whatever the key selects
+    for( i = 0; i < noTables; i++ )
+        if( FindShardedTable(tables[i]) == NULL && !IsCteName(query, tables[i]) )
+        {
+            snprintf(error, errorLen, "the sharded table %s can't be used with %s, which lives on shard 0 only",
+                     sharded[0]->name, tables[i]);
+            return 0;
+        }
+
+    NextToken(query, &first);
+    QueryKind kind = ClassifyQuery(query);
+    if( kind == QUERY_DDL )
+        return ((ShardSet)1 << shardMap.noShards) - 1; // every shard holds the table
+    if( TokenIs(&first, "INSERT") || TokenIs(&first, "REPLACE") )
+        return InsertShards(query, texts, error, errorLen);
+    if( kind == QUERY_READ || TokenIs(&first, "WITH") || TokenIs(&first, "UPDATE") || TokenIs(&first, "DELETE") )
+    {
+        ShardSet shards = WhereShards(query, sharded, noSharded, NULL, error, errorLen);
+        if( shards == 0 )
+            return 0;
+        // A join or subquery sees the rows of one shard only: every sharded table it names,
+        // a table named twice included, must be pinned to the same shard by its qualified key
+        char refs[MAX_DEP_TABLES][NAMEBUFSIZE], aliases[MAX_DEP_TABLES][NAMEBUFSIZE];
+        int noRefs = ExtractTables(query, refs, aliases, MAX_DEP_TABLES), firstRef = -1, secondRef = -1;
+        ShardSet pinned = 0;
+        if( noRefs < 0 )
+        {
+            snprintf(error, errorLen, "the statement names too many tables to be routed to its shards");
+            return 0;
+        }
+        for( i = 0; i < noRefs; i++ )
+            if( FindShardedTable(refs[i]) != NULL )
+            {
+                if( firstRef < 0 )
+                    firstRef = i;
+                else if( secondRef < 0 )
+                    secondRef = i;
+            }
+        for( i = 0; i < noRefs && secondRef >= 0; i++ )
+        {
+            const ShardedTable *table = FindShardedTable(refs[i]);
+            if( table == NULL )
+                continue;
+            ShardSet own = WhereShards(query, &table, 1, aliases[i], error, errorLen);
+            if( own == 0 )
+                return 0;
+            if( (own & (own - 1)) != 0 || (pinned != 0 && own != pinned) )
+            {
+                snprintf(error, errorLen, "the sharded tables %s and %s can only be used together when the WHERE clause "
+                         "gives the key of each, qualified by its name or alias, all on the same shard", refs[firstRef], refs[i == firstRef ? secondRef : i]);
+                return 0;
+            }
+            pinned = own;
+        }
+        if( pinned != 0 )
+            return pinned;
+        // The gather only concatenates the shards' results
+        const char *clause = (shards & (shards - 1)) != 0 ? MergeClause(query) : NULL;
+        if( clause != NULL )
+        {
+            snprintf(error, errorLen, "%s can't run over several shards, their results aren't merged; "
+                     "give the key of %s in the WHERE clause", clause, sharded[0]->name);
+            return 0;
+        }
+        return shards;
+    }
+    if( kind == QUERY_OTHER )
+        return 1; // SHOW, DESCRIBE, EXPLAIN: the shards share one schema
+    snprintf(error, errorLen, "%.*s isn't supported on the sharded table %s", (int)first.len, first.start, sharded[0]->name);
+    return 0;
+}
+
+/* Routes INSERT/REPLACE INTO table (columns) VALUES (...), ... by the key of each row. When
+ * the rows go to several shards, each gets the statement with its own rows, whatever
+ * follows the rows (ON DUPLICATE KEY UPDATE) repeated. */
+ShardSet InsertShards(const char *query, char **texts, char *error, size_t errorLen)
+{
+    static const char *modifiers[] = { "LOW_PRIORITY", "DELAYED", "HIGH_PRIORITY", "IGNORE", "INTO", NULL };
+    size_t lens[MAX_SHARDS] = { 0 }, caps[MAX_SHARDS] = { 0 };
+    const ShardedTable *table = NULL;
+    const char *p, *values = NULL, *suffix = NULL;
+    ShardSet shards = 0;
+    int keyColumn = -1, noColumns = 0, row, pass, i, s;
+    Token tok;
+
+    // INSERT [modifiers] [INTO] table (columns)
+    p = NextToken(NextToken(query, &tok), &tok);
+    for( i = 0; modifiers[i] != NULL; i++ )
+        if( TokenIs(&tok, modifiers[i]) )
+        {
+            p = NextToken(p, &tok);
+            i = -1;
+        }
+    if( tok.type == TOKEN_WORD )
+    {
+        char name[NAMEBUFSIZE];
+        const char *start = tok.start, *c;
+        size_t len = 0;
+        for( c = tok.start; c < tok.start + tok.len; c++ )
+            if( *c == '.' )
+                start = c + 1;
+        for( c = start; c < tok.start + tok.len && len < sizeof(name) - 1; c++ )
+            if( *c != '`' )
+                name[len++] = *c;
+        name[len] = '\0';
+        table = FindShardedTable(name);
+    }
+    if( table == NULL )
+    {
+        snprintf(error, errorLen, "an INSERT into a table of shard 0 can't read a sharded table");
+        return 0;
+    }
+    p = NextToken(p, &tok);
+    if( tok.type == TOKEN_PUNCT && *tok.start == '(' )
+        for( p = NextToken(p, &tok); tok.type != TOKEN_END && !(tok.type == TOKEN_PUNCT && *tok.start == ')'); p = NextToken(p, &tok) )
+        {
+            if( tok.type == TOKEN_PUNCT && *tok.start == ',' )
+                noColumns++;
+            else if( IsShardKey(&tok, &table, 1, NULL) )
+                keyColumn = noColumns;
+        }
+    if( keyColumn < 0 )
+    {
+        snprintf(error, errorLen, "an INSERT into the sharded table %s must list its key column %s", table->name, table->column);
+        return 0;
+    }
+    p = NextToken(p, &tok);
+    if( !TokenIs(&tok, "VALUES") && !TokenIs(&tok, "VALUE") )
+    {
+        snprintf(error, errorLen, "an INSERT into the sharded table %s must give its rows as VALUES", table->name);
+        return 0;
+    }
+    values = p;
+
+    // The first pass finds the shards, the second splits the rows when there are several
+    for( pass = 0; pass < 2; pass++ )
+    {
+        for( p = values, row = 1; ; row++ )
+        {
+            const char *rowStart;
+            int column = 0, depth = 1, shard = -1;
+
+            p = NextToken(p, &tok);
+            if( tok.type != TOKEN_PUNCT || *tok.start != '(' )
+            {
+                snprintf(error, errorLen, "malformed VALUES of the INSERT into %s", table->name);
+                return 0;
+            }
+            rowStart = tok.start;
+            bool columnStart = TRUE;
+            while( depth > 0 )
+            {
+                p = NextToken(p, &tok);
+                if( tok.type == TOKEN_END )
+                    break;
+                if( depth == 1 && column == keyColumn && columnStart )
+                {
+                    // The key must be the whole value, not the start of an expression
+                    p = KeyLiteral(tok.start, &tok, &shard);
+                    if( tok.type != TOKEN_PUNCT || (*tok.start != ',' && *tok.start != ')') )
+                        shard = -1;
+                }
+                columnStart = FALSE;
+                if( tok.type == TOKEN_PUNCT && *tok.start == '(' )
+                    depth++;
+                else if( tok.type == TOKEN_PUNCT && *tok.start == ')' )
+                    depth--;
+                else if( tok.type == TOKEN_PUNCT && *tok.start == ',' && depth == 1 )
+                {
+                    column++;
+                    columnStart = TRUE;
+                }
+            }
+            if( shard < 0 )
+            {
+                snprintf(error, errorLen, "the key %s of row %d of the INSERT into %s must be a number or a string",
+                         table->column, row, table->name);
+                return 0;
+            }
+            if( pass == 0 )
+                shards |= (ShardSet)1 << shard;
+            else
+            {
+                if( lens[shard] > (size_t)(values - query) + 1 ) // past "... VALUES "
+                    AppendText(&texts[shard], &lens[shard], &caps[shard], ",", 1);
+                AppendText(&texts[shard], &lens[shard], &caps[shard], rowStart, p - rowStart);
+            }
+
+            const char *next = NextToken(p, &tok);
+            if( tok.type != TOKEN_PUNCT || *tok.start != ',' )
+            {
+                suffix = p;
+                break;
+            }
+            p = next;
+        }
+        // A single shard takes the statement as it is
+        if( (shards & (shards - 1)) == 0 )
+            return shards;
+        if( pass == 0 )
+            for( s = 0; s < shardMap.noShards; s++ )
+                if( shards & ((ShardSet)1 << s) )
+                {
+                    AppendText(&texts[s], &lens[s], &caps[s], query, values - query);
+                    AppendText(&texts[s], &lens[s], &caps[s], " ", 1);
+                }
+    }
+    for( s = 0; s < shardMap.noShards; s++ )
+        if( texts[s] != NULL )
+            AppendText(&texts[s], &lens[s], &caps[s], suffix, strlen(suffix));
+    return shards;
+}
+
+/* Looks for the shard key in the WHERE clause of the outermost statement: key = literal
+ * or key IN (literals), ANDed with the rest of the clause. Without one, or with an OR at
+ * the top of the clause, the statement goes to every shard. An UPDATE can't change the
+ * key, the row would belong to another shard. With alias, only keys qualified by it
+ * count. */
+ShardSet WhereShards(const char *query, const ShardedTable **sharded, int noSharded, const char *alias, char *error, size_t errorLen)
+{
+    // Keywords ending the WHERE clause
+    static const char *clauseEnds[] = { "GROUP", "ORDER", "LIMIT", "HAVING", "WINDOW", "FOR", "LOCK", "INTO", "UNION", NULL };
+    ShardSet shards = 0, all = ((ShardSet)1 << shardMap.noShards) - 1;
+    Token tok, prev = { TOKEN_END, query, 0 }, op;
+    bool inWhere = FALSE, inSet = FALSE, anyOr = FALSE;
+    int depth = 0, shard, i;
+    const char *p, *q;
+
+    for( p = NextToken(query, &tok); tok.type != TOKEN_END; prev = tok, p = NextToken(p, &tok) )
+    {
+        if( tok.type == TOKEN_PUNCT && *tok.start == '(' )
+            depth++;
+        else if( tok.type == TOKEN_PUNCT && *tok.start == ')' )
+            depth--;
+        if( depth != 0 || tok.type == TOKEN_PUNCT )
+            continue;
+        if( TokenIs(&tok, "WHERE") )
+        {
+            inWhere = TRUE;
+            inSet = FALSE;
+            continue;
+        }
+        if( TokenIs(&tok, "SET") )
+            inSet = TRUE;
+        for( i = 0; clauseEnds[i] != NULL; i++ )
+            if( TokenIs(&tok, clauseEnds[i]) )
+                inWhere = FALSE;
+        if( TokenIs(&tok, "UNION") )
+            return all;
+        if( inWhere && (TokenIs(&tok, "OR") || TokenIs(&tok, "XOR")) )
+            anyOr = TRUE;
+        if( tok.type != TOKEN_WORD || !IsShardKey(&tok, sharded, noSharded, alias) )
+            continue;
+
+        q = NextToken(p, &op);
+        if( inSet && op.type == TOKEN_PUNCT && *op.start == '=' )
+        {
+            snprintf(error, errorLen, "the shard key %.*s can't be updated", (int)tok.len, tok.start);
+            return 0;
+        }
+        // Only a predicate of its own: WHERE key = ... or AND key = ...
+        if( !inWhere || !(TokenIs(&prev, "WHERE") || TokenIs(&prev, "AND")) )
+            continue;
+        if( op.type == TOKEN_PUNCT && *op.start == '=' )
+        {
+            q = KeyLiteral(q, &op, &shard);
+            bool ends = op.type == TOKEN_END || (op.type == TOKEN_PUNCT && *op.start == ';')
+                        || TokenIs(&op, "AND") || TokenIs(&op, "OR");
+            for( i = 0; clauseEnds[i] != NULL; i++ )
+                ends |= TokenIs(&op, clauseEnds[i]);
+            if( shard >= 0 && ends )
+                shards |= (ShardSet)1 << shard;
+        }
+        else if( TokenIs(&op, "IN") )
+        {
+            ShardSet in = 0;
+            q = NextToken(q, &op);
+            shard = -1;
+            if( op.type == TOKEN_PUNCT && *op.start == '(' )
+                do
+                {
+                    q = KeyLiteral(q, &op, &shard);
+                    if( shard < 0 )
+                        break;
+                    in |= (ShardSet)1 << shard;
+                } while( op.type == TOKEN_PUNCT && *op.start == ',' );
+            if( shard >= 0 && op.type == TOKEN_PUNCT && *op.start == ')' )
+                shards |= in;
+        }
+    }
+    return anyOr || shards == 0 ? all : shards;
+}
+
+/* The first part of a statement that needs the rows of every shard at once: sorting, limits,
+ * grouping, duplicate removal, aggregate and window functions. NULL when there is none. */
+const char* MergeClause(const char *query)
+{
+    static const char *clauses[] = { "ORDER", "ORDER BY", "LIMIT", "LIMIT", "GROUP", "GROUP BY", "HAVING", "HAVING",
+                                     "DISTINCT", "DISTINCT", "DISTINCTROW", "DISTINCT", "OVER", "a window function", NULL };
+    static const char *aggregates[] = { "COUNT", "SUM", "MIN", "MAX", "AVG", "GROUP_CONCAT", "TOTAL", "STD",
+                                        "STDDEV", "STDDEV_POP", "STDDEV_SAMP", "VARIANCE", "VAR_POP", "VAR_SAMP",
+                                        "BIT_AND", "BIT_OR", "BIT_XOR", "JSON_ARRAYAGG", "JSON_OBJECTAGG", NULL };
+    Token tok, next;
+    const char *p;
+    int i;
+
+    for( p = NextToken(query, &tok); tok.type != TOKEN_END; tok = next )
+    {
+        p = NextToken(p, &next);
+        if( tok.type != TOKEN_WORD )
+            continue;
+        for( i = 0; clauses[i] != NULL; i += 2 )
+            if( TokenIs(&tok, clauses[i]) )
+                return clauses[i + 1];
+        if( TokenIs(&tok, "UNION") && !TokenIs(&next, "ALL") )
+            return "UNION";
+        for( i = 0; aggregates[i] != NULL; i++ )
+            if( TokenIs(&tok, aggregates[i]) && next.type == TOKEN_PUNCT && *next.start == '(' )
+                return "an aggregate function";
+    }
+    return NULL;
+}
+
+/* Whether name, lower-cased as ExtractTables leaves it, is defined by the statement's WITH clause */
+bool IsCteName(const char *query, const char *name)
+{
+    Token tok, prev = { TOKEN_END, query, 0 };
+    bool inWith = FALSE;
+    int depth = 0;
+    const char *p;
+
+    for( p = NextToken(query, &tok); tok.type != TOKEN_END; p = NextToken(p, &tok) )
+    {
+        if( tok.type == TOKEN_PUNCT && *tok.start == '(' )
+            depth++;
+        else if( tok.type == TOKEN_PUNCT && *tok.start == ')' )
+            depth--;
+        if( depth != 0 )
+            continue;
+        if( TokenIs(&tok, "WITH") )
+            inWith = TRUE;
+        else if( inWith && tok.type == TOKEN_WORD && !TokenIs(&tok, "RECURSIVE") && (TokenIs(&prev, "WITH")
+                 || TokenIs(&prev, "RECURSIVE") || (prev.type == TOKEN_PUNCT && *prev.start == ',')) )
+        {
+            // WITH [RECURSIVE] name [(columns)] AS (...), name ...
+            char cte[NAMEBUFSIZE];
+            size_t len = 0, i;
+            for( i = 0; i < tok.len && len < NAMEBUFSIZE - 1; i++ )
+                if( tok.start[i] != '`' )
+                    cte[len++] = tolower((unsigned char)tok.start[i]);
+            cte[len] = '\0';
+            if( strcmp(cte, name) == 0 )
+                return TRUE;
+        }
+        else if( TokenIs(&tok, "SELECT") || TokenIs(&tok, "UPDATE") || TokenIs(&tok, "DELETE") )
+            inWith = FALSE;
+        prev = tok;
+    }
+    return FALSE;
+}
+
+/* Whether a column name, possibly qualified, is the key of one of the tables. With alias,
+ * only the name qualified by it counts. */
+bool IsShardKey(const Token *tok, const ShardedTable **sharded, int noSharded, const char *alias)
+{
+    char name[NAMEBUFSIZE];
+    const char *start = tok->start, *qualifier = tok->start, *c;
+    size_t len = 0;
+    int i;
+
+    if( tok->type != TOKEN_WORD )
+        return FALSE;
+    for( c = tok->start; c < tok->start + tok->len; c++ )
+        if( *c == '.' )
+        {
+            qualifier = start;
+            start = c + 1;
+        }
+    if( alias != NULL )
+    {
+        if( start == tok->start )
+            return FALSE;
+        for( c = qualifier; c < start - 1 && len < sizeof(name) - 1; c++ )
+            if( *c != '`' )
+                name[len++] = *c;
+        name[len] = '\0';
+        if( strcasecmp(name, alias) != 0 )
+            return FALSE;
+        len = 0;
+    }
+    for( c = start; c < tok->start + tok->len && len < sizeof(name) - 1; c++ )
+        if( *c != '`' )
+            name[len++] = *c;
+    name[len] = '\0';
+    for( i = 0; i < noSharded; i++ )
+        if( strcasecmp(sharded[i]->column, name) == 0 )
+            return TRUE;
+    return FALSE;
+}
+
+/* Reads a key value, a number (maybe negative) or a string, from p. Sets shard to its
+ * shard, -1 if there is no literal, and tok to the token after it. */
+const char* KeyLiteral(const char *p, Token *tok, int *shard)
+{
+    Token literal;
+    bool negative = FALSE;
+
+    p = NextToken(p, &literal);
+    if( literal.type == TOKEN_PUNCT && *literal.start == '-' )
+    {
+        negative = TRUE;
+        p = NextToken(p, &literal);
+    }
+    *shard = -1;
+    if( literal.type == TOKEN_NUMBER || (literal.type == TOKEN_STRING && !negative) )
+    {
+        *shard = KeyShard(&literal, negative);
+        return NextToken(p, tok);
+    }
+    *tok = literal;
+    return p;
+}
+
+/* The shard of a key: the FNV-1a hash of its value as text, modulo the number of shards.
+ * Integers are hashed in their plain decimal form, so that 42, 042 and '42' agree. */
+int KeyShard(const Token *literal, bool negative)
+{
+    char *value = (char*)malloc(literal->len + 32);
+    const char *c, *end = literal->start + literal->len;
+    uint32_t hash = 2166136261u;
+    long len = 0, i;
+
+    if( value == NULL )
+    {
+        perror("malloc() failed");
+        exit(-1);
+    }
+    if( literal->type == TOKEN_NUMBER )
+    {
+        char *numberEnd;
+        long long number = strtoll(literal->start, &numberEnd, 10);
+        if( numberEnd == end )
+            len = sprintf(value, "%lld", negative ? -number : number);
+        else
+            len = sprintf(value, "%s%.*s", negative ? "-" : "", (int)literal->len, literal->start);
+    }
+    else if( backend->backslashEscapes )
+        len = UnescapeString(literal->start, literal->len, value);
+    else
+    {
+        // Standard SQL strings: a doubled quote is the only escape
+        for( c = literal->start + 1; c < end - 1; c++ )
+        {
+            value[len++] = *c;
+            if( *c == *literal->start && c[1] == *c )
+                c++;
+        }
+    }
+    for( i = 0; i < len; i++ )
+    {
+        hash ^= (unsigned char)value[i];
+        hash *= 16777619u;
+    }
+    free(value);
+    return hash % shardMap.noShards;
+}
+
+/* Checks the routing of sample statements on a map of three shards with the sharded tables
+ * orders and items, keyed by customer_id. %d in a statement is replaced by a key of one shard,
+ * the second %d by another key of that shard, or of another shard where sameShard is FALSE. */
+bool TestRouting()
+{
+    enum { ONE, ALL, SHARD0, REJECTED };
+    static const char *expectNames[] = { "one shard", "every shard", "shard 0", "rejected" };
+    static const struct {
+        const char *query;
+        bool sameShard;
+        int expect;
+    } cases[] = {
+        { "SELECT * FROM orders WHERE customer_id = %d", TRUE, ONE },
+        { "SELECT * FROM orders WHERE customer_id IN (%d, %d)", TRUE, ONE },
+        { "SELECT * FROM orders WHERE customer_id = %d OR customer_id = %d", TRUE, ALL },
+        { "SELECT * FROM orders", TRUE, ALL },
+        { "SELECT COUNT(*) FROM orders", TRUE, REJECTED },
+        { "SELECT * FROM audit", TRUE, SHARD0 },
+        { "SELECT * FROM orders o JOIN audit a ON a.id = o.id WHERE o.customer_id = %d", TRUE, REJECTED },
+        { "UPDATE orders SET customer_id = 2 WHERE customer_id = %d", TRUE, REJECTED },
+        { "SELECT * FROM orders o JOIN items i ON i.order_id = o.id", TRUE, REJECTED },
+        { "SELECT * FROM orders o JOIN items i ON i.order_id = o.id WHERE o.customer_id = %d", TRUE, REJECTED },
+        { "SELECT * FROM orders o JOIN items i ON i.order_id = o.id WHERE o.customer_id = %d AND i.customer_id = %d", TRUE, ONE },
+        { "SELECT * FROM orders o JOIN items i ON i.order_id = o.id WHERE o.customer_id = %d AND i.customer_id = %d", FALSE, REJECTED },
+        { "SELECT * FROM orders AS o, items AS i WHERE o.customer_id = %d AND i.customer_id IN (%d)", TRUE, ONE },
+        { "SELECT * FROM orders, items WHERE orders.customer_id = %d AND items.customer_id = %d", FALSE, REJECTED },
+        { "SELECT * FROM orders a JOIN orders b ON b.parent = a.id WHERE a.customer_id = %d", TRUE, REJECTED },
+        { "SELECT * FROM orders a JOIN orders b ON b.parent = a.id WHERE a.customer_id = %d AND b.customer_id = %d", TRUE, ONE },
+        { "SELECT * FROM orders WHERE customer_id = %d AND id IN (SELECT order_id FROM items)", TRUE, REJECTED },
+        { "DELETE o FROM orders o JOIN items i ON i.order_id = o.id WHERE o.customer_id = %d AND i.customer_id = %d", TRUE, ONE },
+    };
+    char query[BUFSIZE], error[BUFSIZE];
+    char *texts[MAX_SHARDS] = { NULL };
+    Token literal;
+    bool passed = TRUE;
+    int keyShard, sameKey, otherKey, i;
+    size_t c;
+
+    shardMap.noShards = 3;
+    shardMap.noTables = 2;
+    strcpy(shardMap.tables[0].name, "orders");
+    strcpy(shardMap.tables[0].column, "customer_id");
+    strcpy(shardMap.tables[1].name, "items");
+    strcpy(shardMap.tables[1].column, "customer_id");
+    NextToken("1", &literal);
+    keyShard = KeyShard(&literal, FALSE);
+    for( sameKey = otherKey = 0, i = 2; sameKey == 0 || otherKey == 0; i++ )
+    {
+        sprintf(query, "%d", i);
+        NextToken(query, &literal);
+        if( KeyShard(&literal, FALSE) == keyShard )
+            sameKey = sameKey ? sameKey : i;
+        else
+            otherKey = otherKey ? otherKey : i;
+    }
+
+    for( c = 0; c < sizeof(cases) / sizeof(cases[0]); c++ )
+    {
+        snprintf(query, sizeof(query), cases[c].query, 1, cases[c].sameShard ? sameKey : otherKey);
+        error[0] = '\0';
+        ShardSet shards = PlanShards(query, texts, error, sizeof(error));
+        int got = error[0] != '\0' ? REJECTED : shards == 1 && cases[c].expect == SHARD0 ? SHARD0
+                  : shards == ((ShardSet)1 << keyShard) ? ONE : shards == 7 ? ALL : -1;
+        if( got != cases[c].expect )
+        {
+            printf("%-8s FAILED: %s went to %s (shards 0x%x%s%s) instead of %s\n", "routing", query,
+                   got < 0 ? "other shards" : expectNames[got], shards, error[0] ? ", " : "", error,
+                   expectNames[cases[c].expect]);
+            passed = FALSE;
+        }
+    }
+    if( passed )
+        printf("%-8s passed %zu statements\n", "routing", sizeof(cases) / sizeof(cases[0]));
+    return passed;
+}
+
+/* Runs a statement on several shards at once, with texts[s] instead of the query on shard
+ * s where it is set. The parts stream into a gather, which takes over the job's reference
+ * on its client; cancel frames still find them by client and id. */
+void ScatterJob(Job *job, ShardSet shards, char **texts)
+{
+    Gather *gather = (Gather*)calloc(1, sizeof(Gather));
+    int part = 0, s;
+
+    if( gather == NULL || (gather->parts = (GatherPart*)calloc(shardMap.noShards, sizeof(GatherPart))) == NULL )
+    {
+        perror("calloc() failed");
+        exit(-1);
+    }
+    pthread_mutex_init(&gather->lock, NULL);
+    pthread_cond_init(&gather->turn, NULL);
+    StreamInit(&gather->out, job->client, job->id);
+    gather->query = job->query;
+    gather->receivedAt = job->receivedAt;
+    gather->owner = gather->messagePart = -1;
+    for( s = 0; s < shardMap.noShards; s++ )
+        if( shards & ((ShardSet)1 << s) )
+            gather->parts[gather->noParts++].shard = s;
+
+    for( s = 0; s < shardMap.noShards; s++ )
+        if( shards & ((ShardSet)1 << s) )
+        {
+            const char *text = texts[s] ? texts[s] : job->query;
+            Job *partJob = NewJob(NULL, job->id, text, strlen(text));
+            partJob->client = job->client;
+            partJob->receivedAt = job->receivedAt;
+            partJob->deadline = job->deadline;
+            partJob->gather = gather;
+            partJob->part = part++;
+            free(texts[s]);
+            EnqueueTarget(partJob, s);
+        }
+    free(job);
+}
+
+/* Takes a frame from a part: rows go out while the part has the turn and are held back
+ * otherwise, the column header is kept to be checked, messages and errors for the end */
+void GatherFrame(ResultStream *stream)
+{
+    Gather *gather = stream->gather;
+    GatherPart *part = &gather->parts[stream->part];
+
+    pthread_mutex_lock(&gather->lock);
+    if( stream->type == FRAME_COLUMNS )
+        AppendText(&part->header, &part->headerLen, &part->headerCap, stream->payload, stream->len);
+    else if( stream->type == FRAME_ROWS && !part->skipped )
+    {
+        AppendText(&part->rows, &part->rowsLen, &part->rowsCap, stream->payload, stream->len);
+        GatherTurn(gather, stream->part, part->rowsLen >= GATHER_MAX_HELD, stream->cancelled);
+    }
+    else if( stream->type == FRAME_MESSAGE && (gather->messagePart < 0 || gather->messagePart == stream->part) )
+    {
+        // The parts report the same status, one is enough
+        gather->messagePart = stream->part;
+        AppendText(&gather->message, &gather->messageLen, &gather->messageCap, stream->payload, stream->len);
+    }
+    else if( stream->type == FRAME_ERROR )
+        GatherError(gather, stream->payload, stream->len);
+    pthread_mutex_unlock(&gather->lock);
+}
+
+/* Streams the rows a part holds if it has the turn or nobody has, in which case it takes
+ * the turn until it ends. When wait is set the part waits for its turn. The first part
+ * to stream sends its column header; a part whose header differs has its rows dropped.
+ * Called with the gather's lock held. */
+void GatherTurn(Gather *gather, int index, bool wait, volatile const int *cancelled)
+{
+    GatherPart *part = &gather->parts[index];
+    char text[BUFSIZE];
+
+    while( wait && gather->owner >= 0 && gather->owner != index && !(cancelled && *cancelled) )
+        pthread_cond_wait(&gather->turn, &gather->lock);
+    if( gather->owner >= 0 && gather->owner != index )
+        return;
+    if( cancelled && *cancelled )
+    {
+        part->rowsLen = 0;
+        return;
+    }
+
+    if( !part->checked )
+    {
+        part->checked = TRUE;
+        if( gather->sentHeader == NULL )
+        {
+            gather->sentHeader = part;
+            StreamWrite(&gather->out, FRAME_COLUMNS, part->header, part->headerLen);
+        }
+        else if( part->headerLen != gather->sentHeader->headerLen
+                 || memcmp(part->header, gather->sentHeader->header, part->headerLen) != 0 )
+        {
+            int len = snprintf(text, sizeof(text), "\nError: the columns of shard %d differ from shard %d's, its rows are left out\n",
+                               part->shard, gather->sentHeader->shard);
+            GatherError(gather, text, len);
+            part->skipped = TRUE;
+            part->rowsLen = 0;
+            return;
+        }
+    }
+    gather->owner = index;
+    StreamWrite(&gather->out, FRAME_ROWS, part->rows, part->rowsLen);
+    part->rowsLen = 0;
+}
+
+/* Keeps an error for the end of the merged response, unless a part already reported it */
+void GatherError(Gather *gather, const char *text, size_t len)
+{
+    size_t i;
+    for( i = 0; i + len <= gather->errorsLen; i++ )
+        if( memcmp(gather->errors + i, text, len) == 0 )
+            return;
+    AppendText(&gather->errors, &gather->errorsLen, &gather->errorsCap, text, len);
+}
+
+/* A part has ended: it streams the rows it still holds, waiting for its turn, and gives
+ * the turn up. After the last part the merged response ends with the messages or errors
+ * and the total row count. */
+void GatherEnd(ResultStream *stream, long long start)
+{
+    Gather *gather = stream->gather;
+    GatherPart *part = &gather->parts[stream->part];
+    int i;
+
+    StreamFlush(stream);
+    pthread_mutex_lock(&gather->lock);
+    if( part->rowsLen > 0 )
+        GatherTurn(gather, stream->part, TRUE, stream->cancelled);
+    if( gather->owner == stream->part )
+    {
+        gather->owner = -1;
+        pthread_cond_broadcast(&gather->turn);
+    }
+    if( !part->skipped )
+        gather->rowCount += stream->rowCount;
+    if( gather->startedAt == 0 || start < gather->startedAt )
+        gather->startedAt = start;
+    bool last = ++gather->noDone == gather->noParts;
+    pthread_mutex_unlock(&gather->lock);
+    if( !last )
+        return;
+
+    // No part had rows: the header of the first part that has one
+    for( i = 0; i < gather->noParts && gather->sentHeader == NULL; i++ )
+        if( gather->parts[i].headerLen > 0 )
+        {
+            gather->sentHeader = &gather->parts[i];
+            StreamWrite(&gather->out, FRAME_COLUMNS, gather->parts[i].header, gather->parts[i].headerLen);
+        }
+    if( gather->errorsLen > 0 )
+        StreamWrite(&gather->out, FRAME_ERROR, gather->errors, gather->errorsLen);
+    else if( gather->messageLen > 0 )
+        StreamWrite(&gather->out, FRAME_MESSAGE, gather->message, gather->messageLen);
+    gather->out.rowCount = gather->rowCount;
+    StreamEnd(&gather->out);
+    StatsRecord(gather->query, gather->startedAt - gather->receivedAt, MonotonicMicros() - gather->startedAt, &gather->out);
+
+    if( gather->out.client )
+        ReleaseClient(gather->out.client);
+    for( i = 0; i < gather->noParts; i++ )
+    {
+        free(gather->parts[i].header);
+        free(gather->parts[i].rows);
+    }
+    free(gather->parts);
+    free(gather->message);
+    free(gather->errors);
+    free(gather->query);
+    pthread_mutex_destroy(&gather->lock);
+    pthread_cond_destroy(&gather->turn);
+    free(gather);
+}
+
+/* Adds a single-row INSERT to the pending batch for its table and columns.
+ * Returns FALSE when the statement can't be coalesced. */
+bool BatchInsert(Job *job)
+{
+    size_t prefixEnd, valuesStart, valuesEnd;
+    char prefix[BUFSIZE], key[BUFSIZE];
+    InsertBatch *batch;
+
+    if( !SplitSingleRowInsert(job->query, &prefixEnd, &valuesStart, &valuesEnd) || prefixEnd >= sizeof(prefix) )
+        return FALSE;
+    memcpy(prefix, job->query, prefixEnd);
+    prefix[prefixEnd] = '\0';
+    size_t keyLen = NormalizeQuery(prefix, key, sizeof(key));
+    if( keyLen == 0 )
+        return FALSE;
+
+    unsigned int hash = HashString(key);
+    InsertBatch **bucket = &insertBatcher.buckets[hash % BATCH_BUCKETS];
+    for( batch = *bucket; batch != NULL; batch = batch->next )
+        if( batch->hash == hash && batch->prefixLen == keyLen && memcmp(batch->text, key, keyLen) == 0 )
+            break;
+    if( batch == NULL )
+    {
+        batch = (InsertBatch*)calloc(1, sizeof(InsertBatch));
+        if( batch == NULL )
+            return FALSE;
+        batch->hash = hash;
+        batch->prefixLen = keyLen;
+        batch->deadline = MonotonicMillis() + insertBatcher.windowMs;
+        AppendText(&batch->text, &batch->textLen, &batch->textCap, key, keyLen);
+        AppendText(&batch->text, &batch->textLen, &batch->textCap, " ", 1);
+        batch->next = *bucket;
+        *bucket = batch;
+        insertBatcher.noPending++;
+    }
+    else
+        AppendText(&batch->text, &batch->textLen, &batch->textCap, ",", 1);
+    AppendText(&batch->text, &batch->textLen, &batch->textCap, job->query + valuesStart, valuesEnd - valuesStart);
+
+    if( batch->tail )
+        batch->tail->next = job;
+    else
+        batch->head = job;
+    batch->tail = job;
+    batch->noRows++;
+
+    if( batch->noRows >= insertBatcher.maxRows || batch->textLen >= BATCH_MAX_BYTES )
+        FlushInsertBatch(batch);
+    return TRUE;
+}
+
+/* Recognizes INSERT [INTO] table [(columns)] VALUES (row) holding a single row and nothing after it.
+ * Sets the end of the prefix, just past VALUES, and the bounds of the row. */
+bool SplitSingleRowInsert(const char *query, size_t *prefixEnd, size_t *valuesStart, size_t *valuesEnd)
+{
+    static const char *modifiers[] = { "LOW_PRIORITY", "DELAYED", "HIGH_PRIORITY", "IGNORE", NULL };
+    Token tok;
+    const char *p = NextToken(query, &tok);
+    int depth, i;
+
+    if( !TokenIs(&tok, "INSERT") )
+        return FALSE;
+    p = NextToken(p, &tok);
+    if( TokenIs(&tok, "INTO") )
+        p = NextToken(p, &tok);
+    if( tok.type != TOKEN_WORD )
+        return FALSE;
+    for( i = 0; modifiers[i] != NULL; i++ )
+        if( TokenIs(&tok, modifiers[i]) )
+            return FALSE;
+
+    // Optional column list
+    p = NextToken(p, &tok);
+    if( tok.type == TOKEN_PUNCT && *tok.start == '(' )
+    {
+        do
+            p = NextToken(p, &tok);
+        while( tok.type != TOKEN_END && !(tok.type == TOKEN_PUNCT && (*tok.start == '(' || *tok.start == ')')) );
+        if( tok.type == TOKEN_END || *tok.start == '(' )
+            return FALSE;
+        p = NextToken(p, &tok);
+    }
+    if( !TokenIs(&tok, "VALUES") && !TokenIs(&tok, "VALUE") )
+        return FALSE;
+    *prefixEnd = tok.start + tok.len - query;
+
+    p = NextToken(p, &tok);
+    if( tok.type != TOKEN_PUNCT || *tok.start != '(' )
+        return FALSE;
+    *valuesStart = tok.start - query;
+    for( depth = 1; depth > 0; )
+    {
+        p = NextToken(p, &tok);
+        if( tok.type == TOKEN_END )
+            return FALSE;
+        if( tok.type == TOKEN_PUNCT && *tok.start == '(' )
+            depth++;
+        else if( tok.type == TOKEN_PUNCT && *tok.start == ')' )
+            depth--;
+    }
+    *valuesEnd = p - query;
+
+    // A second row, ON DUPLICATE KEY UPDATE or anything else rules the statement out
+    do
+        p = NextToken(p, &tok);
+    while( tok.type == TOKEN_PUNCT && *tok.start == ';' );
+    return tok.type == TOKEN_END;
+}
+
+/* Appends to a growing NUL terminated buffer */
+void AppendText(char **buffer, size_t *len, size_t *cap, const char *text, size_t textLen)
+{
+    if( *len + textLen + 1 > *cap )
+    {
+        size_t newCap = *cap ? *cap * 2 : BUFSIZE;
+        while( newCap < *len + textLen + 1 )
+            newCap *= 2;
+        char *grown = (char*)realloc(*buffer, newCap);
+        if( grown == NULL )
+        {
+            perror("realloc() failed");
+            exit(-1);
+        }
+        *buffer = grown;
+        *cap = newCap;
+    }
+    memcpy(*buffer + *len, text, textLen);
+    *len += textLen;
+    (*buffer)[*len] = '\0';
+}
+
+/* Hands a batch to the workers as one multi-row INSERT */
+void FlushInsertBatch(InsertBatch *batch)
+{
+    InsertBatch **link = &insertBatcher.buckets[batch->hash % BATCH_BUCKETS];
+    while( *link != batch )
+        link = &(*link)->next;
+    *link = batch->next;
+    insertBatcher.noPending--;
+
+    Job *job = (Job*)calloc(1, sizeof(Job));
+    if( job == NULL )
+    {
+        perror("calloc() failed");
+        exit(-1);
+    }
+    job->query = batch->text;
+    job->queryLen = batch->textLen;
+    job->waiters = batch->head;
+
+    pthread_mutex_lock(&insertBatcher.lock);
+    insertBatcher.batches++;
+    insertBatcher.rows += batch->noRows;
+    pthread_mutex_unlock(&insertBatcher.lock);
+    free(batch);
+    EnqueueJob(job, -1);
+}
+
+/* Sends the batches whose window has passed, or all of them */
+void FlushInsertBatches(bool all)
+{
+    long long now = MonotonicMillis();
+    int i;
+
+    for( i = 0; i < BATCH_BUCKETS && insertBatcher.noPending > 0; i++ )
+    {
+        InsertBatch *batch = insertBatcher.buckets[i];
+        while( batch != NULL )
+        {
+            InsertBatch *next = batch->next;
+            if( all || batch->deadline <= now )
+                FlushInsertBatch(batch);
+            batch = next;
+        }
+    }
+}
+
+/* Time until the first pending batch is due, NULL when none is pending */
+struct timeval* BatchTimeout(struct timeval *timeout)
+{
+    long long first = -1, now;
+    InsertBatch *batch;
+    int i;
+
+    if( insertBatcher.noPending == 0 )
+        return NULL;
+    for( i = 0; i < BATCH_BUCKETS; i++ )
+        for( batch = insertBatcher.buckets[i]; batch != NULL; batch = batch->next )
+            if( first < 0 || batch->deadline < first )
+                first = batch->deadline;
+
+    now = MonotonicMillis();
+    first = first > now ? first - now : 0;
+    timeout->tv_sec = first / 1000;
+    timeout->tv_usec = (first % 1000) * 1000;
+    return timeout;
+}
+
+/* Runs a batch of coalesced INSERTs as one statement, a single transaction, and acks each row.
+ * If it fails, its rows are retried one by one so that each client gets its own result. */
+void RunInsertBatch(DBConnection *db, Job *batch)
+{
+    ResultStream stream;
+    Job *row, *next;
+
+    // Nobody reads the batch's own response
+    long long start = MonotonicMicros();
+    StreamInit(&stream, NULL, 0);
+    bool success = backend->execute(db, batch->query, batch->queryLen, &stream);
+    StreamEnd(&stream);
+    if( success )
+        CacheInvalidate(batch->query, QUERY_WRITE);
+
+    for( row = batch->waiters; row != NULL; row = next )
+    {
+        next = row->next;
+        StreamInit(&stream, row->client, row->id);
+        if( success )
+        {
+            StreamPrintf(&stream, FRAME_MESSAGE, "\nResult Successful.\n");
+            stream.rowCount = 1;
+        }
+        else
+        {
+            pthread_mutex_lock(&insertBatcher.lock);
+            insertBatcher.fallbacks++;
+            pthread_mutex_unlock(&insertBatcher.lock);
+            ExecuteQuery(db, row->query, row->queryLen, FALSE, &stream);
+        }
+        StreamEnd(&stream);
+        // Each row is accounted the time its client waited for the batch
+        StatsRecord(row->query, start - row->receivedAt, MonotonicMicros() - start, &stream);
+
+        if( row->client )
+            ReleaseClient(row->client);
+        free(row->query);
+        free(row);
+    }
+    free(batch->query);
+    free(batch);
+}
+
+/* Starts a bulk load, the data frames that follow are queued for the worker running it */
+void DispatchLoad(Client *client, uint32_t id, const unsigned char *payload, size_t len)
+{
+    const char *error = NULL;
+    char table[NAMEBUFSIZE];
+    Token tok;
+
+    if( len < 3 || len - 2 >= NAMEBUFSIZE || (payload[0] != LOAD_CSV && payload[0] != LOAD_TSV) )
+        error = "malformed load request";
+    else
+    {
+        memcpy(table, payload + 2, len - 2);
+        table[len - 2] = '\0';
+        // The name goes into the INSERTs, so it has to be a single identifier
+        const char *end = NextToken(table, &tok);
+        if( tok.type != TOKEN_WORD || *end != '\0' )
+            error = "invalid table name";
+        else if( client->load != NULL )
+            error = "a bulk load is already running on this connection";
+        else if( shardMap.noShards > 0 && FindShardedTable(table) != NULL )
+            error = "the table is sharded, send its rows as INSERTs";
+    }
+    if( error != NULL )
+    {
+        unsigned char count[8] = { 0 };
+        char text[BUFSIZE];
+        int textLen = snprintf(text, sizeof(text), "\nError: %s\n", error);
+        SendFrame(client, FRAME_ERROR, id, text, textLen);
+        SendFrame(client, FRAME_END, id, (char*)count, sizeof(count));
+        return;
+    }
+    if( !AdmitQuery(client, id) )
+        return;
+
+    BulkLoad *load = (BulkLoad*)calloc(1, sizeof(BulkLoad));
+    if( load == NULL )
+    {
+        perror("calloc() failed");
+        exit(-1);
+    }
+    pthread_mutex_init(&load->lock, NULL);
+    pthread_cond_init(&load->ready, NULL);
+    load->refs = 2;
+    load->format = payload[0];
+    load->skipLines = payload[1];
+    strcpy(load->table, table);
+    client->load = load;
+    client->loadId = id;
+
+    Job *job = NewJob(client, id, "", 0);
+    job->load = load;
+    EnqueueJob(job, client->pinned);
+}
+
+/* Queues a chunk of load data, pausing the client when the worker falls behind */
+void FeedLoad(Client *client, uint32_t id, const char *data, size_t len)
+{
+    BulkLoad *load = client->load;
+
+    // Data of a load that was refused is dropped
+    if( load == NULL || client->loadId != id )
+        return;
+
+    pthread_mutex_lock(&load->lock);
+    if( len == 0 )
+    {
+        load->eof = TRUE;
+        client->load = NULL;
+    }
+    else if( !load->aborted )
+    {
+        DataChunk *chunk = (DataChunk*)malloc(sizeof(DataChunk) + len);
+        if( chunk == NULL )
+        {
+            perror("malloc() failed");
+            exit(-1);
+        }
+        chunk->len = len;
+        chunk->next = NULL;
+        memcpy(chunk->data, data, len);
+        if( load->tail )
+            load->tail->next = chunk;
+        else
+            load->head = chunk;
+        load->tail = chunk;
+        load->queued += len;
+        if( load->queued >= LOAD_MAX_BUFFERED )
+            load->paused = client->paused = TRUE;
+    }
+    pthread_cond_signal(&load->ready);
+    pthread_mutex_unlock(&load->lock);
+
+    if( len == 0 )
+        ReleaseLoad(load);
+}
+
+/* TRUE once the worker has drained the load data of a paused client */
+bool ResumeClient(Client *client)
+{
+    BulkLoad *load = client->load;
+    if( load == NULL )
+        client->paused = FALSE;
+    else
+    {
+        pthread_mutex_lock(&load->lock);
+        client->paused = load->paused;
+        pthread_mutex_unlock(&load->lock);
+    }
+    return !client->paused;
+}
+
+void ReleaseLoad(BulkLoad *load)
+{
+    pthread_mutex_lock(&load->lock);
+    bool last = --load->refs == 0;
+    pthread_mutex_unlock(&load->lock);
+    if( last )
+    {
+        while( load->head != NULL )
+        {
+            DataChunk *chunk = load->head;
+            load->head = chunk->next;
+            free(chunk);
+        }
+        pthread_cond_destroy(&load->ready);
+        pthread_mutex_destroy(&load->lock);
+        free(load);
+    }
+}
+
+/* Inserts the rows of a bulk load as its data arrives, in multi-row INSERTs.
+ * Outside a client transaction the load is all or nothing, committed at the end. */
+void RunBulkLoad(DBConnection *db, BulkLoad *load, bool inTransaction, ResultStream *stream)
+{
+    LoadParser parser;
+    bool success = TRUE, cancelled = FALSE;
+
+    memset(&parser, 0, sizeof(parser));
+    parser.csv = load->format == LOAD_CSV;
+    parser.delimiter = parser.csv ? ',' : '\t';
+    parser.backslashEscapes = backend->backslashEscapes;
+    parser.skipLines = load->skipLines;
+    parser.record = 1;
+    AppendText(&parser.text, &parser.textLen, &parser.textCap, "INSERT INTO ", 12);
+    AppendText(&parser.text, &parser.textLen, &parser.textCap, load->table, strlen(load->table));
+    AppendText(&parser.text, &parser.textLen, &parser.textCap, " VALUES ", 8);
+    parser.prefixLen = parser.textLen;
+
+    if( !inTransaction )
+        success = RunQuietly(db, "BEGIN", 5, parser.error, sizeof(parser.error));
+
+    while( success )
+    {
+        pthread_mutex_lock(&load->lock);
+        while( load->head == NULL && !load->eof )
+            pthread_cond_wait(&load->ready, &load->lock);
+        DataChunk *chunk = load->head;
+        if( chunk != NULL )
+        {
+            load->head = chunk->next;
+            if( load->head == NULL )
+                load->tail = NULL;
+            load->queued -= chunk->len;
+        }
+        // Let the I/O thread read the client again once half the backlog is gone
+        if( load->paused && load->queued <= LOAD_MAX_BUFFERED / 2 )
+        {
+            load->paused = FALSE;
+            if( write(workerPool.notify[1], "", 1) < 0 && errno != EAGAIN )
+                perror("write() failed");
+        }
+        cancelled = load->cancelled || (stream->cancelled && *stream->cancelled);
+        pthread_mutex_unlock(&load->lock);
+
+        if( chunk == NULL || cancelled )
+        {
+            free(chunk);
+            break;
+        }
+        success = ParseLoadData(db, &parser, chunk->data, chunk->len, stream);
+        free(chunk);
+    }
+
+    // The last record may lack its newline
+    if( cancelled )
+    {
+        success = FALSE;
+        snprintf(parser.error, sizeof(parser.error), "the client went away before the end of the data");
+    }
+    else if( success && parser.inQuotes && !parser.quoteSeen )
+    {
+        success = FALSE;
+        snprintf(parser.error, sizeof(parser.error), "unterminated quoted field in row %lu", parser.rows + 1);
+    }
+    else if( success )
+    {
+        success = EndLoadRecord(db, &parser, stream);
+        if( success && parser.batchRows > 0 )
+            success = FlushLoadBatch(db, &parser, stream);
+    }
+    if( !inTransaction )
+    {
+        char error[BUFSIZE];
+        if( !RunQuietly(db, success ? "COMMIT" : "ROLLBACK", success ? 6 : 8, error, sizeof(error)) && success )
+        {
+            success = FALSE;
+            strcpy(parser.error, error);
+        }
+    }
+
+    parser.text[parser.prefixLen] = '\0';
+    CacheInvalidate(parser.text, QUERY_WRITE);
+    if( success )
+    {
+        StreamPrintf(stream, FRAME_MESSAGE, "\nLoaded %lu rows.\n", parser.rows);
+        stream->rowCount = parser.rows;
+    }
+    else
+        StreamPrintf(stream, FRAME_ERROR, "\nError: %s\n%s\n", parser.error,
+                     inTransaction ? "The rows before stay in the transaction." : "No rows were loaded.");
+
+    // Data still on its way is dropped
+    pthread_mutex_lock(&load->lock);
+    load->aborted = TRUE;
+    while( load->head != NULL )
+    {
+        DataChunk *chunk = load->head;
+        load->head = chunk->next;
+        free(chunk);
+    }
+    load->tail = NULL;
+    load->queued = 0;
+    if( load->paused )
+    {
+        load->paused = FALSE;
+        if( write(workerPool.notify[1], "", 1) < 0 && errno != EAGAIN )
+            perror("write() failed");
+    }
+    pthread_mutex_unlock(&load->lock);
+    ReleaseLoad(load);
+    free(parser.text);
+    free(parser.field);
+}
+
+/* Feeds a chunk of load data through the parser, FALSE once an INSERT fails */
+bool ParseLoadData(DBConnection *db, LoadParser *parser, const char *data, size_t len, ResultStream *stream)
+{
+    size_t i;
+
+    for( i = 0; i < len; i++ )
+    {
+        char c = data[i];
+        if( parser->inQuotes )
+        {
+            if( !parser->quoteSeen )
+            {
+                if( c == '"' )
+                    parser->quoteSeen = TRUE;
+                else
+                    AppendLoadChar(parser, c);
+                continue;
+            }
+            parser->quoteSeen = FALSE;
+            if( c == '"' )
+            {
+                // A doubled quote stands for one
+                AppendLoadChar(parser, c);
+                continue;
+            }
+            // The quote closed the field, c follows it
+            parser->inQuotes = FALSE;
+        }
+
+        if( parser->csv && c == '"' && parser->fieldLen == 0 && !parser->fieldQuoted )
+            parser->inQuotes = parser->fieldQuoted = TRUE;
+        else if( c == parser->delimiter )
+            EndLoadField(parser);
+        else if( c == '\n' )
+        {
+            if( !EndLoadRecord(db, parser, stream) )
+                return FALSE;
+        }
+        else if( c != '\r' )
+            AppendLoadChar(parser, c);
+    }
+    return TRUE;
+}
+
+void AppendLoadChar(LoadParser *parser, char c)
+{
+    if( parser->fieldLen + 1 >= parser->fieldCap )
+    {
+        size_t cap = parser->fieldCap ? parser->fieldCap * 2 : BUFSIZE;
+        char *grown = (char*)realloc(parser->field, cap);
+        if( grown == NULL )
+        {
+            perror("realloc() failed");
+            exit(-1);
+        }
+        parser->field = grown;
+        parser->fieldCap = cap;
+    }
+    parser->field[parser->fieldLen++] = c;
+}
+
+/* Adds the field read to the row being built, as a string literal, or NULL for an unquoted \N */
+void EndLoadField(LoadParser *parser)
+{
+    char **text = &parser->text;
+    size_t *textLen = &parser->textLen, *textCap = &parser->textCap;
+    size_t i, run;
+
+    if( parser->record > parser->skipLines )
+    {
+        if( parser->noFields > 0 )
+            AppendText(text, textLen, textCap, ",", 1);
+        else
+            AppendText(text, textLen, textCap, parser->batchRows > 0 ? ",(" : "(", parser->batchRows > 0 ? 2 : 1);
+
+        if( !parser->fieldQuoted && parser->fieldLen == 2 && parser->field[0] == '\\' && parser->field[1] == 'N' )
+            AppendText(text, textLen, textCap, "NULL", 4);
+        else
+        {
+            AppendText(text, textLen, textCap, "'", 1);
+            for( i = run = 0; i < parser->fieldLen; i++ )
+            {
+                char c = parser->field[i];
+                const char *escaped = c == '\'' ? "''"
+                                    : parser->backslashEscapes && c == '\\' ? "\\\\"
+                                    : parser->backslashEscapes && c == '\0' ? "\\0" : NULL;
+                if( escaped == NULL )
+                    continue;
+                AppendText(text, textLen, textCap, parser->field + run, i - run);
+                AppendText(text, textLen, textCap, escaped, 2);
+                run = i + 1;
+            }
+            AppendText(text, textLen, textCap, parser->field + run, parser->fieldLen - run);
+            AppendText(text, textLen, textCap, "'", 1);
+        }
+    }
+    parser->noFields++;
+    parser->fieldLen = 0;
+    parser->fieldQuoted = FALSE;
+}
+
+/* Closes the row being built, sending the INSERT once it is full */
+bool EndLoadRecord(DBConnection *db, LoadParser *parser, ResultStream *stream)
+{
+    // Blank lines carry no record
+    if( parser->noFields == 0 && parser->fieldLen == 0 && !parser->fieldQuoted )
+        return TRUE;
+
+    EndLoadField(parser);
+    parser->noFields = 0;
+    if( parser->record++ <= parser->skipLines )
+        return TRUE;
+
+    AppendText(&parser->text, &parser->textLen, &parser->textCap, ")", 1);
+    parser->batchRows++;
+    parser->rows++;
+    if( parser->batchRows >= LOAD_BATCH_ROWS || parser->textLen >= BATCH_MAX_BYTES )
+        return FlushLoadBatch(db, parser, stream);
+    return TRUE;
+}
+
+/* Sends the INSERT built so far and reports progress */
+bool FlushLoadBatch(DBConnection *db, LoadParser *parser, ResultStream *stream)
+{
+    unsigned long first = parser->rows - parser->batchRows + 1;
+    char error[BUFSIZE];
+
+    if( !RunQuietly(db, parser->text, parser->textLen, error, sizeof(error)) )
+    {
+        snprintf(parser->error, sizeof(parser->error), "rows %lu-%lu: %.900s", first, parser->rows, error);
+        return FALSE;
+    }
+    if( parser->rows / LOAD_PROGRESS_ROWS != (first - 1) / LOAD_PROGRESS_ROWS )
+    {
+        StreamPrintf(stream, FRAME_MESSAGE, "Loaded %lu rows\n", parser->rows);
+        StreamFlush(stream);
+    }
+    parser->textLen = parser->prefixLen;
+    parser->text[parser->textLen] = '\0';
+    parser->batchRows = 0;
+    return TRUE;
+}
+
+/* Runs a statement whose result nobody reads, keeping its error message. FALSE on error */
+bool RunQuietly(DBConnection *db, const char *query, size_t len, char *error, size_t errorLen)
+{
+    ResultStream stream;
+    size_t offset = 0;
+
+    StreamInit(&stream, NULL, 0);
+    stream.capturing = TRUE;
+    bool success = backend->execute(db, (char*)query, len, &stream);
+    StreamFlush(&stream);
+
+    snprintf(error, errorLen, "unknown error");
+    while( !success && stream.capturing && offset + FRAME_HEADER_LEN <= stream.captureLen )
+    {
+        const unsigned char *header = (unsigned char*)stream.capture + offset;
+        uint32_t payloadLen = GetUint32(header + 5);
+        if( header[0] == FRAME_ERROR )
+        {
+            // "\nError: message[code]\n"
+            const char *text = (const char*)header + FRAME_HEADER_LEN;
+            while( payloadLen > 0 && *text == '\n' )
+                text++, payloadLen--;
+            while( payloadLen > 0 && text[payloadLen - 1] == '\n' )
+                payloadLen--;
+            if( payloadLen >= 7 && strncmp(text, "Error: ", 7) == 0 )
+                text += 7, payloadLen -= 7;
+            snprintf(error, errorLen, "%.*s", (int)payloadLen, text);
+            break;
+        }
+        offset += FRAME_HEADER_LEN + payloadLen;
+    }
+    StreamEnd(&stream);
+    return success;
+}
+
+/* Connects to the mysql-server in the localhost */
+bool InitializeMYSQL(DBConnection* db, char ** argv)
+{
+    char *user = (char*)argv[2];
+    char *password = (char*)argv[3];
+    char *host = (char*)argv[4];
+    char *dbname = (char*)argv[5];
+    unsigned int port = atoi((char*)argv[6]);
+    MYSQL **conn = &db->conn;
+    *conn = mysql_init(NULL); // Initialize the mysql structue
+
+    if(!mysql_real_connect(*conn, host, user, password, dbname, port, NULL, 0))
+    {
+        printf("\nError: %s[%d]\n", mysql_error(*conn), mysql_errno(*conn));
+        return FALSE;
+    }
+    db->threadId = mysql_thread_id(*conn);
+
+    return TRUE;
+}
+
+void CloseMYSQL(DBConnection* db)
+{
+    StmtCacheClose(db);
+    mysql_close(db->conn);
+}
+
+/* Stops the statement running on db by a KILL QUERY on the killer connection. The
+ * statement fails with ER_QUERY_INTERRUPTED, db stays usable. */
+bool CancelMYSQL(DBConnection* db, DBConnection* killer)
+{
+    char kill[NAMEBUFSIZE];
+    snprintf(kill, sizeof(kill), "KILL QUERY %lu", db->threadId);
+    if( mysql_query(killer->conn, kill) != 0 )
+    {
+        // The query may have ended, and its connection with it
+        fprintf(stderr, "%s failed: %s[%d]\n", kill, mysql_error(killer->conn), mysql_errno(killer->conn));
+        return mysql_errno(killer->conn) == ER_NO_SUCH_THREAD;
+    }
+    return TRUE;
+}
+
+/* libmysqlclient keeps per-thread state */
+void MYSQLThreadInit()
+{
+    mysql_thread_init();
+}
+
+void MYSQLThreadEnd()
+{
+    mysql_thread_end();
+}
+
+/* Performs query on mysql and streams the query-result row by row, FALSE on error */
+bool OperateOnMYSQL(DBConnection* db, char *query, ssize_t query_len, ResultStream *stream)
+{
+    MYSQL *conn = db->conn;
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+    bool success;
+
+    // Queries of a known shape run as prepared statements, the rest as text
+    if( ExecutePrepared(db, query, stream, &success) )
+        return success;
+
+    mysql_query(conn, query);
+
+    // Rows are fetched from mysql one at a time rather than stored up front
+    res = mysql_use_result(conn);
+    if( res == NULL)
+    {
+        if( mysql_errno(conn)!=0 )
+        {
+            StreamPrintf(stream, FRAME_ERROR, "\nError: %s[%d]\n", mysql_error(conn), mysql_errno(conn));
+            return FALSE;
+        }
+        else
+        {
+            StreamPrintf(stream, FRAME_MESSAGE, "\nResult Successful.\n");
+            stream->rowCount = mysql_affected_rows(conn);
+        }
+        return TRUE;
+    }
+
+    unsigned int noColumns = mysql_num_fields(res);
+    unsigned char types[MAX_COLUMNS], bitmap[MAX_COLUMNS / 8];
+    unsigned int bitmapLen = (noColumns + 7) / 8;
+    unsigned long noRows = 0;
+    int i;
+    // The column count goes out in two bytes and sizes the arrays above
+    if( noColumns > MAX_COLUMNS )
+    {
+        StreamPrintf(stream, FRAME_ERROR, "\nError: %s[%d]\n", "Too many columns", ER_TOO_MANY_FIELDS);
+        mysql_free_result(res);
+        return FALSE;
+    }
+    StreamColumns(stream, mysql_fetch_fields(res), noColumns, types);
+    while( (row = mysql_fetch_row(res)) )
+    {
+        unsigned long *lengths = mysql_fetch_lengths(res);
+        memset(bitmap, 0, bitmapLen);
+        for(i = 0; i < noColumns; i++ )
+            if( row[i] == NULL )
+                bitmap[i / 8] |= 1 << (i % 8);
+        StreamWrite(stream, FRAME_ROWS, (char*)bitmap, bitmapLen);
+        for(i = 0; i < noColumns; i++ )
+            if( row[i] )
+                StreamTextValue(stream, types[i], row[i], lengths[i]);
+        noRows++;
+    }
+
+    // A NULL row ends the result set, or reports an error part way through it
+    success = mysql_errno(conn) == 0;
+    if( !success )
+        StreamPrintf(stream, FRAME_ERROR, "\nError: %s[%d]\n", mysql_error(conn), mysql_errno(conn));
+    stream->rowCount = noRows;
+    mysql_free_result(res);
+    return success;
+}
+
+/* Opens the embedded SQLite database, creating the file when needed */
+bool InitializeSQLite(DBConnection* db, char ** argv)
+{
+    char *path = (char*)argv[2];
+
+    if( sqlite3_open_v2(path, &db->sqlite, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, NULL) != SQLITE_OK )
+    {
+        printf("\nError: %s[%d]\n", sqlite3_errmsg(db->sqlite), sqlite3_errcode(db->sqlite));
+        sqlite3_close(db->sqlite);
+        db->sqlite = NULL;
+        return FALSE;
+    }
+    // In WAL mode readers and the writer don't block each other; a second writer
+    // waits for the lock rather than failing straight away
+    sqlite3_busy_timeout(db->sqlite, SQLITE_LOCK_WAIT_MS);
+    sqlite3_exec(db->sqlite, "PRAGMA journal_mode=WAL", NULL, NULL, NULL);
+    return TRUE;
+}
+
+void CloseSQLite(DBConnection* db)
+{
+    sqlite3_close(db->sqlite);
+}
+
+/* Makes the statement running on db fail with SQLITE_INTERRUPT, safe from any thread */
+bool CancelSQLite(DBConnection* db, DBConnection* killer)
+{
+    sqlite3_interrupt(db->sqlite);
+    return TRUE;
+}
+
+/* Runs a query on the embedded database and streams the query-result row by row, FALSE on error */
+bool OperateOnSQLite(DBConnection* db, char *query, ssize_t query_len, ResultStream *stream)
+{
+    sqlite3 *conn = db->sqlite;
+    sqlite3_stmt *stmt;
+    const char *tail;
+    unsigned char types[MAX_COLUMNS], bitmap[MAX_COLUMNS / 8];
+    unsigned long noRows = 0;
+    int noColumns, i, rc;
+
+    if( sqlite3_prepare_v2(conn, query, -1, &stmt, &tail) != SQLITE_OK )
+    {
+        StreamPrintf(stream, FRAME_ERROR, "\nError: %s[%d]\n", sqlite3_errmsg(conn), sqlite3_extended_errcode(conn));
+        return FALSE;
+    }
+    // As on the mysql connection, a query holds exactly one statement
+    while( isspace((unsigned char)*tail) || *tail == ';' )
+        tail++;
+    noColumns = stmt ? sqlite3_column_count(stmt) : 0;
+    if( stmt == NULL || *tail != '\0' || noColumns > MAX_COLUMNS )
+    {
+        StreamPrintf(stream, FRAME_ERROR, "\nError: %s[%d]\n",
+                     stmt == NULL ? "Query was empty" : *tail != '\0' ? "Only one statement per query is supported"
+                     : "Too many columns", SQLITE_MISUSE);
+        sqlite3_finalize(stmt);
+        return FALSE;
+    }
+
+    rc = sqlite3_step(stmt);
+    if( noColumns == 0 )
+    {
+        bool success = rc == SQLITE_DONE;
+        if( success )
+        {
+            StreamPrintf(stream, FRAME_MESSAGE, "\nResult Successful.\n");
+            stream->rowCount = sqlite3_changes(conn);
+        }
+        else
+            StreamPrintf(stream, FRAME_ERROR, "\nError: %s[%d]\n", sqlite3_errmsg(conn), sqlite3_extended_errcode(conn));
+        sqlite3_finalize(stmt);
+        return success;
+    }
+
+    uint16_t netColumns = htons(noColumns);
+    StreamWrite(stream, FRAME_COLUMNS, (char*)&netColumns, sizeof(netColumns));
+    for( i = 0; i < noColumns; i++ )
+    {
+        types[i] = SQLiteColumnType(stmt, i, rc == SQLITE_ROW);
+        StreamColumn(stream, types[i], sqlite3_column_name(stmt, i));
+    }
+
+    unsigned int bitmapLen = (noColumns + 7) / 8;
+    while( rc == SQLITE_ROW )
+    {
+        memset(bitmap, 0, bitmapLen);
+        for( i = 0; i < noColumns; i++ )
+            if( sqlite3_column_type(stmt, i) == SQLITE_NULL )
+                bitmap[i / 8] |= 1 << (i % 8);
+        StreamWrite(stream, FRAME_ROWS, (char*)bitmap, bitmapLen);
+        for( i = 0; i < noColumns; i++ )
+            if( !(bitmap[i / 8] & (1 << (i % 8))) )
+                StreamSQLiteValue(stream, stmt, i, types[i]);
+        noRows++;
+        rc = sqlite3_step(stmt);
+    }
+
+    // Anything but SQLITE_DONE ends the result set with an error
+    bool success = rc == SQLITE_DONE;
+    if( !success )
+        StreamPrintf(stream, FRAME_ERROR, "\nError: %s[%d]\n", sqlite3_errmsg(conn), sqlite3_extended_errcode(conn));
+    stream->rowCount = noRows;
+    sqlite3_finalize(stmt);
+    return success;
+}
+
+/* Wire type of a result column. SQLite types values rather than columns, so the
+ * declared type decides where there is one, the value in the first row otherwise. */
+unsigned char SQLiteColumnType(sqlite3_stmt *stmt, int column, bool hasRow)
+{
+    const char *decl = sqlite3_column_decltype(stmt, column);
+    int type = hasRow ? sqlite3_column_type(stmt, column) : SQLITE_NULL;
+
+    if( decl != NULL && *decl != '\0' )
+    {
+        // SQLite's type affinity rules, in their order of precedence
+        char upper[NAMEBUFSIZE];
+        int i;
+        for( i = 0; decl[i] != '\0' && i < NAMEBUFSIZE - 1; i++ )
+            upper[i] = toupper((unsigned char)decl[i]);
+        upper[i] = '\0';
+        if( strstr(upper, "INT") )
+            return COLTYPE_INT;
+        if( strstr(upper, "CHAR") || strstr(upper, "CLOB") || strstr(upper, "TEXT") )
+            return COLTYPE_TEXT;
+        if( strstr(upper, "REAL") || strstr(upper, "FLOA") || strstr(upper, "DOUB") )
+            return COLTYPE_DOUBLE;
+        if( !strstr(upper, "BLOB") )
+            return COLTYPE_TEXT; // NUMERIC affinity holds integers and reals alike
+    }
+    switch( type )
+    {
+    case SQLITE_INTEGER:
+        return COLTYPE_INT;
+    case SQLITE_FLOAT:
+        return COLTYPE_DOUBLE;
+    case SQLITE_BLOB:
+        return COLTYPE_BLOB;
+    default:
+        return COLTYPE_TEXT;
+    }
+}
+
+/* Encodes a value as its column's wire type, SQLite converting it where they differ */
+void StreamSQLiteValue(ResultStream *stream, sqlite3_stmt *stmt, int column, unsigned char type)
+{
+    if( type == COLTYPE_INT )
+        StreamVarint(stream, ZigZagEncode(sqlite3_column_int64(stmt, column)));
+    else if( type == COLTYPE_DOUBLE )
+        StreamDouble(stream, sqlite3_column_double(stmt, column));
+    else
+    {
+        const char *value = type == COLTYPE_BLOB ? (const char*)sqlite3_column_blob(stmt, column)
+                                                 : (const char*)sqlite3_column_text(stmt, column);
+        unsigned long len = sqlite3_column_bytes(stmt, column);
+        StreamVarint(stream, len);
+        StreamWrite(stream, FRAME_ROWS, value, len);
+    }
+}
+
+
+
+/* Serves a query from the result cache when possible, otherwise runs it on mysql.
+ * Writes and DDL invalidate the cached results of the tables they touch. */
+void ExecuteQuery(DBConnection* db, char *query, ssize_t query_len, bool inTransaction, ResultStream *stream)
+{
+    QueryKind kind = ClassifyQuery(query);
+    char key[BUFSIZE];
+
+    // A transaction may read its own uncommitted writes, its reads bypass the cache
+    // Part of a scattered read, only the merged result would be worth caching
+    if( kind == QUERY_READ && !inTransaction && stream->gather == NULL && queryCache.maxBytes > 0 && IsCacheableRead(query)
+        && NormalizeQuery(query, key, sizeof(key)) > 0 )
+    {
+        CacheEntry *cached = CacheLookup(key);
+        if( cached != NULL )
+        {
+            stream->rowCount = cached->rowCount;
+            StreamSend(stream, cached->result, cached->resultLen);
+            CacheRelease(cached);
+            return;
+        }
+
+        // Capture the frames while streaming them, the result is cached if it stays small.
+        // The table versions are taken first, so a write racing with the read voids the copy.
+        // A replica may not have the writes behind those versions yet, its results aren't kept.
+        CacheDeps deps;
+        CacheSnapshot(query, &deps);
+        stream->capturing = !stream->replica;
+        if( backend->execute(db, query, query_len, stream) )
+        {
+            StreamFlush(stream);
+            if( stream->capturing )
+                CacheStore(key, &deps, stream->capture, stream->captureLen, stream->rowCount);
+        }
+        return;
+    }
+
+    bool success = backend->execute(db, query, query_len, stream);
+    if( kind == QUERY_DDL && success )
+        __atomic_add_fetch(&workerPool.schemaVersion, 1, __ATOMIC_RELEASE);
+    if( kind != QUERY_READ )
+        CacheInvalidate(query, kind);
+}
+
+/* Answers the gateway's own commands, which start with a backslash */
+void HandleAdminCommand(DBConnection* db, char *command, ResultStream *stream)
+{
+    char result[BUFSIZE];
+
+    if( strncmp(command, "\\cache flush", 12) == 0 )
+    {
+        CacheInvalidate(NULL, QUERY_OTHER);
+        StreamPrintf(stream, FRAME_MESSAGE, "\nCache flushed.\n");
+    }
+    else if( strncmp(command, "\\cache", 6) == 0 )
+    {
+        CacheStats(result, sizeof(result));
+        StreamPrintf(stream, FRAME_MESSAGE, "%s", result);
+    }
+    else if( strncmp(command, "\\stmts", 6) == 0 )
+    {
+        // Summed over the workers; the counters are read without locking, they are only statistics
+        unsigned int noStmts = 0;
+        unsigned long prepares = 0, executions = 0, fallbacks = 0;
+        int i;
+        for( i = 0; i < workerPool.noWorkers; i++ )
+        {
+            noStmts += workerPool.dbs[i].noStmts;
+            prepares += workerPool.dbs[i].prepares;
+            executions += workerPool.dbs[i].executions;
+            fallbacks += workerPool.dbs[i].fallbacks;
+        }
+        StreamPrintf(stream, FRAME_MESSAGE,
+                     "\nPrepared statements: %u/%u on %d connections\nPrepares: %lu\tExecutions: %lu\tText fallbacks: %lu\n",
+                     noStmts, db->maxStmts * workerPool.noWorkers, workerPool.noWorkers,
+                     prepares, executions, fallbacks);
+    }
+    else if( strncmp(command, "\\routes", 7) == 0 )
+    {
+        // Read without the pool lock, the counters are only statistics
+        char role[NAMEBUFSIZE];
+        int i;
+        StreamPrintf(stream, FRAME_MESSAGE, "\n%-8s %-32s %8s %12s %12s\n", "role", "server", "workers", "outstanding", "served");
+        for( i = 0; i < workerPool.noTargets; i++ )
+        {
+            Target *target = &workerPool.targets[i];
+            snprintf(result, sizeof(result), "%s%s%s", target->name, target->port[0] ? ":" : "", target->port);
+            if( shardMap.noShards > 0 )
+                snprintf(role, sizeof(role), "shard %d", i);
+            else
+                snprintf(role, sizeof(role), "%s", i == 0 ? "primary" : "replica");
+            StreamPrintf(stream, FRAME_MESSAGE, "%-8s %-32s %8d %12u %12lu\n", role,
+                         result, workerPool.workersPerTarget, target->outstanding, target->served);
+        }
+        for( i = 0; i < shardMap.noTables; i++ )
+            StreamPrintf(stream, FRAME_MESSAGE, "%s%s(%s)%s", i == 0 ? "Sharded tables: " : "", shardMap.tables[i].name,
+                         shardMap.tables[i].column, i + 1 < shardMap.noTables ? ", " : "\n");
+        if( shardMap.noShards > 0 )
+            StreamPrintf(stream, FRAME_MESSAGE, "Single-shard queries: %lu\tScattered: %lu\n",
+                         shardMap.singleShard, shardMap.scattered);
+        if( workerPool.readYourWritesMs > 0 )
+            StreamPrintf(stream, FRAME_MESSAGE, "Reads stay on the primary for %u ms after a write\n", workerPool.readYourWritesMs);
+    }
+    else if( strncmp(command, "\\top reset", 10) == 0 )
+    {
+        StatsReset();
+        StreamPrintf(stream, FRAME_MESSAGE, "\nQuery statistics reset.\n");
+    }
+    else if( strncmp(command, "\\top", 4) == 0 )
+    {
+        int n = atoi(command + 4);
+        StatsTop(stream, n > 0 ? n : STATS_TOP_DEFAULT);
+    }
+    else
+        StreamPrintf(stream, FRAME_ERROR, "\nError: unknown gateway command, try \\cache, \\cache flush, \\stmts, \\routes, \\timeout [ms], \\top [N] or \\top reset\n");
+}
+
+/* Runs a query as a prepared statement of its shape, binding its literals as parameters.
+ * Returns FALSE when the query has to go through the text protocol instead. */
+bool ExecutePrepared(DBConnection* db, char *query, ResultStream *stream, bool *success)
+{
+    char shape[BUFSIZE];
+    QueryParam params[MAX_PARAMS];
+    MYSQL_BIND binds[MAX_PARAMS];
+    QueryKind kind = ClassifyQuery(query);
+    Token tok;
+    int noParams, i;
+
+    // Only DML takes parameters, schema statements and the like go as text
+    NextToken(query, &tok);
+    if( db->maxStmts == 0 || !(kind == QUERY_READ || (kind == QUERY_WRITE && !TokenIs(&tok, "LOAD"))) )
+        return FALSE;
+
+    // Statements prepared before a schema change have stale column metadata
+    unsigned long schemaVersion = __atomic_load_n(&workerPool.schemaVersion, __ATOMIC_ACQUIRE);
+    if( db->schemaVersion != schemaVersion )
+    {
+        StmtCacheClose(db);
+        db->schemaVersion = schemaVersion;
+    }
+
+    char *scratch = (char*)malloc(strlen(query) + 1);
+    if( scratch == NULL )
+        return FALSE;
+    noParams = FingerprintQuery(query, shape, sizeof(shape), params, MAX_PARAMS, scratch);
+    PreparedStmt *ps = noParams < 0 ? NULL : GetPreparedStmt(db, shape);
+    if( ps == NULL || ps->stmt == NULL || mysql_stmt_param_count(ps->stmt) != noParams )
+    {
+        free(scratch);
+        db->fallbacks++;
+        return FALSE;
+    }
+
+    memset(binds, 0, sizeof(MYSQL_BIND) * noParams);
+    for( i = 0; i < noParams; i++ )
+    {
+        binds[i].buffer_type = params[i].type;
+        if( params[i].type == MYSQL_TYPE_LONGLONG )
+            binds[i].buffer = &params[i].intValue;
+        else if( params[i].type == MYSQL_TYPE_DOUBLE )
+            binds[i].buffer = &params[i].doubleValue;
+        else
+        {
+            binds[i].buffer = params[i].str;
+            binds[i].buffer_length = params[i].len;
+            binds[i].length = &params[i].len;
+        }
+    }
+
+    db->executions++;
+    if( mysql_stmt_bind_param(ps->stmt, binds) || mysql_stmt_execute(ps->stmt) )
+    {
+        unsigned int err = mysql_stmt_errno(ps->stmt);
+        // The tables changed under the statement, before it ran or before a read sent its
+        // rows: it is prepared again next time and runs as text now
+        if( err == ER_NEED_REPREPARE || err == CR_NEW_STMT_METADATA )
+        {
+            StmtCacheRemove(db, ps);
+            free(scratch);
+            db->fallbacks++;
+            return FALSE;
+        }
+        StreamPrintf(stream, FRAME_ERROR, "\nError: %s[%d]\n", mysql_stmt_error(ps->stmt), err);
+        // The statement is gone with the server's session, prepare it again
+        if( err == ER_UNKNOWN_STMT_HANDLER || err >= CR_MIN_ERROR )
+            StmtCacheRemove(db, ps);
+        *success = FALSE;
+    }
+    else if( ps->noColumns == 0 )
+    {
+        StreamPrintf(stream, FRAME_MESSAGE, "\nResult Successful.\n");
+        stream->rowCount = mysql_stmt_affected_rows(ps->stmt);
+        *success = TRUE;
+    }
+    else
+        *success = StreamStmtRows(ps, stream);
+
+    free(scratch);
+    return TRUE;
+}
+
+/* Streams the rows of an executed statement, fetching them one at a time */
+bool StreamStmtRows(PreparedStmt *ps, ResultStream *stream)
+{
+    MYSQL_STMT *stmt = ps->stmt;
+    unsigned char bitmap[MAX_COLUMNS / 8];
+    unsigned int bitmapLen = (ps->noColumns + 7) / 8;
+    unsigned long noRows = 0;
+    unsigned int i;
+    int rc = 1;
+
+    if( ps->noColumns > MAX_COLUMNS )
+    {
+        StreamPrintf(stream, FRAME_ERROR, "\nError: %s[%d]\n", "Too many columns", ER_TOO_MANY_FIELDS);
+        mysql_stmt_free_result(stmt);
+        return FALSE;
+    }
+    StreamColumns(stream, mysql_fetch_fields(ps->metadata), ps->noColumns, ps->types);
+    if( mysql_stmt_bind_result(stmt, ps->results) == 0 )
+    {
+        while( (rc = mysql_stmt_fetch(stmt)) == 0 || rc == MYSQL_DATA_TRUNCATED )
+        {
+            memset(bitmap, 0, bitmapLen);
+            for( i = 0; i < ps->noColumns; i++ )
+                if( ps->isNull[i] )
+                    bitmap[i / 8] |= 1 << (i % 8);
+            StreamWrite(stream, FRAME_ROWS, (char*)bitmap, bitmapLen);
+
+            for( i = 0; i < ps->noColumns; i++ )
+            {
+                char *buffer = ps->buffers + i * STMT_COLUMN_BUFSIZE;
+                unsigned long length = ps->lengths[i], offset;
+
+                // Numbers arrive in binary from mysql and go out that way
+                if( ps->isNull[i] )
+                    continue;
+                else if( ps->types[i] == COLTYPE_INT )
+                    StreamVarint(stream, ZigZagEncode(*(long long*)buffer));
+                else if( ps->types[i] == COLTYPE_UINT )
+                    StreamVarint(stream, *(unsigned long long*)buffer);
+                else if( ps->types[i] == COLTYPE_DOUBLE && ps->results[i].buffer_type == MYSQL_TYPE_DOUBLE )
+                    StreamDouble(stream, *(double*)buffer);
+                else if( ps->types[i] == COLTYPE_DOUBLE )
+                    StreamTextValue(stream, COLTYPE_DOUBLE, buffer, length);
+                else if( length <= STMT_COLUMN_BUFSIZE )
+                {
+                    StreamVarint(stream, length);
+                    StreamWrite(stream, FRAME_ROWS, buffer, length);
+                }
+                else
+                {
+                    // Values longer than the column buffer are fetched piecewise
+                    StreamVarint(stream, length);
+                    StreamWrite(stream, FRAME_ROWS, buffer, STMT_COLUMN_BUFSIZE);
+                    for( offset = STMT_COLUMN_BUFSIZE; offset < length; offset += STMT_COLUMN_BUFSIZE )
+                    {
+                        mysql_stmt_fetch_column(stmt, &ps->results[i], i, offset);
+                        unsigned long pieceLen = length - offset;
+                        if( pieceLen > STMT_COLUMN_BUFSIZE )
+                            pieceLen = STMT_COLUMN_BUFSIZE;
+                        StreamWrite(stream, FRAME_ROWS, buffer, pieceLen);
+                    }
+                }
+            }
+            noRows++;
+        }
+    }
+
+    if( rc != MYSQL_NO_DATA )
+        StreamPrintf(stream, FRAME_ERROR, "\nError: %s[%d]\n", mysql_stmt_error(stmt), mysql_stmt_errno(stmt));
+    stream->rowCount = noRows;
+    mysql_stmt_free_result(stmt);
+    return rc == MYSQL_NO_DATA;
+}
+
+/* Copies the value of a quoted string literal into out.
+ * Returns its length, -1 if the literal isn't terminated. */
+long UnescapeString(const char *literal, size_t len, char *out)
+{
+    const char *p = literal + 1, *end = literal + len;
+    char quote = literal[0];
+    long outLen = 0;
+
+    while( p < end )
+    {
+        if( *p == '\\' && p + 1 < end )
+        {
+            p++;
+            switch( *p )
+            {
+            case '0': out[outLen++] = '\0'; break;
+            case 'n': out[outLen++] = '\n'; break;
+            case 'r': out[outLen++] = '\r'; break;
+            case 't': out[outLen++] = '\t'; break;
+            case 'b': out[outLen++] = '\b'; break;
+            case 'Z': out[outLen++] = '\032'; break;
+            case '%': case '_': // kept escaped, for LIKE patterns
+                out[outLen++] = '\\';
+                out[outLen++] = *p;
+                break;
+            default: out[outLen++] = *p;
+            }
+            p++;
+        }
+        else if( *p == quote && p + 1 < end && p[1] == quote )
+        {
+            out[outLen++] = quote;
+            p += 2;
+        }
+        else if( *p == quote )
+            return p + 1 == end ? outLen : -1;
+        else
+            out[outLen++] = *p++;
+    }
+    return -1;
+}
+
+/* Builds the shape of a query: its text with whitespace runs and comments collapsed
+ * to single spaces, and string and number literals replaced by '?'. The literals go
+ * to params, string values unescaped into scratch, which must hold strlen(query) bytes.
+ * Literals of a select list stay in the shape, they name its columns (SELECT 1, id+1).
+ * Returns the number of params, -1 if the query can't run as a prepared statement. */
+int FingerprintQuery(const char *query, char *shape, size_t shapeLen, QueryParam *params, int maxParams, char *scratch)
+{
+    // Numbers after BY are column positions (ORDER BY 2) and must stay literal
+    static const char *endPositional[] = { "LIMIT", "HAVING", "WINDOW", "FOR", "LOCK",
+                                           "UNION", "INTO", NULL };
+    // Keywords ending a select list
+    static const char *endSelect[] = { "FROM", "INTO", "WHERE", "GROUP", "HAVING", "ORDER", "LIMIT",
+                                       "WINDOW", "UNION", "FOR", "LOCK", NULL };
+    Token tok, prev = { TOKEN_END, query, 0 };
+    bool positional = FALSE, ended = FALSE;
+    bool selectList[MAX_PAREN_DEPTH] = { FALSE }; // by parenthesis depth
+    size_t len = 0;
+    int noParams = 0, depth = 0, i;
+    const char *p;
+
+    for( p = NextToken(query, &tok); tok.type != TOKEN_END; prev = tok, p = NextToken(p, &tok) )
+    {
+        if( tok.type == TOKEN_PUNCT && *tok.start == ';' )
+        {
+            ended = TRUE;
+            continue;
+        }
+        // Several statements, or placeholders the client wrote itself
+        if( ended || (tok.type == TOKEN_PUNCT && *tok.start == '?') )
+            return -1;
+
+        // Inside a select list, subqueries and function calls included
+        if( tok.type == TOKEN_PUNCT && *tok.start == '(' )
+        {
+            if( ++depth == MAX_PAREN_DEPTH )
+                return -1;
+            selectList[depth] = FALSE;
+        }
+        else if( tok.type == TOKEN_PUNCT && *tok.start == ')' && depth > 0 )
+            depth--;
+        bool naming = FALSE;
+        for( i = 0; i <= depth; i++ )
+            naming |= selectList[i];
+
+        bool literal = FALSE;
+        if( naming && (tok.type == TOKEN_STRING || tok.type == TOKEN_NUMBER) )
+            ; // copied as it is
+        else if( tok.type == TOKEN_STRING )
+        {
+            // Charset introducers (_utf8'..'), X'..', b'..' and adjacent strings are literal syntax
+            if( prev.type == TOKEN_STRING || (prev.type == TOKEN_WORD && prev.start + prev.len == tok.start) )
+                return -1;
+            if( noParams == maxParams )
+                return -1;
+            QueryParam *param = &params[noParams++];
+            long strLen = UnescapeString(tok.start, tok.len, scratch);
+            if( strLen < 0 )
+                return -1;
+            param->type = MYSQL_TYPE_STRING;
+            param->str = scratch;
+            param->len = strLen;
+            scratch += strLen;
+            literal = TRUE;
+        }
+        else if( tok.type == TOKEN_NUMBER && !positional )
+        {
+            if( tok.len > 1 && tok.start[0] == '0' && strchr("xXbB", tok.start[1]) ) // hex and bit values
+                return -1;
+            if( noParams == maxParams )
+                return -1;
+            QueryParam *param = &params[noParams++];
+            param->str = (char*)tok.start;
+            param->len = tok.len;
+            if( memchr(tok.start, 'e', tok.len) || memchr(tok.start, 'E', tok.len) )
+            {
+                param->type = MYSQL_TYPE_DOUBLE;
+                param->doubleValue = strtod(tok.start, NULL);
+            }
+            else
+            {
+                // Exact values: integers that fit in 64 bits, decimals as text
+                errno = 0;
+                param->intValue = strtoll(tok.start, NULL, 10);
+                if( memchr(tok.start, '.', tok.len) || errno == ERANGE )
+                    param->type = MYSQL_TYPE_NEWDECIMAL;
+                else
+                    param->type = MYSQL_TYPE_LONGLONG;
+            }
+            literal = TRUE;
+        }
+        else if( tok.type == TOKEN_WORD )
+        {
+            if( TokenIs(&tok, "BY") )
+                positional = TRUE;
+            for( i = 0; endPositional[i] != NULL; i++ )
+                if( TokenIs(&tok, endPositional[i]) )
+                    positional = FALSE;
+            if( TokenIs(&tok, "SELECT") )
+                selectList[depth] = TRUE;
+            for( i = 0; endSelect[i] != NULL; i++ )
+                if( TokenIs(&tok, endSelect[i]) )
+                    selectList[depth] = FALSE;
+        }
+
+        // Spacing is kept where the query had some: expression column names come from the text
+        size_t tokLen = literal ? 1 : tok.len;
+        if( len + tokLen + 2 > shapeLen )
+            return -1;
+        if( len > 0 && tok.start != prev.start + prev.len )
+            shape[len++] = ' ';
+        memcpy(shape + len, literal ? "?" : tok.start, tokLen);
+        len += tokLen;
+    }
+    shape[len] = '\0';
+    return len > 0 ? noParams : -1;
+}
+
+/* Finds the prepared statement of a shape, preparing it on a miss */
+PreparedStmt* GetPreparedStmt(DBConnection* db, const char *shape)
+{
+    unsigned int hash = HashString(shape), i;
+    PreparedStmt *ps = db->stmts[hash % STMT_BUCKETS];
+
+    while( ps != NULL && !(ps->hash == hash && strcmp(ps->shape, shape) == 0) )
+        ps = ps->hashNext;
+
+    if( ps != NULL )
+    {
+        // Move to the front of the LRU list
+        if( ps != db->lruHead )
+        {
+            ps->lruPrev->lruNext = ps->lruNext;
+            if( ps->lruNext )
+                ps->lruNext->lruPrev = ps->lruPrev;
+            else
+                db->lruTail = ps->lruPrev;
+            ps->lruPrev = NULL;
+            ps->lruNext = db->lruHead;
+            db->lruHead->lruPrev = ps;
+            db->lruHead = ps;
+        }
+        return ps;
+    }
+
+    while( db->noStmts >= db->maxStmts && db->lruTail != NULL )
+        StmtCacheRemove(db, db->lruTail);
+
+    ps = (PreparedStmt*)calloc(1, sizeof(PreparedStmt));
+    if( ps == NULL || (ps->shape = strdup(shape)) == NULL )
+    {
+        free(ps);
+        return NULL;
+    }
+    ps->hash = hash;
+
+    // Shapes that fail to prepare are remembered too, so they go straight to text
+    ps->stmt = mysql_stmt_init(db->conn);
+    if( ps->stmt != NULL && mysql_stmt_prepare(ps->stmt, shape, strlen(shape)) != 0 )
+    {
+        if(DEBUG) printf("Can't prepare |%s|: %s\n", shape, mysql_stmt_error(ps->stmt));
+        mysql_stmt_close(ps->stmt);
+        ps->stmt = NULL;
+    }
+    if( ps->stmt != NULL )
+    {
+        db->prepares++;
+        ps->noColumns = mysql_stmt_field_count(ps->stmt);
+        ps->metadata = mysql_stmt_result_metadata(ps->stmt);
+        ps->types = (unsigned char*)calloc(ps->noColumns + 1, 1);
+        ps->results = (MYSQL_BIND*)calloc(ps->noColumns, sizeof(MYSQL_BIND));
+        ps->buffers = (char*)malloc(ps->noColumns * STMT_COLUMN_BUFSIZE + 1);
+        ps->lengths = (unsigned long*)calloc(ps->noColumns, sizeof(unsigned long));
+        ps->isNull = (bool*)calloc(ps->noColumns, sizeof(bool));
+        if( ps->types == NULL || ps->results == NULL || ps->buffers == NULL || ps->lengths == NULL
+            || ps->isNull == NULL || (ps->noColumns > 0 && ps->metadata == NULL) )
+        {
+            perror("calloc() failed");
+            exit(-1);
+        }
+        // Numbers are fetched in binary, everything else as text. FLOAT is the exception:
+        // widened to a double 0.1 would read 0.10000000149011612, so it comes as mysql
+        // prints it and is parsed like a value of the text protocol.
+        MYSQL_FIELD *fields = ps->noColumns > 0 ? mysql_fetch_fields(ps->metadata) : NULL;
+        for( i = 0; i < ps->noColumns; i++ )
+        {
+            ps->types[i] = ColumnType(&fields[i]);
+            if( ps->types[i] == COLTYPE_INT || ps->types[i] == COLTYPE_UINT )
+                ps->results[i].buffer_type = MYSQL_TYPE_LONGLONG;
+            else if( ps->types[i] == COLTYPE_DOUBLE && fields[i].type != MYSQL_TYPE_FLOAT )
+                ps->results[i].buffer_type = MYSQL_TYPE_DOUBLE;
+            else if( ps->types[i] == COLTYPE_BLOB )
+                ps->results[i].buffer_type = MYSQL_TYPE_BLOB;
+            else
+                ps->results[i].buffer_type = MYSQL_TYPE_STRING;
+            ps->results[i].is_unsigned = ps->types[i] == COLTYPE_UINT;
+            ps->results[i].buffer = ps->buffers + i * STMT_COLUMN_BUFSIZE;
+            ps->results[i].buffer_length = STMT_COLUMN_BUFSIZE;
+            ps->results[i].length = &ps->lengths[i];
+            ps->results[i].is_null = &ps->isNull[i];
+        }
+    }
+
+    ps->hashNext = db->stmts[hash % STMT_BUCKETS];
+    db->stmts[hash % STMT_BUCKETS] = ps;
+    ps->lruNext = db->lruHead;
+    if( db->lruHead )
+        db->lruHead->lruPrev = ps;
+    else
+        db->lruTail = ps;
+    db->lruHead = ps;
+    db->noStmts++;
+    return ps;
+}
+
+/* Closes a prepared statement and drops it from the connection's cache */
+void StmtCacheRemove(DBConnection* db, PreparedStmt *ps)
+{
+    PreparedStmt **link = &db->stmts[ps->hash % STMT_BUCKETS];
+    while( *link != ps )
+        link = &(*link)->hashNext;
+    *link = ps->hashNext;
+
+    if( ps->lruPrev )
+        ps->lruPrev->lruNext = ps->lruNext;
+    else
+        db->lruHead = ps->lruNext;
+    if( ps->lruNext )
+        ps->lruNext->lruPrev = ps->lruPrev;
+    else
+        db->lruTail = ps->lruPrev;
+
+    if( ps->stmt )
+        mysql_stmt_close(ps->stmt);
+    db->noStmts--;
+    if( ps->metadata )
+        mysql_free_result(ps->metadata);
+    free(ps->types);
+    free(ps->shape);
+    free(ps->results);
+    free(ps->buffers);
+    free(ps->lengths);
+    free(ps->isNull);
+    free(ps);
+}
+
+void StmtCacheClose(DBConnection* db)
+{
+    while( db->lruHead != NULL )
+        StmtCacheRemove(db, db->lruHead);
+}
+
+/* Returns pointer past the next token of query, skipping whitespace and comments */
+const char* NextToken(const char *p, Token *tok)
+{
+    while( TRUE )
+    {
+        while( isspace((unsigned char)*p) )
+            p++;
+        if( *p == '#' || (p[0] == '-' && p[1] == '-' && (p[2] == '\0' || isspace((unsigned char)p[2]))) )
+        {
+            while( *p != '\0' && *p != '\n' )
+                p++;
+        }
+        else if( p[0] == '/' && p[1] == '*' )
+        {
+            const char *end = strstr(p + 2, "*/");
+            p = end ? end + 2 : p + strlen(p);
+        }
+        else
+            break;
+    }
+
+    tok->start = p;
+    if( *p == '\0' )
+        tok->type = TOKEN_END;
+    else if( *p == '\'' || *p == '"' )
+    {
+        char quote = *p++;
+        while( *p != '\0' )
+        {
+            if( *p == '\\' && p[1] != '\0' )
+                p += 2;
+            else if( *p == quote && p[1] == quote )
+                p += 2;
+            else if( *p++ == quote )
+                break;
+        }
+        tok->type = TOKEN_STRING;
+    }
+    else if( isdigit((unsigned char)*p) || (*p == '.' && isdigit((unsigned char)p[1])) )
+    {
+        while( isalnum((unsigned char)*p) || *p == '.'
+               || ((*p == '+' || *p == '-') && (p[-1] == 'e' || p[-1] == 'E')) )
+            p++;
+        tok->type = TOKEN_NUMBER;
+    }
+    else if( isalpha((unsigned char)*p) || *p == '_' || *p == '$' || *p == '`' )
+    {
+        // Identifiers, keywords and qualified names such as db.`table`
+        while( isalnum((unsigned char)*p) || *p == '_' || *p == '$' || *p == '.' || *p == '`' )
+        {
+            if( *p == '`' )
+            {
+                const char *end = strchr(p + 1, '`');
+                p = end ? end + 1 : p + strlen(p);
+            }
+            else
+                p++;
+        }
+        tok->type = TOKEN_WORD;
+    }
+    else
+    {
+        p++;
+        tok->type = TOKEN_PUNCT;
+    }
+    tok->len = p - tok->start;
+    return p;
+}
+
+/* Case insensitive comparison of a word token */
+bool TokenIs(const Token *tok, const char *word)
+{
+    return tok->type == TOKEN_WORD && strlen(word) == tok->len
+           && strncasecmp(tok->start, word, tok->len) == 0;
+}
+
+/* Rewrites query as its tokens separated by single spaces, without trailing ';'.
+ * Returns the normalized length, 0 if it does not fit in out. */
+size_t NormalizeQuery(const char *query, char *out, size_t outLen)
+{
+    size_t len = 0, end = 0;
+    Token tok;
+    const char *p = NextToken(query, &tok);
+
+    for( ; tok.type != TOKEN_END; p = NextToken(p, &tok) )
+    {
+        if( len + tok.len + 2 > outLen )
+            return 0;
+        if( len > 0 )
+            out[len++] = ' ';
+        memcpy(out + len, tok.start, tok.len);
+        len += tok.len;
+        if( !(tok.type == TOKEN_PUNCT && *tok.start == ';') )
+            end = len;
+    }
+    out[end] = '\0';
+    return end;
+}
+
+/* Decides from the leading keyword whether a statement reads, writes or changes schema */
+QueryKind ClassifyQuery(const char *query)
+{
+    static const char *writes[] = { "INSERT", "UPDATE", "DELETE", "REPLACE", "LOAD", NULL };
+    static const char *ddl[] = { "CREATE", "DROP", "ALTER", "TRUNCATE", "RENAME", NULL };
+    Token tok;
+    const char *p = NextToken(query, &tok);
+    int i;
+
+    // Parenthesized selects: (SELECT ...) UNION (SELECT ...)
+    while( tok.type == TOKEN_PUNCT && *tok.start == '(' )
+        p = NextToken(p, &tok);
+
+    if( TokenIs(&tok, "SELECT") )
+        return QUERY_READ;
+    for( i = 0; writes[i] != NULL; i++ )
+        if( TokenIs(&tok, writes[i]) )
+            return QUERY_WRITE;
+    for( i = 0; ddl[i] != NULL; i++ )
+        if( TokenIs(&tok, ddl[i]) )
+            return QUERY_DDL;
+    return QUERY_OTHER;
+}
+
+/* A SELECT is cacheable when its result depends on table contents only */
+bool IsCacheableRead(const char *query)
+{
+    static const char *volatileWords[] = {
+        "NOW", "CURDATE", "CURTIME", "CURRENT_DATE", "CURRENT_TIME", "CURRENT_TIMESTAMP",
+        "LOCALTIME", "LOCALTIMESTAMP", "SYSDATE", "UNIX_TIMESTAMP", "UTC_DATE", "UTC_TIME",
+        "UTC_TIMESTAMP", "RAND", "UUID", "UUID_SHORT", "CONNECTION_ID", "LAST_INSERT_ID",
+        "FOUND_ROWS", "ROW_COUNT", "SLEEP", "BENCHMARK", "GET_LOCK", "RELEASE_LOCK",
+        "IS_FREE_LOCK", "IS_USED_LOCK", "DATABASE", "SCHEMA", "USER", "CURRENT_USER",
+        "SESSION_USER", "SYSTEM_USER", "SQL_NO_CACHE", "SQL_CALC_FOUND_ROWS", "INTO",
+        "UPDATE", "SHARE", NULL };
+    Token tok;
+    const char *p;
+    int i;
+
+    for( p = NextToken(query, &tok); tok.type != TOKEN_END; p = NextToken(p, &tok) )
+    {
+        if( tok.type == TOKEN_PUNCT && *tok.start == '@' ) // user or system variables
+            return FALSE;
+        for( i = 0; volatileWords[i] != NULL; i++ )
+            if( TokenIs(&tok, volatileWords[i]) )
+                return FALSE;
+    }
+    return TRUE;
+}
+
+/* A SELECT may run on a replica unless it locks rows, writes, or depends on the session
+ * state of the primary connection */
+bool IsReplicaRead(const char *query)
+{
+    static const char *primaryWords[] = {
+        "UPDATE", "SHARE", "INTO", "LAST_INSERT_ID", "FOUND_ROWS", "ROW_COUNT", "SQL_CALC_FOUND_ROWS",
+        "GET_LOCK", "RELEASE_LOCK", "RELEASE_ALL_LOCKS", "IS_FREE_LOCK", "IS_USED_LOCK",
+        "NEXTVAL", "LASTVAL", NULL };
+    Token tok;
+    const char *p;
+    int i;
+
+    if( ClassifyQuery(query) != QUERY_READ )
+        return FALSE;
+    for( p = NextToken(query, &tok); tok.type != TOKEN_END; p = NextToken(p, &tok) )
+    {
+        if( tok.type == TOKEN_PUNCT && *tok.start == '@' ) // user or system variables
+            return FALSE;
+        for( i = 0; primaryWords[i] != NULL; i++ )
+            if( TokenIs(&tok, primaryWords[i]) )
+                return FALSE;
+    }
+    return TRUE;
+}
+
+/* Collects the lower-cased, unqualified names of the tables a statement references.
+ * With aliases, a table named twice is listed twice and aliases[i] receives the name
+ * tables[i] goes by there: its alias, or the table name without one.
+ * Returns the number of tables, -1 if there are more than maxTables. */
+int ExtractTables(const char *query, char tables[][NAMEBUFSIZE], char aliases[][NAMEBUFSIZE], int maxTables)
+{
+    // Keywords after which a table name, or a comma separated list of them, follows
+    static const char *introducers[] = { "FROM", "JOIN", "STRAIGHT_JOIN", "INTO", "UPDATE",
+                                         "TABLE", "TABLES", "TRUNCATE", "TO", NULL };
+    // Keywords that may sit between an introducer and the table name
+    static const char *modifiers[] = { "IF", "NOT", "EXISTS", "TABLE", "LOW_PRIORITY", "DELAYED",
+                                       "HIGH_PRIORITY", "IGNORE", "QUICK", "ONLY", "LATERAL", NULL };
+    // Keywords that end a table list; join conditions don't, a comma may follow them
+    static const char *terminators[] = { "WHERE", "GROUP", "ORDER", "HAVING", "LIMIT",
+                                         "UNION", "WINDOW", "FOR", "LOCK", "SET", "VALUES", "VALUE",
+                                         "SELECT", "PARTITION", "PROCEDURE", "ADD", "MODIFY",
+                                         "CHANGE", "RENAME", "ENGINE", NULL };
+    // Keywords that may follow a table name in place of an alias
+    static const char *joins[] = { "ON", "USING", "JOIN", "STRAIGHT_JOIN", "LEFT", "RIGHT", "INNER",
+                                   "OUTER", "CROSS", "NATURAL", "USE", "FORCE", "IGNORE", NULL };
+    bool inList[MAX_PAREN_DEPTH] = { FALSE };
+    bool expectTable = FALSE;
+    int depth = 0, noTables = 0, aliasOf = -1, i;
+    Token tok;
+    const char *p;
+
+    for( p = NextToken(query, &tok); tok.type != TOKEN_END; p = NextToken(p, &tok) )
+    {
+        // table [AS] alias
+        if( aliasOf >= 0 )
+        {
+            if( TokenIs(&tok, "AS") )
+                continue;
+            bool keyword = tok.type != TOKEN_WORD;
+            for( i = 0; joins[i] != NULL && !keyword; i++ )
+                keyword = TokenIs(&tok, joins[i]);
+            for( i = 0; terminators[i] != NULL && !keyword; i++ )
+                keyword = TokenIs(&tok, terminators[i]);
+            if( !keyword )
+            {
+                size_t len = 0, c;
+                for( c = 0; c < tok.len && len < NAMEBUFSIZE - 1; c++ )
+                    if( tok.start[c] != '`' )
+                        aliases[aliasOf][len++] = tolower((unsigned char)tok.start[c]);
+                aliases[aliasOf][len] = '\0';
+                aliasOf = -1;
+                continue;
+            }
+            aliasOf = -1;
+        }
+        if( tok.type == TOKEN_PUNCT )
+        {
+            if( *tok.start == '(' && depth < MAX_PAREN_DEPTH - 1 )
+                inList[++depth] = FALSE;
+            else if( *tok.start == ')' && depth > 0 )
+                depth--;
+            else if( *tok.start == ',' && inList[depth] )
+            {
+                expectTable = TRUE;
+                continue;
+            }
+            expectTable = FALSE;
+            continue;
+        }
+        if( tok.type != TOKEN_WORD )
+        {
+            expectTable = FALSE;
+            continue;
+        }
+
+        bool matched = FALSE;
+        for( i = 0; introducers[i] != NULL && !matched; i++ )
+            if( TokenIs(&tok, introducers[i]) && !(expectTable && TokenIs(&tok, "TABLE")) )
+            {
+                inList[depth] = expectTable = matched = TRUE;
+            }
+        for( i = 0; terminators[i] != NULL && !matched; i++ )
+            if( TokenIs(&tok, terminators[i]) )
+            {
+                inList[depth] = expectTable = FALSE;
+                matched = TRUE;
+            }
+        for( i = 0; modifiers[i] != NULL && !matched && expectTable; i++ )
+            if( TokenIs(&tok, modifiers[i]) )
+                matched = TRUE;
+        if( matched || !expectTable )
+            continue;
+
+        // The table name: keep the last dotted component, drop backticks, lower-case
+        const char *name = tok.start, *end = tok.start + tok.len, *c;
+        for( c = tok.start; c < end; c++ )
+            if( *c == '.' )
+                name = c + 1;
+        if( noTables == maxTables )
+            return -1;
+        size_t len = 0;
+        for( c = name; c < end && len < NAMEBUFSIZE - 1; c++ )
+            if( *c != '`' )
+                tables[noTables][len++] = tolower((unsigned char)*c);
+        tables[noTables][len] = '\0';
+        for( i = 0; i < noTables && (aliases != NULL || strcmp(tables[i], tables[noTables]) != 0); i++ )
+            ;
+        if( i == noTables && len > 0 )
+        {
+            if( aliases != NULL )
+            {
+                strcpy(aliases[noTables], tables[noTables]);
+                aliasOf = noTables;
+            }
+            noTables++;
+        }
+        expectTable = FALSE;
+    }
+    return noTables;
+}
+
+/* Query result cache: LRU list over a hash table, bounded by maxBytes */
+void CacheInit(size_t maxBytes, unsigned int ttl)
+{
+    memset(&queryCache, 0, sizeof(queryCache));
+    pthread_mutex_init(&queryCache.lock, NULL);
+    queryCache.maxBytes = maxBytes;
+    queryCache.ttl = ttl;
+}
+
+/* Returns the cached result of a normalized query, NULL on a miss.
+ * The entry stays valid until it is passed to CacheRelease. */
+CacheEntry* CacheLookup(const char *key)
+{
+    unsigned int hash = HashString(key);
+
+    pthread_mutex_lock(&queryCache.lock);
+    CacheEntry *entry = queryCache.buckets[hash % CACHE_BUCKETS];
+    while( entry != NULL && !(entry->hash == hash && strcmp(entry->key, key) == 0) )
+        entry = entry->hashNext;
+    if( entry == NULL )
+    {
+        queryCache.misses++;
+        pthread_mutex_unlock(&queryCache.lock);
+        return NULL;
+    }
+
+    // Drop entries that outlived their TTL or whose tables were written since
+    if( queryCache.ttl > 0 && MonotonicSeconds() >= entry->expires )
+    {
+        queryCache.expirations++;
+        queryCache.misses++;
+        CacheRemove(entry);
+        pthread_mutex_unlock(&queryCache.lock);
+        return NULL;
+    }
+    if( CacheDepsStale(&entry->deps) )
+    {
+        queryCache.invalidations++;
+        queryCache.misses++;
+        CacheRemove(entry);
+        pthread_mutex_unlock(&queryCache.lock);
+        return NULL;
+    }
+
+    // Move to the front of the LRU list
+    if( entry != queryCache.lruHead )
+    {
+        entry->lruPrev->lruNext = entry->lruNext;
+        if( entry->lruNext )
+            entry->lruNext->lruPrev = entry->lruPrev;
+        else
+            queryCache.lruTail = entry->lruPrev;
+        entry->lruPrev = NULL;
+        entry->lruNext = queryCache.lruHead;
+        queryCache.lruHead->lruPrev = entry;
+        queryCache.lruHead = entry;
+    }
+    queryCache.hits++;
+    entry->refs++;
+    pthread_mutex_unlock(&queryCache.lock);
+    return entry;
+}
+
+void CacheRelease(CacheEntry *entry)
+{
+    pthread_mutex_lock(&queryCache.lock);
+    if( --entry->refs == 0 && entry->removed )
+        CacheFree(entry);
+    pthread_mutex_unlock(&queryCache.lock);
+}
+
+/* Records the versions of the tables a read depends on */
+void CacheSnapshot(const char *query, CacheDeps *deps)
+{
+    char tables[MAX_DEP_TABLES][NAMEBUFSIZE];
+    int i;
+
+    deps->noTables = ExtractTables(query, tables, NULL, MAX_DEP_TABLES);
+    pthread_mutex_lock(&queryCache.lock);
+    deps->epoch = queryCache.epoch;
+    for( i = 0; i < deps->noTables; i++ )
+    {
+        deps->tables[i] = GetTableVersion(tables[i]);
+        deps->versions[i] = deps->tables[i]->version;
+    }
+    pthread_mutex_unlock(&queryCache.lock);
+}
+
+/* TRUE when a table was written, or the cache flushed, since the snapshot. Called with the lock held. */
+bool CacheDepsStale(const CacheDeps *deps)
+{
+    int i;
+    if( deps->epoch != queryCache.epoch )
+        return TRUE;
+    for( i = 0; i < deps->noTables; i++ )
+        if( deps->tables[i]->version != deps->versions[i] )
+            return TRUE;
+    return FALSE;
+}
+
+/* Caches the result of a read along with the table versions it was read at */
+void CacheStore(const char *key, const CacheDeps *deps, const char *result, size_t resultLen, unsigned long long rowCount)
+{
+    size_t keyLen = strlen(key);
+    size_t size = sizeof(CacheEntry) + keyLen + resultLen + 1;
+
+    if( deps->noTables < 0 || size > queryCache.maxBytes )
+        return;
+
+    CacheEntry *entry = (CacheEntry*)calloc(1, sizeof(CacheEntry));
+    if( entry == NULL )
+        return;
+    entry->key = (char*)malloc(keyLen + 1);
+    entry->result = (char*)malloc(resultLen);
+    if( entry->key == NULL || entry->result == NULL )
+    {
+        free(entry->key);
+        free(entry->result);
+        free(entry);
+        return;
+    }
+    memcpy(entry->key, key, keyLen + 1);
+    memcpy(entry->result, result, resultLen);
+    entry->resultLen = resultLen;
+    entry->rowCount = rowCount;
+    entry->size = size;
+    entry->hash = HashString(key);
+    entry->deps = *deps;
+
+    pthread_mutex_lock(&queryCache.lock);
+    // A write that ran alongside the read may have changed its result
+    if( CacheDepsStale(deps) )
+    {
+        pthread_mutex_unlock(&queryCache.lock);
+        CacheFree(entry);
+        return;
+    }
+    entry->expires = MonotonicSeconds() + queryCache.ttl;
+
+    // Another worker may have stored the same query meanwhile
+    CacheEntry *old = queryCache.buckets[entry->hash % CACHE_BUCKETS];
+    while( old != NULL && !(old->hash == entry->hash && strcmp(old->key, key) == 0) )
+        old = old->hashNext;
+    if( old != NULL )
+        CacheRemove(old);
+
+    while( queryCache.usedBytes + size > queryCache.maxBytes && queryCache.lruTail != NULL )
+    {
+        queryCache.evictions++;
+        CacheRemove(queryCache.lruTail);
+    }
+
+    entry->hashNext = queryCache.buckets[entry->hash % CACHE_BUCKETS];
+    queryCache.buckets[entry->hash % CACHE_BUCKETS] = entry;
+    entry->lruNext = queryCache.lruHead;
+    if( queryCache.lruHead )
+        queryCache.lruHead->lruPrev = entry;
+    else
+        queryCache.lruTail = entry;
+    queryCache.lruHead = entry;
+
+    queryCache.usedBytes += size;
+    queryCache.noEntries++;
+    queryCache.stores++;
+    pthread_mutex_unlock(&queryCache.lock);
+}
+
+/* Invalidates the cached results depending on the tables a statement modifies.
+ * Statements whose tables can't be determined, or query NULL, flush the whole cache.
+ * COMMIT and ROLLBACK flush too: a read by another connection may have cached
+ * a result while the transaction's writes were still uncommitted. */
+void CacheInvalidate(const char *query, QueryKind kind)
+{
+    // Statements that can't change what a cached SELECT would return
+    static const char *harmless[] = { "SHOW", "DESCRIBE", "DESC", "EXPLAIN", "HELP",
+                                      "BEGIN", "START", NULL };
+    char tables[MAX_DEP_TABLES][NAMEBUFSIZE];
+    int noTables = -1, i;
+
+    if( query != NULL && kind == QUERY_OTHER )
+    {
+        Token tok;
+        NextToken(query, &tok);
+        for( i = 0; harmless[i] != NULL; i++ )
+            if( TokenIs(&tok, harmless[i]) )
+                return;
+    }
+    else if( query != NULL )
+        noTables = ExtractTables(query, tables, NULL, MAX_DEP_TABLES);
+
+    pthread_mutex_lock(&queryCache.lock);
+    if( noTables <= 0 )
+    {
+        // Stale entries are dropped lazily on lookup or by LRU eviction
+        queryCache.epoch++;
+    }
+    else
+    {
+        for( i = 0; i < noTables; i++ )
+            GetTableVersion(tables[i])->version++;
+    }
+    pthread_mutex_unlock(&queryCache.lock);
+}
+
+/* Unlinks an entry from the hash chain and LRU list, freeing it unless it is being sent.
+ * Called with the lock held. */
+void CacheRemove(CacheEntry *entry)
+{
+    CacheEntry **link = &queryCache.buckets[entry->hash % CACHE_BUCKETS];
+    while( *link != entry )
+        link = &(*link)->hashNext;
+    *link = entry->hashNext;
+
+    if( entry->lruPrev )
+        entry->lruPrev->lruNext = entry->lruNext;
+    else
+        queryCache.lruHead = entry->lruNext;
+    if( entry->lruNext )
+        entry->lruNext->lruPrev = entry->lruPrev;
+    else
+        queryCache.lruTail = entry->lruPrev;
+
+    queryCache.usedBytes -= entry->size;
+    queryCache.noEntries--;
+    entry->removed = TRUE;
+    if( entry->refs == 0 )
+        CacheFree(entry);
+}
+
+void CacheFree(CacheEntry *entry)
+{
+    free(entry->key);
+    free(entry->result);
+    free(entry);
+}
+
+/* Formats the cache counters */
+void CacheStats(char *out, size_t outLen)
+{
+    pthread_mutex_lock(&queryCache.lock);
+    unsigned long lookups = queryCache.hits + queryCache.misses;
+    snprintf(out, outLen,
+             "\nCache: %u entries, %zu/%zu bytes, ttl %u s\n"
+             "Hits: %lu\tMisses: %lu\tHit ratio: %.1f%%\n"
+             "Stores: %lu\tEvictions: %lu\tExpirations: %lu\tInvalidations: %lu\n",
+             queryCache.noEntries, queryCache.usedBytes, queryCache.maxBytes, queryCache.ttl,
+             queryCache.hits, queryCache.misses, lookups ? 100.0 * queryCache.hits / lookups : 0.0,
+             queryCache.stores, queryCache.evictions, queryCache.expirations,
+             queryCache.invalidations);
+    pthread_mutex_unlock(&queryCache.lock);
+}
+
+/* Query statistics: latency histograms and counters per query digest, and the slow query log */
+void StatsInit(long slowMs, const char *slowLogPath)
+{
+    pthread_mutex_init(&queryStats.lock, NULL);
+    pthread_mutex_init(&slowLog.lock, NULL);
+    pthread_cond_init(&slowLog.wakeup, NULL);
+    slowLog.thresholdUs = slowMs * 1000LL;
+    if( slowMs < 0 )
+        return;
+
+    slowLog.file = stderr;
+    if( slowLogPath != NULL && (slowLog.file = fopen(slowLogPath, "a")) == NULL )
+    {
+        perror("fopen() failed");
+        exit(-1);
+    }
+    slowLog.running = TRUE;
+    if( pthread_create(&slowLog.thread, NULL, SlowLogMain, NULL) != 0 )
+    {
+        perror("pthread_create() failed");
+        exit(-1);
+    }
+}
+
+/* Writes out the queued slow queries and stops the log writer */
+void StatsShutdown()
+{
+    if( !slowLog.running )
+        return;
+    pthread_mutex_lock(&slowLog.lock);
+    slowLog.running = FALSE;
+    pthread_cond_signal(&slowLog.wakeup);
+    pthread_mutex_unlock(&slowLog.lock);
+    pthread_join(slowLog.thread, NULL);
+    if( slowLog.file != stderr )
+        fclose(slowLog.file);
+}
+
+/* Accounts a finished query to its digest, and logs it when slow.
+ * waitUs is the time it spent queued, us the time from its start to the end of its response. */
+void StatsRecord(const char *query, long long waitUs, long long us, const ResultStream *stream)
+{
+    char digest[BUFSIZE];
+    QueryStat *stat;
+    int bucket = 0;
+
+    if( DigestQuery(query, digest, sizeof(digest)) == 0 )
+        return;
+    while( bucket < STATS_HIST_BUCKETS - 1 && (us >> (bucket + 1)) > 0 )
+        bucket++;
+    unsigned int hash = HashString(digest);
+
+    pthread_mutex_lock(&queryStats.lock);
+    for( stat = queryStats.buckets[hash % STATS_BUCKETS]; stat != NULL; stat = stat->next )
+        if( stat->hash == hash && strcmp(stat->digest, digest) == 0 )
+            break;
+    if( stat == NULL && queryStats.noStats == STATS_MAX_DIGESTS )
+        stat = &queryStats.other;
+    else if( stat == NULL )
+    {
+        stat = (QueryStat*)calloc(1, sizeof(QueryStat));
+        if( stat == NULL || (stat->digest = strdup(digest)) == NULL )
+        {
+            perror("malloc() failed");
+            exit(-1);
+        }
+        stat->hash = hash;
+        stat->next = queryStats.buckets[hash % STATS_BUCKETS];
+        queryStats.buckets[hash % STATS_BUCKETS] = stat;
+        queryStats.noStats++;
+    }
+    stat->calls++;
+    stat->errors += stream->error;
+    stat->totalUs += us;
+    stat->waitUs += waitUs;
+    if( us > stat->maxUs )
+        stat->maxUs = us;
+    stat->rows += stream->rowCount;
+    stat->bytes += stream->bytesSent;
+    stat->histogram[bucket]++;
+    pthread_mutex_unlock(&queryStats.lock);
+
+    if( slowLog.running && us >= slowLog.thresholdUs )
+        SlowLogWrite(query, us, stream);
+}
+
+/* Queues a slow query for the log writer. When it can't keep up the entry is dropped
+ * rather than holding up the worker. */
+void SlowLogWrite(const char *query, long long us, const ResultStream *stream)
+{
+    size_t len = strlen(query);
+    if( len > SLOWLOG_MAX_QUERY )
+        len = SLOWLOG_MAX_QUERY;
+
+    pthread_mutex_lock(&slowLog.lock);
+    if( slowLog.queued == SLOWLOG_MAX_QUEUED )
+    {
+        slowLog.dropped++;
+        pthread_mutex_unlock(&slowLog.lock);
+        return;
+    }
+    slowLog.queued++;
+    pthread_mutex_unlock(&slowLog.lock);
+
+    SlowQuery *entry = (SlowQuery*)malloc(sizeof(SlowQuery) + len + 1);
+    if( entry == NULL )
+    {
+        perror("malloc() failed");
+        exit(-1);
+    }
+    entry->when = time(NULL);
+    entry->us = us;
+    entry->rows = stream->rowCount;
+    entry->bytes = stream->bytesSent;
+    entry->error = stream->error;
+    entry->truncated = len < strlen(query);
+    entry->next = NULL;
+    memcpy(entry->query, query, len);
+    entry->query[len] = '\0';
+
+    pthread_mutex_lock(&slowLog.lock);
+    if( slowLog.tail )
+        slowLog.tail->next = entry;
+    else
+        slowLog.head = entry;
+    slowLog.tail = entry;
+    pthread_cond_signal(&slowLog.wakeup);
+    pthread_mutex_unlock(&slowLog.lock);
+}
+
+/* Log writer thread: formats the queued slow queries and writes them out, in the
+ * format of MySQL's slow query log */
+void* SlowLogMain(void *arg)
+{
+    for( ;; )
+    {
+        pthread_mutex_lock(&slowLog.lock);
+        while( slowLog.head == NULL && slowLog.running )
+            pthread_cond_wait(&slowLog.wakeup, &slowLog.lock);
+        SlowQuery *entry = slowLog.head;
+        slowLog.head = slowLog.tail = NULL;
+        unsigned long dropped = slowLog.dropped;
+        slowLog.dropped = 0;
+        pthread_mutex_unlock(&slowLog.lock);
+        if( entry == NULL )
+            break;
+
+        if( dropped > 0 )
+            fprintf(slowLog.file, "# %lu slow queries not logged, the log fell behind\n", dropped);
+        while( entry != NULL )
+        {
+            SlowQuery *next = entry->next;
+            char when[32];
+            struct tm tm;
+            localtime_r(&entry->when, &tm);
+            strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+            fprintf(slowLog.file, "# Time: %s\n# Query_time: %.6f  Rows: %llu  Bytes_sent: %llu%s\n%s%s;\n",
+                    when, entry->us / 1e6, entry->rows, entry->bytes, entry->error ? "  Error: 1" : "",
+                    entry->query, entry->truncated ? " ..." : "");
+            free(entry);
+            entry = next;
+            pthread_mutex_lock(&slowLog.lock);
+            slowLog.queued--;
+            pthread_mutex_unlock(&slowLog.lock);
+        }
+        fflush(slowLog.file);
+    }
+    return NULL;
+}
+
+/* Lists the n digests with the most total time, the queries that cost the backend most */
+void StatsTop(ResultStream *stream, int n)
+{
+    QueryStat **top = (QueryStat**)calloc(n, sizeof(QueryStat*));
+    QueryStat *stat;
+    int noTop = 0, i, j;
+
+    if( top == NULL )
+    {
+        perror("calloc() failed");
+        exit(-1);
+    }
+    pthread_mutex_lock(&queryStats.lock);
+    for( i = 0; i <= STATS_BUCKETS; i++ )
+    {
+        // The bucket past the end stands for the digests that didn't fit in the table
+        for( stat = i < STATS_BUCKETS ? queryStats.buckets[i] : &queryStats.other; stat != NULL;
+             stat = i < STATS_BUCKETS ? stat->next : NULL )
+        {
+            if( stat->calls == 0 || (noTop == n && stat->totalUs <= top[n - 1]->totalUs) )
+                continue;
+            // Insertion into the sorted top list
+            for( j = noTop < n ? noTop++ : n - 1; j > 0 && top[j - 1]->totalUs < stat->totalUs; j-- )
+                top[j] = top[j - 1];
+            top[j] = stat;
+        }
+    }
+
+    StreamPrintf(stream, FRAME_MESSAGE, "\nTop %d of %u query digests by total time, in ms\n", noTop,
+                 queryStats.noStats + (queryStats.other.calls > 0));
+    StreamPrintf(stream, FRAME_MESSAGE, "%9s %10s %8s %8s %8s %8s %8s %9s %8s %8s  %s\n", "calls", "total",
+                 "avg", "p50", "p95", "p99", "max", "wait avg", "rows", "KB sent", "query");
+    for( i = 0; i < noTop; i++ )
+    {
+        stat = top[i];
+        StreamPrintf(stream, FRAME_MESSAGE, "%9lu %10.1f %8.2f %8.2f %8.2f %8.2f %8.2f %9.2f %8llu %8llu  %s%s\n",
+                     stat->calls, stat->totalUs / 1e3, stat->totalUs / 1e3 / stat->calls,
+                     HistogramPercentile(stat, 0.50) / 1e3, HistogramPercentile(stat, 0.95) / 1e3,
+                     HistogramPercentile(stat, 0.99) / 1e3, stat->maxUs / 1e3,
+                     stat->waitUs / 1e3 / stat->calls, stat->rows, stat->bytes / 1024,
+                     stat == &queryStats.other ? "(other digests)" : stat->digest,
+                     stat->errors ? " [errors]" : "");
+    }
+    pthread_mutex_unlock(&queryStats.lock);
+    free(top);
+}
+
+/* Upper bound of the latency under which a fraction p of the calls completed, in us.
+ * Histogram bucket i counts the calls of 2^i to 2^(i+1) us. Called with the lock held. */
+long long HistogramPercentile(const QueryStat *stat, double p)
+{
+    unsigned long target = (unsigned long)(p * stat->calls + 0.5), seen = 0;
+    int i;
+
+    if( target == 0 )
+        target = 1;
+    for( i = 0; i < STATS_HIST_BUCKETS; i++ )
+    {
+        seen += stat->histogram[i];
+        if( seen >= target )
+            break;
+    }
+    // Nothing took longer than the slowest call
+    long long bound = 2LL << i;
+    return bound < stat->maxUs ? bound : stat->maxUs;
+}
+
+void StatsReset()
+{
+    int i;
+
+    pthread_mutex_lock(&queryStats.lock);
+    for( i = 0; i < STATS_BUCKETS; i++ )
+    {
+        while( queryStats.buckets[i] != NULL )
+        {
+            QueryStat *stat = queryStats.buckets[i];
+            queryStats.buckets[i] = stat->next;
+            free(stat->digest);
+            free(stat);
+        }
+    }
+    memset(&queryStats.other, 0, sizeof(queryStats.other));
+    queryStats.noStats = 0;
+    pthread_mutex_unlock(&queryStats.lock);
+}
+
+/* Reduces a query to its digest: tokens separated by single spaces, string and number
+ * literals replaced by '?' and lists of literals, e.g. IN (1, 2, 3), collapsed to "?, ...".
+ * Queries differing only in their values share a digest. Returns its length, 0 if empty. */
+size_t DigestQuery(const char *query, char *out, size_t outLen)
+{
+    static const char ellipsis[] = "?, ...";
+    size_t len = 0, listStart = 0;
+    int listed = 0;             // literals in the comma separated run being read
+    bool pendingComma = FALSE;  // a comma after a literal, dropped if another literal follows
+    Token tok;
+    const char *p;
+
+    for( p = NextToken(query, &tok); tok.type != TOKEN_END; p = NextToken(p, &tok) )
+    {
+        bool literal = tok.type == TOKEN_STRING || tok.type == TOKEN_NUMBER;
+        if( tok.type == TOKEN_PUNCT && *tok.start == ';' )
+            continue;
+
+        if( tok.type == TOKEN_PUNCT && *tok.start == ',' && listed > 0 && !pendingComma )
+        {
+            pendingComma = TRUE;
+            continue;
+        }
+        if( literal && pendingComma )
+        {
+            // The second literal of a list turns it into the ellipsis, later ones vanish
+            if( listed++ == 1 )
+            {
+                memcpy(out + listStart, ellipsis, sizeof(ellipsis) - 1);
+                len = listStart + sizeof(ellipsis) - 1;
+            }
+            pendingComma = FALSE;
+            continue;
+        }
+
+        const char *text = literal ? "?" : tok.start;
+        size_t textLen = literal ? 1 : tok.len;
+        if( len + textLen + sizeof(ellipsis) + 4 > outLen )
+            break;      // the digest of a huge query is its beginning
+        if( pendingComma )
+        {
+            memcpy(out + len, " ,", 2);
+            len += 2;
+            pendingComma = FALSE;
+        }
+        if( len > 0 )
+            out[len++] = ' ';
+        if( literal )
+            listStart = len;
+        listed = literal ? 1 : 0;
+        memcpy(out + len, text, textLen);
+        len += textLen;
+    }
+    out[len] = '\0';
+    return len;
+}
+
+/* Finds or creates the version counter of a table. Called with the lock held. */
+TableVersion* GetTableVersion(const char *name)
+{
+    unsigned int bucket = HashString(name) % TABLE_BUCKETS;
+    TableVersion *table;
+
+    for( table = queryCache.tables[bucket]; table != NULL; table = table->next )
+        if( strcmp(table->name, name) == 0 )
+            return table;
+
+    table = (TableVersion*)calloc(1, sizeof(TableVersion));
+    if( table == NULL )
+    {
+        perror("calloc() failed");
+        exit(-1);
+    }
+    strncpy(table->name, name, NAMEBUFSIZE - 1);
+    table->next = queryCache.tables[bucket];
+    queryCache.tables[bucket] = table;
+    return table;
+}
+
+/* FNV-1a hash */
+unsigned int HashString(const char *str)
+{
+    unsigned int hash = 2166136261u;
+    while( *str )
+        hash = (hash ^ (unsigned char)*str++) * 16777619u;
+    return hash;
+}
+
+time_t MonotonicSeconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+long long MonotonicMillis()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+long long MonotonicMicros()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+/* Starts the response to a query */
+void StreamInit(ResultStream *stream, Client *client, uint32_t id)
+{
+    stream->client = client;
+    stream->id = id;
+    stream->failed = client == NULL;
+    stream->type = FRAME_ROWS;
+    stream->len = 0;
+    stream->rowCount = 0;
+    stream->bytesSent = 0;
+    stream->error = FALSE;
+    stream->cancelled = NULL;
+    stream->gather = NULL;
+    stream->part = 0;
+    stream->replica = FALSE;
+    stream->capturing = FALSE;
+    stream->capture = NULL;
+    stream->captureLen = stream->captureCap = 0;
+}
+
+/* Appends payload to the current frame, flushing whenever the chunk fills */
+void StreamWrite(ResultStream *stream, char type, const char *data, size_t len)
+{
+    // A cancelled query's output is dropped, nor is its partial result cached
+    if( stream->cancelled != NULL && *stream->cancelled )
+    {
+        stream->capturing = FALSE;
+        return;
+    }
+    if( stream->type != type )
+    {
+        StreamFlush(stream);
+        stream->type = type;
+    }
+    if( type == FRAME_ERROR )
+        stream->error = TRUE;
+    while( len > 0 )
+    {
+        size_t room = CHUNKSIZE - stream->len;
+        if( room == 0 )
+        {
+            StreamFlush(stream);
+            continue;
+        }
+        if( room > len )
+            room = len;
+        memcpy(stream->payload + stream->len, data, room);
+        stream->len += room;
+        data += room;
+        len -= room;
+    }
+}
+
+void StreamPrintf(ResultStream *stream, char type, const char *format, ...)
+{
+    char text[BUFSIZE];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if( len > 0 )
+        StreamWrite(stream, type, text, len < sizeof(text) ? len : sizeof(text) - 1);
+}
+
+/* Writes the column header of a result set and picks the wire type of each column */
+void StreamColumns(ResultStream *stream, MYSQL_FIELD *fields, unsigned int noColumns, unsigned char *types)
+{
+    uint16_t netColumns = htons(noColumns);
+    unsigned int i;
+
+    StreamWrite(stream, FRAME_COLUMNS, (char*)&netColumns, sizeof(netColumns));
+    for( i = 0; i < noColumns; i++ )
+    {
+        types[i] = ColumnType(&fields[i]);
+        StreamColumn(stream, types[i], fields[i].name);
+    }
+}
+
+/* One column of the header: its wire type and name */
+void StreamColumn(ResultStream *stream, unsigned char type, const char *name)
+{
+    unsigned char prefix[1 + MAX_VARINT_LEN];
+    size_t nameLen = strlen(name);
+    prefix[0] = type;
+    int prefixLen = 1 + PutVarint(prefix + 1, nameLen);
+    StreamWrite(stream, FRAME_COLUMNS, (char*)prefix, prefixLen);
+    StreamWrite(stream, FRAME_COLUMNS, name, nameLen);
+}
+
+/* Wire type of a mysql column */
+unsigned char ColumnType(const MYSQL_FIELD *field)
+{
+    switch( field->type )
+    {
+    case MYSQL_TYPE_TINY:
+    case MYSQL_TYPE_SHORT:
+    case MYSQL_TYPE_INT24:
+    case MYSQL_TYPE_LONG:
+    case MYSQL_TYPE_LONGLONG:
+    case MYSQL_TYPE_YEAR:
+        return (field->flags & UNSIGNED_FLAG) ? COLTYPE_UINT : COLTYPE_INT;
+    case MYSQL_TYPE_FLOAT:
+    case MYSQL_TYPE_DOUBLE:
+        return COLTYPE_DOUBLE;
+    case MYSQL_TYPE_BIT:
+    case MYSQL_TYPE_GEOMETRY:
+        return COLTYPE_BLOB;
+    case MYSQL_TYPE_TINY_BLOB:
+    case MYSQL_TYPE_MEDIUM_BLOB:
+    case MYSQL_TYPE_LONG_BLOB:
+    case MYSQL_TYPE_BLOB:
+    case MYSQL_TYPE_STRING:
+    case MYSQL_TYPE_VAR_STRING:
+        return field->charsetnr == BINARY_CHARSET ? COLTYPE_BLOB : COLTYPE_TEXT;
+    default:
+        return COLTYPE_TEXT;
+    }
+}
+
+/* Row values */
+void StreamVarint(ResultStream *stream, uint64_t value)
+{
+    unsigned char varint[MAX_VARINT_LEN];
+    int len = PutVarint(varint, value);
+    StreamWrite(stream, FRAME_ROWS, (char*)varint, len);
+}
+
+void StreamDouble(ResultStream *stream, double value)
+{
+    unsigned char bytes[8];
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    PutUint64(bytes, bits);
+    StreamWrite(stream, FRAME_ROWS, (char*)bytes, sizeof(bytes));
+}
+
+/* Encodes a value mysql returned as text */
+void StreamTextValue(ResultStream *stream, unsigned char type, const char *value, unsigned long len)
+{
+    if( type == COLTYPE_INT )
+        StreamVarint(stream, ZigZagEncode(strtoll(value, NULL, 10)));
+    else if( type == COLTYPE_UINT )
+        StreamVarint(stream, strtoull(value, NULL, 10));
+    else if( type == COLTYPE_DOUBLE )
+        StreamDouble(stream, strtod(value, NULL));
+    else
+    {
+        StreamVarint(stream, len);
+        StreamWrite(stream, FRAME_ROWS, value, len);
+    }
+}
+
+/* Sends frames stored without a request id, i.e. a cached result */
+void StreamSend(ResultStream *stream, const char *frames, size_t len)
+{
+    StreamFlush(stream);
+    while( len >= FRAME_HEADER_LEN && !stream->failed )
+    {
+        uint32_t payloadLen = GetUint32((const unsigned char*)frames + 5);
+        if( !SendFrame(stream->client, frames[0], stream->id, frames + FRAME_HEADER_LEN, payloadLen) )
+            stream->failed = TRUE;
+        else
+            stream->bytesSent += FRAME_HEADER_LEN + payloadLen;
+        frames += FRAME_HEADER_LEN + payloadLen;
+        len -= FRAME_HEADER_LEN + payloadLen;
+    }
+}
+
+/* Sends the current frame, if it holds any payload */
+void StreamFlush(ResultStream *stream)
+{
+    if( stream->len == 0 )
+        return;
+    if( stream->gather != NULL )
+    {
+        GatherFrame(stream);
+        stream->len = 0;
+        return;
+    }
+
+    size_t frameLen = FRAME_HEADER_LEN + stream->len;
+    if( stream->capturing )
+    {
+        if( stream->captureLen + frameLen > CACHE_MAX_RESULT )
+        {
+            stream->capturing = FALSE;
+        }
+        else
+        {
+            if( stream->captureLen + frameLen > stream->captureCap )
+            {
+                size_t cap = stream->captureCap ? stream->captureCap * 2 : CHUNKSIZE;
+                while( cap < stream->captureLen + frameLen )
+                    cap *= 2;
+                char *capture = (char*)realloc(stream->capture, cap);
+                if( capture == NULL )
+                    stream->capturing = FALSE;
+                else
+                {
+                    stream->capture = capture;
+                    stream->captureCap = cap;
+                }
+            }
+            if( stream->capturing )
+            {
+                PutFrameHeader((unsigned char*)stream->capture + stream->captureLen, stream->type, 0, stream->len);
+                memcpy(stream->capture + stream->captureLen + FRAME_HEADER_LEN, stream->payload, stream->len);
+                stream->captureLen += frameLen;
+            }
+        }
+    }
+
+    if( !stream->failed && !SendFrame(stream->client, stream->type, stream->id, stream->payload, stream->len) )
+        stream->failed = TRUE;
+    else if( !stream->failed )
+        stream->bytesSent += frameLen;
+    stream->len = 0;
+}
+
+/* Flushes the last frame and marks the end of the result */
+void StreamEnd(ResultStream *stream)
+{
+    unsigned char count[8];
+
+    PutUint64(count, stream->rowCount);
+    StreamFlush(stream);
+    if( !stream->failed && !SendFrame(stream->client, FRAME_END, stream->id, (char*)count, sizeof(count)) )
+        stream->failed = TRUE;
+    else if( !stream->failed )
+        stream->bytesSent += FRAME_HEADER_LEN + sizeof(count);
+    free(stream->capture);
+    stream->capture = NULL;
+    stream->capturing = FALSE;
+}
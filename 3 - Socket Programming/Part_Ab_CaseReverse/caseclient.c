@@ -1,35 +1,156 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include "casemap.h"
 
 #define BUFSIZE 1024
+#define STREAM_CHUNK 65536 // Each direction of a streamed file goes through one buffer of this size
+
+/* UDP mode: a datagram is a 4 byte request id and the text, the reply carries the same id */
+#define UDP_HEADER 4
+#define UDP_MAX_TEXT 32768 // Longest text the server takes in one datagram
+#define UDP_MAX_REPLY (UDP_HEADER + UDP_MAX_TEXT + UDP_MAX_TEXT / 2 + 256)
+#define UDP_WINDOW 64 // Requests in flight while streaming a file
+#define UDP_WINDOW_BYTES (128 * 1024) // and their bytes, so that the replies fit in the socket buffer
+#define UDP_TIMEOUT 0.2 // Seconds until the first retransmission, doubled after each
+#define UDP_TRIES 6
+
+typedef struct {
+    uint32_t id;
+    size_t len;
+    ssize_t replyLen;           // -1 until the reply is in
+    double sentAt;
+    int tries;
+    char text[UDP_HEADER + UDP_MAX_TEXT];
+    char reply[UDP_MAX_REPLY];
+} UdpRequest;
+
+/* Benchmark mode: connections with requests in flight on each, every request a line of
+ * random text checked against the chain applied here. The requests are drawn from a pool
+ * made up front, so that the client spends its time on the sockets. */
+#define BENCH_POOL 1024 // Distinct requests, fewer when they are long
+#define BENCH_POOL_BYTES (64 * 1024 * 1024)
+#define BENCH_MAX_SIZE (1024 * 1024)
+#define BENCH_MAX_REVERSE (64 * 1024) // The server reverses a line whole only if it fits its 256 KB ring,
+                                      // beside replies on their way out and room for case mapping
+#define BENCH_MAX_SIZES 16
+#define BENCH_IOV 64 // Requests handed to one sendmsg()
+#define HIST_SUB 8 // Latency buckets per power of two nanoseconds
+#define HIST_BUCKETS (40 * HIST_SUB)
+
+typedef struct {
+    size_t min, max;            // bytes of a request, newline included, picked uniformly
+    unsigned weight;
+} BenchSize;
+
+typedef struct {
+    char *text;                 // a line
+    size_t len;
+    char *expect;               // what the chain makes of it
+    size_t expectLen;
+} BenchRequest;
+
+typedef struct {
+    int sock;
+    BenchRequest **queue;       // in flight in the order sent, a ring of inFlight
+    double *issuedAt;           // when the first byte of each went to the socket
+    int head, count;
+    int unsent;                 // of the count, the last ones not yet all sent
+    size_t sentLen;             // of the first unsent
+    size_t matched;             // reply bytes of the oldest checked so far
+} BenchConnection;
+
+typedef struct {
+    unsigned long long done, sentBytes, recvBytes;
+    unsigned long long histogram[HIST_BUCKETS]; // latencies, HIST_SUB buckets per power of two ns
+    double worst;
+} BenchStats;
+
+void Benchmark(struct sockaddr_in *servAddr, const char *chain, int noConnections, int inFlight,
+               const char *sizes, double seconds, int utf8);
+int ParseSizes(const char *spec, BenchSize *sizes);
+void MakeRequest(BenchRequest *request, const BenchSize *sizes, int noSizes, const int *chain, int noStages, int utf8);
+size_t ApplyChain(const int *chain, int noStages, const char *text, size_t len, char *out);
+uint32_t MapCodePoint(int stage, uint32_t cp);
+size_t DecodeUTF8(const unsigned char *text, size_t len, uint32_t *cp);
+size_t EncodeUTF8(uint32_t cp, char *dst);
+void SendRequests(BenchConnection *conn, int inFlight);
+void IssueRequest(BenchConnection *conn, int inFlight, BenchRequest *pool, int poolSize);
+void CheckReplies(BenchConnection *conn, int inFlight, BenchRequest *pool, int poolSize, int issuing, BenchStats *stats);
+int LatencyBucket(uint64_t ns);
+uint64_t BucketStart(int bucket);
+void PrintLatencies(const BenchStats *stats);
+const char *FormatSeconds(double seconds, char *buffer);
+uint64_t Random();
+
+/* Stages of the chain, as the server knows them */
+static const char *stageNames[] = { "swap", "upper", "lower", "rot13", "squeeze", "reverse" };
+#define NO_STAGE_NAMES (sizeof(stageNames) / sizeof(stageNames[0]))
+#define STAGE_SWAP    0
+#define STAGE_UPPER   1
+#define STAGE_LOWER   2
+#define STAGE_ROT13   3
+#define STAGE_SQUEEZE 4
+#define STAGE_REVERSE 5
+
+/* Sends a whole file through the server and writes what comes back to stdout */
+void StreamFile(int sockfd, const char *path);
+/* Asks the server for a chain of transforms */
+void Handshake(int sockfd, const char *chain, int verbose);
+/* UDP mode */
+void UdpInteractive(int sockfd);
+void UdpStream(int sockfd, const char *path);
+int UdpExchange(int sockfd, UdpRequest *request);
+void SendRequest(int sockfd, UdpRequest *request);
+ssize_t ReceiveReply(int sockfd, char *reply);
+size_t NextRequest(int fd, char *text);
+double Now();
 
 int main(int argc, char **argv) {
 
-	if (argc != 3) {
-		perror("<Server Address> <Server Port>");
+	const char *streamPath = NULL, *chain = NULL, *sizes = "64-1024";
+	int udp = 0, connections = 0, inFlight = 8, utf8 = 0;
+	double seconds = 5;
+	int opt;
+	while ((opt = getopt(argc, argv, "f:p:uc:k:s:d:U")) != -1) {
+		switch (opt) {
+		case 'f': streamPath = optarg; break;
+		case 'p': chain = optarg; break;
+		case 'u': udp = 1; break;
+		case 'c': connections = atoi(optarg); break;
+		case 'k': inFlight = atoi(optarg); break;
+		case 's': sizes = optarg; break;
+		case 'd': seconds = atof(optarg); break;
+		case 'U': utf8 = 1; break;
+		default:
+			argc = 0; // print usage below
+		}
+	}
+
+	if (argc - optind != 2 || (udp && chain != NULL) || (connections > 0 && (udp || streamPath != NULL || inFlight < 1))) {
+		perror("[-p <stage>,... | -u] [-f <file>|-] [-c <connections> [-k <in flight>] [-s <sizes>] [-d <seconds>] [-U]] <Server Address> <Server Port>");
 		exit(-1);
 	}
 	
-	char *servIP = argv[1];
+	char *servIP = argv[optind];
 	
 	// Set port number as given by user or as default 12345
 	// in_port_t servPort = (argc == 3) ? atoi(argv[2]) : 12345;
 	
 	// Set port number as user specifies
-	in_port_t servPort = atoi(argv[2]);
-	
-	//Creat a socket
-	int sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-	if (sockfd < 0) {
-		perror("socket() failed");
-		exit(-1);
-	}
+	in_port_t servPort = atoi(argv[optind + 1]);
 	
 	// Set the server address
 	struct sockaddr_in servAddr;
@@ -41,12 +162,45 @@ int main(int argc, char **argv) {
 		exit(-1);
 	}
 	servAddr.sin_port = htons(servPort);
+
+	// Load the server from many connections instead
+	if (connections > 0) {
+		Benchmark(&servAddr, chain != NULL ? chain : "swap", connections, inFlight, sizes, seconds, utf8);
+		exit(0);
+	}
 	
-	// Connect to server
+	//Creat a socket
+	int sockfd = udp ? socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP) : socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (sockfd < 0) {
+		perror("socket() failed");
+		exit(-1);
+	}
+	
+	// Connect to server, for UDP only the address datagrams go to and come from
 	if (connect(sockfd, (struct sockaddr *) &servAddr, sizeof(servAddr)) < 0) {
 		perror("connect() failed");
 		exit(-1);
 	}
+
+	if (udp) {
+		if (streamPath != NULL) {
+			UdpStream(sockfd, streamPath);
+		} else {
+			UdpInteractive(sockfd);
+		}
+		close(sockfd);
+		exit(0);
+	}
+
+	if (chain != NULL) {
+		Handshake(sockfd, chain, 1);
+	}
+
+	if (streamPath != NULL) {
+		StreamFile(sockfd, streamPath);
+		close(sockfd);
+		exit(0);
+	}
 	
 	// Loopaction
 	while(1) {
@@ -71,10 +225,10 @@ int main(int argc, char **argv) {
 			exit(-1);
 		}
 
-		// Receive string from server
-		unsigned int totalRecvLen = 0;
+		// Receive string from server, a line for a line: squeezing may shorten it
+		int lineDone = (echoStringLen == 0 || echoString[echoStringLen - 1] != '\n'); // the rest of a long line comes later
         fputs("Received: ", stdout);
-		while (totalRecvLen < echoStringLen) {
+		while (!lineDone) {
 			char buffer[BUFSIZE];
 			memset(buffer, 0, BUFSIZE);
 			ssize_t recvLen = recv(sockfd, buffer, BUFSIZE - 1, 0);
@@ -86,7 +240,7 @@ int main(int argc, char **argv) {
 				exit(-1);
 			}
 
-			totalRecvLen += recvLen;
+			lineDone = (buffer[recvLen - 1] == '\n');
 			buffer[recvLen] = '\n';
 			fputs(buffer, stdout);	
 		}
@@ -95,3 +249,951 @@ int main(int argc, char **argv) {
 	close(sockfd);
 	exit(0);
 }
+
+/* Reading the file, sending, receiving and writing stdout overlap, so the file can be of
+ * any length: the client shuts down its side at the end of the file and the server closes
+ * the connection once it has sent everything back. */
+void StreamFile(int sockfd, const char *path)
+{
+    int fd = STDIN_FILENO;
+    if( strcmp(path, "-") != 0 && (fd = open(path, O_RDONLY)) < 0 )
+    {
+        perror("open() failed");
+        exit(-1);
+    }
+
+    static char outBuf[STREAM_CHUNK], inBuf[STREAM_CHUNK];
+    size_t outStart = 0, outLen = 0;
+    int fileDone = 0;
+    unsigned long long sentTotal = 0, recvTotal = 0;
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    while( 1 )
+    {
+        // Refill from the file once the previous chunk is sent
+        if( outLen == 0 && !fileDone )
+        {
+            ssize_t readLen = read(fd, outBuf, STREAM_CHUNK);
+            if( readLen < 0 )
+            {
+                if( errno == EINTR )
+                    continue;
+                perror("read() failed");
+                exit(-1);
+            }
+            outStart = 0;
+            outLen = readLen;
+            if( readLen == 0 )
+            {
+                fileDone = 1;
+                shutdown(sockfd, SHUT_WR);
+            }
+        }
+
+        struct pollfd pfd;
+        pfd.fd = sockfd;
+        pfd.events = POLLIN | (outLen > 0 ? POLLOUT : 0);
+        if( poll(&pfd, 1, -1) < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+            perror("poll() failed");
+            exit(-1);
+        }
+
+        if( pfd.revents & POLLOUT )
+        {
+            ssize_t sentLen = send(sockfd, outBuf + outStart, outLen, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if( sentLen < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+            {
+                perror("send() failed");
+                exit(-1);
+            }
+            if( sentLen > 0 )
+            {
+                outStart += sentLen;
+                outLen -= sentLen;
+                sentTotal += sentLen;
+            }
+        }
+
+        if( pfd.revents & (POLLIN | POLLHUP | POLLERR) )
+        {
+            ssize_t recvLen = recv(sockfd, inBuf, STREAM_CHUNK, MSG_DONTWAIT);
+            if( recvLen < 0 )
+            {
+                if( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR )
+                    continue;
+                perror("recv() failed");
+                exit(-1);
+            }
+            if( recvLen == 0 )
+                break;
+
+            ssize_t written = 0;
+            while( written < recvLen )
+            {
+                ssize_t writeLen = write(STDOUT_FILENO, inBuf + written, recvLen - written);
+                if( writeLen < 0 && errno != EINTR )
+                {
+                    perror("write() failed");
+                    exit(-1);
+                }
+                if( writeLen > 0 )
+                    written += writeLen;
+            }
+            recvTotal += recvLen;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    // The reply may be shorter than the file, the server only hangs up early on errors
+    if( !fileDone )
+    {
+        fprintf(stderr, "Connection closed after %llu bytes sent\n", sentTotal);
+        exit(-1);
+    }
+    fprintf(stderr, "Streamed %llu bytes in %.3f s, %.1f MB/s, %llu bytes back\n",
+            sentTotal, seconds, seconds > 0 ? sentTotal / seconds / 1e6 : 0.0, recvTotal);
+    if( fd != STDIN_FILENO )
+        close(fd);
+}
+
+/* Sends "PIPELINE <chain>" and waits for the reply line, "OK <stages>" or "ERR <reason>" */
+void Handshake(int sockfd, const char *chain, int verbose)
+{
+    char line[BUFSIZE];
+    int len = snprintf(line, sizeof(line), "PIPELINE %s\n", chain);
+    if( len >= (int)sizeof(line) )
+    {
+        fputs("Chain too long\n", stderr);
+        exit(-1);
+    }
+    if( send(sockfd, line, len, 0) != len )
+    {
+        perror("send() failed");
+        exit(-1);
+    }
+
+    // One byte at a time, so that nothing after the reply is taken
+    for( len = 0; len < (int)sizeof(line) - 1; len++ )
+    {
+        ssize_t recvLen = recv(sockfd, line + len, 1, 0);
+        if( recvLen <= 0 )
+        {
+            perror("recv() connection closed during handshake");
+            exit(-1);
+        }
+        if( line[len] == '\n' )
+            break;
+    }
+    line[len] = '\0';
+    if( strncmp(line, "OK", 2) != 0 )
+    {
+        fprintf(stderr, "Server refused the chain: %s\n", line);
+        exit(-1);
+    }
+    if( verbose )
+        fprintf(stderr, "Chain: %s\n", line[2] == ' ' ? line + 3 : "none");
+}
+
+/* Type string, wait for its reply, as over TCP; a lost datagram is sent again */
+void UdpInteractive(int sockfd)
+{
+    static UdpRequest request;
+    uint32_t id = 0;
+
+    while( 1 )
+    {
+        printf("Type string: ");
+        char *text = request.text + UDP_HEADER;
+        memset(text, 0, BUFSIZE);
+        fgets(text, BUFSIZE, stdin);
+        if( strncmp(text, "BYE", 3) == 0 )
+            break;
+
+        request.id = ++id;
+        request.len = strlen(text);
+        request.tries = 0;
+        if( !UdpExchange(sockfd, &request) )
+        {
+            puts("No reply from server");
+            continue;
+        }
+        fputs("Received: ", stdout);
+        fwrite(request.reply + UDP_HEADER, 1, request.replyLen, stdout);
+        if( request.replyLen == 0 || request.reply[UDP_HEADER + request.replyLen - 1] != '\n' )
+            putchar('\n');
+    }
+}
+
+/* Sends a request until its reply comes back or it has been tried UDP_TRIES times.
+ * Returns 1 with the reply in the request, 0 when there was none. */
+int UdpExchange(int sockfd, UdpRequest *request)
+{
+    while( request->tries < UDP_TRIES )
+    {
+        SendRequest(sockfd, request);
+        double timeout = UDP_TIMEOUT * (1 << (request->tries - 1));
+        double left;
+        while( (left = request->sentAt + timeout - Now()) > 0 )
+        {
+            struct pollfd pfd;
+            pfd.fd = sockfd;
+            pfd.events = POLLIN;
+            if( poll(&pfd, 1, (int)(left * 1000) + 1) <= 0 )
+                continue;
+            ssize_t recvLen = ReceiveReply(sockfd, request->reply);
+            // Replies to earlier tries of earlier requests are late, not this one's
+            if( recvLen >= UDP_HEADER && memcmp(request->reply, request->text, UDP_HEADER) == 0 )
+            {
+                request->replyLen = recvLen - UDP_HEADER;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Sends the lines of a file as requests, up to UDP_WINDOW of them in flight, and writes the
+ * replies to stdout in the order of the file. A request without a reply is sent again once
+ * its timeout passes, the timeout doubling each time. */
+void UdpStream(int sockfd, const char *path)
+{
+    int fd = STDIN_FILENO;
+    if( strcmp(path, "-") != 0 && (fd = open(path, O_RDONLY)) < 0 )
+    {
+        perror("open() failed");
+        exit(-1);
+    }
+
+    static UdpRequest window[UDP_WINDOW];
+    static char reply[UDP_MAX_REPLY];
+    uint32_t nextId = 1, oldest = 1, id;    // ids number the requests, the window holds [oldest, nextId)
+    size_t windowBytes = 0;
+    int fileDone = 0;
+    unsigned long long retransmits = 0, sentBytes = 0, recvBytes = 0;
+    double begin = Now();
+
+    int bufferSize = 4 * 1024 * 1024;
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
+    while( !fileDone || oldest != nextId )
+    {
+        // Keep the window full
+        while( !fileDone && nextId - oldest < UDP_WINDOW && (windowBytes < UDP_WINDOW_BYTES || oldest == nextId) )
+        {
+            UdpRequest *request = &window[nextId % UDP_WINDOW];
+            request->len = NextRequest(fd, request->text + UDP_HEADER);
+            if( request->len == 0 )
+            {
+                fileDone = 1;
+                break;
+            }
+            request->id = nextId++;
+            request->replyLen = -1;
+            request->tries = 0;
+            SendRequest(sockfd, request);
+            sentBytes += request->len;
+            windowBytes += request->len;
+        }
+
+        // Wait for replies until the next retransmission is due
+        double now = Now(), due = now + UDP_TIMEOUT;
+        for( id = oldest; id != nextId; id++ )
+        {
+            UdpRequest *request = &window[id % UDP_WINDOW];
+            double timeout = request->sentAt + UDP_TIMEOUT * (1 << (request->tries - 1));
+            if( request->replyLen < 0 && timeout < due )
+                due = timeout;
+        }
+        struct pollfd pfd;
+        pfd.fd = sockfd;
+        pfd.events = POLLIN;
+        if( oldest != nextId && poll(&pfd, 1, due > now ? (int)((due - now) * 1000) + 1 : 0) > 0 )
+        {
+            ssize_t recvLen;
+            while( (recvLen = ReceiveReply(sockfd, reply)) >= UDP_HEADER )
+            {
+                id = ((uint32_t)(unsigned char)reply[0] << 24) | ((uint32_t)(unsigned char)reply[1] << 16) |
+                     ((uint32_t)(unsigned char)reply[2] << 8) | (unsigned char)reply[3];
+                UdpRequest *request = &window[id % UDP_WINDOW];
+                if( id - oldest >= nextId - oldest || request->id != id || request->replyLen >= 0 )
+                    continue;   // a duplicate, or late for a request done with
+                memcpy(request->reply, reply, recvLen);
+                request->replyLen = recvLen - UDP_HEADER;
+            }
+        }
+
+        // Write out the replies that are next in order
+        while( oldest != nextId && window[oldest % UDP_WINDOW].replyLen >= 0 )
+        {
+            UdpRequest *request = &window[oldest % UDP_WINDOW];
+            if( write(STDOUT_FILENO, request->reply + UDP_HEADER, request->replyLen) != request->replyLen )
+            {
+                perror("write() failed");
+                exit(-1);
+            }
+            recvBytes += request->replyLen;
+            windowBytes -= request->len;
+            oldest++;
+        }
+
+        // Ask again for the overdue ones
+        now = Now();
+        for( id = oldest; id != nextId; id++ )
+        {
+            UdpRequest *request = &window[id % UDP_WINDOW];
+            if( request->replyLen >= 0 || now < request->sentAt + UDP_TIMEOUT * (1 << (request->tries - 1)) )
+                continue;
+            if( request->tries == UDP_TRIES )
+            {
+                fprintf(stderr, "No reply to request %u after %d tries\n", id, UDP_TRIES);
+                exit(-1);
+            }
+            SendRequest(sockfd, request);
+            retransmits++;
+        }
+    }
+
+    double seconds = Now() - begin;
+    fprintf(stderr, "%u requests, %llu bytes in %.3f s, %.0f requests/s, %llu retransmitted, %llu bytes back\n",
+            nextId - 1, sentBytes, seconds, seconds > 0 ? (nextId - 1) / seconds : 0.0, retransmits, recvBytes);
+    if( fd != STDIN_FILENO )
+        close(fd);
+}
+
+/* Sends the request under its id, counting the try */
+void SendRequest(int sockfd, UdpRequest *request)
+{
+    int i;
+    for( i = 0; i < UDP_HEADER; i++ )
+        request->text[i] = (char)(request->id >> (24 - 8 * i));
+    if( send(sockfd, request->text, UDP_HEADER + request->len, 0) < 0 && errno != ECONNREFUSED )
+    {
+        perror("send() failed");
+        exit(-1);
+    }
+    request->sentAt = Now();
+    request->tries++;
+}
+
+/* Takes one reply if there is one, returns its length or -1 */
+ssize_t ReceiveReply(int sockfd, char *reply)
+{
+    ssize_t recvLen = recv(sockfd, reply, UDP_MAX_REPLY, MSG_DONTWAIT);
+    if( recvLen < 0 && errno == ECONNREFUSED )
+    {
+        // Port unreachable: nothing listens there, at least not yet
+        return -1;
+    }
+    if( recvLen < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+    {
+        perror("recv() failed");
+        exit(-1);
+    }
+    return recvLen;
+}
+
+/* Reads the next request from the file: a line, or of a longer one as much as fits in a
+ * datagram without cutting a UTF-8 character. Returns 0 at the end of the file. */
+size_t NextRequest(int fd, char *text)
+{
+    static char buffer[2 * UDP_MAX_TEXT];
+    static size_t start = 0, len = 0;
+    static int eof = 0;
+
+    // Enough to see the byte after a full datagram
+    if( len <= UDP_MAX_TEXT && !eof )
+    {
+        memmove(buffer, buffer + start, len);
+        start = 0;
+        while( len <= UDP_MAX_TEXT && !eof )
+        {
+            ssize_t readLen = read(fd, buffer + len, sizeof(buffer) - len);
+            if( readLen < 0 && errno != EINTR )
+            {
+                perror("read() failed");
+                exit(-1);
+            }
+            eof = readLen == 0;
+            if( readLen > 0 )
+                len += readLen;
+        }
+    }
+
+    size_t n = len < UDP_MAX_TEXT ? len : UDP_MAX_TEXT;
+    char *newline = memchr(buffer + start, '\n', n);
+    if( newline != NULL )
+        n = newline - (buffer + start) + 1;
+    else if( n < len )
+    {
+        // Don't leave a continuation byte at the front of the next request
+        while( n > UDP_MAX_TEXT - 4 && (buffer[start + n] & 0xc0) == 0x80 )
+            n--;
+    }
+    memcpy(text, buffer + start, n);
+    start += n;
+    len -= n;
+    return n;
+}
+
+double Now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+/* Keeps inFlight requests on each of noConnections connections until seconds have passed,
+ * then waits for the last replies and prints the rates and the latencies, from handing a
+ * request to the socket to the last byte of its reply. Any reply that differs from the
+ * chain applied here ends the run. */
+void Benchmark(struct sockaddr_in *servAddr, const char *chain, int noConnections, int inFlight,
+               const char *sizes, double seconds, int utf8)
+{
+    int stages[NO_STAGE_NAMES * 4], noStages = 0, reverse = 0, i;
+    BenchSize sizeList[BENCH_MAX_SIZES];
+    char spec[BUFSIZE], *name, *save;
+
+    // The chain the server is asked for, to apply the same here
+    snprintf(spec, sizeof(spec), "%s", chain);
+    for( name = strtok_r(spec, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save) )
+    {
+        for( i = 0; i < (int)NO_STAGE_NAMES && strcmp(name, stageNames[i]) != 0; i++ )
+            ;
+        if( i == (int)NO_STAGE_NAMES || noStages == (int)(sizeof(stages) / sizeof(stages[0])) )
+        {
+            fprintf(stderr, "Unknown stage %s, or too many\n", name);
+            exit(-1);
+        }
+        stages[noStages++] = i;
+        reverse |= i == STAGE_REVERSE;
+    }
+    int noSizes = ParseSizes(sizes, sizeList);
+    if( noSizes == 0 )
+    {
+        fprintf(stderr, "Bad sizes %s, expected <bytes>[-<bytes>][:<weight>],...\n", sizes);
+        exit(-1);
+    }
+    for( i = 0; reverse && i < noSizes; i++ )
+        if( sizeList[i].max > BENCH_MAX_REVERSE )
+        {
+            fprintf(stderr, "Sizes up to %d bytes with reverse, the server reverses longer lines in pieces\n",
+                    BENCH_MAX_REVERSE);
+            exit(-1);
+        }
+
+    static BenchRequest pool[BENCH_POOL];
+    int poolSize = 0;
+    size_t poolBytes = 0;
+    while( poolSize < BENCH_POOL && poolBytes < BENCH_POOL_BYTES )
+    {
+        MakeRequest(&pool[poolSize], sizeList, noSizes, stages, noStages, utf8);
+        poolBytes += pool[poolSize++].len;
+    }
+
+    BenchConnection *conns = calloc(noConnections, sizeof(BenchConnection));
+    struct pollfd *pfds = calloc(noConnections, sizeof(struct pollfd));
+    static BenchStats stats;
+    if( conns == NULL || pfds == NULL )
+    {
+        perror("calloc() failed");
+        exit(-1);
+    }
+    for( i = 0; i < noConnections; i++ )
+    {
+        BenchConnection *conn = &conns[i];
+        conn->sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if( conn->sock < 0 )
+        {
+            perror("socket() failed");
+            exit(-1);
+        }
+        if( connect(conn->sock, (struct sockaddr *) servAddr, sizeof(*servAddr)) < 0 )
+        {
+            perror("connect() failed");
+            exit(-1);
+        }
+        Handshake(conn->sock, chain, i == 0);
+        int on = 1;
+        setsockopt(conn->sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        fcntl(conn->sock, F_SETFL, fcntl(conn->sock, F_GETFL, 0) | O_NONBLOCK);
+        conn->queue = malloc(inFlight * sizeof(BenchRequest *));
+        conn->issuedAt = malloc(inFlight * sizeof(double));
+        if( conn->queue == NULL || conn->issuedAt == NULL )
+        {
+            perror("malloc() failed");
+            exit(-1);
+        }
+        pfds[i].fd = conn->sock;
+    }
+    fprintf(stderr, "%d connections, %d requests in flight on each, sizes %s, %d distinct requests\n",
+            noConnections, inFlight, sizes, poolSize);
+
+    double begin = Now(), end = begin + seconds;
+    int issuing = 1, busy = noConnections;
+    for( i = 0; i < noConnections; i++ )
+        while( conns[i].count < inFlight )
+            IssueRequest(&conns[i], inFlight, pool, poolSize);
+
+    while( busy > 0 )
+    {
+        for( i = 0; i < noConnections; i++ )
+            pfds[i].events = conns[i].count > 0 ? POLLIN | (conns[i].unsent > 0 ? POLLOUT : 0) : 0;
+        double left = end - Now();
+        if( poll(pfds, noConnections, !issuing ? -1 : left > 0 ? (int)(left * 1000) + 1 : 0) < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+            perror("poll() failed");
+            exit(-1);
+        }
+        if( issuing && Now() >= end )
+            issuing = 0;
+
+        busy = 0;
+        for( i = 0; i < noConnections; i++ )
+        {
+            BenchConnection *conn = &conns[i];
+            if( pfds[i].revents & (POLLIN | POLLHUP | POLLERR) )
+                CheckReplies(conn, inFlight, pool, poolSize, issuing, &stats);
+            // Replies make room for new requests, send them right away
+            if( conn->unsent > 0 )
+                SendRequests(conn, inFlight);
+            busy += conn->count > 0;
+        }
+    }
+
+    double elapsed = Now() - begin;
+    for( i = 0; i < noConnections; i++ )
+    {
+        close(conns[i].sock);
+        free(conns[i].queue);
+        free(conns[i].issuedAt);
+    }
+    free(conns);
+    free(pfds);
+
+    fprintf(stderr, "%llu requests in %.3f s: %.0f requests/s, %.1f MB/s out, %.1f MB/s back\n",
+            stats.done, elapsed, stats.done / elapsed, stats.sentBytes / elapsed / 1e6, stats.recvBytes / elapsed / 1e6);
+    PrintLatencies(&stats);
+}
+
+/* Reads <bytes>[-<bytes>][:<weight>],... returns the number of sizes, 0 when spec is bad */
+int ParseSizes(const char *spec, BenchSize *sizes)
+{
+    int noSizes = 0;
+    const char *p = spec;
+
+    while( *p != '\0' && noSizes < BENCH_MAX_SIZES )
+    {
+        char *next;
+        BenchSize *size = &sizes[noSizes++];
+        size->min = size->max = strtoul(p, &next, 10);
+        if( *next == '-' )
+            size->max = strtoul(next + 1, &next, 10);
+        size->weight = 1;
+        if( *next == ':' )
+            size->weight = strtoul(next + 1, &next, 10);
+        if( next == p || size->min < 1 || size->max < size->min || size->max > BENCH_MAX_SIZE || size->weight == 0 )
+            return 0;
+        if( *next == ',' )
+            next++;
+        else if( *next != '\0' )
+            return 0;
+        p = next;
+    }
+    return *p == '\0' ? noSizes : 0;
+}
+
+/* A line of random words and blanks, some of the letters beyond ASCII with utf8, of a size
+ * drawn from the list, and the reply the chain should give for it */
+void MakeRequest(BenchRequest *request, const BenchSize *sizes, int noSizes, const int *chain, int noStages, int utf8)
+{
+    static const char *letters[] = { "é", "Ä", "ß", "Σ", "ω", "ж", "Щ", "ա", "ǅ", "ſ", "K", "ⓐ", "ɐ", "中", "𐐀", "𐑍" };
+    static const char punctuation[] = "0123456789.,;:!?-'\"()";
+    unsigned totalWeight = 0;
+    int i;
+
+    for( i = 0; i < noSizes; i++ )
+        totalWeight += sizes[i].weight;
+    unsigned pick = Random() % totalWeight;
+    for( i = 0; pick >= sizes[i].weight; i++ )
+        pick -= sizes[i].weight;
+    size_t len = sizes[i].min + Random() % (sizes[i].max - sizes[i].min + 1);
+
+    request->text = malloc(len);
+    request->expect = malloc(2 * len);
+    if( request->text == NULL || request->expect == NULL )
+    {
+        perror("malloc() failed");
+        exit(-1);
+    }
+    size_t at = 0;
+    while( at < len - 1 )
+    {
+        unsigned kind = Random() % 100;
+        const char *letter = letters[Random() % (sizeof(letters) / sizeof(letters[0]))];
+        if( utf8 && kind < 10 && strlen(letter) <= len - 1 - at )
+        {
+            memcpy(request->text + at, letter, strlen(letter));
+            at += strlen(letter);
+        }
+        else if( kind < 25 )
+            request->text[at++] = kind % 5 == 0 ? '\t' : ' ';
+        else if( kind < 30 )
+            request->text[at++] = punctuation[Random() % (sizeof(punctuation) - 1)];
+        else
+            request->text[at++] = (Random() % 2 ? 'a' : 'A') + Random() % 26;
+    }
+    request->text[at] = '\n';
+    request->len = len;
+    request->expectLen = ApplyChain(chain, noStages, request->text, len, request->expect);
+}
+
+/* The chain applied to a line of valid UTF-8, the newline at its end left where it is.
+ * On one line the stages commute: the case stages never make or take a blank, so the
+ * code points are mapped first, then squeezed, then reversed. */
+size_t ApplyChain(const int *chain, int noStages, const char *text, size_t len, char *out)
+{
+    int squeeze = 0, reverse = 0, s;
+    size_t i, outLen = 0;
+    char *work = malloc(2 * len);
+    if( work == NULL )
+    {
+        perror("malloc() failed");
+        exit(-1);
+    }
+
+    for( s = 0; s < noStages; s++ )
+    {
+        squeeze |= chain[s] == STAGE_SQUEEZE;
+        reverse |= chain[s] == STAGE_REVERSE;
+    }
+    len--;  // the newline
+    for( i = 0; i < len; )
+    {
+        uint32_t cp;
+        i += DecodeUTF8((const unsigned char *)text + i, len - i, &cp);
+        for( s = 0; s < noStages; s++ )
+            cp = MapCodePoint(chain[s], cp);
+        if( squeeze && (cp == ' ' || cp == '\t' || cp == '\v' || cp == '\f') )
+        {
+            if( outLen > 0 && work[outLen - 1] == ' ' )
+                continue;
+            cp = ' ';
+        }
+        outLen += EncodeUTF8(cp, work + outLen);
+    }
+
+    if( !reverse )
+        memcpy(out, work, outLen);
+    else
+    {
+        // Character by character from the back
+        size_t end = outLen;
+        for( i = 0; i < outLen; )
+        {
+            size_t start = end;
+            while( start > 0 && ((unsigned char)work[--start] & 0xc0) == 0x80 )
+                ;
+            memcpy(out + i, work + start, end - start);
+            i += end - start;
+            end = start;
+        }
+    }
+    out[outLen++] = '\n';
+    free(work);
+    return outLen;
+}
+
+/* One stage on a code point: the byte-wise stages on ASCII, the Unicode simple case
+ * mappings beyond, the swap taking the upper case when there is one, as on the server */
+uint32_t MapCodePoint(int stage, uint32_t cp)
+{
+    if( cp < 0x80 )
+    {
+        int upper = cp >= 'A' && cp <= 'Z', lower = cp >= 'a' && cp <= 'z';
+        switch( stage )
+        {
+        case STAGE_SWAP:  return upper ? cp + 32 : lower ? cp - 32 : cp;
+        case STAGE_UPPER: return lower ? cp - 32 : cp;
+        case STAGE_LOWER: return upper ? cp + 32 : cp;
+        case STAGE_ROT13:
+            if( upper || lower )
+                return (cp & 0x20) | ((((cp & ~0x20) - 'A' + 13) % 26) + 'A');
+            return cp;
+        }
+        return cp;
+    }
+    if( cp >= CASEMAP_LIMIT || (stage != STAGE_SWAP && stage != STAGE_UPPER && stage != STAGE_LOWER) )
+        return cp;
+    uint32_t upper = cp + caseBlocks[upperIndex[cp >> CASEMAP_SHIFT]][cp & (CASEMAP_BLOCK - 1)];
+    uint32_t lower = cp + caseBlocks[lowerIndex[cp >> CASEMAP_SHIFT]][cp & (CASEMAP_BLOCK - 1)];
+    if( stage == STAGE_UPPER )
+        return upper;
+    if( stage == STAGE_LOWER )
+        return lower;
+    return upper != cp ? upper : lower;
+}
+
+/* Decodes the sequence at text, returns its length */
+size_t DecodeUTF8(const unsigned char *text, size_t len, uint32_t *cp)
+{
+    if( text[0] < 0xc0 || len < 2 )
+    {
+        *cp = text[0];
+        return 1;
+    }
+    if( text[0] < 0xe0 )
+    {
+        *cp = ((text[0] & 0x1f) << 6) | (text[1] & 0x3f);
+        return 2;
+    }
+    if( text[0] < 0xf0 )
+    {
+        *cp = ((text[0] & 0x0f) << 12) | ((text[1] & 0x3f) << 6) | (text[2] & 0x3f);
+        return 3;
+    }
+    *cp = ((text[0] & 0x07) << 18) | ((text[1] & 0x3f) << 12) | ((text[2] & 0x3f) << 6) | (text[3] & 0x3f);
+    return 4;
+}
+
+size_t EncodeUTF8(uint32_t cp, char *dst)
+{
+    unsigned char *out = (unsigned char *)dst;
+
+    if( cp < 0x80 )
+    {
+        out[0] = cp;
+        return 1;
+    }
+    if( cp < 0x800 )
+    {
+        out[0] = 0xc0 | (cp >> 6);
+        out[1] = 0x80 | (cp & 0x3f);
+        return 2;
+    }
+    if( cp < 0x10000 )
+    {
+        out[0] = 0xe0 | (cp >> 12);
+        out[1] = 0x80 | ((cp >> 6) & 0x3f);
+        out[2] = 0x80 | (cp & 0x3f);
+        return 3;
+    }
+    out[0] = 0xf0 | (cp >> 18);
+    out[1] = 0x80 | ((cp >> 12) & 0x3f);
+    out[2] = 0x80 | ((cp >> 6) & 0x3f);
+    out[3] = 0x80 | (cp & 0x3f);
+    return 4;
+}
+
+/* Puts a request from the pool at the back of the connection's queue */
+void IssueRequest(BenchConnection *conn, int inFlight, BenchRequest *pool, int poolSize)
+{
+    int slot = (conn->head + conn->count) % inFlight;
+    conn->queue[slot] = &pool[Random() % poolSize];
+    conn->count++;
+    conn->unsent++;
+}
+
+/* Sends the requests not yet sent, as many as the socket takes, up to BENCH_IOV at a time.
+ * A request's latency counts from when its first byte is taken. */
+void SendRequests(BenchConnection *conn, int inFlight)
+{
+    while( conn->unsent > 0 )
+    {
+        struct iovec iov[BENCH_IOV];
+        int first = conn->head + conn->count - conn->unsent, n;
+        for( n = 0; n < conn->unsent && n < BENCH_IOV; n++ )
+        {
+            BenchRequest *request = conn->queue[(first + n) % inFlight];
+            size_t skip = n == 0 ? conn->sentLen : 0;
+            iov[n].iov_base = request->text + skip;
+            iov[n].iov_len = request->len - skip;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+        ssize_t sentLen = sendmsg(conn->sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if( sentLen < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+            if( errno == EAGAIN || errno == EWOULDBLOCK )
+                return;
+            perror("send() failed");
+            exit(-1);
+        }
+
+        double now = Now();
+        while( sentLen > 0 )
+        {
+            int slot = (conn->head + conn->count - conn->unsent) % inFlight;
+            BenchRequest *request = conn->queue[slot];
+            size_t rest = request->len - conn->sentLen;
+            if( conn->sentLen == 0 )
+                conn->issuedAt[slot] = now;
+            if( (size_t)sentLen < rest )
+            {
+                conn->sentLen += sentLen;
+                break;
+            }
+            sentLen -= rest;
+            conn->sentLen = 0;
+            conn->unsent--;
+        }
+    }
+}
+
+/* Checks whatever replies have come in against the expected ones, in the order of the
+ * requests; each one complete makes room for another while issuing */
+void CheckReplies(BenchConnection *conn, int inFlight, BenchRequest *pool, int poolSize, int issuing, BenchStats *stats)
+{
+    static char buffer[STREAM_CHUNK];
+
+    while( 1 )
+    {
+        ssize_t recvLen = recv(conn->sock, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if( recvLen < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+            if( errno == EAGAIN || errno == EWOULDBLOCK )
+                return;
+            perror("recv() failed");
+            exit(-1);
+        }
+        if( recvLen == 0 )
+        {
+            fprintf(stderr, "Server closed a connection with %d requests in flight\n", conn->count);
+            exit(-1);
+        }
+
+        double now = Now();
+        ssize_t at = 0;
+        while( at < recvLen )
+        {
+            if( conn->count == 0 )
+            {
+                fprintf(stderr, "Reply bytes without a request\n");
+                exit(-1);
+            }
+            BenchRequest *request = conn->queue[conn->head];
+            size_t len = request->expectLen - conn->matched;
+            if( len > (size_t)(recvLen - at) )
+                len = recvLen - at;
+            if( memcmp(buffer + at, request->expect + conn->matched, len) != 0 )
+            {
+                size_t i = 0;
+                while( buffer[at + i] == request->expect[conn->matched + i] )
+                    i++;
+                fprintf(stderr, "Wrong reply after %llu requests, byte %zu of %zu: got 0x%02x, expected 0x%02x\n",
+                        stats->done, conn->matched + i, request->expectLen,
+                        (unsigned char)buffer[at + i], (unsigned char)request->expect[conn->matched + i]);
+                exit(-1);
+            }
+            conn->matched += len;
+            at += len;
+            if( conn->matched < request->expectLen )
+                continue;
+
+            double latency = now - conn->issuedAt[conn->head];
+            stats->histogram[LatencyBucket((uint64_t)(latency * 1e9))]++;
+            if( latency > stats->worst )
+                stats->worst = latency;
+            stats->done++;
+            stats->sentBytes += request->len;
+            stats->recvBytes += request->expectLen;
+            conn->matched = 0;
+            conn->head = (conn->head + 1) % inFlight;
+            conn->count--;
+            if( issuing )
+                IssueRequest(conn, inFlight, pool, poolSize);
+        }
+    }
+}
+
+/* HIST_SUB buckets from each power of two nanoseconds on, one per nanosecond below that */
+int LatencyBucket(uint64_t ns)
+{
+    if( ns < HIST_SUB )
+        return ns;
+    int octave = 63 - __builtin_clzll(ns);
+    int bucket = (octave - 2) * HIST_SUB + ((ns >> (octave - 3)) & (HIST_SUB - 1));
+    return bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1;
+}
+
+uint64_t BucketStart(int bucket)
+{
+    if( bucket < HIST_SUB )
+        return bucket;
+    return (uint64_t)(HIST_SUB + bucket % HIST_SUB) << (bucket / HIST_SUB - 1);
+}
+
+/* Percentiles, from the upper end of their bucket but no more than the worst latency,
+ * and a bar per power of two */
+void PrintLatencies(const BenchStats *stats)
+{
+    static const double percentiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    char from[32], to[32];
+    unsigned long long seen = 0, octaves[HIST_BUCKETS / HIST_SUB] = { 0 }, most = 0;
+    int bucket, p = 0, o;
+
+    if( stats->done == 0 )
+        return;
+    fputs("Latency:", stderr);
+    for( bucket = 0; bucket < HIST_BUCKETS; bucket++ )
+    {
+        seen += stats->histogram[bucket];
+        while( p < (int)(sizeof(percentiles) / sizeof(percentiles[0])) && seen >= percentiles[p] * stats->done )
+        {
+            double upper = BucketStart(bucket + 1) / 1e9;
+            fprintf(stderr, " p%g %s,", percentiles[p++] * 100, FormatSeconds(upper < stats->worst ? upper : stats->worst, from));
+        }
+        octaves[bucket / HIST_SUB] += stats->histogram[bucket];
+    }
+    fprintf(stderr, " max %s\n", FormatSeconds(stats->worst, from));
+
+    for( o = 0; o < HIST_BUCKETS / HIST_SUB; o++ )
+        if( octaves[o] > most )
+            most = octaves[o];
+    for( o = 0; o < HIST_BUCKETS / HIST_SUB; o++ )
+    {
+        if( octaves[o] == 0 )
+            continue;
+        int bar = (int)(50 * octaves[o] / most);
+        fprintf(stderr, "%10s - %-10s %10llu %5.1f%% %.*s\n", FormatSeconds(BucketStart(o * HIST_SUB) / 1e9, from),
+                FormatSeconds(BucketStart((o + 1) * HIST_SUB) / 1e9, to), octaves[o],
+                100.0 * octaves[o] / stats->done, bar > 0 ? bar : 1,
+                "##################################################");
+    }
+}
+
+const char *FormatSeconds(double seconds, char *buffer)
+{
+    if( seconds < 1e-6 )
+        sprintf(buffer, "%.0f ns", seconds * 1e9);
+    else if( seconds < 1e-3 )
+        sprintf(buffer, "%.1f us", seconds * 1e6);
+    else if( seconds < 1 )
+        sprintf(buffer, "%.2f ms", seconds * 1e3);
+    else
+        sprintf(buffer, "%.2f s", seconds);
+    return buffer;
+}
+
+/* xorshift64*, the same sequence every run so that runs compare */
+uint64_t Random()
+{
+    static uint64_t state = 0x9e3779b97f4a7c15ULL;
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1dULL;
+}
@@ -0,0 +1,699 @@
+/* Unicode simple case mappings, generated by gencasemap.c - do not edit.
+ * 2883 mappings, 77 distinct blocks of 128 deltas. */
+#ifndef CASEMAP_H
+#define CASEMAP_H
+
+#include <stdint.h>
+
+#define CASEMAP_SHIFT 7
+#define CASEMAP_BLOCK 128
+#define CASEMAP_LIMIT 0x1E980
+
+static const uint8_t upperIndex[CASEMAP_LIMIT >> CASEMAP_SHIFT] = {
+    1,3,5,7,9,11,12,14,16,18,20,22,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,23,0,0,0,0,0,25,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,27,29,30,31,33,35,37,
+    0,0,39,41,0,0,0,0,0,43,0,0,0,0,0,0,0,0,0,0,0,0,0,0,45,47,49,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,50,52,54,56,0,0,0,0,0,0,58,59,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,60,0,
+    0,0,0,0,0,0,0,0,62,64,0,67,0,0,0,0,0,0,0,0,0,0,0,0,0,69,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,71,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,73,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,75
+};
+
+static const uint8_t lowerIndex[CASEMAP_LIMIT >> CASEMAP_SHIFT] = {
+    2,4,6,8,10,0,13,15,17,19,21,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,24,0,0,0,0,0,26,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,28,0,0,32,34,36,38,
+    0,0,40,42,0,0,0,0,0,44,0,0,0,0,0,0,0,0,0,0,0,0,0,0,46,48,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,51,53,55,57,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,61,0,
+    0,0,0,0,0,0,0,0,63,65,66,68,0,0,0,0,0,0,0,0,0,0,0,0,0,70,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,72,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,74,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,76
+};
+
+static const int32_t caseBlocks[77][CASEMAP_BLOCK] = {
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,
+     -32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,32,32,32,32,32,32,32,32,32,32,32,32,32,32,32,
+     32,32,32,32,32,32,32,32,32,32,32,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,743,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     -32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,
+     -32,-32,-32,-32,-32,-32,-32,0,-32,-32,-32,-32,-32,-32,-32,121},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     32,32,32,32,32,32,32,32,32,32,32,32,32,32,32,32,
+     32,32,32,32,32,32,32,0,32,32,32,32,32,32,32,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-232,0,-1,0,-1,0,-1,0,0,-1,0,-1,0,-1,0,
+     -1,0,-1,0,-1,0,-1,0,-1,0,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,0,-1,0,-1,0,-1,-300},
+    {1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     -199,0,1,0,1,0,1,0,0,1,0,1,0,1,0,1,
+     0,1,0,1,0,1,0,1,0,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,-121,1,0,1,0,1,0,0},
+    {195,0,0,-1,0,-1,0,0,-1,0,0,0,-1,0,0,0,
+     0,0,-1,0,0,97,0,0,0,-1,163,0,0,0,130,0,
+     0,-1,0,-1,0,-1,0,0,-1,0,0,0,0,-1,0,0,
+     -1,0,0,0,-1,0,-1,0,0,-1,0,0,0,-1,0,56,
+     0,0,0,0,0,-1,-2,0,-1,-2,0,-1,-2,0,-1,0,
+     -1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,-79,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,0,-1,-2,0,-1,0,0,0,-1,0,-1,0,-1,0,-1},
+    {0,210,1,0,1,0,206,1,0,205,205,1,0,0,79,202,
+     203,1,0,205,207,0,211,209,1,0,0,0,211,213,0,214,
+     1,0,1,0,1,0,218,1,0,218,0,0,1,0,218,1,
+     0,217,217,1,0,1,0,219,1,0,0,0,1,0,0,0,
+     0,0,0,0,2,1,0,2,1,0,2,1,0,1,0,1,
+     0,1,0,1,0,1,0,1,0,1,0,1,0,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     0,2,1,0,1,0,-97,-56,1,0,1,0,1,0,1,0},
+    {0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,0,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,0,0,0,0,0,0,0,-1,0,0,10815,
+     10815,0,-1,0,0,0,0,-1,0,-1,0,-1,0,-1,0,-1,
+     10783,10780,10782,-210,-206,0,-205,-205,0,-202,0,-203,42319,0,0,0,
+     -205,42315,0,-207,0,42280,42308,0,-209,-211,42308,10743,42305,0,0,-211,
+     0,10749,-213,0,0,-214,0,0,0,0,0,0,0,10727,0,0},
+    {1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     -130,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,0,0,0,0,0,0,10795,1,0,-163,10792,0,
+     0,1,0,-195,69,71,1,0,1,0,1,0,1,0,1,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {-218,0,42307,-218,0,0,0,42282,-218,-69,-217,-217,-71,0,0,0,
+     0,0,-219,0,0,0,0,0,0,0,0,0,0,42261,42258,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,84,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,-1,0,-1,0,0,0,-1,0,0,0,130,130,130,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     1,0,1,0,0,0,1,0,0,0,0,0,0,0,0,116},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,-38,-37,-37,-37,
+     0,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,
+     -32,-32,-31,-32,-32,-32,-32,-32,-32,-32,-32,-32,-64,-63,-63,0,
+     -62,-57,0,0,0,-47,-54,-8,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     -86,-80,7,-116,0,-96,0,0,-1,0,0,-1,0,0,0,0},
+    {0,0,0,0,0,0,38,0,37,37,37,0,64,0,63,63,
+     0,32,32,32,32,32,32,32,32,32,32,32,32,32,32,32,
+     32,32,0,32,32,32,32,32,32,32,32,32,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,8,
+     0,0,0,0,0,0,0,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     0,0,0,0,-60,0,0,1,0,-7,1,0,0,-130,-130,-130},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     -32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,
+     -32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,
+     -80,-80,-80,-80,-80,-80,-80,-80,-80,-80,-80,-80,-80,-80,-80,-80,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1},
+    {80,80,80,80,80,80,80,80,80,80,80,80,80,80,80,80,
+     32,32,32,32,32,32,32,32,32,32,32,32,32,32,32,32,
+     32,32,32,32,32,32,32,32,32,32,32,32,32,32,32,32,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0},
+    {0,-1,0,0,0,0,0,0,0,0,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,-15,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1},
+    {1,0,0,0,0,0,0,0,0,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     15,1,0,1,0,1,0,1,0,1,0,1,0,1,0,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0},
+    {0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,
+     -48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48},
+    {1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     0,48,48,48,48,48,48,48,48,48,48,48,48,48,48,48,
+     48,48,48,48,48,48,48,48,48,48,48,48,48,48,48,48,
+     48,48,48,48,48,48,48,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {-48,-48,-48,-48,-48,-48,-48,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     3008,3008,3008,3008,3008,3008,3008,3008,3008,3008,3008,3008,3008,3008,3008,3008,
+     3008,3008,3008,3008,3008,3008,3008,3008,3008,3008,3008,3008,3008,3008,3008,3008,
+     3008,3008,3008,3008,3008,3008,3008,3008,3008,3008,3008,0,0,3008,3008,3008},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     7264,7264,7264,7264,7264,7264,7264,7264,7264,7264,7264,7264,7264,7264,7264,7264,
+     7264,7264,7264,7264,7264,7264,7264,7264,7264,7264,7264,7264,7264,7264,7264,7264,
+     7264,7264,7264,7264,7264,7264,0,7264,0,0,0,0,0,7264,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,-8,-8,-8,-8,-8,-8,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,
+     38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,
+     38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,
+     38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,
+     38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,38864,
+     8,8,8,8,8,8,0,0,0,0,0,0,0,0,0,0},
+    {-6254,-6253,-6244,-6242,-6242,-6243,-6236,-6181,35266,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     -3008,-3008,-3008,-3008,-3008,-3008,-3008,-3008,-3008,-3008,-3008,-3008,-3008,-3008,-3008,-3008,
+     -3008,-3008,-3008,-3008,-3008,-3008,-3008,-3008,-3008,-3008,-3008,-3008,-3008,-3008,-3008,-3008,
+     -3008,-3008,-3008,-3008,-3008,-3008,-3008,-3008,-3008,-3008,-3008,0,0,-3008,-3008,-3008,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,35332,0,0,0,3814,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,35384,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1},
+    {1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0},
+    {0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,0,0,0,0,-59,0,0,0,0,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1},
+    {1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,0,0,0,0,0,0,0,0,-7615,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0},
+    {8,8,8,8,8,8,8,8,0,0,0,0,0,0,0,0,
+     8,8,8,8,8,8,0,0,0,0,0,0,0,0,0,0,
+     8,8,8,8,8,8,8,8,0,0,0,0,0,0,0,0,
+     8,8,8,8,8,8,8,8,0,0,0,0,0,0,0,0,
+     8,8,8,8,8,8,0,0,0,0,0,0,0,0,0,0,
+     0,8,0,8,0,8,0,8,0,0,0,0,0,0,0,0,
+     8,8,8,8,8,8,8,8,0,0,0,0,0,0,0,0,
+     74,74,86,86,86,86,100,100,128,128,112,112,126,126,0,0},
+    {0,0,0,0,0,0,0,0,-8,-8,-8,-8,-8,-8,-8,-8,
+     0,0,0,0,0,0,0,0,-8,-8,-8,-8,-8,-8,0,0,
+     0,0,0,0,0,0,0,0,-8,-8,-8,-8,-8,-8,-8,-8,
+     0,0,0,0,0,0,0,0,-8,-8,-8,-8,-8,-8,-8,-8,
+     0,0,0,0,0,0,0,0,-8,-8,-8,-8,-8,-8,0,0,
+     0,0,0,0,0,0,0,0,0,-8,0,-8,0,-8,0,-8,
+     0,0,0,0,0,0,0,0,-8,-8,-8,-8,-8,-8,-8,-8,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {8,8,8,8,8,8,8,8,0,0,0,0,0,0,0,0,
+     8,8,8,8,8,8,8,8,0,0,0,0,0,0,0,0,
+     8,8,8,8,8,8,8,8,0,0,0,0,0,0,0,0,
+     8,8,0,9,0,0,0,0,0,0,0,0,0,0,-7205,0,
+     0,0,0,9,0,0,0,0,0,0,0,0,0,0,0,0,
+     8,8,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     8,8,0,0,0,7,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,9,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,-8,-8,-8,-8,-8,-8,-8,-8,
+     0,0,0,0,0,0,0,0,-8,-8,-8,-8,-8,-8,-8,-8,
+     0,0,0,0,0,0,0,0,-8,-8,-8,-8,-8,-8,-8,-8,
+     0,0,0,0,0,0,0,0,-8,-8,-74,-74,-9,0,0,0,
+     0,0,0,0,0,0,0,0,-86,-86,-86,-86,-9,0,0,0,
+     0,0,0,0,0,0,0,0,-8,-8,-100,-100,0,0,0,0,
+     0,0,0,0,0,0,0,0,-8,-8,-112,-112,-7,0,0,0,
+     0,0,0,0,0,0,0,0,-128,-128,-126,-126,-9,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,-28,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     -16,-16,-16,-16,-16,-16,-16,-16,-16,-16,-16,-16,-16,-16,-16,-16},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,-7517,0,0,0,-8383,-8262,0,0,0,0,
+     0,0,28,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     16,16,16,16,16,16,16,16,16,16,16,16,16,16,16,16,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,-1,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     -26,-26,-26,-26,-26,-26,-26,-26,-26,-26,-26,-26,-26,-26,-26,-26,
+     -26,-26,-26,-26,-26,-26,-26,-26,-26,-26,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,26,26,26,26,26,26,26,26,26,26,
+     26,26,26,26,26,26,26,26,26,26,26,26,26,26,26,26,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     -48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,
+     -48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,
+     -48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,-48,
+     0,-1,0,0,0,-10795,-10792,0,-1,0,-1,0,-1,0,0,0,
+     0,0,0,-1,0,0,-1,0,0,0,0,0,0,0,0,0},
+    {48,48,48,48,48,48,48,48,48,48,48,48,48,48,48,48,
+     48,48,48,48,48,48,48,48,48,48,48,48,48,48,48,48,
+     48,48,48,48,48,48,48,48,48,48,48,48,48,48,48,48,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     1,0,-10743,-3814,-10727,0,0,1,0,1,0,1,0,-10780,-10749,-10783,
+     -10782,0,1,0,0,1,0,0,0,0,0,0,0,0,-10815,-10815},
+    {0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,0,0,0,0,0,0,0,-1,0,-1,0,
+     0,0,0,-1,0,0,0,0,0,0,0,0,0,0,0,0},
+    {1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,0,0,0,0,0,0,0,1,0,1,0,0,
+     0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {-7264,-7264,-7264,-7264,-7264,-7264,-7264,-7264,-7264,-7264,-7264,-7264,-7264,-7264,-7264,-7264,
+     -7264,-7264,-7264,-7264,-7264,-7264,-7264,-7264,-7264,-7264,-7264,-7264,-7264,-7264,-7264,-7264,
+     -7264,-7264,-7264,-7264,-7264,-7264,0,-7264,0,0,0,0,0,-7264,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,0,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,0,0,0,0,0,0,0,0,0,-1,0,-1,0,0,-1},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     0,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0,
+     0,0,0,0,0,0,0,0,0,1,0,1,0,-35332,1,0},
+    {0,-1,0,-1,0,-1,0,-1,0,0,0,0,-1,0,0,0,
+     0,-1,0,-1,48,0,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,-1,0,-1,0,-1,0,0,0,0,0,0,
+     0,0,0,0,0,-1,0,-1,0,-1,0,-1,0,-1,0,-1,
+     0,-1,0,-1,0,0,0,0,-1,0,-1,0,0,0,0,0,
+     0,-1,0,0,0,0,0,-1,0,-1,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,-1,0,0,0,0,0,0,0,0,0},
+    {1,0,1,0,1,0,1,0,0,0,0,1,0,-42280,0,0,
+     1,0,1,0,0,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,1,0,1,0,1,0,-42308,-42319,-42315,-42305,-42308,0,
+     -42258,-42282,-42261,928,1,0,1,0,1,0,1,0,1,0,1,0,
+     1,0,1,0,-48,-42307,-35384,1,0,1,0,0,0,0,0,0,
+     1,0,0,0,0,0,1,0,1,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,1,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,-928,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     -38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864},
+    {-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,
+     -38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,
+     -38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,
+     -38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,-38864,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,
+     -32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,32,32,32,32,32,32,32,32,32,32,32,32,32,32,32,
+     32,32,32,32,32,32,32,32,32,32,32,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,-40,-40,-40,-40,-40,-40,-40,-40,
+     -40,-40,-40,-40,-40,-40,-40,-40,-40,-40,-40,-40,-40,-40,-40,-40,
+     -40,-40,-40,-40,-40,-40,-40,-40,-40,-40,-40,-40,-40,-40,-40,-40,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {40,40,40,40,40,40,40,40,40,40,40,40,40,40,40,40,
+     40,40,40,40,40,40,40,40,40,40,40,40,40,40,40,40,
+     40,40,40,40,40,40,40,40,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,-40,-40,-40,-40,-40,-40,-40,-40,
+     -40,-40,-40,-40,-40,-40,-40,-40,-40,-40,-40,-40,-40,-40,-40,-40,
+     -40,-40,-40,-40,-40,-40,-40,-40,-40,-40,-40,-40,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     40,40,40,40,40,40,40,40,40,40,40,40,40,40,40,40,
+     40,40,40,40,40,40,40,40,40,40,40,40,40,40,40,40,
+     40,40,40,40,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     39,39,39,39,39,39,39,39,39,39,39,0,39,39,39,39},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,-39,-39,-39,-39,-39,-39,-39,-39,-39,
+     -39,-39,0,-39,-39,-39,-39,-39,-39,-39,-39,-39,-39,-39,-39,-39,
+     -39,-39,0,-39,-39,-39,-39,-39,-39,-39,0,-39,-39,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {39,39,39,39,39,39,39,39,39,39,39,0,39,39,39,39,
+     39,39,39,0,39,39,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     -64,-64,-64,-64,-64,-64,-64,-64,-64,-64,-64,-64,-64,-64,-64,-64,
+     -64,-64,-64,-64,-64,-64,-64,-64,-64,-64,-64,-64,-64,-64,-64,-64,
+     -64,-64,-64,-64,-64,-64,-64,-64,-64,-64,-64,-64,-64,-64,-64,-64,
+     -64,-64,-64,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+     64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+     64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,64,
+     64,64,64,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     -32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,
+     -32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     32,32,32,32,32,32,32,32,32,32,32,32,32,32,32,32,
+     32,32,32,32,32,32,32,32,32,32,32,32,32,32,32,32,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     -32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,
+     -32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32,-32},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     32,32,32,32,32,32,32,32,32,32,32,32,32,32,32,32,
+     32,32,32,32,32,32,32,32,32,32,32,32,32,32,32,32,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,-34,-34,-34,-34,-34,-34,-34,-34,-34,-34,-34,-34,-34,-34,
+     -34,-34,-34,-34,-34,-34,-34,-34,-34,-34,-34,-34,-34,-34,-34,-34,
+     -34,-34,-34,-34,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+    {34,34,34,34,34,34,34,34,34,34,34,34,34,34,34,34,
+     34,34,34,34,34,34,34,34,34,34,34,34,34,34,34,34,
+     34,34,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0},
+};
+
+#endif
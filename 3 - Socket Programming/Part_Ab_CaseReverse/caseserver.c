@@ -1,35 +1,318 @@
+#define _GNU_SOURCE // recvmmsg(), sendmmsg()
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/types.h>
+#include <sys/select.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define X86_KERNELS 1
+#endif
+#include "casemap.h"
 
-#define BUFSIZE 1024
+#define RINGSIZE (256 * 1024) // Per connection, bounds the memory of a stream of any length
+#define CHUNKSIZE 65536 // Most bytes taken by one recv(), flipped while still in cache
+#define PIPE_BLOCK 16384 // Every pass of a chain runs over this much before the next block
+#define MAX_STAGES 16
+#define MAX_HELLO 512 // Longest handshake line
+#define HELLO "PIPELINE " // Starts the handshake line
+#define UTF8_SLACK (8 * MAX_STAGES) // What case mapping may add to a block besides half its length
+#define UDP_BATCH 64 // Datagrams taken and answered per system call
+#define UDP_HEADER 4 // Request id, sent back with the reply
+#define UDP_MAX_TEXT 32768 // Longest text of a request, the reply may be half as long again
+#define UDP_SLOT (UDP_HEADER + UDP_MAX_TEXT + UDP_MAX_TEXT / 2 + UTF8_SLACK)
+#define OFFLOAD_MIN 32768 // Blocks from this long go to the workers, if there are any
 #define TRUE 1
 #define FALSE 0
 #define DEBUG 0
 
+#define TEST_ROUNDS 100000 // random inputs each kernel is checked on
+#define TEST_STREAM_BYTES (32 * 1024 * 1024) // streamed through the workers to a slow reader
+#define BENCH_BYTES (16 * 1024 * 1024)
+#define BENCH_SECONDS 0.5
+
+/* CPU features a kernel needs */
+#define CPU_SSE2     0x1
+#define CPU_AVX2     0x2
+#define CPU_AVX512BW 0x4
+#define CPU_AVX512VBMI 0x8
+
 static const int MAXPENDING = 5; // Maximum outstanding connection requests
 
+/* Text transforms. A chain of stages compiles into passes: adjacent byte-wise stages fuse
+ * into one 256 byte table, so a chain of them costs a single lookup per byte of ASCII. The
+ * case stages also map the letters beyond ASCII of UTF-8 text, one code point at a time. */
+#define STAGE_BYTE    1 // maps each byte on its own
+#define STAGE_SQUEEZE 2 // runs of blanks become one space
+#define STAGE_REVERSE 3 // reverses each line
+
+/* Unicode simple case mappings, from casemap.h */
+#define CASE_NONE  0
+#define CASE_SWAP  1
+#define CASE_UPPER 2
+#define CASE_LOWER 3
+
+typedef struct {
+    const char *name;
+    int kind;
+    unsigned char (*map)(unsigned char c);  // STAGE_BYTE, for ASCII
+    int caseMap;                            // STAGE_BYTE, CASE_* for the code points beyond
+} Stage;
+
+#define PASS_TABLE   1
+#define PASS_FLIP    2 // the table is the case swap, left to the vector kernel
+#define PASS_SQUEEZE 3
+
+typedef struct {
+    int kind;
+    unsigned char table[256];   // PASS_TABLE
+    bool ascii;                 // the table leaves bytes from 0x80 up as they are
+    bool unicode;               // PASS_TABLE, PASS_FLIP: has case stages, which map UTF-8 too
+    int stages[MAX_STAGES];     // the stages fused, applied in turn to code points beyond ASCII
+    int noStages;
+    unsigned char carry[4];     // a UTF-8 sequence cut off at the end of the last block
+    int carryLen;
+    bool blank;                 // PASS_SQUEEZE: the last byte out was a blank
+} Pass;
+
+typedef struct {
+    Pass passes[MAX_STAGES];
+    int noPasses;
+    bool reverse;               // reversal commutes with the other stages, it's done as lines complete
+    bool unicode;               // some pass maps UTF-8, which may lengthen the text
+    char chain[MAX_HELLO];      // stage names, for the handshake reply
+} Pipeline;
+
+unsigned char SwapByte(unsigned char c);
+unsigned char UpperByte(unsigned char c);
+unsigned char LowerByte(unsigned char c);
+unsigned char Rot13Byte(unsigned char c);
+bool BuildPipeline(Pipeline *pipe, const char *spec, char *error, size_t errorLen);
+void MapBytes(const unsigned char *table, char *buffer, size_t len);
+#ifdef X86_KERNELS
+void MapBytesVBMI(const unsigned char *table, char *buffer, size_t len);
+#endif
+size_t Squeeze(char *buffer, size_t len, bool *blank);
+void MapAscii(Pass *pass, char *buffer, size_t len);
+size_t MapUTF8(Pass *pass, const char *src, size_t len, char *dst, bool last);
+size_t MapSequence(Pass *pass, const unsigned char *seq, size_t len, char *dst);
+int UTF8Length(unsigned char lead);
+size_t EncodeUTF8(uint32_t cp, char *dst);
+uint32_t CaseMap(int caseMap, uint32_t cp);
+bool Carrying(Pipeline *pipe);
+
+static const Stage stages[] = {
+    { "swap",    STAGE_BYTE,    SwapByte,  CASE_SWAP },
+    { "upper",   STAGE_BYTE,    UpperByte, CASE_UPPER },
+    { "lower",   STAGE_BYTE,    LowerByte, CASE_LOWER },
+    { "rot13",   STAGE_BYTE,    Rot13Byte, CASE_NONE },
+    { "squeeze", STAGE_SQUEEZE, NULL,      CASE_NONE },
+    { "reverse", STAGE_REVERSE, NULL,      CASE_NONE },
+};
+#define NO_STAGES (sizeof(stages) / sizeof(stages[0]))
+Pipeline defaultPipeline; // for clients that skip the handshake
+
+/* A block of a client's stream handed to a worker. Only the worker touches the block and
+ * the connection's pipeline until the job comes back. */
+typedef struct Job {
+    struct Connection *conn;
+    size_t at, len;             // ring position and length of the block
+    bool aside;                 // transformed in work, as it may come out longer, else in place
+    size_t outLen;
+    struct Job *next;
+} Job;
+
+/* A client's stream goes through a fixed ring: recv() appends to the pending bytes, they
+ * are flipped in place right away and send() drains them from start as the socket takes
+ * them. While the ring is full the client isn't read, so TCP throttles it. */
+typedef struct Connection {
+    int sock;
+    char *ring;
+    size_t start, len;          // pending bytes, may wrap around the end of the ring
+    size_t ready;               // of them, those free to send; the rest is a line waiting to be reversed
+    unsigned long long total;   // bytes transformed so far
+    bool eof;                   // the client shut down its side
+    bool failed;
+    Pipeline pipe;
+    bool greeting;              // the first bytes may still turn out to be the handshake
+    char hello[MAX_HELLO];
+    size_t helloLen;
+    bool busy;                  // a worker has the last block, the client isn't read meanwhile
+    Job job;
+    char *work;                 // for job.aside, allocated on the first one
+} Connection;
+
 /* Socket related functions */
-ssize_t HandleMessage(int clntSock);
+ssize_t HandleMessage(Connection *conn);
+ssize_t HandleGreeting(Connection *conn);
+size_t ReadRoom(Connection *conn);
+void TakeBlock(Connection *conn, size_t at, size_t len, bool last);
+void RingWrite(Connection *conn, size_t at, const char *data, size_t len);
+void CommitLines(Connection *conn, size_t from, bool all);
+void ReverseRing(Connection *conn, size_t offset, size_t count);
+void ReverseText(char *ring, size_t from, size_t to);
+void ReverseBytes(char *ring, size_t from, size_t to);
+void QueueReply(Connection *conn, const char *reply);
+void SendPending(Connection *conn);
 int AcceptTCPConnection(int servSock);
+Connection *OpenConnection(int clntSock);
+void CloseConnection(Connection *conn);
+
+/* Worker pool for long blocks, so that a costly chain on one client doesn't hold up the
+ * others. Jobs wait in a list under the lock; finished ones are pushed onto a lock-free
+ * stack that the select() loop takes whole, woken by a byte on a pipe. A connection has at
+ * most one job out and isn't read until it's back, so its replies stay in order. */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t more;
+    Job *first, *last;          // waiting for a worker
+    Job *done;                  // finished, newest first
+    int wake[2];                // a byte is written when done stops being empty
+    int noWorkers;
+    size_t minLen;
+    unsigned long long jobs;
+} WorkerPool;
+
+void StartWorkers(int noWorkers, size_t minLen);
+void SubmitJob(Connection *conn, size_t at, size_t len, bool aside);
+void *RunWorker(void *arg);
+void FinishJobs();
+void FinishBlock(Connection *conn, size_t from, size_t at, const char *work, size_t len, size_t outLen);
+
+/* UDP mode: each datagram is a request id and a text, the reply the id and the text
+ * transformed. A thread per socket, the sockets share the port with SO_REUSEPORT. */
+typedef struct {
+    int sock;
+    Pipeline pipe;
+    unsigned long long requests, batches;
+} UdpServer;
+
+/* The client side of the streaming test: its end of a socket pair and the text it sends */
+typedef struct {
+    int sock;
+    const char *text;
+    size_t len;
+    size_t received;
+    size_t wrong;               // first byte that came back wrong, len when none did
+} StreamTest;
+
+void RunUDP(in_port_t port, int noSockets);
+int OpenUDPSocket(in_port_t port, bool reusePort);
+void *ServeUDP(void *arg);
+size_t TransformDatagram(Pipeline *pipe, char *text, size_t len, size_t cap);
+void ResetPipeline(Pipeline *pipe);
 
 /* Feature related function */
-void OperateOnQuery(char* buffer, ssize_t recvLen);
+size_t OperateOnQuery(Pipeline *pipe, char* buffer, size_t recvLen, size_t cap, bool last);
+
+/* Case inversion kernels, the fastest the CPU supports is picked at startup */
+typedef struct {
+    const char *name;
+    void (*flip)(char *buffer, size_t len);
+    size_t (*ascii)(const char *buffer, size_t len);    // length of the ASCII bytes at the front
+    unsigned int needs;         // CPU_* features
+} CaseKernel;
+
+void FlipCaseScalar(char *buffer, size_t len);
+size_t AsciiPrefixScalar(const char *buffer, size_t len);
+#ifdef X86_KERNELS
+void FlipCaseSSE2(char *buffer, size_t len);
+void FlipCaseAVX2(char *buffer, size_t len);
+void FlipCaseAVX512(char *buffer, size_t len);
+size_t AsciiPrefixSSE2(const char *buffer, size_t len);
+size_t AsciiPrefixAVX2(const char *buffer, size_t len);
+size_t AsciiPrefixAVX512(const char *buffer, size_t len);
+#endif
+unsigned int CPUFeatures();
+bool SelectKernel(const char *name);
+bool TestKernels();
+bool TestUTF8();
+bool TestStream();
+void *StreamTestWriter(void *arg);
+void *StreamTestReader(void *arg);
+void BenchKernels();
+double Seconds();
+
+static const CaseKernel kernels[] = {
+#ifdef X86_KERNELS
+    { "avx512", FlipCaseAVX512, AsciiPrefixAVX512, CPU_AVX512BW },
+    { "avx2",   FlipCaseAVX2,   AsciiPrefixAVX2,   CPU_AVX2 },
+    { "sse2",   FlipCaseSSE2,   AsciiPrefixSSE2,   CPU_SSE2 },
+#endif
+    { "scalar", FlipCaseScalar, AsciiPrefixScalar, 0 },
+};
+#define NO_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+const CaseKernel *caseKernel = &kernels[NO_KERNELS - 1];
+// Table lookup for the tables of ASCII stages, vectorized along with the avx512 kernel
+void (*mapAscii)(const unsigned char *table, char *buffer, size_t len) = MapBytes;
+WorkerPool pool = { .lock = PTHREAD_MUTEX_INITIALIZER, .more = PTHREAD_COND_INITIALIZER,
+                    .wake = { -1, -1 } };
 
 int main(int argc, char ** argv) {
 
-	if (argc != 2) {
-		perror("<server port>");
+	const char *kernelName = NULL, *chain = "swap";
+	bool selfTest = FALSE, bench = FALSE;
+	int udpSockets = 0, noWorkers = 0;
+	size_t offloadMin = OFFLOAD_MIN;
+	int opt;
+	while ((opt = getopt(argc, argv, "k:p:u:w:m:tb")) != -1) {
+		switch (opt) {
+		case 'k': kernelName = optarg; break;
+		case 'p': chain = optarg; break;
+		case 'u': udpSockets = atoi(optarg); break;
+		case 'w': noWorkers = atoi(optarg); break;
+		case 'm': offloadMin = strtoul(optarg, NULL, 10); break;
+		case 't': selfTest = TRUE; break;
+		case 'b': bench = TRUE; break;
+		default:
+			argc = 0; // print usage below
+		}
+	}
+	if (!SelectKernel(kernelName)) {
+		fprintf(stderr, "Unknown case kernel %s, or the CPU doesn't support it\n", kernelName);
+		exit(-1);
+	}
+
+	// Check the kernels against the scalar one and time them, instead of serving
+	if (argc > 0 && (selfTest || bench)) {
+		bool passed = !selfTest || (TestKernels() & TestUTF8() & TestStream());
+		if (bench)
+			BenchKernels();
+		exit(passed ? 0 : 1);
+	}
+
+	if (argc - optind != 1) {
+		perror("[-k avx512|avx2|sse2|scalar] [-p <stage>,...] [-u <sockets>] [-w <workers> [-m <bytes>]] [-t] [-b] <server port>");
+		exit(-1);
+	}
+
+	char error[MAX_HELLO];
+	if (!BuildPipeline(&defaultPipeline, chain, error, sizeof(error))) {
+		fprintf(stderr, "%s\n", error);
 		exit(-1);
 	}
 
-	in_port_t servPort = atoi(argv[1]); // Local port
+	in_port_t servPort = atoi(argv[optind]); // Local port
+	printf("Case kernel: %s\n", caseKernel->name);
+	printf("Default chain: %s\n", defaultPipeline.chain);
+
+	// Datagrams instead of connections
+	if (udpSockets > 0) {
+		RunUDP(servPort, udpSockets);
+		printf("End of Program\n");
+		exit(0);
+	}
 
 	// create socket for incoming connections
 	int servSock;
@@ -57,42 +340,68 @@ int main(int argc, char ** argv) {
 		exit(-1);
 	}
 
+	// Long blocks are transformed aside
+	if (noWorkers > 0) {
+		StartWorkers(noWorkers, offloadMin);
+		printf("Workers: %d, for blocks from %zu bytes\n", noWorkers, offloadMin);
+	}
+
 	// Prepare for using select()
-	fd_set orgSockSet; // Set of socket descriptors for select
-	FD_ZERO(&orgSockSet);
-	FD_SET(STDIN_FILENO, &orgSockSet); // STDIN
-	FD_SET(servSock, &orgSockSet);
+	static Connection *conns[FD_SETSIZE]; // by socket
 	int maxDescriptor;
 	if (STDIN_FILENO > servSock) {	
 		maxDescriptor = STDIN_FILENO;
 	} else {
 		maxDescriptor = servSock;
 	}
-	// Setting select timeout as Zero makes select non-blocking
-	struct timeval timeOut;
-	timeOut.tv_sec = 0; // 0 sec
-	timeOut.tv_usec = 0; // 0 microsec
+	if (pool.wake[0] > maxDescriptor) {
+		maxDescriptor = pool.wake[0];
+	}
 
 	// Server Loop
 	int loopRunning = 1;
 	while (loopRunning) {
-		// The following process has to be done every time
-		// because select() overwrite fd_set.
-		fd_set currSockSet;
-		memcpy(&currSockSet, &orgSockSet, sizeof(fd_set));
+		// The sets are built every time, a client is read only while its ring has room
+		// and written only while it has pending bytes.
+		fd_set readSet, writeSet;
+		FD_ZERO(&readSet);
+		FD_ZERO(&writeSet);
+		FD_SET(STDIN_FILENO, &readSet);
+		FD_SET(servSock, &readSet);
+		if (pool.wake[0] >= 0)
+			FD_SET(pool.wake[0], &readSet);
+		int currSock;
+		for (currSock = 0; currSock < maxDescriptor + 1; currSock++) {
+			Connection *conn = conns[currSock];
+			if (conn == NULL)
+				continue;
+			if (!conn->eof && !conn->busy && ReadRoom(conn) > 0)
+				FD_SET(currSock, &readSet);
+			if (conn->ready > 0)
+				FD_SET(currSock, &writeSet);
+		}
 
-		select(maxDescriptor + 1, &currSockSet, NULL, NULL, &timeOut);
+		if (select(maxDescriptor + 1, &readSet, &writeSet, NULL, NULL) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("select() failed");
+			exit(-1);
+		}
 
-		int currSock;
 		for (currSock = 0; currSock < maxDescriptor + 1; currSock++) {
 
-			if (FD_ISSET(currSock, &currSockSet)) {
+			if (FD_ISSET(currSock, &readSet)) {
 				// A new client
-				// Establish TCP connection, register a new socket to fd_sed to watch with select()
+				// Establish TCP connection, register a new socket to watch with select()
 				if (currSock  == servSock) {
 					int newClntSock;
 					newClntSock = AcceptTCPConnection(servSock);
-					FD_SET(newClntSock, &orgSockSet);
+					if (newClntSock >= FD_SETSIZE) {
+						puts("Too many clients, closing the connection");
+						close(newClntSock);
+						continue;
+					}
+					conns[newClntSock] = OpenConnection(newClntSock);
 					if (maxDescriptor < newClntSock) {
 						maxDescriptor = newClntSock;
 					}
@@ -104,18 +413,34 @@ int main(int argc, char ** argv) {
 					loopRunning = 0;
 				}
 
-				// Echo the message
-				else {
-					ssize_t recvLen = HandleMessage(currSock);
-					if (recvLen == 0) {
-						FD_CLR(currSock, &orgSockSet);
-					}
+				// Blocks back from the workers
+				else if (currSock == pool.wake[0]) {
+					FinishJobs();
+				}
+
+				// Transform the next chunk of the stream
+				else if (conns[currSock] != NULL) {
+					HandleMessage(conns[currSock]);
 				}
 			}
+
+			Connection *conn = conns[currSock];
+			if (conn == NULL)
+				continue;
+			if (FD_ISSET(currSock, &writeSet))
+				SendPending(conn);
+			// Done once the client has shut down its side and got all of it back
+			if (!conn->busy && (conn->failed || (conn->eof && conn->len == 0))) {
+				CloseConnection(conn);
+				conns[currSock] = NULL;
+			}
 		}
 	}
 
 
+	if (noWorkers > 0)
+		printf("%llu blocks went to the workers\n", pool.jobs);
+
 	int closingSock;
 	for (closingSock = 0; closingSock < maxDescriptor + 1; closingSock++)
 		close(closingSock);
@@ -145,44 +470,1006 @@ int AcceptTCPConnection(int servSock) {
 	return(clntSock);
 }
 
-/* Receives query and Sends response */
-ssize_t HandleMessage(int clntSock) {
-	// Receive data
-	char buffer[BUFSIZE];
-	memset(buffer, 0, BUFSIZE);
+/* Sets up the ring of a new client, whose socket never blocks from now on */
+Connection *OpenConnection(int clntSock)
+{
+    Connection *conn = calloc(1, sizeof(Connection));
+    if( conn == NULL || (conn->ring = malloc(RINGSIZE)) == NULL )
+    {
+        perror("malloc() failed");
+        exit(-1);
+    }
+    conn->sock = clntSock;
+    conn->pipe = defaultPipeline;
+    conn->greeting = TRUE;
 
-    ssize_t recvLen = recv(clntSock, buffer, BUFSIZE, 0);
-	if (recvLen < 0) {
-		perror("recv() failed");
-		exit(-1);
-	}
-	buffer[recvLen] = '\0';
-    
-    if( recvLen > 0 )
+    int flags = fcntl(clntSock, F_GETFL, 0);
+    if( flags < 0 || fcntl(clntSock, F_SETFL, flags | O_NONBLOCK) < 0 )
     {
-        if(DEBUG) printf("String received : |%s|\n", buffer);
+        perror("fcntl() failed");
+        exit(-1);
+    }
+    return conn;
+}
 
-        OperateOnQuery(buffer, recvLen);
+void CloseConnection(Connection *conn)
+{
+    if(DEBUG) printf("Closing client after %llu bytes\n", conn->total);
+    close(conn->sock);
+    free(conn->ring);
+    free(conn->work);
+    free(conn);
+}
 
-		// Send the mysql result back to client
-		ssize_t sentLen = send(clntSock, buffer, recvLen, 0);
-		if (sentLen < 0) {
-			perror("send() failed");
-			exit(-1);
-		} else if (sentLen != recvLen) {
-			perror("send() sent unexpected number of bytes");
-			exit(-1);
-		}
+/* Receives the next chunk of the stream into the ring, transforms it in place and sends as
+ * much as the socket takes. Returns the bytes received, 0 at the end of the stream and -1
+ * when there was nothing to read or the connection failed. */
+ssize_t HandleMessage(Connection *conn)
+{
+    if( conn->greeting )
+        return HandleGreeting(conn);
+
+    size_t at = (conn->start + conn->len) % RINGSIZE;
+    ssize_t recvLen = recv(conn->sock, conn->ring + at, ReadRoom(conn), 0);
+    if( recvLen < 0 )
+    {
+        if( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+        {
+            perror("recv() failed");
+            conn->failed = TRUE;
+        }
+        return -1;
+    }
+
+    if( recvLen == 0 )
+    {
+        conn->eof = TRUE;
+        TakeBlock(conn, at, 0, TRUE);
+        CommitLines(conn, conn->len, TRUE);
+        SendPending(conn);
+        return 0;
+    }
+
+    if(DEBUG) printf("Received %zd bytes\n", recvLen);
+
+    TakeBlock(conn, at, recvLen, FALSE);
+
+    // Send the result back to client without waiting for another select()
+    SendPending(conn);
+    return(recvLen);
+}
+
+/* A connection may open with "PIPELINE <stage>,...\n" to pick its own chain, answered with
+ * "OK <stages>\n" or "ERR <reason>\n". Any other first bytes are data for the default chain. */
+ssize_t HandleGreeting(Connection *conn)
+{
+    ssize_t recvLen = recv(conn->sock, conn->hello + conn->helloLen, MAX_HELLO - conn->helloLen, 0);
+    if( recvLen < 0 )
+    {
+        if( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+        {
+            perror("recv() failed");
+            conn->failed = TRUE;
+        }
+        return -1;
+    }
+    conn->helloLen += recvLen;
+
+    size_t prefixLen = conn->helloLen < strlen(HELLO) ? conn->helloLen : strlen(HELLO);
+    char *newline = memchr(conn->hello, '\n', conn->helloLen);
+    if( recvLen == 0 || memcmp(conn->hello, HELLO, prefixLen) != 0 )
+    {
+        // Not a handshake after all
+        conn->greeting = FALSE;
+        memcpy(conn->ring, conn->hello, conn->helloLen);
+        TakeBlock(conn, 0, conn->helloLen, recvLen == 0);
+        if( recvLen == 0 )
+        {
+            conn->eof = TRUE;
+            CommitLines(conn, conn->len, TRUE);
+        }
+    }
+    else if( newline != NULL )
+    {
+        char spec[MAX_HELLO], reply[MAX_HELLO + 8];
+        size_t specLen = newline - conn->hello - strlen(HELLO);
+        memcpy(spec, conn->hello + strlen(HELLO), specLen);
+        spec[specLen] = '\0';
+        if( specLen > 0 && spec[specLen - 1] == '\r' )
+            spec[specLen - 1] = '\0';
+
+        conn->greeting = FALSE;
+        if( BuildPipeline(&conn->pipe, spec, reply + 4, sizeof(reply) - 5) )
+        {
+            snprintf(reply, sizeof(reply), "OK %s\n", conn->pipe.chain);
+            QueueReply(conn, reply);
+            // What follows the handshake line is data
+            size_t rest = conn->hello + conn->helloLen - (newline + 1);
+            memcpy(conn->ring + conn->len, newline + 1, rest);
+            TakeBlock(conn, conn->len, rest, FALSE);
+        }
+        else
+        {
+            memcpy(reply, "ERR ", 4);
+            strcat(reply, "\n");
+            QueueReply(conn, reply);
+            conn->eof = TRUE;   // hang up once the reply is out
+        }
+    }
+    else if( conn->helloLen == MAX_HELLO )
+    {
+        conn->greeting = FALSE;
+        QueueReply(conn, "ERR handshake line too long\n");
+        conn->eof = TRUE;
+    }
+
+    SendPending(conn);
+    return(recvLen);
+}
+
+/* How much the next recv() may take: up to the end of the ring, and with a chain that may
+ * lengthen the text no more than its result can fill */
+size_t ReadRoom(Connection *conn)
+{
+    size_t at = (conn->start + conn->len) % RINGSIZE;
+    size_t room = RINGSIZE - conn->len;
+    if( conn->pipe.unicode )
+        room = room > UTF8_SLACK ? (room - UTF8_SLACK) * 2 / 3 : 0;
+    if( room > RINGSIZE - at )
+        room = RINGSIZE - at;
+    if( room > CHUNKSIZE )
+        room = CHUNKSIZE;
+    return room;
+}
+
+/* Transforms the len bytes just placed at ring position at, right after the pending ones.
+ * last is set at the end of the stream. */
+void TakeBlock(Connection *conn, size_t at, size_t len, bool last)
+{
+    char *block = conn->ring + at;
+    // Text beyond ASCII may come out longer, it's worked on aside and copied back
+    bool aside = conn->pipe.unicode && (last || Carrying(&conn->pipe) || caseKernel->ascii(block, len) < len);
+
+    if( pool.noWorkers > 0 && len >= pool.minLen && !last )
+    {
+        SubmitJob(conn, at, len, aside);
+        return;
     }
 
-	return(recvLen);
+    if( aside )
+    {
+        char work[CHUNKSIZE + CHUNKSIZE / 2 + UTF8_SLACK];
+        memcpy(work, block, len);
+        FinishBlock(conn, conn->len, at, work, len, OperateOnQuery(&conn->pipe, work, len, sizeof(work), last));
+    }
+    else
+        FinishBlock(conn, conn->len, at, NULL, len, OperateOnQuery(&conn->pipe, block, len, len, last));
 }
 
-/* Performs functionality - LowerCase to UpperCase */
-void OperateOnQuery(char* buffer, ssize_t recvLen)
+/* Appends a block transformed into outLen bytes, in the ring already or in work */
+void FinishBlock(Connection *conn, size_t from, size_t at, const char *work, size_t len, size_t outLen)
+{
+    if( work != NULL )
+        RingWrite(conn, at, work, outLen);
+    conn->len += outLen;
+    conn->total += len;
+    CommitLines(conn, from, FALSE);
+}
+
+/* Copies data to ring position at, wrapping around the end of the ring */
+void RingWrite(Connection *conn, size_t at, const char *data, size_t len)
+{
+    size_t first = len < RINGSIZE - at ? len : RINGSIZE - at;
+    memcpy(conn->ring + at, data, first);
+    memcpy(conn->ring, data + first, len - first);
+}
+
+/* Frees the transformed bytes for sending. A reversing chain holds back the last line until
+ * its newline arrives, then reverses it in the ring; at the end of the stream, or when one
+ * line fills the ring, what is held goes out reversed as a piece. from is where the bytes
+ * not yet looked at start, the held ones before it have no newline. */
+void CommitLines(Connection *conn, size_t from, bool all)
+{
+    if( !conn->pipe.reverse )
+    {
+        conn->ready = conn->len;
+        return;
+    }
+
+    size_t i = from, lineStart = conn->ready;
+    while( i < conn->len )
+    {
+        // Look for the next newline up to the end of the ring
+        size_t at = (conn->start + i) % RINGSIZE;
+        size_t count = conn->len - i < RINGSIZE - at ? conn->len - i : RINGSIZE - at;
+        char *newline = memchr(conn->ring + at, '\n', count);
+        if( newline == NULL )
+        {
+            i += count;
+            continue;
+        }
+        i += newline - (conn->ring + at);
+
+        size_t lineLen = i - lineStart;
+        // A CRLF line keeps its CR at the end
+        if( lineLen > 0 && conn->ring[(conn->start + i - 1) % RINGSIZE] == '\r' )
+            lineLen--;
+        ReverseRing(conn, lineStart, lineLen);
+        lineStart = ++i;
+    }
+    if( all || ReadRoom(conn) == 0 )
+    {
+        ReverseRing(conn, lineStart, conn->len - lineStart);
+        lineStart = conn->len;
+    }
+    conn->ready = lineStart;
+}
+
+/* Reverses count pending bytes from offset, wrapping around the end of the ring */
+void ReverseRing(Connection *conn, size_t offset, size_t count)
+{
+    ReverseText(conn->ring, conn->start + offset, conn->start + offset + count);
+}
+
+/* Reverses ring positions from up to to, then puts the bytes of each UTF-8 sequence back in
+ * order so that characters stay whole. Any buffer shorter than the ring will do as well. */
+void ReverseText(char *ring, size_t from, size_t to)
+{
+    size_t k = from;
+
+    ReverseBytes(ring, from, to);
+    // Reversed, a sequence is its continuation bytes followed by the lead byte
+    while( k < to )
+    {
+        if( (ring[k % RINGSIZE] & 0xc0) != 0x80 )
+        {
+            k++;
+            continue;
+        }
+        size_t lead = k;
+        while( lead < to && lead - k < 3 && (ring[lead % RINGSIZE] & 0xc0) == 0x80 )
+            lead++;
+        if( lead < to && UTF8Length(ring[lead % RINGSIZE]) == (int)(lead - k + 1) )
+        {
+            ReverseBytes(ring, k, lead + 1);
+            lead++;
+        }
+        k = lead;
+    }
+}
+
+/* Reverses ring positions from up to to, which may run past the end of the ring */
+void ReverseBytes(char *ring, size_t from, size_t to)
+{
+    if( to <= RINGSIZE )
+    {
+        char *left = ring + from, *right = ring + to - 1;
+        while( left < right )
+        {
+            char c = *left;
+            *left++ = *right;
+            *right-- = c;
+        }
+        return;
+    }
+    while( from + 1 < to )
+    {
+        to--;
+        char c = ring[from % RINGSIZE];
+        ring[from % RINGSIZE] = ring[to % RINGSIZE];
+        ring[to % RINGSIZE] = c;
+        from++;
+    }
+}
+
+/* Queues a line from the server itself, untransformed; only while the ring holds no data */
+void QueueReply(Connection *conn, const char *reply)
+{
+    size_t len = strlen(reply);
+    memcpy(conn->ring + conn->start + conn->len, reply, len);
+    conn->len += len;
+    conn->ready = conn->len;
+}
+
+/* Sends the bytes ready to go until the socket would block */
+void SendPending(Connection *conn)
+{
+    while( conn->ready > 0 )
+    {
+        size_t len = conn->ready;
+        if( len > RINGSIZE - conn->start )
+            len = RINGSIZE - conn->start;
+
+        ssize_t sentLen = send(conn->sock, conn->ring + conn->start, len, MSG_NOSIGNAL);
+        if( sentLen < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+            if( errno != EAGAIN && errno != EWOULDBLOCK )
+            {
+                perror("send() failed");
+                conn->failed = TRUE;
+            }
+            return;
+        }
+
+        conn->start = (conn->start + sentLen) % RINGSIZE;
+        conn->len -= sentLen;
+        conn->ready -= sentLen;
+    }
+    // Start over at the front, so that the next recv() gets a whole chunk. Not while a
+    // worker has a block: it sits at start + len and comes back to be appended there.
+    if( conn->len == 0 && !conn->busy )
+        conn->start = 0;
+}
+
+/* Starts noWorkers threads for the blocks from minLen bytes on */
+void StartWorkers(int noWorkers, size_t minLen)
 {
     int i;
-    for(i=0;i<recvLen;i++)
+
+    if( pipe(pool.wake) < 0 )
+    {
+        perror("pipe() failed");
+        exit(-1);
+    }
+    for( i = 0; i < 2; i++ )
+        fcntl(pool.wake[i], F_SETFL, fcntl(pool.wake[i], F_GETFL, 0) | O_NONBLOCK);
+    pool.noWorkers = noWorkers;
+    pool.minLen = minLen > 0 ? minLen : 1;
+
+    for( i = 0; i < noWorkers; i++ )
+    {
+        pthread_t thread;
+        if( pthread_create(&thread, NULL, RunWorker, NULL) != 0 )
+        {
+            perror("pthread_create() failed");
+            exit(-1);
+        }
+        pthread_detach(thread);
+    }
+}
+
+/* Hands the len bytes at ring position at to a worker; the client waits until they're back */
+void SubmitJob(Connection *conn, size_t at, size_t len, bool aside)
+{
+    if( aside && conn->work == NULL && (conn->work = malloc(CHUNKSIZE + CHUNKSIZE / 2 + UTF8_SLACK)) == NULL )
+    {
+        perror("malloc() failed");
+        exit(-1);
+    }
+    Job *job = &conn->job;
+    job->conn = conn;
+    job->at = at;
+    job->len = len;
+    job->aside = aside;
+    job->next = NULL;
+    conn->busy = TRUE;
+    pool.jobs++;
+
+    pthread_mutex_lock(&pool.lock);
+    if( pool.last != NULL )
+        pool.last->next = job;
+    else
+        pool.first = job;
+    pool.last = job;
+    pthread_cond_signal(&pool.more);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+void *RunWorker(void *arg)
+{
+    (void)arg;
+    for( ;; )
+    {
+        pthread_mutex_lock(&pool.lock);
+        while( pool.first == NULL )
+            pthread_cond_wait(&pool.more, &pool.lock);
+        Job *job = pool.first;
+        pool.first = job->next;
+        if( pool.first == NULL )
+            pool.last = NULL;
+        pthread_mutex_unlock(&pool.lock);
+
+        Connection *conn = job->conn;
+        if( job->aside )
+        {
+            memcpy(conn->work, conn->ring + job->at, job->len);
+            job->outLen = OperateOnQuery(&conn->pipe, conn->work, job->len, CHUNKSIZE + CHUNKSIZE / 2 + UTF8_SLACK, FALSE);
+        }
+        else
+            job->outLen = OperateOnQuery(&conn->pipe, conn->ring + job->at, job->len, job->len, FALSE);
+
+        // Push onto the finished ones; the first after the loop took them all wakes it
+        Job *head = __atomic_load_n(&pool.done, __ATOMIC_RELAXED);
+        do
+            job->next = head;
+        while( !__atomic_compare_exchange_n(&pool.done, &head, job, TRUE, __ATOMIC_RELEASE, __ATOMIC_RELAXED) );
+        if( head == NULL )
+        {
+            char byte = 0;
+            while( write(pool.wake[1], &byte, 1) < 0 && errno == EINTR )
+                ;
+        }
+    }
+    return NULL;
+}
+
+/* Puts the finished blocks in their rings and sends them. The pipe is drained before the
+ * stack is taken, so a job pushed after that always leaves a byte for the next select(). */
+void FinishJobs()
+{
+    char bytes[64];
+    while( read(pool.wake[0], bytes, sizeof(bytes)) > 0 )
+        ;
+
+    Job *job = __atomic_exchange_n(&pool.done, NULL, __ATOMIC_ACQUIRE);
+    while( job != NULL )
+    {
+        Job *next = job->next;
+        Connection *conn = job->conn;
+        conn->busy = FALSE;
+        FinishBlock(conn, conn->len, job->at, job->aside ? conn->work : NULL, job->len, job->outLen);
+        SendPending(conn);
+        job = next;
+    }
+}
+
+/* Serves datagrams on noSockets sockets bound to the same port, a thread each, until there
+ * is input from the keyboard */
+void RunUDP(in_port_t port, int noSockets)
+{
+    UdpServer *servers = calloc(noSockets, sizeof(UdpServer));
+    int i;
+
+    if( servers == NULL )
+    {
+        perror("calloc() failed");
+        exit(-1);
+    }
+    for( i = 0; i < noSockets; i++ )
+    {
+        pthread_t thread;
+        servers[i].sock = OpenUDPSocket(port, noSockets > 1);
+        servers[i].pipe = defaultPipeline;
+        if( pthread_create(&thread, NULL, ServeUDP, &servers[i]) != 0 )
+        {
+            perror("pthread_create() failed");
+            exit(-1);
+        }
+        pthread_detach(thread);
+    }
+    printf("Serving UDP on %d socket%s\n", noSockets, noSockets > 1 ? "s" : "");
+
+    fd_set stdinSet;
+    FD_ZERO(&stdinSet);
+    FD_SET(STDIN_FILENO, &stdinSet);
+    while( select(STDIN_FILENO + 1, &stdinSet, NULL, NULL, NULL) < 0 && errno == EINTR )
+        ;
+    printf("Shutting down server\n");
+
+    for( i = 0; i < noSockets; i++ )
+    {
+        unsigned long long requests = __atomic_load_n(&servers[i].requests, __ATOMIC_RELAXED);
+        unsigned long long batches = __atomic_load_n(&servers[i].batches, __ATOMIC_RELAXED);
+        printf("Socket %d: %llu datagrams in %llu batches\n", i, requests, batches);
+    }
+}
+
+int OpenUDPSocket(in_port_t port, bool reusePort)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if( sock < 0 )
+    {
+        perror("socket() failed");
+        exit(-1);
+    }
+
+    int on = 1;
+    if( reusePort && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0 )
+    {
+        perror("setsockopt(SO_REUSEPORT) failed");
+        exit(-1);
+    }
+    // Room for the bursts that arrive while a batch is transformed
+    int bufferSize = 4 * 1024 * 1024;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
+    struct sockaddr_in servAddr;
+    memset(&servAddr, 0, sizeof(servAddr));
+    servAddr.sin_family = AF_INET;
+    servAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    servAddr.sin_port = htons(port);
+    if( bind(sock, (struct sockaddr *) &servAddr, sizeof(servAddr)) < 0 )
+    {
+        perror("bind() failed");
+        exit(-1);
+    }
+    return sock;
+}
+
+/* Takes whatever datagrams are queued, up to UDP_BATCH, in one recvmmsg(), transforms the
+ * batch in place and sends all the replies with one sendmmsg(). Datagrams shorter than the
+ * header or longer than UDP_MAX_TEXT get no reply. */
+void *ServeUDP(void *arg)
+{
+    UdpServer *server = arg;
+    char (*slots)[UDP_SLOT] = malloc(UDP_BATCH * sizeof(*slots));
+    struct mmsghdr requests[UDP_BATCH], replies[UDP_BATCH];
+    struct iovec requestVecs[UDP_BATCH], replyVecs[UDP_BATCH];
+    struct sockaddr_in clients[UDP_BATCH];
+    int i;
+
+    if( slots == NULL )
+    {
+        perror("malloc() failed");
+        exit(-1);
+    }
+    memset(requests, 0, sizeof(requests));
+    memset(replies, 0, sizeof(replies));
+    for( i = 0; i < UDP_BATCH; i++ )
+    {
+        // One byte more than allowed tells a request that is too long
+        requestVecs[i].iov_base = slots[i];
+        requestVecs[i].iov_len = UDP_HEADER + UDP_MAX_TEXT + 1;
+        requests[i].msg_hdr.msg_iov = &requestVecs[i];
+        requests[i].msg_hdr.msg_iovlen = 1;
+        requests[i].msg_hdr.msg_name = &clients[i];
+    }
+
+    while( TRUE )
+    {
+        for( i = 0; i < UDP_BATCH; i++ )
+            requests[i].msg_hdr.msg_namelen = sizeof(clients[i]);
+        int received = recvmmsg(server->sock, requests, UDP_BATCH, MSG_WAITFORONE, NULL);
+        if( received < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+            perror("recvmmsg() failed");
+            exit(-1);
+        }
+
+        int noReplies = 0;
+        for( i = 0; i < received; i++ )
+        {
+            size_t len = requests[i].msg_len;
+            if( len < UDP_HEADER || len > UDP_HEADER + UDP_MAX_TEXT )
+                continue;
+            len = TransformDatagram(&server->pipe, slots[i] + UDP_HEADER, len - UDP_HEADER, UDP_SLOT - UDP_HEADER);
+
+            replyVecs[noReplies].iov_base = slots[i];
+            replyVecs[noReplies].iov_len = UDP_HEADER + len;
+            replies[noReplies].msg_hdr.msg_name = &clients[i];
+            replies[noReplies].msg_hdr.msg_namelen = requests[i].msg_hdr.msg_namelen;
+            replies[noReplies].msg_hdr.msg_iov = &replyVecs[noReplies];
+            replies[noReplies].msg_hdr.msg_iovlen = 1;
+            noReplies++;
+        }
+
+        int sent = 0;
+        while( sent < noReplies )
+        {
+            int sentNow = sendmmsg(server->sock, replies + sent, noReplies - sent, 0);
+            if( sentNow < 0 )
+            {
+                if( errno == EINTR )
+                    continue;
+                // The client will ask again, drop this reply
+                perror("sendmmsg() failed");
+                sentNow = 1;
+            }
+            sent += sentNow;
+        }
+        __atomic_fetch_add(&server->requests, received, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&server->batches, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+/* A datagram is a whole text: the chain starts afresh, flushes what it carries at the end
+ * and reverses the lines right away. cap is the room for the result. */
+size_t TransformDatagram(Pipeline *pipe, char *text, size_t len, size_t cap)
+{
+    ResetPipeline(pipe);
+    if( !pipe->unicode || caseKernel->ascii(text, len) == len )
+        len = OperateOnQuery(pipe, text, len, len, FALSE);
+    else
+        len = OperateOnQuery(pipe, text, len, cap, TRUE);
+
+    if( pipe->reverse )
+    {
+        size_t lineStart = 0;
+        while( lineStart < len )
+        {
+            char *newline = memchr(text + lineStart, '\n', len - lineStart);
+            size_t lineEnd = newline != NULL ? (size_t)(newline - text) : len;
+            size_t reverseEnd = lineEnd;
+            // A CRLF line keeps its CR at the end
+            if( newline != NULL && reverseEnd > lineStart && text[reverseEnd - 1] == '\r' )
+                reverseEnd--;
+            ReverseText(text, lineStart, reverseEnd);
+            lineStart = lineEnd + 1;
+        }
+    }
+    return len;
+}
+
+/* Forgets the state carried from one block to the next */
+void ResetPipeline(Pipeline *pipe)
+{
+    int p;
+    for( p = 0; p < pipe->noPasses; p++ )
+    {
+        pipe->passes[p].carryLen = 0;
+        pipe->passes[p].blank = FALSE;
+    }
+}
+
+/* Performs functionality - runs the chain over buffer in place, one cache sized block at a
+ * time through all its passes, and returns the length of the result. Squeezing shortens it,
+ * case mapping beyond ASCII may lengthen it by half plus UTF8_SLACK: cap is the room for the
+ * result, and a caller that passes cap == recvLen has made sure the text is ASCII and no
+ * sequence is carried over. last flushes the sequences carried at the end of the stream. */
+size_t OperateOnQuery(Pipeline *pipe, char* buffer, size_t recvLen, size_t cap, bool last)
+{
+    char scratch[2][PIPE_BLOCK + PIPE_BLOCK / 2 + UTF8_SLACK];
+    char *input = buffer;
+    bool ascii = cap == recvLen && !last;
+    size_t in, out = 0;
+    int p;
+
+    // The result is written from the front while the input is read from the back
+    if( cap > recvLen )
+    {
+        input = buffer + cap - recvLen;
+        memmove(input, buffer, recvLen);
+    }
+
+    for( in = 0; in < recvLen || (last && in == 0); in += PIPE_BLOCK )
+    {
+        char *block = input + in;
+        size_t len = recvLen - in < PIPE_BLOCK ? recvLen - in : PIPE_BLOCK;
+        int next = 0;
+        for( p = 0; p < pipe->noPasses; p++ )
+        {
+            Pass *pass = &pipe->passes[p];
+            if( pass->kind == PASS_SQUEEZE )
+                len = Squeeze(block, len, &pass->blank);
+            else if( pass->unicode && !ascii && (last || pass->carryLen > 0 || caseKernel->ascii(block, len) < len) )
+            {
+                len = MapUTF8(pass, block, len, scratch[next], last);
+                block = scratch[next];
+                next ^= 1;
+            }
+            else
+                MapAscii(pass, block, len);
+        }
+        if( buffer + out != block )
+            memmove(buffer + out, block, len);
+        out += len;
+    }
+    return out;
+}
+
+/* Compiles a chain of stage names, separated by commas or blanks. On failure error says why. */
+bool BuildPipeline(Pipeline *pipe, const char *spec, char *error, size_t errorLen)
+{
+    char names[MAX_HELLO], *name, *save;
+    int noStages = 0, p, i;
+    size_t k;
+
+    memset(pipe, 0, sizeof(Pipeline));
+    snprintf(names, sizeof(names), "%s", spec);
+    for( name = strtok_r(names, ", \t", &save); name != NULL; name = strtok_r(NULL, ", \t", &save) )
+    {
+        for( k = 0; k < NO_STAGES && strcmp(name, stages[k].name) != 0; k++ )
+            ;
+        if( k == NO_STAGES )
+        {
+            snprintf(error, errorLen, "unknown stage %.64s, there are swap upper lower rot13 squeeze reverse", name);
+            return FALSE;
+        }
+        if( ++noStages > MAX_STAGES )
+        {
+            snprintf(error, errorLen, "more than %d stages", MAX_STAGES);
+            return FALSE;
+        }
+        if( strlen(pipe->chain) + strlen(name) + 2 < sizeof(pipe->chain) )
+        {
+            if( pipe->chain[0] != '\0' )
+                strcat(pipe->chain, ",");
+            strcat(pipe->chain, name);
+        }
+
+        Pass *last = pipe->noPasses > 0 ? &pipe->passes[pipe->noPasses - 1] : NULL;
+        if( stages[k].kind == STAGE_REVERSE )
+            pipe->reverse = !pipe->reverse;
+        else if( stages[k].kind == STAGE_SQUEEZE )
+        {
+            if( last == NULL || last->kind != PASS_SQUEEZE )
+                pipe->passes[pipe->noPasses++].kind = PASS_SQUEEZE;
+        }
+        else if( last != NULL && last->kind == PASS_TABLE )
+        {
+            // Fuse with the byte-wise stage before
+            for( i = 0; i < 256; i++ )
+                last->table[i] = stages[k].map(last->table[i]);
+            last->stages[last->noStages++] = k;
+            last->unicode = last->unicode || stages[k].caseMap != CASE_NONE;
+        }
+        else
+        {
+            Pass *pass = &pipe->passes[pipe->noPasses++];
+            pass->kind = PASS_TABLE;
+            for( i = 0; i < 256; i++ )
+                pass->table[i] = stages[k].map(i);
+            pass->stages[pass->noStages++] = k;
+            pass->unicode = stages[k].caseMap != CASE_NONE;
+        }
+    }
+
+    // Tables that change nothing are dropped, the case swap of ASCII goes to the vector kernel
+    for( p = 0; p < pipe->noPasses; p++ )
+    {
+        Pass *pass = &pipe->passes[p];
+        if( pass->kind != PASS_TABLE )
+            continue;
+        pipe->unicode = pipe->unicode || pass->unicode;
+        bool identity = TRUE, swap = TRUE;
+        pass->ascii = TRUE;
+        for( i = 0; i < 256; i++ )
+        {
+            identity = identity && pass->table[i] == i;
+            swap = swap && pass->table[i] == SwapByte(i);
+            pass->ascii = pass->ascii && (i < 0x80 || pass->table[i] == i);
+        }
+        if( identity && !pass->unicode )
+        {
+            memmove(pass, pass + 1, (pipe->noPasses - p - 1) * sizeof(Pass));
+            pipe->noPasses--;
+            p--;
+        }
+        else if( swap )
+            pass->kind = PASS_FLIP;
+    }
+    return TRUE;
+}
+
+unsigned char SwapByte(unsigned char c)
+{
+    if( c >= 'A' && c <= 'Z' )
+        return c + 32;
+    if( c >= 'a' && c <= 'z' )
+        return c - 32;
+    return c;
+}
+
+unsigned char UpperByte(unsigned char c)
+{
+    return c >= 'a' && c <= 'z' ? c - 32 : c;
+}
+
+unsigned char LowerByte(unsigned char c)
+{
+    return c >= 'A' && c <= 'Z' ? c + 32 : c;
+}
+
+unsigned char Rot13Byte(unsigned char c)
+{
+    if( (c >= 'a' && c <= 'm') || (c >= 'A' && c <= 'M') )
+        return c + 13;
+    if( (c >= 'n' && c <= 'z') || (c >= 'N' && c <= 'Z') )
+        return c - 13;
+    return c;
+}
+
+void MapBytes(const unsigned char *table, char *buffer, size_t len)
+{
+    size_t i;
+    for( i = 0; i < len; i++ )
+        buffer[i] = table[(unsigned char)buffer[i]];
+}
+
+#ifdef X86_KERNELS
+/* A 128 byte table fits in two registers, vpermi2b looks up 64 bytes at once. Bytes with the
+ * high bit set aren't stored, they keep their value. */
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+void MapBytesVBMI(const unsigned char *table, char *buffer, size_t len)
+{
+    const __m512i low = _mm512_loadu_si512(table), high = _mm512_loadu_si512(table + 64);
+    size_t i;
+
+    for( i = 0; i < len; i += 64 )
+    {
+        __mmask64 bytes = len - i >= 64 ? ~(__mmask64)0 : ((__mmask64)1 << (len - i)) - 1;
+        __m512i v = _mm512_maskz_loadu_epi8(bytes, buffer + i);
+        __m512i mapped = _mm512_permutex2var_epi8(low, v, high);
+        _mm512_mask_storeu_epi8(buffer + i, bytes & ~_mm512_movepi8_mask(v), mapped);
+    }
+}
+#endif
+
+/* The pass' table over text known to be ASCII */
+void MapAscii(Pass *pass, char *buffer, size_t len)
+{
+    if( pass->kind == PASS_FLIP )
+        caseKernel->flip(buffer, len);
+    else
+        (pass->ascii ? mapAscii : MapBytes)(pass->table, buffer, len);
+}
+
+/* Case maps UTF-8 text from src to dst, which has room for half as much again plus
+ * UTF8_SLACK. ASCII runs go through the pass' table, other code points through its stages
+ * in turn. Bytes that aren't valid UTF-8 stay as they are; a sequence cut off at the end of
+ * src waits in the pass' carry for the next block, unless this is the last. */
+size_t MapUTF8(Pass *pass, const char *src, size_t len, char *dst, bool last)
+{
+    const unsigned char *in = (const unsigned char *)src;
+    size_t i = 0, out = 0;
+
+    // Finish the sequence cut off at the end of the previous block
+    if( pass->carryLen > 0 )
+    {
+        int need = UTF8Length(pass->carry[0]);
+        while( pass->carryLen < need && i < len && (in[i] & 0xc0) == 0x80 )
+            pass->carry[pass->carryLen++] = in[i++];
+        if( pass->carryLen < need && i == len && !last )
+            return 0;
+        out += MapSequence(pass, pass->carry, pass->carryLen, dst);
+        pass->carryLen = 0;
+    }
+
+    while( i < len )
+    {
+        size_t run = caseKernel->ascii(src + i, len - i);
+        if( run > 0 )
+        {
+            memcpy(dst + out, src + i, run);
+            MapAscii(pass, dst + out, run);
+            i += run;
+            out += run;
+            continue;
+        }
+
+        size_t n = 1, need = UTF8Length(in[i]);
+        while( n < need && i + n < len && (in[i + n] & 0xc0) == 0x80 )
+            n++;
+        if( n < need && i + n == len && !last )
+        {
+            memcpy(pass->carry, in + i, n);
+            pass->carryLen = n;
+            break;
+        }
+        out += MapSequence(pass, in + i, n, dst + out);
+        i += n;
+    }
+    return out;
+}
+
+/* Maps one UTF-8 sequence of len bytes to dst, returns the bytes written. An invalid one,
+ * overlong, a surrogate, cut short, is copied as it is. */
+size_t MapSequence(Pass *pass, const unsigned char *seq, size_t len, char *dst)
+{
+    uint32_t cp;
+    int s;
+
+    if( len == 0 || (int)len != UTF8Length(seq[0]) || len == 1 )
+    {
+        memcpy(dst, seq, len);
+        return len;
+    }
+    if( len == 2 )
+        cp = ((seq[0] & 0x1f) << 6) | (seq[1] & 0x3f);
+    else if( len == 3 )
+        cp = ((seq[0] & 0x0f) << 12) | ((seq[1] & 0x3f) << 6) | (seq[2] & 0x3f);
+    else
+        cp = ((seq[0] & 0x07) << 18) | ((seq[1] & 0x3f) << 12) | ((seq[2] & 0x3f) << 6) | (seq[3] & 0x3f);
+    if( (len == 3 && (cp < 0x800 || (cp >= 0xd800 && cp <= 0xdfff))) || (len == 4 && (cp < 0x10000 || cp > 0x10ffff)) )
+    {
+        memcpy(dst, seq, len);
+        return len;
+    }
+
+    for( s = 0; s < pass->noStages; s++ )
+        cp = cp < 0x80 ? stages[pass->stages[s]].map(cp) : CaseMap(stages[pass->stages[s]].caseMap, cp);
+    return EncodeUTF8(cp, dst);
+}
+
+size_t EncodeUTF8(uint32_t cp, char *dst)
+{
+    unsigned char *out = (unsigned char *)dst;
+
+    if( cp < 0x80 )
+    {
+        out[0] = cp;
+        return 1;
+    }
+    if( cp < 0x800 )
+    {
+        out[0] = 0xc0 | (cp >> 6);
+        out[1] = 0x80 | (cp & 0x3f);
+        return 2;
+    }
+    if( cp < 0x10000 )
+    {
+        out[0] = 0xe0 | (cp >> 12);
+        out[1] = 0x80 | ((cp >> 6) & 0x3f);
+        out[2] = 0x80 | (cp & 0x3f);
+        return 3;
+    }
+    out[0] = 0xf0 | (cp >> 18);
+    out[1] = 0x80 | ((cp >> 12) & 0x3f);
+    out[2] = 0x80 | ((cp >> 6) & 0x3f);
+    out[3] = 0x80 | (cp & 0x3f);
+    return 4;
+}
+
+/* Bytes in the sequence a lead byte starts, 0 for bytes that can't start one */
+int UTF8Length(unsigned char lead)
+{
+    if( lead < 0x80 )
+        return 1;
+    if( lead >= 0xc2 && lead <= 0xdf )
+        return 2;
+    if( lead >= 0xe0 && lead <= 0xef )
+        return 3;
+    if( lead >= 0xf0 && lead <= 0xf4 )
+        return 4;
+    return 0;
+}
+
+/* Simple case mapping of a code point, by the two-level tables of casemap.h. The swap takes
+ * the upper case when there is one, else the lower. */
+uint32_t CaseMap(int caseMap, uint32_t cp)
+{
+    if( caseMap == CASE_NONE || cp >= CASEMAP_LIMIT )
+        return cp;
+    uint32_t upper = cp + caseBlocks[upperIndex[cp >> CASEMAP_SHIFT]][cp & (CASEMAP_BLOCK - 1)];
+    uint32_t lower = cp + caseBlocks[lowerIndex[cp >> CASEMAP_SHIFT]][cp & (CASEMAP_BLOCK - 1)];
+    if( caseMap == CASE_UPPER )
+        return upper;
+    if( caseMap == CASE_LOWER )
+        return lower;
+    return upper != cp ? upper : lower;
+}
+
+/* Whether a pass holds part of a UTF-8 sequence for the next block */
+bool Carrying(Pipeline *pipe)
+{
+    int p;
+    for( p = 0; p < pipe->noPasses; p++ )
+        if( pipe->passes[p].carryLen > 0 )
+            return TRUE;
+    return FALSE;
+}
+
+/* Turns each run of blanks into one space, in place; blank carries over between calls */
+size_t Squeeze(char *buffer, size_t len, bool *blank)
+{
+    size_t i, out = 0;
+    for( i = 0; i < len; i++ )
+    {
+        char c = buffer[i];
+        if( c == ' ' || c == '\t' || c == '\v' || c == '\f' )
+        {
+            if( *blank )
+                continue;
+            *blank = TRUE;
+            c = ' ';
+        }
+        else
+            *blank = FALSE;
+        buffer[out++] = c;
+    }
+    return out;
+}
+
+/* One byte at a time, the reference the vector kernels are checked against */
+void FlipCaseScalar(char *buffer, size_t len)
+{
+    size_t i;
+    for(i=0;i<len;i++)
     {
         if( buffer[i] >= 65 && buffer[i] <=90 )
             buffer[i] += 32;
@@ -190,3 +1477,540 @@ void OperateOnQuery(char* buffer, ssize_t recvLen)
             buffer[i] -= 32;
     }
 }
+
+/* Eight bytes at a time, the high bits of ASCII are all clear */
+size_t AsciiPrefixScalar(const char *buffer, size_t len)
+{
+    size_t i;
+    uint64_t word;
+    for( i = 0; i + 8 <= len; i += 8 )
+    {
+        memcpy(&word, buffer + i, 8);
+        if( word & 0x8080808080808080ULL )
+            break;
+    }
+    while( i < len && (unsigned char)buffer[i] < 0x80 )
+        i++;
+    return i;
+}
+
+#ifdef X86_KERNELS
+/* The vector kernels share one test: a byte is a letter when, with bit 0x20 set, it lies
+ * in 'a'..'z'; the letters get bit 0x20 flipped. Without unsigned byte compares below
+ * AVX-512, the range check shifts the bytes by 0x80 and compares them signed. */
+__attribute__((target("sse2")))
+void FlipCaseSSE2(char *buffer, size_t len)
+{
+    const __m128i lower = _mm_set1_epi8(0x20);
+    const __m128i shift = _mm_set1_epi8((char)(0x80 - 'a'));
+    const __m128i limit = _mm_set1_epi8((char)(0x80 + 26));
+    size_t i;
+
+    for( i = 0; i + 16 <= len; i += 16 )
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(buffer + i));
+        __m128i shifted = _mm_add_epi8(_mm_or_si128(v, lower), shift);
+        __m128i letters = _mm_cmplt_epi8(shifted, limit);
+        _mm_storeu_si128((__m128i*)(buffer + i), _mm_xor_si128(v, _mm_and_si128(letters, lower)));
+    }
+    FlipCaseScalar(buffer + i, len - i);
+}
+
+__attribute__((target("avx2")))
+void FlipCaseAVX2(char *buffer, size_t len)
+{
+    const __m256i lower = _mm256_set1_epi8(0x20);
+    const __m256i shift = _mm256_set1_epi8((char)(0x80 - 'a'));
+    const __m256i limit = _mm256_set1_epi8((char)(0x80 + 26));
+    size_t i;
+
+    for( i = 0; i + 32 <= len; i += 32 )
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(buffer + i));
+        __m256i shifted = _mm256_add_epi8(_mm256_or_si256(v, lower), shift);
+        __m256i letters = _mm256_cmpgt_epi8(limit, shifted);
+        _mm256_storeu_si256((__m256i*)(buffer + i), _mm256_xor_si256(v, _mm256_and_si256(letters, lower)));
+    }
+    FlipCaseSSE2(buffer + i, len - i);
+}
+
+/* Masked loads and stores handle the tail without a scalar loop */
+__attribute__((target("avx512f,avx512bw")))
+void FlipCaseAVX512(char *buffer, size_t len)
+{
+    const __m512i lower = _mm512_set1_epi8(0x20);
+    const __m512i a = _mm512_set1_epi8('a');
+    const __m512i letterCount = _mm512_set1_epi8(26);
+    size_t i;
+
+    for( i = 0; i < len; i += 64 )
+    {
+        __mmask64 bytes = len - i >= 64 ? ~(__mmask64)0 : ((__mmask64)1 << (len - i)) - 1;
+        __m512i v = _mm512_maskz_loadu_epi8(bytes, buffer + i);
+        __mmask64 letters = _mm512_cmplt_epu8_mask(_mm512_sub_epi8(_mm512_or_si512(v, lower), a), letterCount);
+        _mm512_mask_storeu_epi8(buffer + i, bytes, _mm512_xor_si512(v, _mm512_maskz_mov_epi8(letters, lower)));
+    }
+}
+
+/* The ASCII scans look for the first byte with its high bit set, four vectors at a time
+ * until there is one */
+__attribute__((target("sse2")))
+size_t AsciiPrefixSSE2(const char *buffer, size_t len)
+{
+    size_t i;
+    for( i = 0; i + 64 <= len; i += 64 )
+    {
+        const __m128i *v = (const __m128i*)(buffer + i);
+        __m128i any = _mm_or_si128(_mm_or_si128(_mm_loadu_si128(v), _mm_loadu_si128(v + 1)),
+                                   _mm_or_si128(_mm_loadu_si128(v + 2), _mm_loadu_si128(v + 3)));
+        if( _mm_movemask_epi8(any) != 0 )
+            break;
+    }
+    for( ; i + 16 <= len; i += 16 )
+    {
+        int high = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(buffer + i)));
+        if( high != 0 )
+            return i + __builtin_ctz(high);
+    }
+    return i + AsciiPrefixScalar(buffer + i, len - i);
+}
+
+__attribute__((target("avx2")))
+size_t AsciiPrefixAVX2(const char *buffer, size_t len)
+{
+    size_t i;
+    for( i = 0; i + 128 <= len; i += 128 )
+    {
+        const __m256i *v = (const __m256i*)(buffer + i);
+        __m256i any = _mm256_or_si256(_mm256_or_si256(_mm256_loadu_si256(v), _mm256_loadu_si256(v + 1)),
+                                      _mm256_or_si256(_mm256_loadu_si256(v + 2), _mm256_loadu_si256(v + 3)));
+        if( _mm256_movemask_epi8(any) != 0 )
+            break;
+    }
+    for( ; i + 32 <= len; i += 32 )
+    {
+        unsigned int high = _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)(buffer + i)));
+        if( high != 0 )
+            return i + __builtin_ctz(high);
+    }
+    return i + AsciiPrefixSSE2(buffer + i, len - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+size_t AsciiPrefixAVX512(const char *buffer, size_t len)
+{
+    size_t i;
+    for( i = 0; i + 256 <= len; i += 256 )
+    {
+        const char *v = buffer + i;
+        __m512i any = _mm512_or_si512(_mm512_or_si512(_mm512_loadu_si512(v), _mm512_loadu_si512(v + 64)),
+                                      _mm512_or_si512(_mm512_loadu_si512(v + 128), _mm512_loadu_si512(v + 192)));
+        if( _mm512_movepi8_mask(any) != 0 )
+            break;
+    }
+    for( ; i < len; i += 64 )
+    {
+        __mmask64 bytes = len - i >= 64 ? ~(__mmask64)0 : ((__mmask64)1 << (len - i)) - 1;
+        __mmask64 high = _mm512_movepi8_mask(_mm512_maskz_loadu_epi8(bytes, buffer + i));
+        if( high != 0 )
+            return i + __builtin_ctzll(high);
+    }
+    return len;
+}
+#endif
+
+/* CPUID features, the AVX ones only when the OS saves their registers */
+unsigned int CPUFeatures()
+{
+    unsigned int features = 0;
+#ifdef X86_KERNELS
+    unsigned int eax, ebx, ecx, edx, xcr0Low = 0, xcr0High = 0;
+
+    if( !__get_cpuid(1, &eax, &ebx, &ecx, &edx) )
+        return 0;
+    if( edx & bit_SSE2 )
+        features |= CPU_SSE2;
+    if( !(ecx & bit_OSXSAVE) || !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) )
+        return features;
+    __asm__ volatile( "xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0) );
+    // XMM and YMM state for AVX2, plus the opmask and ZMM state for AVX-512
+    if( (xcr0Low & 0x06) == 0x06 && (ebx & bit_AVX2) )
+        features |= CPU_AVX2;
+    if( (xcr0Low & 0xe6) == 0xe6 && (ebx & bit_AVX512F) && (ebx & bit_AVX512BW) )
+        features |= CPU_AVX512BW;
+    if( (features & CPU_AVX512BW) && (ecx & bit_AVX512VBMI) )
+        features |= CPU_AVX512VBMI;
+#endif
+    return features;
+}
+
+/* Picks the named kernel, or the fastest one the CPU runs when name is NULL */
+bool SelectKernel(const char *name)
+{
+    unsigned int features = CPUFeatures();
+    size_t i;
+
+    for( i = 0; i < NO_KERNELS; i++ )
+        if( (kernels[i].needs & features) == kernels[i].needs && (name == NULL || strcmp(name, kernels[i].name) == 0) )
+        {
+            caseKernel = &kernels[i];
+#ifdef X86_KERNELS
+            if( (caseKernel->needs & CPU_AVX512BW) && (features & CPU_AVX512VBMI) )
+                mapAscii = MapBytesVBMI;
+#endif
+            return TRUE;
+        }
+    return FALSE;
+}
+
+/* Checks every kernel the CPU runs against the scalar one, on random bytes of random
+ * lengths and alignments. The bytes around the input must stay as they were. */
+bool TestKernels()
+{
+    static char input[4096 + 128], expected[4096 + 128], actual[4096 + 128];
+    unsigned int features = CPUFeatures();
+    bool passed = TRUE;
+    size_t i, k, round;
+
+    srand(time(NULL));
+    for( k = 0; k < NO_KERNELS; k++ )
+    {
+        if( (kernels[k].needs & features) != kernels[k].needs )
+        {
+            printf("%-8s skipped, not supported by this CPU\n", kernels[k].name);
+            continue;
+        }
+        for( round = 0; round < TEST_ROUNDS; round++ )
+        {
+            size_t offset = rand() % 64;
+            size_t len = round % 8 == 0 ? rand() % 4096 : rand() % 256;
+            for( i = 0; i < offset + len + 64; i++ )
+                input[i] = round % 2 ? rand() : 'A' + rand() % 58; // all bytes, or around the letters
+            memcpy(expected, input, sizeof(input));
+            memcpy(actual, input, sizeof(input));
+            FlipCaseScalar(expected + offset, len);
+            kernels[k].flip(actual + offset, len);
+            // ASCII, with a byte beyond somewhere or not at all, for the scan
+            for( i = 0; i < len && round % 4 == 3; i++ )
+                input[offset + i] &= 0x7f;
+            if( round % 4 == 3 && len > 0 && rand() % 2 )
+                input[offset + rand() % len] |= 0x80;
+            if( kernels[k].ascii(input + offset, len) != AsciiPrefixScalar(input + offset, len) )
+            {
+                printf("%-8s FAILED: ASCII scan of %zu bytes at offset %zu gave %zu instead of %zu\n", kernels[k].name, len,
+                       offset, kernels[k].ascii(input + offset, len), AsciiPrefixScalar(input + offset, len));
+                passed = FALSE;
+                break;
+            }
+            if( memcmp(expected, actual, sizeof(input)) != 0 )
+            {
+                for( i = 0; expected[i] == actual[i]; i++ )
+                    ;
+                printf("%-8s FAILED: %zu bytes at offset %zu, byte %zd is 0x%02x instead of 0x%02x\n", kernels[k].name,
+                       len, offset, (ssize_t)i - (ssize_t)offset, (unsigned char)actual[i], (unsigned char)expected[i]);
+                passed = FALSE;
+                break;
+            }
+        }
+        if( round == TEST_ROUNDS )
+            printf("%-8s passed %d random inputs\n", kernels[k].name, TEST_ROUNDS);
+    }
+
+#ifdef X86_KERNELS
+    // The vector table lookup, on the tables of random chains of byte-wise stages
+    if( features & CPU_AVX512VBMI )
+    {
+        Pipeline pipe;
+        char error[MAX_HELLO];
+        for( round = 0; round < TEST_ROUNDS && passed; round++ )
+        {
+            char chain[64] = "";
+            size_t noStages = 1 + rand() % 4;
+            for( i = 0; i < noStages; i++ )
+                strcat(chain, (const char *[]){ "upper,", "lower,", "rot13,", "rot13,swap," }[rand() % 4]);
+            BuildPipeline(&pipe, chain, error, sizeof(error));
+            if( pipe.noPasses == 0 || pipe.passes[0].kind != PASS_TABLE )
+                continue;
+            size_t offset = rand() % 64, len = rand() % 1024;
+            for( i = 0; i < sizeof(input); i++ )
+                input[i] = rand();
+            memcpy(expected, input, sizeof(input));
+            memcpy(actual, input, sizeof(input));
+            MapBytes(pipe.passes[0].table, expected + offset, len);
+            MapBytesVBMI(pipe.passes[0].table, actual + offset, len);
+            if( memcmp(expected, actual, sizeof(input)) != 0 )
+            {
+                printf("%-8s FAILED: chain %s, %zu bytes at offset %zu\n", "vbmi", chain, len, offset);
+                passed = FALSE;
+            }
+        }
+        if( passed )
+            printf("%-8s passed %d random inputs\n", "vbmi", TEST_ROUNDS);
+    }
+#endif
+    return passed;
+}
+
+/* Runs random multilingual text through random chains of case stages in pieces of random
+ * sizes, which cut sequences anywhere, against mapping it a code point at a time */
+bool TestUTF8()
+{
+    // A few mappings of the tables, some of them change the length of the sequence
+    static const uint32_t known[][3] = {
+        { CASE_UPPER, 0x3b1, 0x391 },   { CASE_LOWER, 0x42f, 0x44f },   { CASE_SWAP, 0xe9, 0xc9 },
+        { CASE_LOWER, 0x212a, 'k' },    { CASE_UPPER, 0x250, 0x2c6f },  { CASE_UPPER, 0x131, 'I' },
+        { CASE_UPPER, 0xdf, 0xdf },     { CASE_UPPER, 0x10428, 0x10400 }, { CASE_SWAP, 0x4e2d, 0x4e2d },
+    };
+    static const uint32_t ranges[][2] = {
+        { 0x20, 0x7f }, { 0xc0, 0x250 }, { 0x250, 0x2b0 }, { 0x370, 0x400 }, { 0x400, 0x530 },
+        { 0x1e00, 0x2000 }, { 0x2100, 0x2200 }, { 0x2c60, 0x2c80 }, { 0xab70, 0xabc0 }, { 0x10400, 0x10450 },
+    };
+    static char text[200000], expected[300000], actual[300000];
+    char work[CHUNKSIZE + CHUNKSIZE / 2 + UTF8_SLACK], error[MAX_HELLO];
+    Pipeline pipe;
+    bool passed = TRUE;
+    size_t i, round;
+    int s;
+
+    for( i = 0; i < sizeof(known) / sizeof(known[0]); i++ )
+        if( CaseMap(known[i][0], known[i][1]) != known[i][2] )
+        {
+            printf("%-8s FAILED: U+%04X maps to U+%04X instead of U+%04X\n", "utf8", known[i][1],
+                   CaseMap(known[i][0], known[i][1]), known[i][2]);
+            passed = FALSE;
+        }
+
+    for( round = 0; round < 200 && passed; round++ )
+    {
+        char chain[64] = "";
+        size_t noStages = 1 + rand() % 3;
+        for( i = 0; i < noStages; i++ )
+            strcat(chain, (const char *[]){ "swap,", "upper,", "lower,", "rot13," }[rand() % 4]);
+        BuildPipeline(&pipe, chain, error, sizeof(error));
+
+        size_t textLen = 0, expectedLen = 0, actualLen = 0;
+        while( textLen < sizeof(text) - 8 )
+        {
+            if( rand() % 500 == 0 )
+            {
+                // a stray continuation byte, which passes as it is
+                text[textLen++] = expected[expectedLen++] = 0x80 + rand() % 64;
+                continue;
+            }
+            int r = rand() % 3 == 0 ? 0 : rand() % (sizeof(ranges) / sizeof(ranges[0]));
+            uint32_t cp = ranges[r][0] + rand() % (ranges[r][1] - ranges[r][0]);
+            textLen += EncodeUTF8(cp, text + textLen);
+            for( s = 0; s < pipe.passes[0].noStages; s++ )
+                cp = cp < 0x80 ? stages[pipe.passes[0].stages[s]].map(cp) : CaseMap(stages[pipe.passes[0].stages[s]].caseMap, cp);
+            expectedLen += EncodeUTF8(cp, expected + expectedLen);
+        }
+
+        for( i = 0; i < textLen; )
+        {
+            size_t len = 1 + rand() % (round % 2 ? 16 : CHUNKSIZE);
+            if( len > textLen - i )
+                len = textLen - i;
+            memcpy(work, text + i, len);
+            i += len;
+            len = OperateOnQuery(&pipe, work, len, sizeof(work), FALSE);
+            memcpy(actual + actualLen, work, len);
+            actualLen += len;
+        }
+        actualLen += OperateOnQuery(&pipe, actual + actualLen, 0, UTF8_SLACK, TRUE);
+
+        if( actualLen != expectedLen || memcmp(actual, expected, expectedLen) != 0 )
+        {
+            for( i = 0; i < actualLen && i < expectedLen && actual[i] == expected[i]; i++ )
+                ;
+            printf("%-8s FAILED: chain %s, %zu bytes instead of %zu, first difference at byte %zu\n", "utf8",
+                   chain, actualLen, expectedLen, i);
+            passed = FALSE;
+        }
+    }
+    if( passed )
+        printf("%-8s passed %zu random texts\n", "utf8", round);
+    return passed;
+}
+
+/* Streams text through a connection whose blocks go to the workers, to a client that reads
+ * in bursts, so that the socket drains completely now and then while a block is out */
+bool TestStream()
+{
+    static char text[TEST_STREAM_BYTES];
+    char error[MAX_HELLO];
+    int fds[2], sndBuf = 64 * 1024;
+    pthread_t writer, reader;
+    size_t i;
+
+    for( i = 0; i < sizeof(text); i++ )
+        text[i] = rand() % 16 == 0 ? (rand() % 4 == 0 ? '\n' : ' ') : 'A' + rand() % 58;
+    if( socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0 )
+    {
+        perror("socketpair() failed");
+        exit(-1);
+    }
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndBuf, sizeof(sndBuf));
+    if( pool.noWorkers == 0 )
+        StartWorkers(2, 1024);
+
+    Connection *conn = OpenConnection(fds[0]);
+    conn->greeting = FALSE;
+    BuildPipeline(&conn->pipe, "swap", error, sizeof(error));
+    StreamTest test = { fds[1], text, sizeof(text), 0, sizeof(text) };
+    if( pthread_create(&writer, NULL, StreamTestWriter, &test) != 0
+        || pthread_create(&reader, NULL, StreamTestReader, &test) != 0 )
+    {
+        perror("pthread_create() failed");
+        exit(-1);
+    }
+
+    // The server loop for this one connection
+    int maxDescriptor = conn->sock > pool.wake[0] ? conn->sock : pool.wake[0];
+    while( !conn->failed && (conn->busy || !conn->eof || conn->len > 0) )
+    {
+        fd_set readSet, writeSet;
+        FD_ZERO(&readSet);
+        FD_ZERO(&writeSet);
+        FD_SET(pool.wake[0], &readSet);
+        if( !conn->eof && !conn->busy && ReadRoom(conn) > 0 )
+            FD_SET(conn->sock, &readSet);
+        if( conn->ready > 0 )
+            FD_SET(conn->sock, &writeSet);
+        if( select(maxDescriptor + 1, &readSet, &writeSet, NULL, NULL) < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+            perror("select() failed");
+            exit(-1);
+        }
+        if( FD_ISSET(pool.wake[0], &readSet) )
+            FinishJobs();
+        if( FD_ISSET(conn->sock, &readSet) )
+            HandleMessage(conn);
+        if( FD_ISSET(conn->sock, &writeSet) )
+            SendPending(conn);
+    }
+    CloseConnection(conn);
+    pthread_join(writer, NULL);
+    pthread_join(reader, NULL);
+    close(fds[1]);
+
+    if( test.wrong < test.len || test.received != test.len )
+    {
+        printf("%-8s FAILED: %zu bytes back instead of %zu, first wrong byte at %zu\n", "stream",
+               test.received, test.len, test.wrong);
+        return FALSE;
+    }
+    printf("%-8s passed %d MB through %d workers to a slow reader\n", "stream", TEST_STREAM_BYTES >> 20, pool.noWorkers);
+    return TRUE;
+}
+
+/* Sends the test's text and shuts down the sending side */
+void *StreamTestWriter(void *arg)
+{
+    StreamTest *test = arg;
+    size_t sent = 0;
+
+    while( sent < test->len )
+    {
+        ssize_t sentLen = send(test->sock, test->text + sent, test->len - sent, MSG_NOSIGNAL);
+        if( sentLen < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+            break;
+        }
+        sent += sentLen;
+    }
+    shutdown(test->sock, SHUT_WR);
+    return NULL;
+}
+
+/* Reads the reply in bursts with pauses between them, checking it against the text swapped */
+void *StreamTestReader(void *arg)
+{
+    StreamTest *test = arg;
+    static char buffer[CHUNKSIZE];
+    unsigned long reads = 0;
+    size_t i;
+
+    for( ;; )
+    {
+        ssize_t recvLen = recv(test->sock, buffer, sizeof(buffer), 0);
+        if( recvLen < 0 && errno == EINTR )
+            continue;
+        if( recvLen <= 0 )
+            break;
+        for( i = 0; i < (size_t)recvLen && test->wrong == test->len; i++ )
+            if( test->received + i >= test->len || (unsigned char)buffer[i] != SwapByte(test->text[test->received + i]) )
+                test->wrong = test->received + i;
+        test->received += recvLen;
+        if( ++reads % 8 == 0 )
+            usleep(200);
+    }
+    return NULL;
+}
+
+/* Throughput of each kernel the CPU runs over a buffer of text, memcpy for reference */
+void BenchKernels()
+{
+    char *buffer = (char*)malloc(BENCH_BYTES), *copy = (char*)malloc(BENCH_BYTES);
+    unsigned int features = CPUFeatures();
+    size_t i, k;
+
+    if( buffer == NULL || copy == NULL )
+    {
+        perror("malloc() failed");
+        exit(-1);
+    }
+    for( i = 0; i < BENCH_BYTES; i++ )
+        buffer[i] = ' ' + rand() % 95;
+    printf("%-8s %10s  (%d MB buffer)\n", "kernel", "GB/s", BENCH_BYTES >> 20);
+    for( k = 0; k <= NO_KERNELS; k++ )
+    {
+        if( k < NO_KERNELS && (kernels[k].needs & features) != kernels[k].needs )
+            continue;
+        unsigned long runs = 0;
+        double start = Seconds(), elapsed;
+        do
+        {
+            if( k == NO_KERNELS )
+                memcpy(copy, buffer, BENCH_BYTES);
+            else
+                kernels[k].flip(buffer, BENCH_BYTES);
+            runs++;
+        } while( (elapsed = Seconds() - start) < BENCH_SECONDS );
+        printf("%-8s %10.2f\n", k == NO_KERNELS ? "memcpy" : kernels[k].name, (double)runs * BENCH_BYTES / elapsed / 1e9);
+    }
+
+    // A three stage chain fused into one pass, against a pass over the buffer per stage
+    static const char *chains[] = { "upper,rot13,lower", "upper", "rot13", "lower" };
+    Pipeline pipes[4];
+    char error[MAX_HELLO];
+    for( k = 0; k < 4; k++ )
+        BuildPipeline(&pipes[k], chains[k], error, sizeof(error));
+    for( k = 0; k < 2; k++ )
+    {
+        unsigned long runs = 0;
+        double start = Seconds(), elapsed;
+        do
+        {
+            if( k == 0 )
+                OperateOnQuery(&pipes[0], buffer, BENCH_BYTES, BENCH_BYTES, FALSE);
+            else
+                for( i = 1; i < 4; i++ )
+                    OperateOnQuery(&pipes[i], buffer, BENCH_BYTES, BENCH_BYTES, FALSE);
+            runs++;
+        } while( (elapsed = Seconds() - start) < BENCH_SECONDS );
+        printf("%s %s %10.2f\n", chains[0], k == 0 ? "fused   " : "unfused ", (double)runs * BENCH_BYTES / elapsed / 1e9);
+    }
+    free(buffer);
+    free(copy);
+}
+
+double Seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
@@ -0,0 +1,99 @@
+/* Generates casemap.h, the Unicode simple case mappings of the server, from the C library's
+ * towupper() and towlower() in the C.UTF-8 locale:
+ *     gcc gencasemap.c -o gencasemap && ./gencasemap > casemap.h
+ *
+ * Each mapping is a two-level table of deltas, the code point's block of CASEMAP_BLOCK picks
+ * one of the distinct blocks, most of them the block of zeros:
+ *     cp + caseBlocks[upperIndex[cp >> CASEMAP_SHIFT]][cp & (CASEMAP_BLOCK - 1)]
+ * Code points from CASEMAP_LIMIT up have no mapping.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <locale.h>
+#include <wctype.h>
+
+#define CASEMAP_SHIFT 7
+#define CASEMAP_BLOCK (1 << CASEMAP_SHIFT)
+#define MAX_CODEPOINT 0x110000
+#define MAX_BLOCKS (2 * MAX_CODEPOINT / CASEMAP_BLOCK)
+
+static int32_t blocks[MAX_BLOCKS][CASEMAP_BLOCK];
+static int noBlocks = 1; // block 0 is all zeros
+
+int BlockOf(const int32_t *deltas);
+void PrintIndex(const char *name, const int *index, int noIndex);
+
+int main(void) {
+
+	if (setlocale(LC_CTYPE, "C.UTF-8") == NULL) {
+		perror("setlocale(C.UTF-8) failed");
+		exit(-1);
+	}
+
+	// Past the last code point that has a mapping, rounded up to a whole block
+	int limit = 0, cp;
+	for (cp = 0; cp < MAX_CODEPOINT; cp++) {
+		if ((int)towupper(cp) != cp || (int)towlower(cp) != cp) {
+			limit = cp + 1;
+		}
+	}
+	limit = (limit + CASEMAP_BLOCK - 1) & ~(CASEMAP_BLOCK - 1);
+
+	static int upperIndex[MAX_CODEPOINT / CASEMAP_BLOCK], lowerIndex[MAX_CODEPOINT / CASEMAP_BLOCK];
+	int block, noIndex = limit / CASEMAP_BLOCK, mappings = 0;
+	for (block = 0; block < noIndex; block++) {
+		int32_t upper[CASEMAP_BLOCK], lower[CASEMAP_BLOCK];
+		int i;
+		for (i = 0; i < CASEMAP_BLOCK; i++) {
+			cp = block * CASEMAP_BLOCK + i;
+			upper[i] = (int32_t)towupper(cp) - cp;
+			lower[i] = (int32_t)towlower(cp) - cp;
+			mappings += (upper[i] != 0) + (lower[i] != 0);
+		}
+		upperIndex[block] = BlockOf(upper);
+		lowerIndex[block] = BlockOf(lower);
+	}
+
+	printf("/* Unicode simple case mappings, generated by gencasemap.c - do not edit.\n");
+	printf(" * %d mappings, %d distinct blocks of %d deltas. */\n", mappings, noBlocks, CASEMAP_BLOCK);
+	printf("#ifndef CASEMAP_H\n#define CASEMAP_H\n\n#include <stdint.h>\n\n");
+	printf("#define CASEMAP_SHIFT %d\n", CASEMAP_SHIFT);
+	printf("#define CASEMAP_BLOCK %d\n", CASEMAP_BLOCK);
+	printf("#define CASEMAP_LIMIT 0x%X\n\n", limit);
+	PrintIndex("upperIndex", upperIndex, noIndex);
+	PrintIndex("lowerIndex", lowerIndex, noIndex);
+
+	printf("static const int32_t caseBlocks[%d][CASEMAP_BLOCK] = {\n", noBlocks);
+	for (block = 0; block < noBlocks; block++) {
+		int i;
+		printf("    {");
+		for (i = 0; i < CASEMAP_BLOCK; i++) {
+			printf("%s%d", i == 0 ? "" : i % 16 == 0 ? ",\n     " : ",", blocks[block][i]);
+		}
+		printf("},\n");
+	}
+	printf("};\n\n#endif\n");
+	exit(0);
+}
+
+/* Index of the block with these deltas, added when it's new */
+int BlockOf(const int32_t *deltas)
+{
+    int block;
+    for( block = 0; block < noBlocks; block++ )
+        if( memcmp(blocks[block], deltas, sizeof(blocks[block])) == 0 )
+            return block;
+    memcpy(blocks[noBlocks], deltas, sizeof(blocks[noBlocks]));
+    return noBlocks++;
+}
+
+void PrintIndex(const char *name, const int *index, int noIndex)
+{
+    int i;
+    printf("static const %s %s[CASEMAP_LIMIT >> CASEMAP_SHIFT] = {", noBlocks <= 256 ? "uint8_t" : "uint16_t", name);
+    for( i = 0; i < noIndex; i++ )
+        printf("%s%d", i == 0 ? "\n    " : i % 32 == 0 ? ",\n    " : ",", index[i]);
+    printf("\n};\n\n");
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // getaddrinfo_a()
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
@@ -6,9 +7,16 @@
 #include <unistd.h>
 #include <string.h>
 #include <netdb.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <netinet/in.h>
+#include "resolve.h"
 
 #define BUFSIZE 512
 #define DEBUG 0
+#define ATTEMPT_DELAY 250 // ms before the next address is tried while earlier ones are pending (RFC 8305)
 #define LOG_ERROR(x) \
     { \
         perror(x); \
@@ -16,13 +24,15 @@
     }
 
 void print(struct addrinfo* sockaddrPtr);
+int HappyEyeballs(struct addrinfo *result, in_port_t servPort);
+int StartAttempt(struct addrinfo *addr, in_port_t servPort);
+long long NowMs();
 
 int main(int argc, char *argv[]) // IPAddr, service, transport_protocol, port
 {
     struct addrinfo hints;
-    struct addrinfo *result, *resPtr;
-    int sockfd, s, j;
-    size_t len;
+    struct addrinfo *result;
+    int sockfd;
 
     if (argc != 3)
    		LOG_ERROR("input error");
@@ -34,36 +44,19 @@ int main(int argc, char *argv[]) // IPAddr, service, transport_protocol, port
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_protocol = IPPROTO_TCP;
 
-    if (getaddrinfo(argv[1], NULL, &hints, &result) != 0)
+    /* From the cache shared with earlier runs, else resolved in the background with a timeout */
+    if (Resolve(argv[1], &hints, &result) != 0)
    		LOG_ERROR("getaddrinfo() failed");
 
     /* returns one or more addrinfo structures, each
        of which contains an Internet address that can be specified in a call
        to bind(2) or connect(2) */
 	in_port_t servPort = atoi(argv[2]);
-    for (resPtr = result; resPtr != NULL; resPtr = resPtr->ai_next) 
-    {
-        if(DEBUG) print(resPtr);
-
-        sockfd = socket(resPtr->ai_family, resPtr->ai_socktype, resPtr->ai_protocol);
-        if (sockfd == -1)
-            continue;
-
-        /* Port */
-        if(resPtr->ai_family == AF_INET) // IPv4
-            ((struct sockaddr_in *)resPtr->ai_addr)->sin_port = htons(servPort); 
-        else if(resPtr->ai_family == AF_INET6) // IPv6
-            ((struct sockaddr_in6 *)resPtr->ai_addr)->sin6_port = htons(servPort);
-
-        if (connect(sockfd, resPtr->ai_addr, resPtr->ai_addrlen) != -1) /* Success */
-            break;
+    sockfd = HappyEyeballs(result, servPort);
 
-        close(sockfd);
-    }
+    FreeResolved(result);
 
-    freeaddrinfo(result);
-
-    if (resPtr == NULL)               /* No address succeeded */
+    if (sockfd == -1)               /* No address succeeded */
         LOG_ERROR("Could not connect\n");
 
     // Loopaction
@@ -118,3 +111,122 @@ void print(struct addrinfo* sockaddrPtr)
     return;
 }
 
+
+/* Races the addresses as in RFC 8305: the families take turns, starting with the one
+ * getaddrinfo() put first, and a new attempt starts every ATTEMPT_DELAY ms, or at once when
+ * one fails, while the earlier ones go on. The first connection to complete wins and the
+ * others are closed, so an unreachable address costs ATTEMPT_DELAY rather than a TCP timeout.
+ * Returns a blocking socket, or -1 when no address worked. */
+int HappyEyeballs(struct addrinfo *result, in_port_t servPort)
+{
+    struct addrinfo *resPtr, **order;
+    struct pollfd *attempts;
+    int noAddrs = 0, noFirst = 0, next = 0, pending = 0, winner = -1, i;
+
+    for (resPtr = result; resPtr != NULL; resPtr = resPtr->ai_next)
+    {
+        noAddrs++;
+        noFirst += resPtr->ai_family == result->ai_family;
+    }
+    order = malloc(noAddrs * sizeof(*order));
+    attempts = malloc(noAddrs * sizeof(*attempts));
+    if (order == NULL || attempts == NULL)
+        LOG_ERROR("malloc() failed");
+
+    /* Interleave the families: first family, other family, first family... */
+    int first = 0, other = 0;
+    for (resPtr = result; resPtr != NULL; resPtr = resPtr->ai_next)
+    {
+        int same = resPtr->ai_family == result->ai_family;
+        int rank = same ? first++ : other++;
+        int slot = same ? (rank < noAddrs - noFirst ? 2 * rank : noAddrs - noFirst + rank)
+                        : (rank < noFirst ? 2 * rank + 1 : noFirst + rank);
+        order[slot] = resPtr;
+    }
+
+    long long nextAt = NowMs();
+    while (winner == -1 && (next < noAddrs || pending > 0))
+    {
+        /* Start the next address when its turn comes, or right away when none is pending */
+        if (next < noAddrs && (pending == 0 || NowMs() >= nextAt))
+        {
+            if(DEBUG) print(order[next]);
+            int sockfd = StartAttempt(order[next++], servPort);
+            if (sockfd != -1)
+            {
+                attempts[pending].fd = sockfd;
+                attempts[pending].events = POLLOUT;
+                pending++;
+                nextAt = NowMs() + ATTEMPT_DELAY;
+            }
+            continue;
+        }
+
+        int timeout = next < noAddrs ? (int)(nextAt - NowMs()) : -1;
+        if (poll(attempts, pending, timeout < 0 && next < noAddrs ? 0 : timeout) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            LOG_ERROR("poll() failed");
+        }
+
+        for (i = 0; i < pending; i++)
+        {
+            if (attempts[i].revents == 0)
+                continue;
+            int error = 0;
+            socklen_t errorLen = sizeof(error);
+            if (getsockopt(attempts[i].fd, SOL_SOCKET, SO_ERROR, &error, &errorLen) == 0 && error == 0)
+            {
+                winner = attempts[i].fd;
+                attempts[i] = attempts[--pending];
+                break;
+            }
+            /* Failed, the next address needn't wait */
+            if(DEBUG) printf("connect() failed: %s\n", strerror(error));
+            close(attempts[i].fd);
+            attempts[i--] = attempts[--pending];
+            nextAt = NowMs();
+        }
+    }
+
+    /* Cancel the attempts still under way */
+    for (i = 0; i < pending; i++)
+        close(attempts[i].fd);
+    free(attempts);
+    free(order);
+
+    if (winner != -1)
+        fcntl(winner, F_SETFL, fcntl(winner, F_GETFL, 0) & ~O_NONBLOCK);
+    return winner;
+}
+
+/* Sets the port and starts a non-blocking connect(), returns the socket or -1 */
+int StartAttempt(struct addrinfo *addr, in_port_t servPort)
+{
+    int sockfd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    if (sockfd == -1)
+        return -1;
+
+    /* Port */
+    if(addr->ai_family == AF_INET) // IPv4
+        ((struct sockaddr_in *)addr->ai_addr)->sin_port = htons(servPort);
+    else if(addr->ai_family == AF_INET6) // IPv6
+        ((struct sockaddr_in6 *)addr->ai_addr)->sin6_port = htons(servPort);
+
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK);
+    if (connect(sockfd, addr->ai_addr, addr->ai_addrlen) == -1 && errno != EINPROGRESS)
+    {
+        if(DEBUG) perror("connect() failed");
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+long long NowMs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
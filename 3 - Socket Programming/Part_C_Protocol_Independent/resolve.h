@@ -0,0 +1,314 @@
+/* Name resolution for the client: getaddrinfo_a() bounded by a timeout, behind a cache of
+ * the results that every client shares through a memory-mapped file, so that a client
+ * started again and again resolves a name once per RESOLVE_TTL seconds.
+ *
+ * The cache is RESOLVE_CACHE_SLOTS slots picked by a hash of the name, a newer name taking
+ * over the slot of an older one. A slot keeps the addresses in the order getaddrinfo() gave
+ * them, so the preference order survives. Each slot has a sequence number that is odd
+ * while a client writes it: readers copy the slot and check the number didn't change,
+ * writers only take a slot whose number they move from even to odd, so no locks are held.
+ *
+ * The file is $RESOLVE_CACHE, else resolve.cache in $XDG_RUNTIME_DIR, else
+ * /tmp/resolve-<uid>.cache; RESOLVE_CACHE set to nothing turns the cache off. A file that
+ * is a symbolic link, belongs to another user or is writable by others isn't used. getaddrinfo() reports no TTL, so every result is kept for
+ * RESOLVE_TTL; failures aren't kept. Needs _GNU_SOURCE before the first #include, and with
+ * a C library older than glibc 2.34, -lanl.
+ */
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define RESOLVE_TIMEOUT_MS 3000
+#define RESOLVE_TTL 60 // seconds a result is used from the cache
+#define RESOLVE_WRITER_DEAD 10 // seconds after which a slot left odd is taken over
+#define RESOLVE_CACHE_SLOTS 256
+#define RESOLVE_CACHE_ADDRS 8 // addresses kept per name, the most preferred
+#define RESOLVE_NAME_LEN 256
+#define RESOLVE_MAGIC 0x52534c31 // "RSL1", changes with the layout
+
+typedef struct {
+    uint32_t seq;                       // odd while being written
+    int64_t expires;                    // time() when the slot goes stale, 0 for empty;
+                                        // while odd, when the writer started
+    int32_t family, socktype, protocol; // of the hints the addresses were asked with
+    char host[RESOLVE_NAME_LEN];
+    char canon[RESOLVE_NAME_LEN];       // canonical name, when asked for
+    uint32_t noAddrs;
+    struct {
+        int32_t family, socktype, protocol;
+        uint32_t len;
+        struct sockaddr_in6 addr;       // large enough for both families
+    } addrs[RESOLVE_CACHE_ADDRS];
+} ResolveSlot;
+
+typedef struct {
+    uint32_t magic;
+    ResolveSlot slots[RESOLVE_CACHE_SLOTS];
+} ResolveCache;
+
+static ResolveCache *OpenResolveCache();
+static int CacheLookup(ResolveCache *cache, const char *host, const struct addrinfo *hints, struct addrinfo **result);
+static void CacheStore(ResolveCache *cache, const char *host, const struct addrinfo *hints, const struct addrinfo *result);
+static int ResolveNow(const char *host, const struct addrinfo *hints, struct addrinfo **result);
+static struct addrinfo *NewAddrinfo(int family, int socktype, int protocol, const void *addr, socklen_t len);
+static uint32_t HostHash(const char *host);
+
+/* Frees a list from Resolve() */
+static void FreeResolved(struct addrinfo *result)
+{
+    while (result != NULL)
+    {
+        struct addrinfo *next = result->ai_next;
+        free(result->ai_canonname);
+        free(result);
+        result = next;
+    }
+}
+
+/* getaddrinfo() without a service, from the cache when it has the name. Returns 0 or an
+ * EAI_* code; the list is freed with FreeResolved(), not freeaddrinfo(). */
+static int Resolve(const char *host, const struct addrinfo *hints, struct addrinfo **result)
+{
+    static ResolveCache *cache;
+    static int opened = 0;
+    unsigned char literal[sizeof(struct in6_addr)];
+
+    // Addresses written out need no resolver and no cache
+    if (inet_pton(AF_INET, host, literal) == 1 || inet_pton(AF_INET6, host, literal) == 1)
+        return ResolveNow(host, hints, result);
+
+    if (!opened)
+    {
+        cache = OpenResolveCache();
+        opened = 1;
+    }
+    if (cache != NULL && CacheLookup(cache, host, hints, result))
+        return 0;
+
+    int error = ResolveNow(host, hints, result);
+    if (error == 0 && cache != NULL)
+        CacheStore(cache, host, hints, *result);
+    return error;
+}
+
+/* Maps the cache file, made on first use; NULL when there's none to be had */
+static ResolveCache *OpenResolveCache()
+{
+    char path[RESOLVE_NAME_LEN];
+    const char *env = getenv("RESOLVE_CACHE");
+
+    if (env != NULL && env[0] == '\0')
+        return NULL;
+    const char *runtimeDir = getenv("XDG_RUNTIME_DIR");
+    if (env != NULL)
+        snprintf(path, sizeof(path), "%s", env);
+    else if (runtimeDir != NULL && runtimeDir[0] == '/')
+        snprintf(path, sizeof(path), "%s/resolve.cache", runtimeDir);
+    else
+        snprintf(path, sizeof(path), "/tmp/resolve-%u.cache", (unsigned)getuid());
+
+    // Anyone may create the name in /tmp first: only a file of our own, that only we
+    // can write, is trusted with the addresses we connect to
+    int fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_uid != getuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) ||
+        (st.st_size != sizeof(ResolveCache) && (st.st_size != 0 || ftruncate(fd, sizeof(ResolveCache)) < 0)))
+    {
+        close(fd);
+        return NULL;
+    }
+    ResolveCache *cache = mmap(NULL, sizeof(ResolveCache), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (cache == MAP_FAILED)
+        return NULL;
+
+    // A new file is all zeros, one of another layout isn't touched
+    uint32_t zero = 0;
+    __atomic_compare_exchange_n(&cache->magic, &zero, RESOLVE_MAGIC, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&cache->magic, __ATOMIC_ACQUIRE) != RESOLVE_MAGIC)
+    {
+        munmap(cache, sizeof(ResolveCache));
+        return NULL;
+    }
+    return cache;
+}
+
+/* Builds the list from the name's slot if it's there and fresh. Returns 1 when it was. */
+static int CacheLookup(ResolveCache *cache, const char *host, const struct addrinfo *hints, struct addrinfo **result)
+{
+    ResolveSlot *shared = &cache->slots[HostHash(host) % RESOLVE_CACHE_SLOTS], slot;
+    uint32_t seq = __atomic_load_n(&shared->seq, __ATOMIC_ACQUIRE);
+    uint32_t i;
+
+    if (seq & 1)
+        return 0;
+    memcpy(&slot, shared, sizeof(slot));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&shared->seq, __ATOMIC_RELAXED) != seq)
+        return 0;   // written meanwhile
+
+    slot.host[RESOLVE_NAME_LEN - 1] = slot.canon[RESOLVE_NAME_LEN - 1] = '\0';
+    if (slot.expires <= time(NULL) || strcmp(slot.host, host) != 0 || slot.family != hints->ai_family ||
+        slot.socktype != hints->ai_socktype || slot.protocol != hints->ai_protocol ||
+        slot.noAddrs == 0 || slot.noAddrs > RESOLVE_CACHE_ADDRS)
+        return 0;
+
+    struct addrinfo **tail = result;
+    *result = NULL;
+    for (i = 0; i < slot.noAddrs; i++)
+    {
+        *tail = NewAddrinfo(slot.addrs[i].family, slot.addrs[i].socktype, slot.addrs[i].protocol,
+                            &slot.addrs[i].addr, slot.addrs[i].len);
+        tail = &(*tail)->ai_next;
+    }
+    if ((hints->ai_flags & AI_CANONNAME) && ((*result)->ai_canonname = strdup(slot.canon)) == NULL)
+    {
+        perror("strdup() failed");
+        exit(-1);
+    }
+    return 1;
+}
+
+/* Keeps the first RESOLVE_CACHE_ADDRS addresses, unless another client is writing the slot.
+ * A client killed while writing leaves the number odd; after RESOLVE_WRITER_DEAD seconds
+ * the slot is taken over, the number moving on to the next odd one. */
+static void CacheStore(ResolveCache *cache, const char *host, const struct addrinfo *hints, const struct addrinfo *result)
+{
+    ResolveSlot *slot = &cache->slots[HostHash(host) % RESOLVE_CACHE_SLOTS];
+    uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    int64_t now = time(NULL);
+
+    if (strlen(host) >= RESOLVE_NAME_LEN ||
+        ((seq & 1) && __atomic_load_n(&slot->expires, __ATOMIC_RELAXED) > now - RESOLVE_WRITER_DEAD))
+        return;
+    uint32_t writing = seq + ((seq & 1) ? 2 : 1);
+    if (!__atomic_compare_exchange_n(&slot->seq, &seq, writing, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+    __atomic_store_n(&slot->expires, now, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->family = hints->ai_family;
+    slot->socktype = hints->ai_socktype;
+    slot->protocol = hints->ai_protocol;
+    snprintf(slot->host, sizeof(slot->host), "%s", host);
+    snprintf(slot->canon, sizeof(slot->canon), "%s", result->ai_canonname != NULL ? result->ai_canonname : host);
+    slot->noAddrs = 0;
+    for (; result != NULL && slot->noAddrs < RESOLVE_CACHE_ADDRS; result = result->ai_next)
+    {
+        if (result->ai_addrlen > sizeof(slot->addrs[0].addr))
+            continue;
+        slot->addrs[slot->noAddrs].family = result->ai_family;
+        slot->addrs[slot->noAddrs].socktype = result->ai_socktype;
+        slot->addrs[slot->noAddrs].protocol = result->ai_protocol;
+        slot->addrs[slot->noAddrs].len = result->ai_addrlen;
+        memcpy(&slot->addrs[slot->noAddrs].addr, result->ai_addr, result->ai_addrlen);
+        slot->noAddrs++;
+    }
+    slot->expires = now + RESOLVE_TTL;
+
+    // Unless we were taken for dead meanwhile, the slot is the other writer's now
+    __atomic_compare_exchange_n(&slot->seq, &writing, writing + 1, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+/* Asks the resolver in the background and waits at most RESOLVE_TIMEOUT_MS, then copies
+ * the result into a list of our own. A lookup that can't be cancelled in time is left to
+ * finish on its own, so its request block is never freed. */
+static int ResolveNow(const char *host, const struct addrinfo *hints, struct addrinfo **result)
+{
+    struct gaicb *request = calloc(1, sizeof(struct gaicb));
+    struct addrinfo *found, *resPtr, **tail = result;
+    struct timespec begin, now;
+    int error;
+
+    if (request == NULL)
+        return EAI_MEMORY;
+    request->ar_name = host;
+    request->ar_request = hints;
+    if ((error = getaddrinfo_a(GAI_NOWAIT, &request, 1, NULL)) != 0)
+    {
+        free(request);
+        return error;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    while ((error = gai_error(request)) == EAI_INPROGRESS)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long left = RESOLVE_TIMEOUT_MS - ((now.tv_sec - begin.tv_sec) * 1000LL + (now.tv_nsec - begin.tv_nsec) / 1000000);
+        if (left <= 0)
+        {
+            if (gai_cancel(request) != EAI_CANCELED)
+                return EAI_AGAIN;
+            error = EAI_AGAIN;
+            break;
+        }
+        struct timespec timeout = { left / 1000, (left % 1000) * 1000000 };
+        const struct gaicb *list[1] = { request };
+        gai_suspend(list, 1, &timeout);
+    }
+    if (error != 0)
+    {
+        free(request);
+        return error;
+    }
+
+    found = request->ar_result;
+    free(request);
+    *result = NULL;
+    for (resPtr = found; resPtr != NULL; resPtr = resPtr->ai_next)
+    {
+        *tail = NewAddrinfo(resPtr->ai_family, resPtr->ai_socktype, resPtr->ai_protocol, resPtr->ai_addr, resPtr->ai_addrlen);
+        tail = &(*tail)->ai_next;
+    }
+    if (found != NULL && found->ai_canonname != NULL && ((*result)->ai_canonname = strdup(found->ai_canonname)) == NULL)
+    {
+        perror("strdup() failed");
+        exit(-1);
+    }
+    freeaddrinfo(found);
+    return 0;
+}
+
+/* One entry with its address stored right behind it */
+static struct addrinfo *NewAddrinfo(int family, int socktype, int protocol, const void *addr, socklen_t len)
+{
+    struct addrinfo *ai = calloc(1, sizeof(struct addrinfo) + sizeof(struct sockaddr_storage));
+    if (ai == NULL)
+    {
+        perror("calloc() failed");
+        exit(-1);
+    }
+    ai->ai_family = family;
+    ai->ai_socktype = socktype;
+    ai->ai_protocol = protocol;
+    ai->ai_addrlen = len;
+    ai->ai_addr = (struct sockaddr *)(ai + 1);
+    memcpy(ai->ai_addr, addr, len);
+    return ai;
+}
+
+/* FNV-1a */
+static uint32_t HostHash(const char *host)
+{
+    uint32_t hash = 2166136261u;
+    while (*host != '\0')
+        hash = (hash ^ (unsigned char)*host++) * 16777619u;
+    return hash;
+}
+
+#endif
@@ -1,9 +1,16 @@
+#define _GNU_SOURCE // accept4(), splice()
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <netdb.h>
@@ -15,24 +22,111 @@
         exit(-1); \
     }
 
-static const int MAXPENDING = 5; // Maximum outstanding connection requests
+static const int MAXPENDING = 4096; // Maximum outstanding connection requests, capped by net.core.somaxconn
+#define FASTOPEN_QUEUE 256 // Pending TCP Fast Open connections, data in the SYN
+#define DEFER_ACCEPT 5 // Seconds a connection may wait for its first data before it's accepted anyway
+#define SEND_TIMEOUT 1000 // ms a client may keep its echo waiting before it's dropped
+#define PIPE_SIZE (1024 * 1024) // What one splice() may move, asked of the kernel per client
 
+/* Zero-copy echo: a client's bytes go from its socket into a pipe and from the pipe back
+ * out of the same socket, splice() moving page references rather than copying. What the
+ * socket won't take yet stays in the pipe, and the client isn't read until it has gone. */
+typedef struct {
+    int pipe[2];        // pipe[0] is 0 until the client's first echo, 0 being stdin
+    size_t pending;     // bytes in the pipe
+} EchoPipe;
+
+int zeroCopy = 0;
+static EchoPipe echoPipes[FD_SETSIZE]; // by socket
+
+int OpenListener(in_port_t servPort, int reusePort);
+void ServeLoop(int servSock, int watchStdin);
 int AcceptTCPConnection(int servSock);
-ssize_t HandleMessage(int clntSock);
+ssize_t HandleMessage(int clntSock, int terminate);
+ssize_t SpliceEcho(int clntSock);
+int FlushPipe(int clntSock);
+void CloseClient(int clntSock);
+int SendAll(int clntSock, const char *buffer, size_t len);
 int max(int val1, int val2);
 
 int main(int argc, char ** argv) {
 
-	if (argc != 2)
-        LOG_ERROR("<server port>");
+	int processes = 1;
+	int opt;
+	while ((opt = getopt(argc, argv, "p:z")) != -1) {
+		switch (opt) {
+		case 'p': processes = atoi(optarg); break;
+		case 'z': zeroCopy = 1; break;
+		default:
+			argc = 0; // print usage below
+		}
+	}
+	if (argc - optind != 1 || processes < 0)
+        LOG_ERROR("[-p <processes>, 0 for one per core] [-z] <server port>");
+
+	in_port_t servPort = atoi(argv[optind]); // Local port
+	if (processes == 0)
+		processes = sysconf(_SC_NPROCESSORS_ONLN);
+
+	// One process serves and watches the keyboard itself
+	if (processes == 1) {
+		ServeLoop(OpenListener(servPort, 0), 1);
+		printf("End of Program\n");
+		exit(0);
+	}
+
+	// Each process has its own listener on the port, the kernel spreads the connections
+	// over them, so there is no accept lock to contend for
+	pid_t *children = calloc(processes, sizeof(pid_t));
+	if (children == NULL)
+		LOG_ERROR("calloc() failed");
+	int i;
+	for (i = 0; i < processes; i++) {
+		children[i] = fork();
+		if (children[i] < 0)
+			LOG_ERROR("fork() failed");
+		if (children[i] == 0) {
+			ServeLoop(OpenListener(servPort, 1), 0);
+			exit(0);
+		}
+	}
+	printf("Serving with %d processes\n", processes);
 
-	in_port_t servPort = atoi(argv[1]); // Local port
+	// An input from Keybord stops them all
+	fd_set stdinSet;
+	FD_ZERO(&stdinSet);
+	FD_SET(STDIN_FILENO, &stdinSet);
+	while (select(STDIN_FILENO + 1, &stdinSet, NULL, NULL, NULL) < 0 && errno == EINTR)
+		;
+	printf("Shutting down server\n");
+	for (i = 0; i < processes; i++)
+		kill(children[i], SIGTERM);
+	for (i = 0; i < processes; i++)
+		waitpid(children[i], NULL, 0);
+	free(children);
+	printf("End of Program\n");
+}
 
+/* A dual-stack listener that hands over connections only once their first data is in, takes
+ * data in the SYN from clients that do TCP Fast Open, and never blocks in accept() */
+int OpenListener(in_port_t servPort, int reusePort)
+{
 	// create socket for incoming connections
 	int servSock;
-	if ((servSock = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP)) < 0)
+	if ((servSock = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP)) < 0)
 		LOG_ERROR("socket() failed");
 
+	int on = 1, off = 0, fastOpen = FASTOPEN_QUEUE, defer = DEFER_ACCEPT;
+	setsockopt(servSock, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)); // IPv4 clients too
+	setsockopt(servSock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (reusePort && setsockopt(servSock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+		LOG_ERROR("setsockopt(SO_REUSEPORT) failed");
+	// Both are optimizations, a kernel without them still serves
+	if (setsockopt(servSock, IPPROTO_TCP, TCP_FASTOPEN, &fastOpen, sizeof(fastOpen)) < 0)
+		perror("setsockopt(TCP_FASTOPEN) failed");
+	if (setsockopt(servSock, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer, sizeof(defer)) < 0)
+		perror("setsockopt(TCP_DEFER_ACCEPT) failed");
+
 	// Set local parameters
 	struct sockaddr_in6 servAddr;
 	memset(&servAddr, 0x00, sizeof(servAddr));
@@ -48,27 +142,37 @@ int main(int argc, char ** argv) {
 	if (listen(servSock, MAXPENDING) < 0)
 		LOG_ERROR("listen() failed");
 
+	return servSock;
+}
+
+/* Accepts and echoes until there is input from the keyboard, if it's watched, else forever */
+void ServeLoop(int servSock, int watchStdin)
+{
 	// Prepare for using select()
 	fd_set orgSockSet; // Set of socket descriptors for select
+	fd_set orgWriteSet; // Clients whose echo is waiting in their pipe
 	FD_ZERO(&orgSockSet);
-	FD_SET(STDIN_FILENO, &orgSockSet); // STDIN
+	FD_ZERO(&orgWriteSet);
+	if (watchStdin)
+		FD_SET(STDIN_FILENO, &orgSockSet); // STDIN
 	FD_SET(servSock, &orgSockSet);
 	int maxDescriptor = max(STDIN_FILENO, servSock);
 
-	// Setting select timeout as Zero makes select non-blocking
-	struct timeval timeOut;
-	timeOut.tv_sec = 0; // 0 sec
-	timeOut.tv_usec = 0; // 0 microsec
-
 	// Server Loop
 	int loopRunning = 1;
 	while (loopRunning) {
 		// The following process has to be done every time
 		// because select() overwrite fd_set.
-		fd_set currSockSet;
+		fd_set currSockSet, currWriteSet;
 		memcpy(&currSockSet, &orgSockSet, sizeof(fd_set));
+		memcpy(&currWriteSet, &orgWriteSet, sizeof(fd_set));
 
-		select(maxDescriptor + 1, &currSockSet, NULL, NULL, &timeOut);
+		// Sleeps until there is something to do
+		if (select(maxDescriptor + 1, &currSockSet, &currWriteSet, NULL, NULL) < 0) {
+			if (errno == EINTR)
+				continue;
+			LOG_ERROR("select() failed");
+		}
 
 		int currSock;
 		for (currSock = 0; currSock < maxDescriptor + 1; currSock++) {
@@ -79,9 +183,16 @@ int main(int argc, char ** argv) {
 				// register a new socket to fd_sed to watch with select(),
 				// and echo first message
 				if (currSock  == servSock) {
-					int newClntSock = AcceptTCPConnection(servSock);
-					FD_SET(newClntSock, &orgSockSet);
-                    maxDescriptor = max(maxDescriptor, newClntSock);
+					// Take all that are waiting, many short sessions come in bursts
+					int newClntSock;
+					while ((newClntSock = AcceptTCPConnection(servSock)) >= 0) {
+						if (newClntSock >= FD_SETSIZE) {
+							close(newClntSock);
+							continue;
+						}
+						FD_SET(newClntSock, &orgSockSet);
+						maxDescriptor = max(maxDescriptor, newClntSock);
+					}
 				}
 
 				// An input from Keybord
@@ -92,32 +203,60 @@ int main(int argc, char ** argv) {
 
 				// Input from an existing client, Echo back message
 				else {
-					ssize_t recvLen = HandleMessage(currSock);
-					if (recvLen == 0)
+					ssize_t recvLen = zeroCopy ? SpliceEcho(currSock) : HandleMessage(currSock, 1);
+					if (recvLen == 0) {
+						FD_CLR(currSock, &orgSockSet);
+						CloseClient(currSock);
+					}
+					// The socket is full, wait until it takes the rest before reading more
+					else if (echoPipes[currSock].pending > 0) {
 						FD_CLR(currSock, &orgSockSet);
+						FD_SET(currSock, &orgWriteSet);
+					}
+				}
+			}
+
+			// The rest of an echo
+			else if (FD_ISSET(currSock, &currWriteSet)) {
+				if (FlushPipe(currSock) < 0) {
+					FD_CLR(currSock, &orgWriteSet);
+					CloseClient(currSock);
+				}
+				else if (echoPipes[currSock].pending == 0) {
+					FD_CLR(currSock, &orgWriteSet);
+					FD_SET(currSock, &orgSockSet);
 				}
 			}
 		}
 	}
 
 	int closingSock;
-	for (closingSock = 0; closingSock < maxDescriptor + 1; closingSock++) {
-		close(closingSock);
+	for (closingSock = STDERR_FILENO + 1; closingSock < maxDescriptor + 1; closingSock++) {
+		if (closingSock != servSock && (FD_ISSET(closingSock, &orgSockSet) || FD_ISSET(closingSock, &orgWriteSet)))
+			CloseClient(closingSock);
 	}
-	printf("End of Program\n");
+	close(servSock);
 }
 
 
+/* Returns the next waiting client, non-blocking from the start, or -1 when there's none */
 int AcceptTCPConnection(int servSock)
 {
 	struct sockaddr_storage clntAddr;
-    int clntSock, clntAddrLen;
+    socklen_t clntAddrLen = sizeof(clntAddr);
+    int clntSock;
     char buffer[BUFSIZE];
     memset(buffer, 0x00, sizeof(buffer));
 
-    clntSock = accept(servSock, (struct sockaddr *)&clntAddr, &clntAddrLen);
-     if (clntSock < 0 )
-         LOG_ERROR("accept() failed");
+    clntSock = accept4(servSock, (struct sockaddr *)&clntAddr, &clntAddrLen, SOCK_NONBLOCK);
+    if (clntSock < 0)
+    {
+        // Gone from the queue, or taken already: not this server's problem
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED ||
+            errno == EMFILE || errno == ENFILE)
+            return -1;
+        LOG_ERROR("accept() failed");
+    }
 
     if(clntAddr.ss_family == AF_INET6)
     {
@@ -129,28 +268,138 @@ int AcceptTCPConnection(int servSock)
 	return(clntSock);
 }
 
-ssize_t HandleMessage(int clntSock)
+/* Echoes what the client sent, through user space. With terminate the last byte, the
+ * newline of a typed line, goes back as the end of a string. Returns the bytes received, 0
+ * when the client is gone and -1 when there was nothing to read after all. */
+ssize_t HandleMessage(int clntSock, int terminate)
 {
     // Receive data
     char buffer[BUFSIZE];
     memset(buffer, 0, BUFSIZE);
     ssize_t recvLen = recv(clntSock, buffer, BUFSIZE, 0);
     if (recvLen < 0)
-        LOG_ERROR("recv() failed");
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return -1;
+        perror("recv() failed");
+        return 0;
+    }
+    if (recvLen == 0)
+        return 0;
 
-    buffer[recvLen-1] = '\0';
+    if (terminate)
+        buffer[recvLen-1] = '\0';
 
     // Send the received data back to client
-    ssize_t sentLen = send(clntSock, buffer, recvLen, 0);
-    if (sentLen < 0)
+    if (SendAll(clntSock, buffer, recvLen) < 0)
+        return 0;
+    return(recvLen);
+}
+
+/* Echoes what the client sent without it entering user space: as much as has come in is
+ * spliced into the client's pipe, then as much as the socket takes back out. Where splice()
+ * can't be used the copy path takes over. Returns as HandleMessage(). */
+ssize_t SpliceEcho(int clntSock)
+{
+    EchoPipe *echo = &echoPipes[clntSock];
+
+    if (echo->pipe[0] == 0)
     {
-        LOG_ERROR("send() failed");
+        if (pipe2(echo->pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+        {
+            echo->pipe[0] = 0;
+            return HandleMessage(clntSock, 0);  // out of descriptors, copy this one
+        }
+        fcntl(echo->pipe[1], F_SETPIPE_SZ, PIPE_SIZE); // the default 64 KB is all there is if refused
     }
-    else if (sentLen != recvLen)
+
+    ssize_t recvLen = splice(clntSock, NULL, echo->pipe[1], NULL, PIPE_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (recvLen < 0)
     {
-        LOG_ERROR("send() sent unexpected number of bytes");
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return -1;
+        if (errno == EINVAL || errno == ENOSYS)
+        {
+            puts("splice() not supported, echoing by copy");
+            zeroCopy = 0;
+            return HandleMessage(clntSock, 0);
+        }
+        perror("splice() failed");
+        return 0;
     }
-    return(recvLen);
+    if (recvLen == 0)
+        return 0;
+
+    echo->pending += recvLen;
+    if (FlushPipe(clntSock) < 0)
+        return 0;
+    return recvLen;
+}
+
+/* Splices what is in the client's pipe back to its socket until it would block. Returns 0,
+ * or -1 when the client is to be closed. */
+int FlushPipe(int clntSock)
+{
+    EchoPipe *echo = &echoPipes[clntSock];
+
+    while (echo->pending > 0)
+    {
+        ssize_t sentLen = splice(echo->pipe[0], NULL, clntSock, NULL, echo->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (sentLen < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            perror("splice() failed");
+            return -1;
+        }
+        echo->pending -= sentLen;
+    }
+    return 0;
+}
+
+void CloseClient(int clntSock)
+{
+    EchoPipe *echo = &echoPipes[clntSock];
+
+    if (echo->pipe[0] != 0)
+    {
+        close(echo->pipe[0]);
+        close(echo->pipe[1]);
+    }
+    memset(echo, 0, sizeof(*echo));
+    close(clntSock);
+}
+
+/* The socket doesn't block: what it won't take at once is waited for a while, then the
+ * client is given up on. Returns 0, or -1 when the client is to be closed. */
+int SendAll(int clntSock, const char *buffer, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t sentLen = send(clntSock, buffer, len, MSG_NOSIGNAL);
+        if (sentLen < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                perror("send() failed");
+                return -1;
+            }
+            struct pollfd pfd = { clntSock, POLLOUT, 0 };
+            if (poll(&pfd, 1, SEND_TIMEOUT) <= 0)
+            {
+                puts("Client not reading its echo, closing the connection");
+                return -1;
+            }
+            continue;
+        }
+        buffer += sentLen;
+        len -= sentLen;
+    }
+    return 0;
 }
 
 int max(int val1, int val2)